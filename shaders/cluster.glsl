@@ -0,0 +1,21 @@
+// Froxel grid of the clustered light pass, must match vk_backend.h
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+#define CLUSTER_COUNT (CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z)
+#define MAX_LIGHTS_PER_CLUSTER 256
+
+// clusterDepth: near, far, log(far / near)
+// Depth slices are exponential so that froxels stay roughly cubic
+float clusterSliceDepth(uint slice, vec4 clusterDepth) {
+	return clusterDepth.x * exp(clusterDepth.z * float(slice) / CLUSTER_GRID_Z);
+}
+
+uint clusterSlice(float viewDepth, vec4 clusterDepth) {
+	float slice = log(viewDepth / clusterDepth.x) / clusterDepth.z * CLUSTER_GRID_Z;
+	return uint(clamp(slice, 0.0, CLUSTER_GRID_Z - 1.0));
+}
+
+uint clusterIndex(uvec3 cluster) {
+	return cluster.x + CLUSTER_GRID_X * (cluster.y + CLUSTER_GRID_Y * cluster.z);
+}
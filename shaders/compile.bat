@@ -1,6 +1,3 @@
-C:/VulkanSDK/1.0.51.0/Bin32/glslangValidator.exe -V gpass.vert -o gpass.vert.spv
-C:/VulkanSDK/1.0.51.0/Bin32/glslangValidator.exe -V gpass.frag -o gpass.frag.spv
-
-C:/VulkanSDK/1.0.51.0/Bin32/glslangValidator.exe -V light.vert -o light.vert.spv
-C:/VulkanSDK/1.0.51.0/Bin32/glslangValidator.exe -V light.frag -o light.frag.spv
+rem Every stage next to its source, as the CMake build does
+for %%f in (*.vert *.frag *.comp) do "%VULKAN_SDK%/Bin/glslangValidator.exe" -V %%f -o %%f.spv
 pause
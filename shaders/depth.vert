@@ -0,0 +1,25 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+// Depth pre-pass and shadow maps: positions only, no fragment shader
+
+#include "instances.glsl"
+
+layout(binding = 0) uniform UniformBufferObject {
+	mat4 model;	// scene root
+	mat4 view;
+	mat4 proj;
+} ubo;
+
+layout(location = 0) in vec3 inPosition;
+
+out gl_PerVertex {
+	vec4 gl_Position;
+};
+invariant gl_Position;
+
+void main() {
+	mat4 model = ubo.model * instanceTransform();
+	gl_Position = ubo.proj * ubo.view * model * vec4(inPosition, 1.0);
+}
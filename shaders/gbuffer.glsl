@@ -0,0 +1,33 @@
+// G-buffer encoding shared by the geometry and light passes
+
+// Specialization constant, constant_id as ShaderConstant in vk_backend.h.
+// Compact: position from depth, RG octahedral normal, RGBA8 albedo.
+layout(constant_id = 0) const bool COMPACT_GBUFFER = false;
+
+// Octahedral normal encoding, see "A Survey of Efficient Representations for
+// Independent Unit Vectors" (Cigolle et al. 2014)
+vec2 signNotZero(vec2 v) {
+	return mix(vec2(-1.0), vec2(1.0), greaterThanEqual(v, vec2(0.0)));
+}
+
+vec2 encodeOctahedral(vec3 n) {
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	return n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * signNotZero(n.xy);
+}
+
+vec3 decodeOctahedral(vec2 f) {
+	vec3 n = vec3(f.x, f.y, 1.0 - abs(f.x) - abs(f.y));
+	float t = clamp(-n.z, 0.0, 1.0);
+	n.xy -= t * signNotZero(n.xy);
+	return normalize(n);
+}
+
+// World position from the depth buffer, fragTexCoord spans [0, 1] over the
+// screen. The geometry pass stores positions with y flipped, so do we.
+vec3 reconstructPosition(vec2 fragTexCoord, float depth, mat4 invViewProj) {
+	vec4 clip = vec4(fragTexCoord * 2.0 - 1.0, depth, 1.0);
+	vec4 world = invViewProj * clip;
+	world.xyz /= world.w;
+	world.y = -world.y;
+	return world.xyz;
+}
@@ -1,31 +1,56 @@
-#version 450
-#extension GL_ARB_separate_shader_objects : enable
-
-layout(binding = 1) uniform sampler2D diffuseSampler;
-layout(binding = 2) uniform sampler2D specularSampler;
-layout(binding = 3) uniform sampler2D normalSampler;
-
-layout(location = 0) in vec3 fragPos;
-layout(location = 1) in vec2 fragTexCoord;
-layout(location = 2) in vec3 fragNormal;
-layout(location = 3) in vec3 fragTangent;
-
-layout(location = 0) out vec4 outPosition;
-layout(location = 1) out vec4 outNormal;
-layout(location = 2) out vec4 outAlbedo;
-
-void main() {
-	outPosition = vec4(fragPos, 1.0f);
-
-	vec3 normal = normalize(fragNormal);
-	normal.y = -normal.y;
-	vec3 tangent = normalize(fragTangent);
-	vec3 bitangent = cross(normal, tangent);
-	mat3 matTBN = mat3(tangent, bitangent, normal);
-	vec3 tangentSpaceNormal = matTBN * 
-		normalize(texture(normalSampler, fragTexCoord).xyz * 2.0 - vec3(1.0));
-	outNormal = vec4(tangentSpaceNormal, 1.0f);
-
-	outAlbedo = texture(diffuseSampler, fragTexCoord);
-	outAlbedo.w = 0.05f; //Specular power
-}
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+#include "gbuffer.glsl"
+
+// Specialization constant, constant_id as ShaderConstant in vk_backend.h.
+// Off: the interpolated vertex normal, the normal map isn't sampled.
+layout(constant_id = 2) const bool NORMAL_MAPPING = true;
+// Texture array size. 1: the set holds the draw's material alone, otherwise
+// every material, indexed by the draw's. The index is constant over a draw,
+// which a multi-draw indirect call runs as separate invocation groups.
+layout(constant_id = 5) const uint MATERIAL_COUNT = 1;
+
+layout(binding = 1) uniform sampler2D diffuseSamplers[MATERIAL_COUNT];
+layout(binding = 2) uniform sampler2D specularSamplers[MATERIAL_COUNT];
+layout(binding = 3) uniform sampler2D normalSamplers[MATERIAL_COUNT];
+
+layout(location = 0) in vec3 fragPos;
+layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) in vec3 fragNormal;
+layout(location = 3) in vec3 fragTangent;
+layout(location = 4) flat in uint fragMaterial;
+
+// Full: position, normal, albedo. Compact: RG normal, albedo, the position
+// is reconstructed from depth in the light pass and the third output has no
+// attachment, its writes are discarded.
+layout(location = 0) out vec4 outGBuffer0;
+layout(location = 1) out vec4 outGBuffer1;
+layout(location = 2) out vec4 outGBuffer2;
+
+void main() {
+	uint material = MATERIAL_COUNT == 1 ? 0 : fragMaterial;
+	vec3 normal = normalize(fragNormal);
+	normal.y = -normal.y;
+	if (NORMAL_MAPPING) {
+		vec3 tangent = normalize(fragTangent);
+		vec3 bitangent = cross(normal, tangent);
+		mat3 matTBN = mat3(tangent, bitangent, normal);
+		normal = matTBN * normalize(
+			texture(normalSamplers[material], fragTexCoord).xyz * 2.0 -
+			vec3(1.0));
+	}
+
+	vec4 albedo = texture(diffuseSamplers[material], fragTexCoord);
+	albedo.w = 0.05f; //Specular power
+
+	if (COMPACT_GBUFFER) {
+		outGBuffer0 = vec4(encodeOctahedral(normalize(normal)), 0.0, 0.0);
+		outGBuffer1 = albedo;
+	} else {
+		outGBuffer0 = vec4(fragPos, 1.0f);
+		outGBuffer1 = vec4(normal, 1.0f);
+		outGBuffer2 = albedo;
+	}
+}
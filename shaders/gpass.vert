@@ -1,36 +1,73 @@
-#version 450
-#extension GL_ARB_separate_shader_objects : enable
-
-layout(binding = 0) uniform UniformBufferObject {
-	mat4 model;
-	mat4 view;
-	mat4 proj;
-} ubo;
-
-layout(location = 0) in vec3 inPosition;
-layout(location = 1) in vec3 inNormal;
-layout(location = 2) in vec2 inTexCoord;
-layout(location = 3) in vec3 inTangent;
-
-layout(location = 0) out vec3 fragPos;
-layout(location = 1) out vec2 fragTexCoord;
-layout(location = 2) out vec3 fragNormal;
-layout(location = 3) out vec3 fragTangent;
-
-out gl_PerVertex {
-	vec4 gl_Position;
-};
-
-void main() {
-	gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
-
-	fragPos = vec3(ubo.model * vec4(inPosition, 1.0));
-	fragPos.y = -fragPos.y;
-
-	fragTexCoord = inTexCoord;
-	fragTexCoord.y = 1.0f - fragTexCoord.y;
-
-	mat3 matNormal = transpose(inverse(mat3(ubo.model)));
-	fragNormal = matNormal * normalize(inNormal);
-	fragTangent = matNormal * normalize(inTangent);
-}
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+#include "instances.glsl"
+
+layout(binding = 0) uniform UniformBufferObject {
+	mat4 model;	// scene root
+	mat4 view;
+	mat4 proj;
+} ubo;
+
+// Specialization constant, constant_id as ShaderConstant in vk_backend.h:
+// where the instance transform and material of the draw are read, values
+// of PerDrawData
+layout(constant_id = 6) const uint PER_DRAW_DATA = 0;
+const uint PER_DRAW_INSTANCE_SLOTS = 0;
+const uint PER_DRAW_PUSH_CONSTANTS = 1;
+const uint PER_DRAW_DYNAMIC_UNIFORM = 2;
+
+// gPassPerDraw, pushed or at the offset bound for the draw
+layout(push_constant) uniform PushConstants {
+	mat4 model;
+	uint material;
+} pushed;
+
+layout(set = 1, binding = 0) uniform PerDrawUniform {
+	mat4 model;
+	uint material;
+} perDraw;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inNormal;
+layout(location = 2) in vec2 inTexCoord;
+layout(location = 3) in vec3 inTangent;
+
+layout(location = 0) out vec3 fragPos;
+layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) out vec3 fragNormal;
+layout(location = 3) out vec3 fragTangent;
+layout(location = 4) flat out uint fragMaterial;
+
+out gl_PerVertex {
+	vec4 gl_Position;
+};
+// Same depth as the pre-pass so that the EQUAL depth test passes
+invariant gl_Position;
+
+void main() {
+	mat4 instance;
+	if (PER_DRAW_DATA == PER_DRAW_PUSH_CONSTANTS) {
+		instance = pushed.model;
+		fragMaterial = pushed.material;
+	} else if (PER_DRAW_DATA == PER_DRAW_DYNAMIC_UNIFORM) {
+		instance = perDraw.model;
+		fragMaterial = perDraw.material;
+	} else {
+		instance = instanceTransform();
+		fragMaterial = instanceMaterial();
+	}
+	mat4 model = ubo.model * instance;
+	gl_Position = ubo.proj * ubo.view * model * vec4(inPosition, 1.0);
+
+	fragPos = vec3(model * vec4(inPosition, 1.0));
+	fragPos.y = -fragPos.y;
+
+	fragTexCoord = inTexCoord;
+	fragTexCoord.y = 1.0f - fragTexCoord.y;
+
+	mat3 matNormal = transpose(inverse(mat3(model)));
+	fragNormal = matNormal * normalize(inNormal);
+	fragTangent = matNormal * normalize(inTangent);
+}
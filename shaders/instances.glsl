@@ -0,0 +1,23 @@
+// Instance transforms of the vertex shaders, bindings of the G-pass and
+// shadow descriptor sets, see VkBackend::writeInstanceDescriptors
+
+// Object to scene space, one per scene instance
+layout(std430, binding = 4) readonly buffer InstanceBuffer {
+	mat4 instances[];
+};
+
+// Scene instance and material (mesh) of each drawn instance: one slot per
+// draw of the culling pass for the indirect draws, then the instances
+// gathered by each batch of the frame
+layout(std430, binding = 5) readonly buffer InstanceIndexBuffer {
+	uvec2 instanceIndices[];
+};
+
+mat4 instanceTransform() {
+	return instances[instanceIndices[gl_InstanceIndex].x];
+}
+
+// Constant over a draw, the instances of a draw share its draw item
+uint instanceMaterial() {
+	return instanceIndices[gl_InstanceIndex].y;
+}
@@ -1,62 +1,142 @@
-#version 450
-#extension GL_ARB_separate_shader_objects : enable
-
-layout (input_attachment_index = 0, binding = 0) uniform subpassInput positionInput;
-layout (input_attachment_index = 1, binding = 1) uniform subpassInput normalInput;
-layout (input_attachment_index = 2, binding = 2) uniform subpassInput albedoInput;
-
-layout(location = 0) in vec2 fragTexCoord;
-
-layout(location = 0) out vec4 outColor;
-
-struct Light {
-	vec4 position;
-	vec3 color;
-	float radius;
-};
-
-layout(binding = 3) uniform UniformBufferObject {
-	vec4	viewPosition;
-	Light	lights[6];
-} ubo;
-
-void main() {
-	vec3 fragPos = subpassLoad(positionInput).rgb;
-	vec3 normal = subpassLoad(normalInput).rgb;
-	vec4 albedo = subpassLoad(albedoInput);
-
-	vec3 fragColor = albedo.rgb * 0.20f;
-
-	for (int i = 0; i < 6; i++) {
-		vec3 L = ubo.lights[i].position.xyz - fragPos;
-		// Distance from light to fragment position
-		float dist = length(L);
-
-		// Viewer to fragment
-		vec3 V = ubo.viewPosition.xyz - fragPos;
-		V = normalize(V);
-		
-		// Light to fragment
-		L = normalize(L);
-
-		// Attenuation
-		float atten = ubo.lights[i].radius / (pow(dist, 2.0) + 1.0);
-
-		// Diffuse part
-		vec3 N = normalize(normal);
-		float NdotL = max(0.0, dot(N, L));
-		vec3 diff = ubo.lights[i].color * albedo.rgb * NdotL * atten;
-
-		// Specular part
-		// Specular map values are stored in alpha of albedo mrt
-		vec3 R = reflect(-L, N);
-		float NdotR = max(0.0, dot(R, V));
-		vec3 spec = ubo.lights[i].color * albedo.a * pow(NdotR, 16.0) * atten;
-
-		fragColor += diff + spec;	
-	}
-
-	//TODO: light calc
-	outColor = vec4(fragColor, 1.0f);
-
-}
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+#include "gbuffer.glsl"
+#include "lighting.glsl"
+#include "shadows.glsl"
+#include "cluster.glsl"
+
+// Specialization constants, constant_id as ShaderConstant in vk_backend.h.
+// Lighting mode as LightingMode: 0 every light, 1 the lights of the
+// fragment's cluster, 2 ambient and sun only, light volumes are blended on
+// top. Light count: lights shaded by mode 0, 0 reads it from the UBO.
+layout(constant_id = 3) const uint LIGHTING_MODE = 0;
+layout(constant_id = 4) const uint LIGHT_COUNT = 0;
+
+// Compact G-buffer: binding 0 is the depth attachment instead of positions
+layout (input_attachment_index = 0, binding = 0) uniform subpassInput positionInput;
+layout (input_attachment_index = 1, binding = 1) uniform subpassInput normalInput;
+layout (input_attachment_index = 2, binding = 2) uniform subpassInput albedoInput;
+
+layout(location = 0) in vec2 fragTexCoord;
+
+layout(location = 0) out vec4 outColor;
+
+layout(binding = 3) uniform UniformBufferObject {
+	mat4	invViewProj;
+	mat4	view;
+	mat4	invProj;
+	vec4	viewPosition;
+	vec4	clusterDepth;
+	uvec4	clusterTile;	// tile size, framebuffer size
+	uint	lightCount;
+} ubo;
+
+layout(std430, binding = 4) readonly buffer LightBuffer {
+	Light lights[];
+};
+
+layout(binding = 6) uniform ShadowBufferObject {
+	mat4	cascadeViewProj[SHADOW_CASCADE_COUNT];
+	vec4	cascadeSplits;	// view-space depth where each cascade ends
+	vec4	cascadeTexelSize;
+	vec4	sunDirection;	// xyz: direction the light travels
+	vec4	sunColor;	// black when shadows are off
+	mat4	pointFaceViewProj[MAX_POINT_SHADOWS * POINT_SHADOW_FACES];
+	uvec4	pointShadowLights;	// light index of each point shadow
+	uint	pointShadowCount;
+} shadow;
+
+// Cascades, then six cube faces per shadowed point light
+layout(binding = 7) uniform sampler2DArrayShadow cascadeShadowMap;
+layout(binding = 8) uniform sampler2DArrayShadow pointShadowMap;
+
+// 1 unless the light is one of the shadowed point lights
+float lightShadow(uint lightIndex, vec3 worldPos, vec3 N) {
+	for (uint slot = 0; slot < shadow.pointShadowCount; slot++) {
+		if (shadow.pointShadowLights[slot] != lightIndex) {
+			continue;
+		}
+		// Light positions are stored in G-buffer space
+		vec3 lightPos = lights[lightIndex].position.xyz * vec3(1.0, -1.0, 1.0);
+		vec3 toFrag = worldPos - lightPos;
+		uint layer = slot * POINT_SHADOW_FACES + cubeFace(toFrag);
+		return pointShadow(pointShadowMap, layer,
+			shadow.pointFaceViewProj[layer], worldPos, N, length(toFrag));
+	}
+	return 1.0;
+}
+
+// Bound in every mode, read in mode 1 only
+layout(std430, binding = 5) readonly buffer ClusterBuffer {
+	uint clusterLightCounts[CLUSTER_COUNT];
+	uint clusterLightIndices[];
+};
+
+void main() {
+	vec3 fragPos;
+	vec3 normal;
+	if (COMPACT_GBUFFER) {
+		fragPos = reconstructPosition(fragTexCoord,
+			subpassLoad(positionInput).r, ubo.invViewProj);
+		normal = decodeOctahedral(subpassLoad(normalInput).rg);
+	} else {
+		fragPos = subpassLoad(positionInput).rgb;
+		normal = subpassLoad(normalInput).rgb;
+	}
+	vec4 albedo = subpassLoad(albedoInput);
+
+	// Ambient
+	vec3 fragColor = albedo.rgb * 0.20f;
+
+	// Viewer to fragment
+	vec3 V = normalize(ubo.viewPosition.xyz - fragPos);
+	vec3 N = normalize(normal);
+	// Shadow maps are rendered in world space, y up
+	vec3 worldPos = vec3(fragPos.x, -fragPos.y, fragPos.z);
+
+	// Sun, in every mode, offset along the normal by the texel size
+	// of its cascade
+	float NdotSun = max(0.0, dot(N, -shadow.sunDirection.xyz));
+	if (shadow.sunColor.a > 0.0 && NdotSun > 0.0) {
+		float viewDepth = -(ubo.view * vec4(worldPos, 1.0)).z;
+		uint cascade = shadowCascade(viewDepth, shadow.cascadeSplits);
+		float lit = 1.0;
+		if (cascade < SHADOW_CASCADE_COUNT) {
+			vec3 offsetPos = worldPos +
+				N * shadow.cascadeTexelSize[cascade] * 1.5;
+			lit = sampleShadow(cascadeShadowMap, float(cascade),
+				shadow.cascadeViewProj[cascade] * vec4(offsetPos, 1.0));
+		}
+		fragColor += albedo.rgb * shadow.sunColor.rgb * NdotSun * lit;
+	}
+
+	if (LIGHTING_MODE == 1) {
+		// Only the lights binned into this fragment's froxel
+		vec4 viewPos = ubo.view * vec4(worldPos, 1.0);
+		uvec2 tile = min(uvec2(gl_FragCoord.xy) / ubo.clusterTile.xy,
+			uvec2(CLUSTER_GRID_X - 1, CLUSTER_GRID_Y - 1));
+		uint cluster = clusterIndex(
+			uvec3(tile, clusterSlice(-viewPos.z, ubo.clusterDepth)));
+		uint count = clusterLightCounts[cluster];
+		for (uint i = 0; i < count; i++) {
+			uint lightIndex =
+				clusterLightIndices[cluster * MAX_LIGHTS_PER_CLUSTER + i];
+			fragColor += shadeLight(lights[lightIndex], fragPos, N, V, albedo) *
+				lightShadow(lightIndex, worldPos, N);
+		}
+	} else if (LIGHTING_MODE == 0) {
+		// A specialized count is a constant loop bound, rounded up: the UBO
+		// count ends the loop
+		uint count = LIGHT_COUNT > 0 ? LIGHT_COUNT : ubo.lightCount;
+		for (uint i = 0; i < count; i++) {
+			if (i >= ubo.lightCount) break;
+			fragColor += shadeLight(lights[i], fragPos, N, V, albedo) *
+				lightShadow(i, worldPos, N);
+		}
+	}
+
+	outColor = vec4(fragColor, 1.0f);
+
+}
@@ -1,15 +1,15 @@
-#version 450
-#extension GL_ARB_separate_shader_objects : enable
-
-layout(location = 0) out vec2 fragTexCoord;
-
-out gl_PerVertex {
-	vec4 gl_Position;
-};
-
-void main() {
-	//Rendering a Quad from a single triangle
-	//explanation at https://www.saschawillems.de/?page_id=2122
-	fragTexCoord = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
-	gl_Position = vec4(fragTexCoord * 2.0f + -1.0f, 0.0f, 1.0f);
-}
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) out vec2 fragTexCoord;
+
+out gl_PerVertex {
+	vec4 gl_Position;
+};
+
+void main() {
+	//Rendering a Quad from a single triangle
+	//explanation at https://www.saschawillems.de/?page_id=2122
+	fragTexCoord = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+	gl_Position = vec4(fragTexCoord * 2.0f + -1.0f, 0.0f, 1.0f);
+}
@@ -0,0 +1,86 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+#include "gbuffer.glsl"
+#include "lighting.glsl"
+#include "shadows.glsl"
+
+// Compact G-buffer: binding 0 is the depth attachment instead of positions
+layout (input_attachment_index = 0, binding = 0) uniform subpassInput positionInput;
+layout (input_attachment_index = 1, binding = 1) uniform subpassInput normalInput;
+layout (input_attachment_index = 2, binding = 2) uniform subpassInput albedoInput;
+
+layout(binding = 3) uniform UniformBufferObject {
+	mat4	invViewProj;
+	mat4	view;
+	mat4	invProj;
+	vec4	viewPosition;
+	vec4	clusterDepth;
+	uvec4	clusterTile;	// tile size, framebuffer size
+	uint	lightCount;
+	mat4	viewProj;
+} ubo;
+
+layout(std430, binding = 4) readonly buffer LightBuffer {
+	Light lights[];
+};
+
+layout(binding = 6) uniform ShadowBufferObject {
+	mat4	cascadeViewProj[SHADOW_CASCADE_COUNT];
+	vec4	cascadeSplits;	// view-space depth where each cascade ends
+	vec4	cascadeTexelSize;
+	vec4	sunDirection;	// xyz: direction the light travels
+	vec4	sunColor;	// black when shadows are off
+	mat4	pointFaceViewProj[MAX_POINT_SHADOWS * POINT_SHADOW_FACES];
+	uvec4	pointShadowLights;	// light index of each point shadow
+	uint	pointShadowCount;
+} shadow;
+
+// Cascades, then six cube faces per shadowed point light
+layout(binding = 7) uniform sampler2DArrayShadow cascadeShadowMap;
+layout(binding = 8) uniform sampler2DArrayShadow pointShadowMap;
+
+// 1 unless the light is one of the shadowed point lights
+float lightShadow(uint lightIndex, vec3 worldPos, vec3 N) {
+	for (uint slot = 0; slot < shadow.pointShadowCount; slot++) {
+		if (shadow.pointShadowLights[slot] != lightIndex) {
+			continue;
+		}
+		// Light positions are stored in G-buffer space
+		vec3 lightPos = lights[lightIndex].position.xyz * vec3(1.0, -1.0, 1.0);
+		vec3 toFrag = worldPos - lightPos;
+		uint layer = slot * POINT_SHADOW_FACES + cubeFace(toFrag);
+		return pointShadow(pointShadowMap, layer,
+			shadow.pointFaceViewProj[layer], worldPos, N, length(toFrag));
+	}
+	return 1.0;
+}
+
+layout(location = 0) flat in uint lightIndex;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+	vec3 fragPos;
+	vec3 normal;
+	if (COMPACT_GBUFFER) {
+		vec2 texCoord = gl_FragCoord.xy / vec2(ubo.clusterTile.zw);
+		fragPos = reconstructPosition(texCoord,
+			subpassLoad(positionInput).r, ubo.invViewProj);
+		normal = decodeOctahedral(subpassLoad(normalInput).rg);
+	} else {
+		fragPos = subpassLoad(positionInput).rgb;
+		normal = subpassLoad(normalInput).rgb;
+	}
+	vec4 albedo = subpassLoad(albedoInput);
+
+	vec3 V = normalize(ubo.viewPosition.xyz - fragPos);
+	vec3 N = normalize(normal);
+
+	vec3 worldPos = vec3(fragPos.x, -fragPos.y, fragPos.z);
+
+	// Blended additively over the ambient pass
+	outColor = vec4(shadeLight(lights[lightIndex], fragPos, N, V, albedo) *
+		lightShadow(lightIndex, worldPos, N), 0.0);
+}
@@ -0,0 +1,57 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+#include "lighting.glsl"
+
+// UV sphere generated from gl_VertexIndex, must match LIGHT_VOLUME_SLICES
+// and LIGHT_VOLUME_STACKS in vk_backend.h
+#define SLICES 16
+#define STACKS 8
+#define PI 3.14159265359
+
+layout(binding = 3) uniform UniformBufferObject {
+	mat4	invViewProj;
+	mat4	view;
+	mat4	invProj;
+	vec4	viewPosition;
+	vec4	clusterDepth;
+	uvec4	clusterTile;
+	uint	lightCount;
+	mat4	viewProj;
+} ubo;
+
+layout(std430, binding = 4) readonly buffer LightBuffer {
+	Light lights[];
+};
+
+layout(location = 0) flat out uint lightIndex;
+
+out gl_PerVertex {
+	vec4 gl_Position;
+};
+
+// Quad corners as two triangles, counter-clockwise seen from outside
+const uvec2 corners[6] = uvec2[](
+	uvec2(0, 0), uvec2(1, 0), uvec2(1, 1),
+	uvec2(0, 0), uvec2(1, 1), uvec2(0, 1));
+
+void main() {
+	// firstInstance of each draw is the light index
+	lightIndex = gl_InstanceIndex;
+	Light light = lights[lightIndex];
+
+	uint quad = gl_VertexIndex / 6;
+	uvec2 corner = corners[gl_VertexIndex % 6];
+	float phi = float(quad % SLICES + corner.x) * 2.0 * PI / float(SLICES);
+	float theta = float(quad / SLICES + corner.y) * PI / float(STACKS);
+	vec3 dir = vec3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+
+	// Push the facets out so the proxy encloses the whole sphere
+	float scale = light.position.w /
+		(cos(PI / float(SLICES)) * cos(PI / float(2 * STACKS)));
+
+	// Light positions live in the G-buffer space where y is flipped
+	vec3 center = vec3(light.position.x, -light.position.y, light.position.z);
+	gl_Position = ubo.viewProj * vec4(center + dir * scale, 1.0);
+}
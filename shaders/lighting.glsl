@@ -0,0 +1,49 @@
+// Point light shading shared by the light passes
+
+// Specialization constant, constant_id as ShaderConstant in vk_backend.h
+layout(constant_id = 1) const bool SPECULAR = true;
+
+struct Light {
+	vec4 position;	// xyz: position, w: range used for culling
+	vec3 color;
+	float radius;
+	vec4 spot;	// xyz: direction, w: cosine of the cone half-angle,
+			// below -1 for point lights
+};
+
+vec3 shadeLight(Light light, vec3 fragPos, vec3 N, vec3 V, vec4 albedo) {
+	vec3 L = light.position.xyz - fragPos;
+	// Distance from light to fragment position
+	float dist = length(L);
+
+	// Light to fragment
+	L = normalize(L);
+
+	// Attenuation, faded out to zero at the culling range so that cluster
+	// boundaries don't show
+	float atten = light.radius / (pow(dist, 2.0) + 1.0);
+	float fade = clamp(1.0 - pow(dist / light.position.w, 4.0), 0.0, 1.0);
+	atten *= fade * fade;
+
+	// Spot cone, softened over the outer tenth of the cone
+	if (light.spot.w >= -1.0) {
+		float cosAngle = dot(-L, light.spot.xyz);
+		atten *= smoothstep(light.spot.w, mix(light.spot.w, 1.0, 0.1), cosAngle);
+	}
+
+	// Diffuse part
+	float NdotL = max(0.0, dot(N, L));
+	vec3 diff = light.color * albedo.rgb * NdotL * atten;
+
+	if (!SPECULAR) {
+		return diff;
+	}
+
+	// Specular part
+	// Specular map values are stored in alpha of albedo mrt
+	vec3 R = reflect(-L, N);
+	float NdotR = max(0.0, dot(R, V));
+	vec3 spec = light.color * albedo.a * pow(NdotR, 16.0) * atten;
+
+	return diff + spec;
+}
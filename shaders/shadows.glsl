@@ -0,0 +1,54 @@
+// Shadow map lookups shared by the light passes, must match shadow_maps.h
+#define SHADOW_CASCADE_COUNT 4
+#define MAX_POINT_SHADOWS 4
+#define POINT_SHADOW_FACES 6
+
+// 3x3 taps around a shadow clip position, each filtered 2x2 by the
+// comparison sampler. Lit outside of the map.
+float sampleShadow(sampler2DArrayShadow shadowMap, float layer, vec4 shadowClip) {
+	vec3 ndc = shadowClip.xyz / shadowClip.w;
+	if (any(greaterThan(abs(ndc.xy), vec2(1.0))) || ndc.z > 1.0) {
+		return 1.0;
+	}
+	vec2 uv = ndc.xy * 0.5 + 0.5;
+	vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+	float lit = 0.0;
+	for (int y = -1; y <= 1; y++) {
+		for (int x = -1; x <= 1; x++) {
+			lit += texture(shadowMap, vec4(uv + vec2(x, y) * texel, layer, ndc.z));
+		}
+	}
+	return lit / 9.0;
+}
+
+// Cascade covering a view-space depth, SHADOW_CASCADE_COUNT past the last
+uint shadowCascade(float viewDepth, vec4 cascadeSplits) {
+	uint cascade = 0;
+	for (uint c = 0; c < SHADOW_CASCADE_COUNT; c++) {
+		if (viewDepth > cascadeSplits[c]) {
+			cascade = c + 1;
+		}
+	}
+	return cascade;
+}
+
+// Cube face of a light to fragment vector: +x, -x, +y, -y, +z, -z
+uint cubeFace(vec3 direction) {
+	vec3 a = abs(direction);
+	if (a.x >= a.y && a.x >= a.z) {
+		return direction.x > 0.0 ? 0u : 1u;
+	} else if (a.y >= a.z) {
+		return direction.y > 0.0 ? 2u : 3u;
+	}
+	return direction.z > 0.0 ? 4u : 5u;
+}
+
+// Point light shadow of one cube face layer. The position is offset along
+// the normal by the size of a texel at its distance, which grows linearly
+// on a 90 degree face.
+float pointShadow(sampler2DArrayShadow shadowMap, uint layer, mat4 faceViewProj,
+		vec3 worldPos, vec3 N, float lightDistance) {
+	float texel = 2.0 * lightDistance / float(textureSize(shadowMap, 0).x);
+	vec3 offsetPos = worldPos + N * texel * 1.5;
+	return sampleShadow(shadowMap, float(layer), faceViewProj * vec4(offsetPos, 1.0));
+}
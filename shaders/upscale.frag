@@ -0,0 +1,21 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Stretches the rendered part of the scene color over the swapchain image
+
+layout(binding = 0) uniform sampler2D sceneColor;
+
+layout(binding = 1) uniform UniformBufferObject {
+	vec4	uvScale;	// xy: render / target extent, zw: last texel center
+} ubo;
+
+layout(location = 0) in vec2 fragTexCoord;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+	// Clamped so that the filter never reaches the texels left over from a
+	// larger scale
+	vec2 uv = min(fragTexCoord * ubo.uvScale.xy, ubo.uvScale.zw);
+	outColor = texture(sceneColor, uv);
+}
@@ -0,0 +1,127 @@
+#include "frustum_culling.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define CULLING_WIDTH 8
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CULLING_WIDTH 4
+#else
+#define CULLING_WIDTH 1
+#endif
+
+Frustum extractFrustum(const glm::mat4 &matrix) {
+  // glm is column-major, matrix[column][row]
+  glm::vec4 rows[4];
+  for (int i = 0; i < 4; i++) {
+    rows[i] = glm::vec4(matrix[0][i], matrix[1][i], matrix[2][i], matrix[3][i]);
+  }
+  Frustum frustum;
+  frustum.planes[0] = rows[3] + rows[0];
+  frustum.planes[1] = rows[3] - rows[0];
+  frustum.planes[2] = rows[3] + rows[1];
+  frustum.planes[3] = rows[3] - rows[1];
+  frustum.planes[4] = rows[2];  // 0 <= z
+  frustum.planes[5] = rows[3] - rows[2];
+  for (auto &plane : frustum.planes) {
+    plane /= glm::length(glm::vec3(plane));
+  }
+  return frustum;
+}
+
+CullingBoxes::CullingBoxes() : _count(0) {}
+
+void CullingBoxes::clear() {
+  _minX.clear();
+  _minY.clear();
+  _minZ.clear();
+  _maxX.clear();
+  _maxY.clear();
+  _maxZ.clear();
+  _count = 0;
+}
+
+uint32_t CullingBoxes::add(const AABB &box) {
+  uint32_t index = _count++;
+  if (index >= _minX.size()) {
+    size_t size = _minX.size() + CULLING_WIDTH;
+    _minX.resize(size, 0.0f);
+    _minY.resize(size, 0.0f);
+    _minZ.resize(size, 0.0f);
+    _maxX.resize(size, 0.0f);
+    _maxY.resize(size, 0.0f);
+    _maxZ.resize(size, 0.0f);
+  }
+  _minX[index] = box.min.x;
+  _minY[index] = box.min.y;
+  _minZ[index] = box.min.z;
+  _maxX[index] = box.max.x;
+  _maxY[index] = box.max.y;
+  _maxZ[index] = box.max.z;
+  return index;
+}
+
+uint32_t CullingBoxes::count() const { return _count; }
+
+void CullingBoxes::cull(const Frustum &frustum,
+                        std::vector<uint32_t> &visible) const {
+  // A box is outside when its corner furthest along the plane normal is
+  // behind the plane, pick that corner's coordinates once per plane
+  const float *cornerX[6], *cornerY[6], *cornerZ[6];
+  for (int p = 0; p < 6; p++) {
+    const glm::vec4 &plane = frustum.planes[p];
+    cornerX[p] = plane.x >= 0.0f ? _maxX.data() : _minX.data();
+    cornerY[p] = plane.y >= 0.0f ? _maxY.data() : _minY.data();
+    cornerZ[p] = plane.z >= 0.0f ? _maxZ.data() : _minZ.data();
+  }
+
+  for (uint32_t i = 0; i < _count; i += CULLING_WIDTH) {
+#if CULLING_WIDTH == 8
+    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (int p = 0; p < 6; p++) {
+      const glm::vec4 &plane = frustum.planes[p];
+      __m256 distance = _mm256_add_ps(
+          _mm256_add_ps(
+              _mm256_mul_ps(_mm256_set1_ps(plane.x),
+                            _mm256_loadu_ps(cornerX[p] + i)),
+              _mm256_mul_ps(_mm256_set1_ps(plane.y),
+                            _mm256_loadu_ps(cornerY[p] + i))),
+          _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.z),
+                                      _mm256_loadu_ps(cornerZ[p] + i)),
+                        _mm256_set1_ps(plane.w)));
+      inside = _mm256_and_ps(
+          inside, _mm256_cmp_ps(distance, _mm256_setzero_ps(), _CMP_GE_OQ));
+    }
+    int mask = _mm256_movemask_ps(inside);
+#elif CULLING_WIDTH == 4
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (int p = 0; p < 6; p++) {
+      const glm::vec4 &plane = frustum.planes[p];
+      __m128 distance = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x),
+                                _mm_loadu_ps(cornerX[p] + i)),
+                     _mm_mul_ps(_mm_set1_ps(plane.y),
+                                _mm_loadu_ps(cornerY[p] + i))),
+          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z),
+                                _mm_loadu_ps(cornerZ[p] + i)),
+                     _mm_set1_ps(plane.w)));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, _mm_setzero_ps()));
+    }
+    int mask = _mm_movemask_ps(inside);
+#else
+    int mask = 1;
+    for (int p = 0; p < 6; p++) {
+      const glm::vec4 &plane = frustum.planes[p];
+      if (plane.x * cornerX[p][i] + plane.y * cornerY[p][i] +
+              plane.z * cornerZ[p][i] + plane.w <
+          0.0f) {
+        mask = 0;
+      }
+    }
+#endif
+    for (uint32_t lane = 0; lane < CULLING_WIDTH && i + lane < _count;
+         lane++) {
+      if (mask & (1 << lane)) visible.push_back(i + lane);
+    }
+  }
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "model.h"
+#include "renderer.h"
+
+// Normalized planes, xyz pointing inside the frustum
+struct Frustum {
+  glm::vec4 planes[6];  // left, right, bottom, top, near, far
+};
+
+// Planes of a Vulkan (0..1 depth) projection matrix, expressed in the space
+// the matrix transforms from: pass proj * view * model to cull object-space
+// boxes
+Frustum extractFrustum(const glm::mat4 &matrix);
+
+// Axis-aligned boxes stored as SoA and tested against a frustum 8 (AVX) or
+// 4 (SSE2) at a time
+class CullingBoxes {
+ public:
+  CullingBoxes();
+
+  void clear();
+  uint32_t add(const AABB &box);
+  uint32_t count() const;
+  // Appends the indices of the boxes intersecting the frustum, in order
+  void cull(const Frustum &frustum, std::vector<uint32_t> &visible) const;
+
+ private:
+  // Padded to a multiple of the SIMD width with empty boxes
+  std::vector<float> _minX, _minY, _minZ;
+  std::vector<float> _maxX, _maxY, _maxZ;
+  uint32_t _count;
+};
@@ -0,0 +1,220 @@
+#include "gpu_profiler.h"
+
+// _openQueries of a scope not opened by a written timestamp
+static const uint32_t NO_QUERY = 0xFFFFFFFF;
+
+void GpuProfiler::init(VkPhysicalDevice physicalDevice, VkDevice device,
+                       uint32_t queueFamily, uint32_t scopeCount,
+                       uint32_t maxQueries,
+                       VkQueryPipelineStatisticFlags statistics,
+                       uint32_t latency) {
+  _device = device;
+  _maxQueries = maxQueries;
+  _frames.assign(std::max(latency, 1u), Frame());
+  _frameIndex = 0;
+  _openQueries.assign(scopeCount, NO_QUERY);
+  _stats.assign(scopeCount, RollingStats());
+
+  if (statistics != 0) {
+    _statisticFlags = statistics;
+    _statisticCount = 0;
+    for (uint32_t bits = statistics; bits != 0; bits &= bits - 1) {
+      _statisticCount++;
+    }
+    _statistics.assign(scopeCount * _statisticCount, RollingStats());
+    VkQueryPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    poolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+    poolInfo.queryCount = maxQueries * frameLatency();
+    poolInfo.pipelineStatistics = statistics;
+    VkResult result =
+        vkCreateQueryPool(_device, &poolInfo, nullptr, &_statisticsPool);
+    vkCheckResult(result, "vkCreateQueryPool");
+  }
+
+  uint32_t familyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount,
+                                           nullptr);
+  std::vector<VkQueueFamilyProperties> families(familyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount,
+                                           families.data());
+  uint32_t validBits =
+      queueFamily < familyCount ? families[queueFamily].timestampValidBits : 0;
+  if (validBits == 0) {
+    std::cerr << "warning: no timestamp support, GPU timings disabled"
+              << std::endl;
+    return;
+  }
+  _timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  _timestampPeriod = properties.limits.timestampPeriod;
+
+  VkQueryPoolCreateInfo poolInfo = {};
+  poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  poolInfo.queryCount = maxQueries * frameLatency();
+  VkResult result =
+      vkCreateQueryPool(_device, &poolInfo, nullptr, &_queryPool);
+  vkCheckResult(result, "vkCreateQueryPool");
+}
+
+void GpuProfiler::destroy() {
+  if (_queryPool != VK_NULL_HANDLE) {
+    vkDestroyQueryPool(_device, _queryPool, nullptr);
+    _queryPool = VK_NULL_HANDLE;
+  }
+  if (_statisticsPool != VK_NULL_HANDLE) {
+    vkDestroyQueryPool(_device, _statisticsPool, nullptr);
+    _statisticsPool = VK_NULL_HANDLE;
+  }
+}
+
+bool GpuProfiler::supported() const { return _queryPool != VK_NULL_HANDLE; }
+
+void GpuProfiler::beginFrame(VkCommandBuffer commandBuffer) {
+  _frameIndex = (_frameIndex + 1) % frameLatency();
+  _frames[_frameIndex] = Frame();
+  std::fill(_openQueries.begin(), _openQueries.end(), NO_QUERY);
+  if (statisticsSupported()) {
+    vkCmdResetQueryPool(commandBuffer, _statisticsPool, firstQuery(),
+                        _maxQueries);
+  }
+  if (!supported()) return;
+  vkCmdResetQueryPool(commandBuffer, _queryPool, firstQuery(), _maxQueries);
+}
+
+// A begin skipped for lack of queries leaves its scope closed, so that the
+// matching end() is skipped as well
+void GpuProfiler::begin(VkCommandBuffer commandBuffer, uint32_t scope,
+                        VkPipelineStageFlagBits stage) {
+  Frame &frame = _frames[_frameIndex];
+  _openQueries[scope] = NO_QUERY;
+  if (!supported() || frame.queryCount + 2 > _maxQueries) return;
+  _openQueries[scope] = frame.queryCount;
+  vkCmdWriteTimestamp(commandBuffer, stage, _queryPool,
+                      firstQuery() + frame.queryCount++);
+}
+
+void GpuProfiler::end(VkCommandBuffer commandBuffer, uint32_t scope,
+                      VkPipelineStageFlagBits stage) {
+  Frame &frame = _frames[_frameIndex];
+  if (!supported() || _openQueries[scope] == NO_QUERY ||
+      frame.queryCount >= _maxQueries) {
+    return;
+  }
+  Interval interval = {};
+  interval.scope = scope;
+  interval.beginQuery = _openQueries[scope];
+  interval.endQuery = frame.queryCount;
+  _openQueries[scope] = NO_QUERY;
+  frame.intervals.push_back(interval);
+  vkCmdWriteTimestamp(commandBuffer, stage, _queryPool,
+                      firstQuery() + frame.queryCount++);
+}
+
+void GpuProfiler::beginStatistics(VkCommandBuffer commandBuffer,
+                                  uint32_t scope) {
+  Frame &frame = _frames[_frameIndex];
+  if (!statisticsSupported() || frame.statisticsQueryCount >= _maxQueries) {
+    return;
+  }
+  frame.statisticsScopes.push_back(scope);
+  vkCmdBeginQuery(commandBuffer, _statisticsPool,
+                  firstQuery() + frame.statisticsQueryCount, 0);
+}
+
+void GpuProfiler::endStatistics(VkCommandBuffer commandBuffer,
+                                uint32_t scope) {
+  Frame &frame = _frames[_frameIndex];
+  if (!statisticsSupported() ||
+      frame.statisticsScopes.size() <= frame.statisticsQueryCount) {
+    return;
+  }
+  vkCmdEndQuery(commandBuffer, _statisticsPool,
+                firstQuery() + frame.statisticsQueryCount++);
+}
+
+// The frame next to the one being recorded is the oldest, its range is the
+// one beginFrame() resets next. Without VK_QUERY_RESULT_WAIT_BIT a frame
+// still executing returns VK_NOT_READY instead of blocking.
+bool GpuProfiler::collect() {
+  if (_frames.empty()) return false;
+  const uint32_t frameIndex = (_frameIndex + 1) % frameLatency();
+  Frame &frame = _frames[frameIndex];
+  const uint32_t first = frameIndex * _maxQueries;
+  if (statisticsSupported() && frame.statisticsQueryCount > 0) {
+    std::vector<uint64_t> values(frame.statisticsQueryCount *
+                                 _statisticCount);
+    VkResult result = vkGetQueryPoolResults(
+        _device, _statisticsPool, first, frame.statisticsQueryCount,
+        values.size() * sizeof(uint64_t), values.data(),
+        _statisticCount * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if (result == VK_SUCCESS) {
+      std::vector<double> sums(_statistics.size(), -1.0);
+      for (uint32_t query = 0; query < frame.statisticsQueryCount; query++) {
+        uint32_t firstValue = frame.statisticsScopes[query] * _statisticCount;
+        for (uint32_t i = 0; i < _statisticCount; i++) {
+          double &sum = sums[firstValue + i];
+          sum = std::max(sum, 0.0) +
+                static_cast<double>(values[query * _statisticCount + i]);
+        }
+      }
+      for (size_t i = 0; i < sums.size(); i++) {
+        if (sums[i] >= 0.0) _statistics[i].push(sums[i]);
+      }
+    }
+    frame.statisticsQueryCount = 0;
+    frame.statisticsScopes.clear();
+  }
+
+  if (!supported() || frame.intervals.empty()) return false;
+  std::vector<uint64_t> timestamps(frame.queryCount);
+  VkResult result = vkGetQueryPoolResults(
+      _device, _queryPool, first, frame.queryCount,
+      timestamps.size() * sizeof(uint64_t), timestamps.data(),
+      sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+  if (result != VK_SUCCESS) {
+    frame.intervals.clear();
+    return false;
+  }
+
+  std::vector<double> elapsed(_stats.size(), -1.0);
+  for (const Interval &interval : frame.intervals) {
+    uint64_t ticks = (timestamps[interval.endQuery] -
+                      timestamps[interval.beginQuery]) &
+                     _timestampMask;
+    double &scopeTime = elapsed[interval.scope];
+    scopeTime = std::max(scopeTime, 0.0) + ticks * _timestampPeriod * 1e-6;
+  }
+  for (size_t scope = 0; scope < _stats.size(); scope++) {
+    if (elapsed[scope] >= 0.0) _stats[scope].push(elapsed[scope]);
+  }
+  frame.intervals.clear();
+  return true;
+}
+
+uint32_t GpuProfiler::frameLatency() const {
+  return static_cast<uint32_t>(_frames.size());
+}
+
+const RollingStats &GpuProfiler::stats(uint32_t scope) const {
+  return _stats[scope];
+}
+
+bool GpuProfiler::statisticsSupported() const {
+  return _statisticsPool != VK_NULL_HANDLE;
+}
+
+const RollingStats &GpuProfiler::statistics(
+    uint32_t scope, VkQueryPipelineStatisticFlagBits statistic) const {
+  if ((_statisticFlags & statistic) == 0) return _emptyStatistics;
+  // Results are ordered by flag bit
+  uint32_t index = 0;
+  for (uint32_t bit = 1; bit < static_cast<uint32_t>(statistic); bit <<= 1) {
+    if (_statisticFlags & bit) index++;
+  }
+  return _statistics[scope * _statisticCount + index];
+}
+
+uint32_t GpuProfiler::firstQuery() const { return _frameIndex * _maxQueries; }
@@ -0,0 +1,80 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "rolling_stats.h"
+#include "vk_utils.h"
+
+// GPU time of named scopes of a frame, from timestamp queries. Each of the
+// last latency frames has its own range of queries: a frame's results
+// are read back latency frames after it was recorded, without waiting,
+// and dropped if they are still unavailable then. A scope may be opened
+// several times in a frame, its intervals add up. Records nothing when the
+// queue family has no timestamp support.
+//
+// Scopes can also count pipeline statistics (the pipelineStatisticsQuery
+// feature must be enabled for non-zero flags). Statistics queries of a frame
+// must not overlap and must stay within one subpass.
+class GpuProfiler {
+ public:
+  void init(VkPhysicalDevice physicalDevice, VkDevice device,
+            uint32_t queueFamily, uint32_t scopeCount,
+            uint32_t maxQueries = 64,
+            VkQueryPipelineStatisticFlags statistics = 0,
+            uint32_t latency = 1);
+  void destroy();
+
+  bool supported() const;
+  // Resets the queries of the next frame range, outside of a render pass.
+  // collect() first, or the results recorded there are lost.
+  void beginFrame(VkCommandBuffer commandBuffer);
+  void begin(VkCommandBuffer commandBuffer, uint32_t scope,
+             VkPipelineStageFlagBits stage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+  void end(VkCommandBuffer commandBuffer, uint32_t scope,
+           VkPipelineStageFlagBits stage =
+               VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+  void beginStatistics(VkCommandBuffer commandBuffer, uint32_t scope);
+  void endStatistics(VkCommandBuffer commandBuffer, uint32_t scope);
+  // Pushes the scope times and statistics of the frame recorded
+  // frameLatency() frames ago, if available. False when no time was pushed.
+  bool collect();
+  uint32_t frameLatency() const;
+
+  const RollingStats &stats(uint32_t scope) const;  // ms
+  bool statisticsSupported() const;
+  // Per frame sum of one of the enabled statistics, empty when disabled
+  const RollingStats &statistics(
+      uint32_t scope, VkQueryPipelineStatisticFlagBits statistic) const;
+
+ private:
+  struct Interval {
+    uint32_t scope;
+    uint32_t beginQuery;
+    uint32_t endQuery;
+  };
+
+  // Queries of one frame, from frameIndex * _maxQueries in both pools
+  struct Frame {
+    uint32_t queryCount = 0;
+    std::vector<Interval> intervals;
+    uint32_t statisticsQueryCount = 0;
+    std::vector<uint32_t> statisticsScopes;  // per query of the frame
+  };
+
+  VkDevice _device = VK_NULL_HANDLE;
+  VkQueryPool _queryPool = VK_NULL_HANDLE;
+  double _timestampPeriod = 0.0;  // ns per tick
+  uint64_t _timestampMask = 0;
+  uint32_t _maxQueries = 0;  // per frame
+  std::vector<Frame> _frames;  // frameLatency() entries
+  uint32_t _frameIndex = 0;    // being recorded
+  std::vector<uint32_t> _openQueries;  // per scope
+  std::vector<RollingStats> _stats;
+
+  VkQueryPool _statisticsPool = VK_NULL_HANDLE;
+  VkQueryPipelineStatisticFlags _statisticFlags = 0;
+  uint32_t _statisticCount = 0;  // values per query, one per flag
+  std::vector<RollingStats> _statistics;    // scope * _statisticCount + i
+  RollingStats _emptyStatistics;
+
+  uint32_t firstQuery() const;  // of the frame being recorded
+};
@@ -0,0 +1,272 @@
+#include "light_manager.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define LIGHT_MANAGER_SSE2
+#endif
+
+static const float PI = 3.14159265359f;
+
+// Distance past which a light contributes less than LIGHT_CUTOFF, given the
+// radius / (d^2 + 1) attenuation of the light shaders
+static float lightRange(const glm::vec3 &color, float intensity) {
+  const float LIGHT_CUTOFF = 0.005f;
+  float peak = intensity * std::max(color.r, std::max(color.g, color.b));
+  return std::max(std::sqrt(std::max(peak / LIGHT_CUTOFF - 1.0f, 0.0f)),
+                  0.01f);
+}
+
+static bool isAnimated(const LightDesc &desc) {
+  return desc.orbitRadius != 0.0f && desc.orbitSpeed != 0.0f;
+}
+
+#ifdef LIGHT_MANAGER_SSE2
+static inline __m128 select4(__m128 mask, __m128 a, __m128 b) {
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// sin() of 4 floats: reduced to [-pi, pi], folded to [-pi/2, pi/2] then an
+// odd Taylor polynomial up to x^11 (error below 1e-7 on that interval)
+static inline __m128 sin4(__m128 x) {
+  const __m128 pi = _mm_set1_ps(PI);
+  const __m128 halfPi = _mm_set1_ps(0.5f * PI);
+  const __m128 negHalfPi = _mm_set1_ps(-0.5f * PI);
+  __m128 turns = _mm_cvtepi32_ps(
+      _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(0.5f / PI))));
+  x = _mm_sub_ps(x, _mm_mul_ps(turns, _mm_set1_ps(2.0f * PI)));
+  // sin(x) = sin(pi - x) = sin(-pi - x)
+  x = select4(_mm_cmpgt_ps(x, halfPi), _mm_sub_ps(pi, x), x);
+  x = select4(_mm_cmplt_ps(x, negHalfPi),
+              _mm_sub_ps(_mm_sub_ps(_mm_setzero_ps(), pi), x), x);
+
+  __m128 x2 = _mm_mul_ps(x, x);
+  __m128 p = _mm_set1_ps(-2.5052108e-8f);
+  p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(2.7557319e-6f));
+  p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(-1.9841270e-4f));
+  p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(8.3333333e-3f));
+  p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(-1.6666667e-1f));
+  p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(1.0f));
+  return _mm_mul_ps(x, p);
+}
+#endif
+
+LightManager::LightManager(uint32_t capacity)
+    : _count(0),
+      _capacity(0),
+      _animatedCount(0),
+      _dirtyBegin(0),
+      _dirtyEnd(0) {
+  reserve(std::max(capacity, 1u));
+}
+
+LightHandle LightManager::add(const LightDesc &desc) {
+  if (_count == _capacity) reserve(_capacity * 2);
+
+  LightHandle handle;
+  if (!_freeHandles.empty()) {
+    handle = _freeHandles.back();
+    _freeHandles.pop_back();
+  } else {
+    handle = static_cast<LightHandle>(_handleToDense.size());
+    _handleToDense.push_back(0);
+  }
+
+  uint32_t index = _count++;
+  _denseToHandle[index] = handle;
+  _handleToDense[handle] = index;
+  write(index, desc);
+  if (isAnimated(desc)) {
+    swap(index, _animatedCount);
+    _animatedCount++;
+  }
+  return handle;
+}
+
+void LightManager::remove(LightHandle handle) {
+  if (handle >= _handleToDense.size() ||
+      _handleToDense[handle] == INVALID_LIGHT_HANDLE) {
+    throw std::runtime_error("invalid light handle");
+  }
+  uint32_t index = _handleToDense[handle];
+  // Keep both the animated and the static ranges packed
+  if (index < _animatedCount) {
+    swap(index, _animatedCount - 1);
+    index = --_animatedCount;
+  }
+  swap(index, _count - 1);
+  _count--;
+
+  _handleToDense[handle] = INVALID_LIGHT_HANDLE;
+  _freeHandles.push_back(handle);
+}
+
+void LightManager::update(LightHandle handle, const LightDesc &desc) {
+  if (handle >= _handleToDense.size() ||
+      _handleToDense[handle] == INVALID_LIGHT_HANDLE) {
+    throw std::runtime_error("invalid light handle");
+  }
+  uint32_t index = _handleToDense[handle];
+  write(index, desc);
+  bool wasAnimated = index < _animatedCount;
+  if (isAnimated(desc) && !wasAnimated) {
+    swap(index, _animatedCount);
+    _animatedCount++;
+  } else if (!isAnimated(desc) && wasAnimated) {
+    swap(index, _animatedCount - 1);
+    _animatedCount--;
+  }
+}
+
+void LightManager::clear() {
+  for (uint32_t i = 0; i < _count; i++) {
+    _handleToDense[_denseToHandle[i]] = INVALID_LIGHT_HANDLE;
+    _freeHandles.push_back(_denseToHandle[i]);
+  }
+  _count = 0;
+  _animatedCount = 0;
+  clearDirty();
+}
+
+void LightManager::animate(float time) {
+  const uint32_t n = _animatedCount;
+  if (n == 0) return;
+
+  const float *centerX = _streams[CenterX].data();
+  const float *centerZ = _streams[CenterZ].data();
+  const float *radius = _streams[OrbitRadius].data();
+  const float *speed = _streams[OrbitSpeed].data();
+  const float *phaseX = _streams[OrbitPhaseX].data();
+  const float *phaseZ = _streams[OrbitPhaseZ].data();
+  float *positionX = _streams[PositionX].data();
+  float *positionZ = _streams[PositionZ].data();
+  const float turn = 2.0f * PI * time;
+
+  uint32_t i = 0;
+#ifdef LIGHT_MANAGER_SSE2
+  const __m128 turn4 = _mm_set1_ps(turn);
+  const __m128 halfPi = _mm_set1_ps(0.5f * PI);
+  for (; i + 4 <= n; i += 4) {
+    __m128 angle = _mm_mul_ps(_mm_loadu_ps(speed + i), turn4);
+    __m128 r = _mm_loadu_ps(radius + i);
+    __m128 sinX = sin4(_mm_add_ps(angle, _mm_loadu_ps(phaseX + i)));
+    // cos(a) = sin(a + pi/2)
+    __m128 cosZ = sin4(
+        _mm_add_ps(angle, _mm_add_ps(_mm_loadu_ps(phaseZ + i), halfPi)));
+    _mm_storeu_ps(positionX + i,
+                  _mm_add_ps(_mm_loadu_ps(centerX + i), _mm_mul_ps(r, sinX)));
+    _mm_storeu_ps(positionZ + i,
+                  _mm_add_ps(_mm_loadu_ps(centerZ + i), _mm_mul_ps(r, cosZ)));
+  }
+#endif
+  for (; i < n; i++) {
+    float angle = speed[i] * turn;
+    positionX[i] = centerX[i] + radius[i] * std::sin(angle + phaseX[i]);
+    positionZ[i] = centerZ[i] + radius[i] * std::cos(angle + phaseZ[i]);
+  }
+  markDirty(0, n);
+}
+
+uint32_t LightManager::count() const { return _count; }
+
+uint32_t LightManager::capacity() const { return _capacity; }
+
+uint32_t LightManager::animatedCount() const { return _animatedCount; }
+
+glm::vec3 LightManager::position(uint32_t index) const {
+  return glm::vec3(_streams[PositionX][index], _streams[PositionY][index],
+                   _streams[PositionZ][index]);
+}
+
+float LightManager::range(uint32_t index) const {
+  return _streams[Range][index];
+}
+
+LightType LightManager::type(uint32_t index) const {
+  // Point lights store a cone cosine no spot can have
+  return _streams[SpotCos][index] < -1.0f ? LightType::Point
+                                           : LightType::Spot;
+}
+
+bool LightManager::dirty() const { return _dirtyBegin < dirtyEnd(); }
+
+uint32_t LightManager::dirtyBegin() const { return _dirtyBegin; }
+
+uint32_t LightManager::dirtyEnd() const {
+  return std::min(_dirtyEnd, _count);
+}
+
+void LightManager::markAllDirty() { markDirty(0, _count); }
+
+void LightManager::clearDirty() {
+  _dirtyBegin = 0;
+  _dirtyEnd = 0;
+}
+
+void LightManager::pack(uint32_t begin, uint32_t end, Light *dst) const {
+  for (uint32_t i = begin; i < end; i++) {
+    Light &light = dst[i - begin];
+    light.position = glm::vec4(_streams[PositionX][i], _streams[PositionY][i],
+                               _streams[PositionZ][i], _streams[Range][i]);
+    light.color = glm::vec3(_streams[ColorR][i], _streams[ColorG][i],
+                            _streams[ColorB][i]);
+    light.radius = _streams[Intensity][i];
+    light.spot = glm::vec4(_streams[DirectionX][i], _streams[DirectionY][i],
+                           _streams[DirectionZ][i], _streams[SpotCos][i]);
+  }
+}
+
+void LightManager::reserve(uint32_t capacity) {
+  for (auto &stream : _streams) stream.resize(capacity);
+  _denseToHandle.resize(capacity);
+  _capacity = capacity;
+}
+
+void LightManager::write(uint32_t index, const LightDesc &desc) {
+  glm::vec3 direction = glm::normalize(desc.direction);
+  // Static lights keep their orbit offset at t = 0
+  _streams[PositionX][index] =
+      desc.position.x + desc.orbitRadius * std::sin(desc.orbitPhase.x);
+  _streams[PositionY][index] = desc.position.y;
+  _streams[PositionZ][index] =
+      desc.position.z + desc.orbitRadius * std::cos(desc.orbitPhase.y);
+  _streams[Range][index] = lightRange(desc.color, desc.intensity);
+  _streams[ColorR][index] = desc.color.r;
+  _streams[ColorG][index] = desc.color.g;
+  _streams[ColorB][index] = desc.color.b;
+  _streams[Intensity][index] = desc.intensity;
+  _streams[DirectionX][index] = direction.x;
+  _streams[DirectionY][index] = direction.y;
+  _streams[DirectionZ][index] = direction.z;
+  _streams[SpotCos][index] =
+      desc.type == LightType::Spot ? std::cos(desc.spotAngle) : -2.0f;
+  _streams[CenterX][index] = desc.position.x;
+  _streams[CenterZ][index] = desc.position.z;
+  _streams[OrbitRadius][index] = desc.orbitRadius;
+  _streams[OrbitSpeed][index] = desc.orbitSpeed;
+  _streams[OrbitPhaseX][index] = desc.orbitPhase.x;
+  _streams[OrbitPhaseZ][index] = desc.orbitPhase.y;
+  markDirty(index, index + 1);
+}
+
+void LightManager::swap(uint32_t a, uint32_t b) {
+  if (a == b) return;
+  for (auto &stream : _streams) std::swap(stream[a], stream[b]);
+  std::swap(_denseToHandle[a], _denseToHandle[b]);
+  _handleToDense[_denseToHandle[a]] = a;
+  _handleToDense[_denseToHandle[b]] = b;
+  markDirty(std::min(a, b), std::max(a, b) + 1);
+}
+
+void LightManager::markDirty(uint32_t begin, uint32_t end) {
+  if (begin >= end) return;
+  if (_dirtyBegin < _dirtyEnd) {
+    _dirtyBegin = std::min(_dirtyBegin, begin);
+    _dirtyEnd = std::max(_dirtyEnd, end);
+  } else {
+    _dirtyBegin = begin;
+    _dirtyEnd = end;
+  }
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "renderer.h"
+
+// GPU layout of a light, must match shaders/lighting.glsl. Positions and
+// directions are in the G-buffer space, where y is flipped.
+struct Light {
+  glm::vec4 position;  // w: range used for culling
+  glm::vec3 color;
+  float radius;    // intensity
+  glm::vec4 spot;  // xyz: direction, w: cosine of the cone half-angle,
+                   // below -1 for point lights
+};
+
+enum class LightType { Point, Spot };
+
+struct LightDesc {
+  LightType type = LightType::Point;
+  glm::vec3 position = glm::vec3(0.0f);  // orbit center when animated
+  glm::vec3 color = glm::vec3(1.0f);
+  float intensity = 1.0f;
+  glm::vec3 direction = glm::vec3(0.0f, 1.0f, 0.0f);  // spot lights only
+  float spotAngle = 0.5f;                             // half-angle, radians
+  // Orbit in the xz plane:
+  //   x += orbitRadius * sin(2pi * orbitSpeed * t + orbitPhase.x)
+  //   z += orbitRadius * cos(2pi * orbitSpeed * t + orbitPhase.y)
+  float orbitRadius = 0.0f;
+  float orbitSpeed = 0.0f;  // turns per second, 0: static
+  glm::vec2 orbitPhase = glm::vec2(0.0f);
+};
+
+typedef uint32_t LightHandle;
+const LightHandle INVALID_LIGHT_HANDLE = 0xFFFFFFFF;
+
+// Point and spot lights stored as structure of arrays. Animated lights are
+// kept packed at the front so animate() runs over a contiguous range in
+// SIMD batches; every edit widens a dirty range that the renderer copies to
+// the GPU light buffer, which is sized by capacity().
+class LightManager {
+ public:
+  LightManager(uint32_t capacity = 64);
+
+  LightHandle add(const LightDesc &desc);
+  void remove(LightHandle handle);
+  void update(LightHandle handle, const LightDesc &desc);
+  void clear();
+  void animate(float time);
+
+  uint32_t count() const;
+  uint32_t capacity() const;  // grows by doubling
+  uint32_t animatedCount() const;
+
+  // Dense index in [0, count()), order changes on add/remove/update
+  glm::vec3 position(uint32_t index) const;
+  float range(uint32_t index) const;
+  LightType type(uint32_t index) const;
+
+  bool dirty() const;
+  uint32_t dirtyBegin() const;
+  uint32_t dirtyEnd() const;
+  void markAllDirty();
+  void clearDirty();
+  // Writes lights [begin, end) to dst[0, end - begin)
+  void pack(uint32_t begin, uint32_t end, Light *dst) const;
+
+ private:
+  enum Stream {
+    PositionX,
+    PositionY,
+    PositionZ,
+    Range,
+    ColorR,
+    ColorG,
+    ColorB,
+    Intensity,
+    DirectionX,
+    DirectionY,
+    DirectionZ,
+    SpotCos,
+    CenterX,
+    CenterZ,
+    OrbitRadius,
+    OrbitSpeed,
+    OrbitPhaseX,
+    OrbitPhaseZ,
+    StreamCount
+  };
+
+  std::vector<float> _streams[StreamCount];
+  std::vector<LightHandle> _denseToHandle;
+  std::vector<uint32_t> _handleToDense;
+  std::vector<LightHandle> _freeHandles;
+  uint32_t _count;
+  uint32_t _capacity;
+  uint32_t _animatedCount;
+  uint32_t _dirtyBegin;
+  uint32_t _dirtyEnd;
+
+  void reserve(uint32_t capacity);
+  void write(uint32_t index, const LightDesc &desc);
+  void swap(uint32_t a, uint32_t b);
+  void markDirty(uint32_t begin, uint32_t end);
+};
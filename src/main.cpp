@@ -1,68 +1,1680 @@
-#define GLFW_INCLUDE_VULKAN
-#include <GLFW/glfw3.h>
-
-#define GLM_FORCE_RADIANS
-#define GLM_FORCE_DEPTH_ZERO_TO_ONE
-#include <functional>
-#include <glm/mat4x4.hpp>
-#include <glm/vec4.hpp>
-#include <iostream>
-#include <stdexcept>
-#include <sstream>
-#include <iomanip>
-#include "graphics_backend.h"
-#include "model.h"
-#include "vk_backend.h"
-
-void updateFpsCounter(GLFWwindow *window) {
-  static double previous_seconds = glfwGetTime();
-  static int frame_count;
-  double current_seconds = glfwGetTime();
-  double elapsed_seconds = current_seconds - previous_seconds;
-  if (elapsed_seconds > 0.25) {
-    previous_seconds = current_seconds;
-    double fps = (double)frame_count / elapsed_seconds;
-    std::ostringstream title;
-    title << "Vulkan Deferred @ " << std::fixed << std::setprecision(1) << fps << " fps";
-    glfwSetWindowTitle(window, title.str().c_str());
-    frame_count = 0;
-  }
-  frame_count++;
-}
-
-
-static void onWindowResized(GLFWwindow* window, int width, int height) {
-  if (width == 0 || height == 0) return;
-
-  GraphicsBackend* backend =
-      reinterpret_cast<GraphicsBackend*>(glfwGetWindowUserPointer(window));
-  backend->onResize();
-}
-
-int main() {
-  glfwInit();
-
-  glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-  GLFWwindow* window =
-      glfwCreateWindow(1280, 720, "Vulkan Deferred renderer", nullptr, nullptr);
-
-  Model model;
-  model.load("models/sponza/sponza.obj");
-
-  VkBackend vulkanBackend = VkBackend();
-  vulkanBackend.init(window, model);
-  glfwSetWindowUserPointer(window, &vulkanBackend);
-  glfwSetWindowSizeCallback(window, onWindowResized);
-  while (!glfwWindowShouldClose(window)) {
-    updateFpsCounter(window);
-    glfwPollEvents();
-    vulkanBackend.update();
-    vulkanBackend.drawFrame();
-  }
-
-  glfwDestroyWindow(window);
-
-  glfwTerminate();
-  vulkanBackend.cleanup();
-  return 0;
-}
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <glm/mat4x4.hpp>
+#include <glm/vec4.hpp>
+#include <iostream>
+#include <stdexcept>
+#include <sstream>
+#include <thread>
+#include <iomanip>
+#include "graphics_backend.h"
+#include "model.h"
+#include "scene.h"
+#include "vk_backend.h"
+
+void updateFpsCounter(GLFWwindow *window, const VkBackend &backend) {
+  static double previous_seconds = glfwGetTime();
+  static int frame_count;
+  double current_seconds = glfwGetTime();
+  double elapsed_seconds = current_seconds - previous_seconds;
+  if (elapsed_seconds > 0.25) {
+    previous_seconds = current_seconds;
+    double fps = (double)frame_count / elapsed_seconds;
+    const SwapChainTelemetry &telemetry = backend.getSwapChainTelemetry();
+    std::ostringstream title;
+    title << "Vulkan Deferred @ " << std::fixed << std::setprecision(1) << fps
+          << " fps | " << presentModeName(backend.getPresentMode()) << " x"
+          << backend.getSwapChainImageCount() << std::setprecision(2)
+          << " | acquire " << telemetry.acquireBlock.average() << " ms"
+          << " | acquire->present " << telemetry.acquireToPresent.average()
+          << " ms | draws " << backend.getCullingStats().visibleDraws << "/"
+          << backend.getCullingStats().totalDraws;
+    glfwSetWindowTitle(window, title.str().c_str());
+    frame_count = 0;
+  }
+  frame_count++;
+}
+
+static const char *cullingModeName(CullingMode mode) {
+  switch (mode) {
+    case CullingMode::None:
+      return "none";
+    case CullingMode::Cpu:
+      return "cpu";
+    case CullingMode::CpuOcclusion:
+      return "cpu-occlusion";
+    case CullingMode::Gpu:
+      return "gpu";
+    case CullingMode::GpuOcclusion:
+      return "gpu-occlusion";
+  }
+  return "unknown";
+}
+
+static const char *perDrawDataName(PerDrawData perDrawData) {
+  switch (perDrawData) {
+    case PerDrawData::InstanceSlots:
+      return "slots";
+    case PerDrawData::PushConstants:
+      return "push";
+    case PerDrawData::DynamicUniform:
+      return "uniform";
+  }
+  return "unknown";
+}
+
+static const char *gpuScopeName(GpuScope scope) {
+  switch (scope) {
+    case GpuScope::LightClustering:
+      return "clustering";
+    case GpuScope::DrawCulling:
+      return "draw culling";
+    case GpuScope::Shadows:
+      return "shadows";
+    case GpuScope::DepthPrePass:
+      return "pre-pass";
+    case GpuScope::GPass:
+      return "G-pass";
+    case GpuScope::Lighting:
+      return "lighting";
+    case GpuScope::HiZ:
+      return "Hi-Z";
+    case GpuScope::Upscale:
+      return "upscale";
+    case GpuScope::Frame:
+      return "frame";
+    case GpuScope::Count:
+      break;
+  }
+  return "unknown";
+}
+
+// One line of the scopes timed over the last frames, averages in ms
+static void logGpuTimes(const VkBackend &backend, uint32_t frame) {
+  std::cout << "gpu frame " << frame << ":";
+  if (!backend.getGpuTimingSupported()) {
+    std::cout << " no timestamp support" << std::endl;
+    return;
+  }
+  std::cout << std::fixed << std::setprecision(3);
+  for (uint32_t i = 0; i < static_cast<uint32_t>(GpuScope::Count); i++) {
+    const GpuScope scope = static_cast<GpuScope>(i);
+    const RollingStats &time = backend.getGpuTime(scope);
+    if (time.count() == 0) continue;
+    std::cout << " " << gpuScopeName(scope) << " " << time.average();
+  }
+  std::cout << std::endl;
+}
+
+static void printTelemetry(const VkBackend &backend) {
+  const SwapChainTelemetry &telemetry = backend.getSwapChainTelemetry();
+  std::cout << std::fixed << std::setprecision(3)
+            << "present mode: " << presentModeName(backend.getPresentMode())
+            << ", swapchain images: " << backend.getSwapChainImageCount()
+            << ", frames in flight: " << backend.getFramesInFlight() << "\n"
+            << "acquire block (ms):      avg "
+            << telemetry.acquireBlock.average() << " p95 "
+            << telemetry.acquireBlock.percentile(95.0) << " max "
+            << telemetry.acquireBlock.max() << "\n"
+            << "acquire->present (ms):   avg "
+            << telemetry.acquireToPresent.average() << " p95 "
+            << telemetry.acquireToPresent.percentile(95.0) << " max "
+            << telemetry.acquireToPresent.max() << "\n"
+            << "light update (ms):       avg "
+            << backend.getLightUpdateStats().average() << " p95 "
+            << backend.getLightUpdateStats().percentile(95.0) << " max "
+            << backend.getLightUpdateStats().max() << "\n"
+            << "frustum culling (ms):    "
+            << cullingModeName(backend.getCullingMode()) << " avg "
+            << backend.getCullingStats().cullTime.average() << " p95 "
+            << backend.getCullingStats().cullTime.percentile(95.0)
+            << ", draws " << backend.getCullingStats().visibleDraws << "/"
+            << backend.getCullingStats().totalDraws << ", triangles "
+            << backend.getCullingStats().visibleTriangles << "/"
+            << backend.getCullingStats().totalTriangles << "\n"
+            << "pipeline creation (ms):  "
+            << (backend.getPipelineCacheWarm() ? "warm" : "cold")
+            << " start, " << backend.getPipelineCreationTime().count()
+            << " times, avg " << backend.getPipelineCreationTime().average()
+            << " max " << backend.getPipelineCreationTime().max() << "\n";
+  // Since the last swapchain recreation
+  std::vector<PipelineVariant> variants = backend.getPipelineVariants();
+  std::cout << "pipeline variants:       " << variants.size() << "\n";
+  for (const PipelineVariant &variant : variants) {
+    std::cout << "  " << std::left << std::setw(36) << variant.name
+              << std::right << " created in " << variant.creationTime
+              << " ms, requested " << variant.requests << "x\n";
+  }
+  const RollingStats &frameTime = backend.getGpuTime(GpuScope::Frame);
+  if (frameTime.count() > 0) {
+    std::cout << "frame GPU (ms):          avg " << frameTime.average()
+              << " p95 " << frameTime.percentile(95.0) << " max "
+              << frameTime.max() << "\n";
+  }
+  // Read back getGpuTimingLatency() frames after recording
+  std::cout << "GPU passes (ms):         "
+            << (backend.getGpuTimingSupported() ? "" : "no timestamps, ")
+            << "latency " << backend.getGpuTimingLatency() << " frames\n";
+  for (uint32_t i = 0; i < static_cast<uint32_t>(GpuScope::Count); i++) {
+    const GpuScope scope = static_cast<GpuScope>(i);
+    const RollingStats &time = backend.getGpuTime(scope);
+    if (time.count() == 0) continue;
+    std::cout << "  " << std::left << std::setw(14) << gpuScopeName(scope)
+              << std::right << " avg " << time.average() << " p95 "
+              << time.percentile(95.0) << " max " << time.max() << "\n";
+  }
+  if (backend.getDynamicResolution()) {
+    VkExtent2D extent = backend.getRenderExtent();
+    std::cout << "render scale:            " << backend.getRenderScale()
+              << ", " << extent.width << "x" << extent.height << ", target "
+              << backend.getTargetFrameTime() << " ms, upscale GPU avg "
+              << backend.getGpuTime(GpuScope::Upscale).average() << " ms\n";
+  }
+  const RollingStats &gPassTime = backend.getGpuTime(GpuScope::GPass);
+  if (gPassTime.count() > 0) {
+    std::cout << "G-pass GPU (ms):         avg " << gPassTime.average()
+              << " p95 " << gPassTime.percentile(95.0) << " max "
+              << gPassTime.max() << "\n";
+  }
+  std::cout << "scene:                   " << backend.getInstanceCount()
+            << " instances, instancing "
+            << (backend.getInstancing() ? "on" : "off") << "\n";
+  // Binds issued in queue order against those of draw item order
+  const BindStats &binds = backend.getBindStats();
+  std::cout << "render queue:            draws " << binds.draws
+            << ", record avg " << binds.recordTime.average()
+            << " ms, sort avg " << binds.sortTime.average()
+            << " ms, shadow pipeline binds " << binds.pipelineBinds << "/"
+            << binds.pipelineRequests << ", descriptor binds "
+            << binds.descriptorBinds << "/" << binds.descriptorRequests
+            << "\n";
+  std::cout << "merged draws:            "
+            << (backend.getMergedDrawsActive()
+                    ? "on"
+                    : backend.getMergedDraws() ? "unsupported" : "off")
+            << ", indirect draws " << binds.indirectDraws
+            << ", descriptor binds " << binds.indirectDescriptorBinds << "\n";
+  // Mixed 16 and 32-bit indices, saved against 32-bit indices only
+  const IndexBufferStats &indexStats = backend.getIndexBufferStats();
+  std::cout << "index buffer:            " << indexStats.narrowIndices
+            << " 16-bit, " << indexStats.wideIndices << " 32-bit, "
+            << indexStats.bytes / 1024 << " KiB, saved "
+            << indexStats.bytesSaved / 1024 << " KiB, binds "
+            << binds.indexBinds << "\n";
+  std::cout << "per-draw data:           "
+            << perDrawDataName(backend.getPerDrawData()) << ", updates "
+            << binds.perDrawUpdates << "\n";
+  const RollingStats &prePassTime =
+      backend.getGpuTime(GpuScope::DepthPrePass);
+  if (backend.getDepthPrePass() && prePassTime.count() > 0) {
+    std::cout << "depth pre-pass GPU (ms): avg " << prePassTime.average()
+              << " p95 " << prePassTime.percentile(95.0) << " max "
+              << prePassTime.max() << "\n";
+  }
+  if (backend.getShadows()) {
+    const ShadowStats &shadows = backend.getShadowStats();
+    std::cout << "shadows (ms):            cpu avg "
+              << shadows.cpuTime.average() << ", layers rendered "
+              << shadows.renderedLayers << " cached " << shadows.cachedLayers
+              << " deferred " << shadows.deferredLayers << ", draws "
+              << shadows.draws << ", triangles " << shadows.triangles << "\n";
+    const RollingStats &shadowTime = backend.getGpuTime(GpuScope::Shadows);
+    if (shadowTime.count() > 0) {
+      std::cout << "shadows GPU (ms):        avg " << shadowTime.average()
+                << " p95 " << shadowTime.percentile(95.0) << " max "
+                << shadowTime.max() << "\n";
+    }
+    // Averages over the frames each pass was rendered in
+    for (uint32_t pass = 0; pass < SHADOW_CASCADE_COUNT + MAX_POINT_SHADOWS;
+         pass++) {
+      const RollingStats &passTime = backend.getShadowGpuTime(pass);
+      if (passTime.count() == 0) continue;
+      std::cout << "  "
+                << (pass < SHADOW_CASCADE_COUNT ? "cascade " : "point light ")
+                << (pass < SHADOW_CASCADE_COUNT ? pass
+                                                : pass - SHADOW_CASCADE_COUNT)
+                << " avg " << passTime.average() << " max "
+                << passTime.max() << "\n";
+    }
+  }
+  const RollingStats &fragments = backend.getGpuStatistic(
+      GpuScope::GPass,
+      VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT);
+  if (fragments.count() > 0) {
+    std::cout << "G-pass fragments:        avg " << std::setprecision(0)
+              << fragments.average() << " max " << fragments.max()
+              << std::setprecision(3) << "\n";
+  }
+  // Vertices fetched by the input assembler times the stride of the
+  // streams each pass binds, against one interleaved stream
+  struct FetchScope {
+    const char *name;
+    GpuScope scope;
+    uint32_t stride;
+  };
+  const FetchScope fetchScopes[] = {
+      {"pre-pass", GpuScope::DepthPrePass, POSITION_STREAM_STRIDE},
+      {"shadows", GpuScope::Shadows, POSITION_STREAM_STRIDE},
+      {"G-pass", GpuScope::GPass, INTERLEAVED_VERTEX_STRIDE}};
+  double fetched = 0.0, interleaved = 0.0;
+  std::ostringstream fetches;
+  for (const FetchScope &fetchScope : fetchScopes) {
+    const RollingStats &vertices = backend.getGpuStatistic(
+        fetchScope.scope,
+        VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT);
+    if (vertices.count() == 0 || vertices.average() == 0.0) continue;
+    const double megabytes = vertices.average() / (1024.0 * 1024.0);
+    fetched += megabytes * fetchScope.stride;
+    interleaved += megabytes * INTERLEAVED_VERTEX_STRIDE;
+    fetches << " " << fetchScope.name << " "
+            << megabytes * fetchScope.stride;
+  }
+  if (fetched > 0.0) {
+    std::cout << "vertex fetch (MB):      " << fetches.str() << ", saved "
+              << interleaved - fetched << " against interleaved\n";
+  }
+  std::cout << std::flush;
+}
+
+// Grid of --instance-benchmark when --instances isn't given
+static const uint32_t DEFAULT_BENCHMARK_INSTANCES = 2048;
+// Draws of --per-draw-benchmark when --instances isn't given
+static const uint32_t PER_DRAW_BENCHMARK_DRAWS = 10000;
+
+// Of --frame-benchmark
+struct FrameBenchmarkOptions {
+  std::string jsonPath;
+  uint32_t warmupFrames = 60;
+  uint32_t measuredFrames = 600;
+};
+
+static void printUsage(const char *program) {
+  std::cout << "usage: " << program << " [options]\n"
+            << "  --present-mode <fifo|fifo_relaxed|mailbox|immediate>\n"
+            << "  --swapchain-images <count>   0 = driver minimum + 1\n"
+            << "  --frames-in-flight <count>   frames recorded ahead of the "
+               "GPU, default 2\n"
+            << "  --gbuffer <full|compact>     G toggles it at runtime\n"
+            << "  --lighting <full|clustered|volumes>\n"
+            << "                               C cycles through them at runtime\n"
+            << "  --lights <count>             number of point lights\n"
+            << "  --culling <none|cpu|cpu-occlusion|gpu|gpu-occlusion>\n"
+            << "                               sub-mesh culling, F cycles "
+               "through them at\n"
+            << "                               runtime, gpu modes write "
+               "indirect draws\n"
+            << "  --depth-prepass              depth-only subpass before the "
+               "G-pass, Z toggles\n"
+            << "                               it at runtime\n"
+            << "  --shadows                    cascaded sun shadows and point "
+               "light cube shadows,\n"
+            << "                               H toggles them at runtime\n"
+            << "  --point-shadows <count>      shadowed point lights, at most "
+            << MAX_POINT_SHADOWS << "\n"
+            << "  --shadow-budget <layers>     shadow map layers re-rendered "
+               "per frame at most\n"
+            << "  --pipeline-cache <path>      pipeline cache file, loaded at "
+               "start and saved on\n"
+            << "                               exit, none disables it\n"
+            << "  --no-normal-mapping          vertex normals only, N "
+               "toggles normal mapping at\n"
+            << "                               runtime\n"
+            << "  --no-specular                diffuse lighting only, S "
+               "toggles specular at runtime\n"
+            << "  --specialize-light-count     full-screen lighting pipeline "
+               "specialized on the\n"
+            << "                               light count, rounded up to a "
+               "power of two\n"
+            << "  --serial-pipelines           create the pipelines on the "
+               "main thread only\n"
+            << "  --dynamic-resolution <ms>    scale the rendering to hold "
+               "the GPU frame time at\n"
+            << "                               the target, R toggles it at "
+               "runtime\n"
+            << "  --instances <count>          copies of the model on a grid "
+               "the size of the\n"
+            << "                               model\n"
+            << "  --no-instancing              one draw per instance, I "
+               "toggles instancing at\n"
+            << "                               runtime\n"
+            << "  --no-merged-draws            one descriptor set and indirect "
+               "draw per mesh, M\n"
+            << "                               toggles merged draws at "
+               "runtime\n"
+            << "  --per-draw <slots|push|uniform>\n"
+            << "                               per-draw data of the CPU "
+               "recorded G-pass draws\n"
+            << "  --animate-instances          sway every fourth row of the "
+               "--instances grid\n"
+            << "  --headless <frames>          no window: render frames "
+               "offscreen and exit,\n"
+            << "                               --swapchain-images sizes the "
+               "image ring\n"
+            << "  --headless-extent <w>x<h>    offscreen image size, "
+               "1280x720 by default\n"
+            << "  --readback <directory>       write headless frames there "
+               "as PPM images\n"
+            << "  --readback-interval <n>      read back every nth headless "
+               "frame only\n"
+            << "  --gpu-timing-log <frames>    print the GPU time of each "
+               "pass every so many\n"
+            << "                               frames\n"
+            << "  --light-benchmark            time the lighting modes from 6 "
+               "to 10000 lights and exit\n"
+            << "  --light-cpu-benchmark        time the CPU light update at "
+               "100k lights and exit\n"
+            << "  --occlusion-benchmark        compare the culling modes along "
+               "a fixed camera\n"
+            << "                               path and exit\n"
+            << "  --occlusion-cpu-benchmark    time the software occlusion "
+               "buffer per thread\n"
+            << "                               count, no window needed, and "
+               "exit\n"
+            << "  --occlusion-test             check the software occlusion "
+               "buffer on fixed\n"
+            << "                               scenes, no window needed, and "
+               "exit, non-zero on\n"
+            << "                               failure\n"
+            << "  --prepass-benchmark          compare G-pass fragments and "
+               "GPU time with and\n"
+            << "                               without the depth pre-pass and "
+               "exit\n"
+            << "  --pipeline-benchmark         time cold pipeline creation, "
+               "serial and on the\n"
+            << "                               worker pool, and exit\n"
+            << "  --resolution-benchmark       dynamic resolution through a "
+               "load spike and its\n"
+            << "                               recovery, prints the scale "
+               "history and exit\n"
+            << "  --instance-benchmark         draw calls and CPU/GPU times "
+               "with and without\n"
+            << "                               instancing, "
+            << DEFAULT_BENCHMARK_INSTANCES
+            << " instances unless --instances\n"
+            << "                               is given, and exit\n"
+            << "  --transform-benchmark        time the world matrix update "
+               "of 1M transforms per\n"
+            << "                               thread count, no window "
+               "needed, and exit\n"
+            << "  --per-draw-benchmark         time the per-draw data paths "
+               "at " << PER_DRAW_BENCHMARK_DRAWS << " draws and\n"
+            << "                               exit\n"
+            << "  --frame-benchmark <json>     frame time percentiles over a "
+               "fixed animation,\n"
+            << "                               written to the file, and "
+               "exit, --headless too\n"
+            << "  --benchmark-warmup <frames>  unmeasured frames first, "
+            << FrameBenchmarkOptions().warmupFrames << " by default\n"
+            << "  --benchmark-frames <frames>  measured frames, "
+            << FrameBenchmarkOptions().measuredFrames << " by default\n";
+}
+
+enum class Benchmark {
+  None,
+  Light,
+  LightCpu,
+  Occlusion,
+  OcclusionCpu,
+  OcclusionTest,
+  PrePass,
+  Resolution,
+  Pipelines,
+  Instances,
+  Transforms,
+  PerDraw,
+  Frames
+};
+
+struct SceneOptions {
+  uint32_t instanceCount = 0;  // 0: the model alone
+  bool animateInstances = false;
+  uint32_t headlessFrames = 1;  // drawn by --headless before exiting
+  uint32_t gpuTimingLogInterval = 0;  // frames, 0: no GPU timing log
+};
+
+static VkBackendSettings parseArguments(int argc, char **argv,
+                                        Benchmark &benchmark,
+                                        SceneOptions &sceneOptions,
+                                        FrameBenchmarkOptions &frameOptions) {
+  VkBackendSettings settings;
+  for (int i = 1; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+    if (std::strcmp(argv[i], "--present-mode") == 0 && hasValue) {
+      if (!parsePresentMode(argv[++i], settings.presentMode)) {
+        throw std::runtime_error(std::string("unknown present mode: ") +
+                                 argv[i]);
+      }
+    } else if (std::strcmp(argv[i], "--swapchain-images") == 0 && hasValue) {
+      settings.swapChainImageCount =
+          static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (std::strcmp(argv[i], "--frames-in-flight") == 0 && hasValue) {
+      settings.framesInFlight =
+          static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (std::strcmp(argv[i], "--gbuffer") == 0 && hasValue) {
+      std::string layout = argv[++i];
+      if (layout == "full") {
+        settings.gBufferLayout = GBufferLayout::Full;
+      } else if (layout == "compact") {
+        settings.gBufferLayout = GBufferLayout::Compact;
+      } else {
+        throw std::runtime_error("unknown G-buffer layout: " + layout);
+      }
+    } else if (std::strcmp(argv[i], "--lighting") == 0 && hasValue) {
+      std::string mode = argv[++i];
+      if (mode == "full") {
+        settings.lightingMode = LightingMode::FullScreen;
+      } else if (mode == "clustered") {
+        settings.lightingMode = LightingMode::Clustered;
+      } else if (mode == "volumes") {
+        settings.lightingMode = LightingMode::Volumes;
+      } else {
+        throw std::runtime_error("unknown lighting mode: " + mode);
+      }
+    } else if (std::strcmp(argv[i], "--lights") == 0 && hasValue) {
+      settings.lightCount =
+          static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (std::strcmp(argv[i], "--culling") == 0 && hasValue) {
+      std::string mode = argv[++i];
+      if (mode == "none") {
+        settings.cullingMode = CullingMode::None;
+      } else if (mode == "cpu") {
+        settings.cullingMode = CullingMode::Cpu;
+      } else if (mode == "cpu-occlusion") {
+        settings.cullingMode = CullingMode::CpuOcclusion;
+      } else if (mode == "gpu") {
+        settings.cullingMode = CullingMode::Gpu;
+      } else if (mode == "gpu-occlusion") {
+        settings.cullingMode = CullingMode::GpuOcclusion;
+      } else {
+        throw std::runtime_error("unknown culling mode: " + mode);
+      }
+    } else if (std::strcmp(argv[i], "--depth-prepass") == 0) {
+      settings.depthPrePass = true;
+    } else if (std::strcmp(argv[i], "--shadows") == 0) {
+      settings.shadows = true;
+    } else if (std::strcmp(argv[i], "--point-shadows") == 0 && hasValue) {
+      settings.pointShadowCount =
+          static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (std::strcmp(argv[i], "--shadow-budget") == 0 && hasValue) {
+      settings.shadowBudget =
+          static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (std::strcmp(argv[i], "--pipeline-cache") == 0 && hasValue) {
+      std::string path = argv[++i];
+      settings.pipelineCachePath = path == "none" ? "" : path;
+    } else if (std::strcmp(argv[i], "--no-normal-mapping") == 0) {
+      settings.normalMapping = false;
+    } else if (std::strcmp(argv[i], "--no-specular") == 0) {
+      settings.specular = false;
+    } else if (std::strcmp(argv[i], "--specialize-light-count") == 0) {
+      settings.specializeLightCount = true;
+    } else if (std::strcmp(argv[i], "--serial-pipelines") == 0) {
+      settings.parallelPipelineCreation = false;
+    } else if (std::strcmp(argv[i], "--dynamic-resolution") == 0 &&
+               hasValue) {
+      settings.dynamicResolution = true;
+      settings.targetFrameTime = std::strtof(argv[++i], nullptr);
+    } else if (std::strcmp(argv[i], "--instances") == 0 && hasValue) {
+      sceneOptions.instanceCount =
+          static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (std::strcmp(argv[i], "--no-instancing") == 0) {
+      settings.instancing = false;
+    } else if (std::strcmp(argv[i], "--no-merged-draws") == 0) {
+      settings.mergedDraws = false;
+    } else if (std::strcmp(argv[i], "--per-draw") == 0 && hasValue) {
+      std::string path = argv[++i];
+      if (path == "slots") {
+        settings.perDrawData = PerDrawData::InstanceSlots;
+      } else if (path == "push") {
+        settings.perDrawData = PerDrawData::PushConstants;
+      } else if (path == "uniform") {
+        settings.perDrawData = PerDrawData::DynamicUniform;
+      } else {
+        throw std::runtime_error("unknown per-draw data path: " + path);
+      }
+    } else if (std::strcmp(argv[i], "--animate-instances") == 0) {
+      sceneOptions.animateInstances = true;
+    } else if (std::strcmp(argv[i], "--headless") == 0 && hasValue) {
+      settings.headless = true;
+      sceneOptions.headlessFrames =
+          static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (std::strcmp(argv[i], "--headless-extent") == 0 && hasValue) {
+      std::string extent = argv[++i];
+      size_t separator = extent.find('x');
+      if (separator == std::string::npos) {
+        throw std::runtime_error("invalid headless extent: " + extent);
+      }
+      settings.headlessExtent.width = static_cast<uint32_t>(
+          std::strtoul(extent.substr(0, separator).c_str(), nullptr, 10));
+      settings.headlessExtent.height = static_cast<uint32_t>(
+          std::strtoul(extent.substr(separator + 1).c_str(), nullptr, 10));
+      if (settings.headlessExtent.width == 0 ||
+          settings.headlessExtent.height == 0) {
+        throw std::runtime_error("invalid headless extent: " + extent);
+      }
+    } else if (std::strcmp(argv[i], "--gpu-timing-log") == 0 && hasValue) {
+      sceneOptions.gpuTimingLogInterval =
+          static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (std::strcmp(argv[i], "--readback") == 0 && hasValue) {
+      settings.readbackDirectory = argv[++i];
+    } else if (std::strcmp(argv[i], "--readback-interval") == 0 &&
+               hasValue) {
+      settings.readbackInterval =
+          static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (std::strcmp(argv[i], "--light-benchmark") == 0) {
+      benchmark = Benchmark::Light;
+    } else if (std::strcmp(argv[i], "--light-cpu-benchmark") == 0) {
+      benchmark = Benchmark::LightCpu;
+    } else if (std::strcmp(argv[i], "--occlusion-benchmark") == 0) {
+      benchmark = Benchmark::Occlusion;
+    } else if (std::strcmp(argv[i], "--occlusion-cpu-benchmark") == 0) {
+      benchmark = Benchmark::OcclusionCpu;
+    } else if (std::strcmp(argv[i], "--occlusion-test") == 0) {
+      benchmark = Benchmark::OcclusionTest;
+    } else if (std::strcmp(argv[i], "--prepass-benchmark") == 0) {
+      benchmark = Benchmark::PrePass;
+    } else if (std::strcmp(argv[i], "--resolution-benchmark") == 0) {
+      benchmark = Benchmark::Resolution;
+    } else if (std::strcmp(argv[i], "--pipeline-benchmark") == 0) {
+      benchmark = Benchmark::Pipelines;
+    } else if (std::strcmp(argv[i], "--instance-benchmark") == 0) {
+      benchmark = Benchmark::Instances;
+    } else if (std::strcmp(argv[i], "--transform-benchmark") == 0) {
+      benchmark = Benchmark::Transforms;
+    } else if (std::strcmp(argv[i], "--per-draw-benchmark") == 0) {
+      benchmark = Benchmark::PerDraw;
+    } else if (std::strcmp(argv[i], "--frame-benchmark") == 0 && hasValue) {
+      benchmark = Benchmark::Frames;
+      frameOptions.jsonPath = argv[++i];
+    } else if (std::strcmp(argv[i], "--benchmark-warmup") == 0 && hasValue) {
+      frameOptions.warmupFrames =
+          static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (std::strcmp(argv[i], "--benchmark-frames") == 0 && hasValue) {
+      frameOptions.measuredFrames = std::max(
+          static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10)), 1u);
+    } else {
+      printUsage(argv[0]);
+      std::exit(std::strcmp(argv[i], "--help") == 0 ? 0 : 1);
+    }
+  }
+  return settings;
+}
+
+static void onWindowResized(GLFWwindow* window, int width, int height) {
+  if (width == 0 || height == 0) return;
+
+  GraphicsBackend* backend =
+      reinterpret_cast<GraphicsBackend*>(glfwGetWindowUserPointer(window));
+  backend->onResize();
+}
+
+static void onKey(GLFWwindow* window, int key, int scancode, int action,
+                  int mods) {
+  if (action != GLFW_PRESS) return;
+
+  VkBackend* backend =
+      reinterpret_cast<VkBackend*>(glfwGetWindowUserPointer(window));
+  if (key == GLFW_KEY_G) {
+    // A/B the G-buffer layouts on the same frame
+    backend->setGBufferLayout(
+        backend->getGBufferLayout() == GBufferLayout::Full
+            ? GBufferLayout::Compact
+            : GBufferLayout::Full);
+  } else if (key == GLFW_KEY_F) {
+    CullingMode mode = backend->getCullingMode();
+    if (mode == CullingMode::None) {
+      backend->setCullingMode(CullingMode::Cpu);
+    } else if (mode == CullingMode::Cpu) {
+      backend->setCullingMode(CullingMode::CpuOcclusion);
+    } else if (mode == CullingMode::CpuOcclusion &&
+               backend->getGpuCullingSupported()) {
+      backend->setCullingMode(CullingMode::Gpu);
+    } else if (mode == CullingMode::Gpu) {
+      backend->setCullingMode(CullingMode::GpuOcclusion);
+    } else {
+      backend->setCullingMode(CullingMode::None);
+    }
+  } else if (key == GLFW_KEY_Z) {
+    backend->setDepthPrePass(!backend->getDepthPrePass());
+  } else if (key == GLFW_KEY_H) {
+    backend->setShadows(!backend->getShadows());
+  } else if (key == GLFW_KEY_R) {
+    backend->setDynamicResolution(!backend->getDynamicResolution());
+  } else if (key == GLFW_KEY_N) {
+    backend->setNormalMapping(!backend->getNormalMapping());
+  } else if (key == GLFW_KEY_S) {
+    backend->setSpecular(!backend->getSpecular());
+  } else if (key == GLFW_KEY_I) {
+    backend->setInstancing(!backend->getInstancing());
+  } else if (key == GLFW_KEY_M) {
+    backend->setMergedDraws(!backend->getMergedDraws());
+  } else if (key == GLFW_KEY_C) {
+    LightingMode mode = backend->getLightingMode();
+    if (mode == LightingMode::FullScreen) {
+      backend->setLightingMode(LightingMode::Clustered);
+    } else if (mode == LightingMode::Clustered) {
+      backend->setLightingMode(LightingMode::Volumes);
+    } else {
+      backend->setLightingMode(LightingMode::FullScreen);
+    }
+  }
+}
+
+static const char *lightingModeName(LightingMode mode) {
+  switch (mode) {
+    case LightingMode::FullScreen:
+      return "full";
+    case LightingMode::Clustered:
+      return "clustered";
+    case LightingMode::Volumes:
+      return "volumes";
+  }
+  return "unknown";
+}
+
+// Frame time of the lighting modes while scaling the light count. Runs
+// unthrottled so the numbers are not clamped to the display refresh rate.
+static void runLightBenchmark(GLFWwindow *window, VkBackend &backend) {
+  const uint32_t lightCounts[] = {6, 64, 256, 1024, 4096, 10000};
+  const LightingMode modes[] = {LightingMode::FullScreen,
+                                LightingMode::Clustered,
+                                LightingMode::Volumes};
+  const int warmupFrames = 60;
+  const int measuredFrames = 300;
+
+  backend.setPresentMode(VK_PRESENT_MODE_IMMEDIATE_KHR);
+  std::cout << std::setw(8) << "lights" << std::setw(12) << "mode"
+            << std::setw(12) << "avg ms" << std::setw(12) << "p95 ms"
+            << std::setw(12) << "max ms" << std::endl;
+  for (uint32_t lightCount : lightCounts) {
+    backend.setLightCount(lightCount);
+    for (LightingMode mode : modes) {
+      backend.setLightingMode(mode);
+      RollingStats frameTimes(measuredFrames);
+      for (int frame = 0; frame < warmupFrames + measuredFrames; frame++) {
+        if (glfwWindowShouldClose(window)) return;
+        auto start = std::chrono::high_resolution_clock::now();
+        glfwPollEvents();
+        backend.update();
+        backend.drawFrame();
+        auto end = std::chrono::high_resolution_clock::now();
+        if (frame >= warmupFrames) {
+          frameTimes.push(
+              std::chrono::duration<double, std::milli>(end - start).count());
+        }
+      }
+      std::cout << std::fixed << std::setprecision(3) << std::setw(8)
+                << lightCount << std::setw(12)
+                << lightingModeName(mode)
+                << std::setw(12) << frameTimes.average() << std::setw(12)
+                << frameTimes.percentile(95.0) << std::setw(12)
+                << frameTimes.max() << std::endl;
+    }
+  }
+}
+
+// Culled draws and triangles and G-pass GPU time of the culling modes over
+// one turn of the model, 1 degree per frame, so every mode sees the same
+// views. GPU modes report the previous frame's statistics, which the fixed
+// path makes comparable.
+static void runOcclusionBenchmark(GLFWwindow *window, VkBackend &backend) {
+  const CullingMode modes[] = {CullingMode::Cpu, CullingMode::CpuOcclusion,
+                               CullingMode::Gpu, CullingMode::GpuOcclusion};
+  const int warmupFrames = 30;
+  const int measuredFrames = 360;
+
+  backend.setPresentMode(VK_PRESENT_MODE_IMMEDIATE_KHR);
+  std::cout << std::setw(15) << "mode" << std::setw(10) << "draws"
+            << std::setw(12) << "triangles" << std::setw(10) << "culled"
+            << std::setw(12) << "culled tri" << std::setw(10) << "occluded"
+            << std::setw(10) << "phase 2" << std::setw(12) << "gpass ms"
+            << std::setw(12) << "gpass p95" << std::setw(10) << "saved"
+            << std::endl;
+  double baselineTime = 0.0;
+  for (CullingMode mode : modes) {
+    backend.setCullingMode(mode);
+    if (backend.getCullingMode() != mode) continue;  // GPU modes unsupported
+    RollingStats gPassTimes(measuredFrames);
+    double draws = 0.0, triangles = 0.0, occluded = 0.0, secondPhase = 0.0;
+    uint32_t totalDraws = 0, totalTriangles = 0;
+    for (int frame = 0; frame < warmupFrames + measuredFrames; frame++) {
+      if (glfwWindowShouldClose(window)) return;
+      int step = std::max(frame - warmupFrames, 0);
+      backend.setAnimationTime(static_cast<float>(step) * 0.1f);
+      glfwPollEvents();
+      backend.update();
+      backend.drawFrame();
+      if (frame < warmupFrames) continue;
+      const CullingStats &stats = backend.getCullingStats();
+      draws += stats.visibleDraws;
+      triangles += stats.visibleTriangles;
+      occluded += stats.frustumDraws - stats.visibleDraws;
+      secondPhase += stats.secondPhaseDraws;
+      totalDraws = stats.totalDraws;
+      totalTriangles = stats.totalTriangles;
+      const RollingStats &gPassTime = backend.getGpuTime(GpuScope::GPass);
+      if (gPassTime.count() > 0) gPassTimes.push(gPassTime.last());
+    }
+    draws /= measuredFrames;
+    triangles /= measuredFrames;
+    std::cout << std::fixed << std::setprecision(1) << std::setw(15)
+              << cullingModeName(mode) << std::setw(10) << draws
+              << std::setw(12) << triangles << std::setw(10)
+              << totalDraws - draws << std::setw(12)
+              << totalTriangles - triangles << std::setw(10)
+              << occluded / measuredFrames << std::setw(10)
+              << secondPhase / measuredFrames << std::setprecision(3);
+    if (gPassTimes.count() == 0) {
+      std::cout << std::setw(12) << "n/a" << std::setw(12) << "n/a"
+                << std::setw(10) << "n/a" << std::endl;
+      continue;
+    }
+    if (mode == CullingMode::Cpu) baselineTime = gPassTimes.average();
+    std::cout << std::setw(12) << gPassTimes.average() << std::setw(12)
+              << gPassTimes.percentile(95.0) << std::setw(10)
+              << baselineTime - gPassTimes.average() << std::endl;
+  }
+  backend.setAnimationTime(-1.0f);
+}
+
+// G-pass fragment shader invocations and GPU time without and with the
+// depth pre-pass, over the camera path of --occlusion-benchmark. The pre-pass
+// pays for itself when the G-pass time it saves exceeds its own.
+static void runPrePassBenchmark(GLFWwindow *window, VkBackend &backend) {
+  const int warmupFrames = 30;
+  const int measuredFrames = 360;
+
+  backend.setPresentMode(VK_PRESENT_MODE_IMMEDIATE_KHR);
+  std::cout << std::setw(10) << "pre-pass" << std::setw(14) << "gpass frags"
+            << std::setw(14) << "overdraw" << std::setw(12) << "pre ms"
+            << std::setw(12) << "gpass ms" << std::setw(12) << "total ms"
+            << std::endl;
+  const uint32_t pixels = backend.getSwapChainExtent().width *
+                          backend.getSwapChainExtent().height;
+  for (bool prePass : {false, true}) {
+    backend.setDepthPrePass(prePass);
+    RollingStats fragments(measuredFrames);
+    RollingStats prePassTimes(measuredFrames);
+    RollingStats gPassTimes(measuredFrames);
+    for (int frame = 0; frame < warmupFrames + measuredFrames; frame++) {
+      if (glfwWindowShouldClose(window)) return;
+      int step = std::max(frame - warmupFrames, 0);
+      backend.setAnimationTime(static_cast<float>(step) * 0.1f);
+      glfwPollEvents();
+      backend.update();
+      backend.drawFrame();
+      if (frame < warmupFrames) continue;
+      const RollingStats &frameFragments = backend.getGpuStatistic(
+          GpuScope::GPass,
+          VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT);
+      if (frameFragments.count() > 0) {
+        fragments.push(frameFragments.last());
+      }
+      const RollingStats &prePassTime =
+          backend.getGpuTime(GpuScope::DepthPrePass);
+      if (prePass && prePassTime.count() > 0) {
+        prePassTimes.push(prePassTime.last());
+      }
+      const RollingStats &gPassTime = backend.getGpuTime(GpuScope::GPass);
+      if (gPassTime.count() > 0) gPassTimes.push(gPassTime.last());
+    }
+    std::cout << std::setw(10) << (prePass ? "on" : "off");
+    if (fragments.count() > 0) {
+      std::cout << std::fixed << std::setprecision(0) << std::setw(14)
+                << fragments.average() << std::setprecision(2)
+                << std::setw(14) << fragments.average() / pixels;
+    } else {
+      std::cout << std::setw(14) << "n/a" << std::setw(14) << "n/a";
+    }
+    if (gPassTimes.count() > 0) {
+      double prePassAverage = prePass ? prePassTimes.average() : 0.0;
+      std::cout << std::fixed << std::setprecision(3) << std::setw(12)
+                << prePassAverage << std::setw(12) << gPassTimes.average()
+                << std::setw(12) << prePassAverage + gPassTimes.average();
+    } else {
+      std::cout << std::setw(12) << "n/a" << std::setw(12) << "n/a"
+                << std::setw(12) << "n/a";
+    }
+    std::cout << std::endl;
+  }
+  backend.setAnimationTime(-1.0f);
+}
+
+// Dynamic resolution holding the target GPU frame time (--dynamic-resolution,
+// 16 ms by default) through three phases: the scene lights, a spike of
+// full-screen lighting over thousands of lights, and the scene lights again.
+// Per phase, the GPU time against the target, the scale range and the
+// direction changes of the scale, which count oscillations; then the
+// controller history averaged over windows of frames.
+static void runResolutionBenchmark(GLFWwindow *window, VkBackend &backend) {
+  struct Phase {
+    const char *name;
+    uint32_t lightCount;
+    LightingMode mode;
+  };
+  const uint32_t sceneLights = backend.getLightCount();
+  const LightingMode sceneMode = backend.getLightingMode();
+  const Phase phases[] = {{"steady", sceneLights, sceneMode},
+                          {"spike", 4096, LightingMode::FullScreen},
+                          {"recovery", sceneLights, sceneMode}};
+  const int frames = 150;  // per phase, all of them fit in the history
+  const size_t windowSize = 15;
+
+  backend.setPresentMode(VK_PRESENT_MODE_IMMEDIATE_KHR);
+  // Starts from the largest scale with an empty history
+  backend.setDynamicResolution(true);
+  const double target = backend.getTargetFrameTime();
+  std::cout << std::setw(10) << "phase" << std::setw(8) << "lights"
+            << std::setw(10) << "gpu ms" << std::setw(10) << "gpu p95"
+            << std::setw(8) << "over" << std::setw(11) << "scale min"
+            << std::setw(11) << "scale avg" << std::setw(11) << "scale max"
+            << std::setw(11) << "reversals" << std::endl;
+  for (const Phase &phase : phases) {
+    backend.setLightCount(phase.lightCount);
+    if (backend.getLightingMode() != phase.mode) {
+      backend.setLightingMode(phase.mode);
+    }
+    const size_t first = backend.getResolutionHistory().size();
+    for (int frame = 0; frame < frames; frame++) {
+      if (glfwWindowShouldClose(window)) return;
+      glfwPollEvents();
+      backend.update();
+      backend.drawFrame();
+    }
+    const std::deque<ResolutionSample> &history =
+        backend.getResolutionHistory();
+    RollingStats gpuTimes(frames);
+    RollingStats scales(frames);
+    uint32_t over = 0, reversals = 0;
+    float previousStep = 0.0f;
+    for (size_t i = first; i < history.size(); i++) {
+      gpuTimes.push(history[i].gpuTime);
+      scales.push(history[i].scale);
+      if (history[i].gpuTime > target) over++;
+      float step = i > first ? history[i].scale - history[i - 1].scale : 0.0f;
+      if (step != 0.0f) {
+        if (step * previousStep < 0.0f) reversals++;
+        previousStep = step;
+      }
+    }
+    std::cout << std::fixed << std::setprecision(3) << std::setw(10)
+              << phase.name << std::setw(8) << phase.lightCount
+              << std::setw(10) << gpuTimes.average() << std::setw(10)
+              << gpuTimes.percentile(95.0) << std::setw(8) << over
+              << std::setw(11) << scales.min() << std::setw(11)
+              << scales.average() << std::setw(11) << scales.max()
+              << std::setw(11) << reversals << std::endl;
+  }
+
+  const std::deque<ResolutionSample> &history = backend.getResolutionHistory();
+  std::cout << "target " << target << " ms, history per " << windowSize
+            << " frames:\n"
+            << std::setw(8) << "frame" << std::setw(10) << "scale"
+            << std::setw(10) << "gpu ms" << std::endl;
+  for (size_t begin = 0; begin < history.size(); begin += windowSize) {
+    size_t end = std::min(begin + windowSize, history.size());
+    double scale = 0.0, gpuTime = 0.0;
+    for (size_t i = begin; i < end; i++) {
+      scale += history[i].scale;
+      gpuTime += history[i].gpuTime;
+    }
+    std::cout << std::setw(8) << begin << std::setw(10)
+              << scale / (end - begin) << std::setw(10)
+              << gpuTime / (end - begin) << std::endl;
+  }
+}
+
+// Software occlusion buffer alone, over the same camera path as
+// --occlusion-benchmark: occluder rasterization and box test times per
+// worker thread count, and the draws hidden among the frustum-visible ones.
+// Needs no window or device.
+static void runOcclusionCpuBenchmark(const Model &model) {
+  const uint32_t triangleBudget = VkBackendSettings().occluderTriangleBudget;
+  const uint32_t hardwareThreads =
+      std::max(std::thread::hardware_concurrency(), 1u);
+  const uint32_t threadCounts[] = {1, 2, 4, hardwareThreads};
+  const int frames = 360;
+
+  CullingBoxes bounds;
+  std::vector<AABB> boxes;
+  for (const auto &mesh : model.meshes) {
+    for (const auto &subMesh : mesh.subMeshes) {
+      bounds.add(subMesh.bounds);
+      boxes.push_back(subMesh.bounds);
+    }
+  }
+  OcclusionCuller culler;
+  culler.selectOccluders(model, triangleBudget);
+  std::cout << "occluders: " << culler.occluderTriangleCount()
+            << " triangles, buffer " << culler.width() << "x"
+            << culler.height() << ", draws " << boxes.size() << std::endl;
+
+  // Camera of VkBackend::update() at 1280x720
+  glm::mat4 view =
+      glm::lookAt(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(1.0f, 2.0f, 0.0f),
+                  glm::vec3(0.0f, 1.0f, 0.0f));
+  glm::mat4 proj =
+      glm::perspective(glm::radians(45.0f), 1280.0f / 720.0f, 0.1f, 100.0f);
+  proj[1][1] *= -1;
+
+  std::cout << std::setw(10) << "threads" << std::setw(12) << "raster ms"
+            << std::setw(12) << "raster p95" << std::setw(12) << "test ms"
+            << std::setw(12) << "frustum" << std::setw(12) << "occluded"
+            << std::endl;
+  for (uint32_t threadCount : threadCounts) {
+    ThreadPool pool(threadCount);
+    RollingStats rasterTimes(frames);
+    RollingStats testTimes(frames);
+    double frustumDraws = 0.0, occludedDraws = 0.0;
+    std::vector<uint32_t> visible;
+    for (int frame = 0; frame < frames; frame++) {
+      glm::mat4 modelMatrix =
+          glm::rotate(glm::mat4(), frame * 0.1f * glm::radians(10.0f),
+                      glm::vec3(0.0f, 1.0f, 0.0f));
+      glm::mat4 modelViewProj = proj * view * modelMatrix;
+      visible.clear();
+      bounds.cull(extractFrustum(modelViewProj), visible);
+
+      auto start = std::chrono::high_resolution_clock::now();
+      culler.render(modelViewProj, pool);
+      auto rendered = std::chrono::high_resolution_clock::now();
+      uint32_t occluded = 0;
+      for (uint32_t drawId : visible) {
+        if (!culler.isVisible(boxes[drawId])) occluded++;
+      }
+      auto tested = std::chrono::high_resolution_clock::now();
+      rasterTimes.push(
+          std::chrono::duration<double, std::milli>(rendered - start).count());
+      testTimes.push(
+          std::chrono::duration<double, std::milli>(tested - rendered)
+              .count());
+      frustumDraws += visible.size();
+      occludedDraws += occluded;
+    }
+    std::cout << std::fixed << std::setprecision(3) << std::setw(10)
+              << pool.size() << std::setw(12) << rasterTimes.average()
+              << std::setw(12) << rasterTimes.percentile(95.0)
+              << std::setw(12) << testTimes.average() << std::setprecision(1)
+              << std::setw(12) << frustumDraws / frames << std::setw(12)
+              << occludedDraws / frames << std::endl;
+  }
+}
+
+static AABB occlusionTestBox(const glm::vec3 &min, const glm::vec3 &max) {
+  AABB box;
+  box.min = min;
+  box.max = max;
+  return box;
+}
+
+// Quad as two triangles, corners given in order around it
+static void addOcclusionTestQuad(OcclusionCuller &culler, const glm::vec3 &a,
+                                 const glm::vec3 &b, const glm::vec3 &c,
+                                 const glm::vec3 &d) {
+  const glm::vec3 corners[6] = {a, b, c, a, c, d};
+  Vertex vertices[6];
+  for (int i = 0; i < 6; i++) vertices[i].pos = corners[i];
+  culler.addOccluder(vertices, 6);
+}
+
+// Pass/fail checks of the software occlusion buffer on hand-placed quads,
+// on one worker thread and on several so that the band split is exercised.
+// Needs no window or device, returns the number of failures.
+static int runOcclusionTest() {
+  // Camera at the origin looking down -z, 90 degrees vertically. At z = -10
+  // the screen spans x in [-17.8, 17.8] and y in [-10, 10].
+  OcclusionCuller culler;
+  glm::mat4 proj = glm::perspective(
+      glm::radians(90.0f),
+      static_cast<float>(culler.width()) / culler.height(), 0.1f, 100.0f);
+  proj[1][1] *= -1;
+
+  const AABB behind = occlusionTestBox(glm::vec3(-0.5f, -0.5f, -11.0f),
+                                       glm::vec3(0.5f, 0.5f, -10.0f));
+  const AABB inFront = occlusionTestBox(glm::vec3(-0.5f, -0.5f, -4.0f),
+                                        glm::vec3(0.5f, 0.5f, -3.0f));
+  const AABB partlyOutside = occlusionTestBox(glm::vec3(3.0f, -0.5f, -11.0f),
+                                              glm::vec3(5.0f, 0.5f, -10.0f));
+  const AABB nearPlane = occlusionTestBox(glm::vec3(-0.5f, -0.5f, -0.5f),
+                                          glm::vec3(0.5f, 0.5f, 0.5f));
+  const AABB behindCamera = occlusionTestBox(glm::vec3(-0.5f, -0.5f, 10.0f),
+                                             glm::vec3(0.5f, 0.5f, 11.0f));
+  const AABB screenEdge = occlusionTestBox(glm::vec3(15.0f, -1.0f, -11.0f),
+                                           glm::vec3(25.0f, 1.0f, -10.0f));
+  const AABB offScreen = occlusionTestBox(glm::vec3(30.0f, -1.0f, -11.0f),
+                                          glm::vec3(40.0f, 1.0f, -10.0f));
+
+  int failures = 0;
+  auto check = [&failures](const char *name, bool visible, bool expected) {
+    bool passed = visible == expected;
+    std::cout << "  " << std::left << std::setw(44) << name << std::right
+              << std::setw(8) << (expected ? "visible" : "hidden")
+              << (passed ? "  passed" : "  FAILED") << std::endl;
+    if (!passed) failures++;
+  };
+
+  const uint32_t threadCounts[] = {1, 4};
+  for (uint32_t threadCount : threadCounts) {
+    ThreadPool pool(threadCount);
+    std::cout << "threads " << pool.size() << std::endl;
+
+    culler.clearOccluders();
+    culler.render(proj, pool);
+    check("empty buffer", culler.isVisible(behind), true);
+
+    // 4x4 wall at z = -5, its shadow at z = -10 spans [-4, 4]
+    addOcclusionTestQuad(culler, glm::vec3(-2.0f, -2.0f, -5.0f),
+                         glm::vec3(2.0f, -2.0f, -5.0f),
+                         glm::vec3(2.0f, 2.0f, -5.0f),
+                         glm::vec3(-2.0f, 2.0f, -5.0f));
+    culler.render(proj, pool);
+    check("box behind the wall", culler.isVisible(behind), false);
+    check("box in front of the wall", culler.isVisible(inFront), true);
+    check("box partly outside the wall's shadow",
+          culler.isVisible(partlyOutside), true);
+    check("box crossing the near plane", culler.isVisible(nearPlane), true);
+    check("box behind the camera", culler.isVisible(behindCamera), true);
+
+    // The same wall tilted through the near plane hides the box in reality,
+    // but occluders crossing the near plane are dropped, not clipped
+    culler.clearOccluders();
+    addOcclusionTestQuad(culler, glm::vec3(-2.0f, -2.0f, 1.0f),
+                         glm::vec3(2.0f, -2.0f, 1.0f),
+                         glm::vec3(2.0f, 2.0f, -5.0f),
+                         glm::vec3(-2.0f, 2.0f, -5.0f));
+    culler.render(proj, pool);
+    check("box behind a wall crossing the near plane",
+          culler.isVisible(behind), true);
+
+    // Wall much larger than the screen, rasterized up to the screen edges
+    culler.clearOccluders();
+    addOcclusionTestQuad(culler, glm::vec3(-50.0f, -50.0f, -5.0f),
+                         glm::vec3(50.0f, -50.0f, -5.0f),
+                         glm::vec3(50.0f, 50.0f, -5.0f),
+                         glm::vec3(-50.0f, 50.0f, -5.0f));
+    culler.render(proj, pool);
+    check("box behind a screen-wide wall", culler.isVisible(behind), false);
+    check("box across the screen edge", culler.isVisible(screenEdge), false);
+    check("box off the screen", culler.isVisible(offScreen), true);
+    check("box in front of a screen-wide wall", culler.isVisible(inFront),
+          true);
+  }
+  std::cout << (failures == 0 ? "all passed" : "FAILED") << std::endl;
+  return failures;
+}
+
+// Per-frame CPU cost of the light manager at 100k lights: SIMD animation and
+// packing of the dirty range into a buffer standing in for the mapped SSBO.
+// Needs no window or device.
+static void runLightCpuBenchmark() {
+  const uint32_t lightCount = 100000;
+  const int frames = 500;
+  const float animatedFractions[] = {1.0f, 0.1f, 0.01f};
+
+  std::cout << std::setw(10) << "animated" << std::setw(14) << "animate ms"
+            << std::setw(14) << "pack ms" << std::setw(14) << "total p95"
+            << std::setw(14) << "upload KiB" << std::endl;
+  for (float fraction : animatedFractions) {
+    LightManager lights(lightCount);
+    uint32_t animatedCount = static_cast<uint32_t>(lightCount * fraction);
+    for (uint32_t i = 0; i < lightCount; i++) {
+      LightDesc desc;
+      desc.type = i % 4 == 0 ? LightType::Spot : LightType::Point;
+      desc.position = glm::vec3(static_cast<float>(i % 100) * 0.3f - 15.0f,
+                                -2.0f, static_cast<float>(i / 100 % 40) * 0.3f);
+      desc.color = glm::vec3(1.0f, 0.8f, 0.6f);
+      desc.intensity = 0.02f;
+      desc.direction = glm::vec3(0.0f, 1.0f, 0.0f);
+      if (i < animatedCount) {
+        desc.orbitRadius = 1.0f;
+        desc.orbitSpeed = 0.25f;
+        desc.orbitPhase = glm::vec2(static_cast<float>(i) * 0.1f);
+      }
+      lights.add(desc);
+    }
+    std::vector<Light> gpuLights(lights.capacity());
+    lights.pack(0, lights.count(), gpuLights.data());
+    lights.clearDirty();
+
+    RollingStats animateTimes(frames);
+    RollingStats packTimes(frames);
+    RollingStats totalTimes(frames);
+    size_t uploadedBytes = 0;
+    for (int frame = 0; frame < frames; frame++) {
+      auto start = std::chrono::high_resolution_clock::now();
+      lights.animate(frame / 60.0f);
+      auto animated = std::chrono::high_resolution_clock::now();
+      uint32_t begin = lights.dirtyBegin();
+      uint32_t end = lights.dirtyEnd();
+      if (lights.dirty()) lights.pack(begin, end, gpuLights.data() + begin);
+      lights.clearDirty();
+      auto packed = std::chrono::high_resolution_clock::now();
+      animateTimes.push(
+          std::chrono::duration<double, std::milli>(animated - start).count());
+      packTimes.push(
+          std::chrono::duration<double, std::milli>(packed - animated).count());
+      totalTimes.push(
+          std::chrono::duration<double, std::milli>(packed - start).count());
+      uploadedBytes = (end - begin) * sizeof(Light);
+    }
+    std::cout << std::fixed << std::setprecision(3) << std::setw(10)
+              << animatedCount << std::setw(14) << animateTimes.average()
+              << std::setw(14) << packTimes.average() << std::setw(14)
+              << totalTimes.percentile(95.0) << std::setw(14)
+              << uploadedBytes / 1024 << std::endl;
+  }
+}
+
+// Startup pipeline creation from an empty pipeline cache, on the main
+// thread then on the worker pool. Drivers with a shader cache of their own
+// make every run after the first faster than a true cold start.
+static void runPipelineBenchmark(VkBackend &backend) {
+  const int repeats = 5;
+  std::cout << std::setw(10) << "mode" << std::setw(10) << "threads"
+            << std::setw(12) << "min ms" << std::setw(12) << "avg ms"
+            << std::setw(12) << "max ms" << std::endl;
+  double serialAverage = 0.0;
+  for (bool parallel : {false, true}) {
+    RollingStats times(repeats);
+    for (int i = 0; i < repeats; i++) {
+      times.push(backend.recreatePipelines(parallel));
+    }
+    std::cout << std::fixed << std::setprecision(3) << std::setw(10)
+              << (parallel ? "parallel" : "serial") << std::setw(10)
+              << (parallel ? backend.getWorkerThreadCount() : 1)
+              << std::setw(12) << times.min() << std::setw(12)
+              << times.average() << std::setw(12) << times.max()
+              << std::endl;
+    if (!parallel) {
+      serialAverage = times.average();
+    } else if (times.average() > 0.0) {
+      std::cout << "speedup: " << std::setprecision(2)
+                << serialAverage / times.average() << "x, "
+                << backend.getPipelineVariants().size()
+                << " graphics variants" << std::endl;
+    }
+  }
+}
+
+// Draw calls, CPU culling and recording times and frame and G-pass times
+// of the instanced scene with and without instancing, over the camera path
+// of --occlusion-benchmark. Both modes draw the same batches: only the
+// number of vkCmdDrawIndexed calls recorded for them differs.
+static void runInstanceBenchmark(GLFWwindow *window, VkBackend &backend) {
+  const int warmupFrames = 30;
+  const int measuredFrames = 120;
+
+  backend.setPresentMode(VK_PRESENT_MODE_IMMEDIATE_KHR);
+  std::cout << backend.getInstanceCount() << " instances, "
+            << backend.getCullingStats().totalDraws << " draw items, culling "
+            << cullingModeName(backend.getCullingMode()) << std::endl;
+  std::cout << std::setw(12) << "instancing" << std::setw(12) << "visible"
+            << std::setw(12) << "draw calls" << std::setw(12) << "cull ms"
+            << std::setw(12) << "record ms" << std::setw(12) << "frame ms"
+            << std::setw(12) << "gpass ms" << std::endl;
+  for (bool instancing : {false, true}) {
+    backend.setInstancing(instancing);
+    RollingStats frameTimes(measuredFrames);
+    RollingStats cullTimes(measuredFrames);
+    RollingStats recordTimes(measuredFrames);
+    RollingStats gPassTimes(measuredFrames);
+    double visible = 0.0, drawCalls = 0.0;
+    for (int frame = 0; frame < warmupFrames + measuredFrames; frame++) {
+      if (glfwWindowShouldClose(window)) return;
+      int step = std::max(frame - warmupFrames, 0);
+      backend.setAnimationTime(static_cast<float>(step) * 0.1f);
+      auto start = std::chrono::high_resolution_clock::now();
+      glfwPollEvents();
+      backend.update();
+      backend.drawFrame();
+      auto end = std::chrono::high_resolution_clock::now();
+      if (frame < warmupFrames) continue;
+      frameTimes.push(
+          std::chrono::duration<double, std::milli>(end - start).count());
+      visible += backend.getCullingStats().visibleDraws;
+      drawCalls += backend.getBindStats().draws;
+      cullTimes.push(backend.getCullingStats().cullTime.last());
+      recordTimes.push(backend.getBindStats().recordTime.last());
+      const RollingStats &gPassTime = backend.getGpuTime(GpuScope::GPass);
+      if (gPassTime.count() > 0) gPassTimes.push(gPassTime.last());
+    }
+    std::cout << std::fixed << std::setprecision(1) << std::setw(12)
+              << (instancing ? "on" : "off") << std::setw(12)
+              << visible / measuredFrames << std::setw(12)
+              << drawCalls / measuredFrames << std::setprecision(3)
+              << std::setw(12) << cullTimes.average() << std::setw(12)
+              << recordTimes.average() << std::setw(12)
+              << frameTimes.average();
+    if (gPassTimes.count() > 0) {
+      std::cout << std::setw(12) << gPassTimes.average() << std::endl;
+    } else {
+      std::cout << std::setw(12) << "n/a" << std::endl;
+    }
+  }
+  backend.setAnimationTime(-1.0f);
+}
+
+// One draw per instance of every sub-mesh, unculled and recorded on the
+// CPU, with the per-draw data of each path: instance slots bound once,
+// gPassPerDraw pushed before each draw, or a dynamic offset into a uniform
+// buffer of gPassPerDraw records bound before each draw.
+static void runPerDrawBenchmark(GLFWwindow *window, VkBackend &backend) {
+  const int warmupFrames = 30;
+  const int measuredFrames = 120;
+  const CullingMode cullingMode = backend.getCullingMode();
+  const bool instancing = backend.getInstancing();
+  const PerDrawData perDrawData = backend.getPerDrawData();
+
+  backend.setPresentMode(VK_PRESENT_MODE_IMMEDIATE_KHR);
+  backend.setCullingMode(CullingMode::None);
+  backend.setInstancing(false);
+  std::cout << backend.getInstanceCount() << " instances, "
+            << backend.getCullingStats().totalDraws << " draw items"
+            << std::endl;
+  std::cout << std::setw(12) << "per-draw" << std::setw(12) << "draw calls"
+            << std::setw(12) << "updates" << std::setw(12) << "record ms"
+            << std::setw(12) << "frame ms" << std::setw(12) << "gpass ms"
+            << std::endl;
+  for (PerDrawData path :
+       {PerDrawData::InstanceSlots, PerDrawData::PushConstants,
+        PerDrawData::DynamicUniform}) {
+    backend.setPerDrawData(path);
+    RollingStats frameTimes(measuredFrames);
+    RollingStats recordTimes(measuredFrames);
+    RollingStats gPassTimes(measuredFrames);
+    double drawCalls = 0.0, updates = 0.0;
+    for (int frame = 0; frame < warmupFrames + measuredFrames; frame++) {
+      if (glfwWindowShouldClose(window)) return;
+      int step = std::max(frame - warmupFrames, 0);
+      backend.setAnimationTime(static_cast<float>(step) * 0.1f);
+      auto start = std::chrono::high_resolution_clock::now();
+      glfwPollEvents();
+      backend.update();
+      backend.drawFrame();
+      auto end = std::chrono::high_resolution_clock::now();
+      if (frame < warmupFrames) continue;
+      frameTimes.push(
+          std::chrono::duration<double, std::milli>(end - start).count());
+      drawCalls += backend.getBindStats().draws;
+      updates += backend.getBindStats().perDrawUpdates;
+      recordTimes.push(backend.getBindStats().recordTime.last());
+      const RollingStats &gPassTime = backend.getGpuTime(GpuScope::GPass);
+      if (gPassTime.count() > 0) gPassTimes.push(gPassTime.last());
+    }
+    std::cout << std::fixed << std::setprecision(1) << std::setw(12)
+              << perDrawDataName(path) << std::setw(12)
+              << drawCalls / measuredFrames << std::setw(12)
+              << updates / measuredFrames << std::setprecision(3)
+              << std::setw(12) << recordTimes.average() << std::setw(12)
+              << frameTimes.average();
+    if (gPassTimes.count() > 0) {
+      std::cout << std::setw(12) << gPassTimes.average() << std::endl;
+    } else {
+      std::cout << std::setw(12) << "n/a" << std::endl;
+    }
+  }
+  backend.setAnimationTime(-1.0f);
+  backend.setPerDrawData(perDrawData);
+  backend.setInstancing(instancing);
+  backend.setCullingMode(cullingMode);
+}
+
+// World matrix updates of a hierarchy of 16 roots where every node has 16
+// children, 5 levels and 1.1M nodes. Moving the roots recomputes every
+// node, moving 1% of the leaves only those, a static frame only tests the
+// dirty flags.
+static void runTransformBenchmark() {
+  const uint32_t fanOut = 16;
+  const uint32_t levels = 5;
+  const int frames = 100;
+  const uint32_t hardwareThreads =
+      std::max(std::thread::hardware_concurrency(), 1u);
+  const uint32_t threadCounts[] = {1, hardwareThreads};
+
+  TransformHierarchy hierarchy;
+  std::vector<TransformHandle> level, next;
+  for (uint32_t i = 0; i < fanOut; i++) {
+    TransformDesc desc;
+    desc.translation = glm::vec3(static_cast<float>(i), 0.0f, 0.0f);
+    level.push_back(hierarchy.add(INVALID_TRANSFORM_HANDLE, desc));
+  }
+  const std::vector<TransformHandle> roots = level;
+  for (uint32_t depth = 1; depth < levels; depth++) {
+    next.clear();
+    for (TransformHandle parent : level) {
+      for (uint32_t i = 0; i < fanOut; i++) {
+        TransformDesc desc;
+        desc.translation = glm::vec3(static_cast<float>(i) * 0.1f, 0.0f, 0.0f);
+        desc.scale = glm::vec3(0.9f);
+        next.push_back(hierarchy.add(parent, desc));
+      }
+    }
+    level.swap(next);
+  }
+  const std::vector<TransformHandle> &leaves = level;
+  hierarchy.update();
+  std::cout << hierarchy.count() << " nodes, " << hierarchy.levelCount()
+            << " levels" << std::endl;
+
+  struct Case {
+    const char *name;
+    const std::vector<TransformHandle> *nodes;  // null: none moves
+    uint32_t stride;
+  };
+  const Case cases[] = {{"roots", &roots, 1},
+                        {"1% leaves", &leaves, 100},
+                        {"static", nullptr, 1}};
+  std::cout << std::setw(10) << "threads" << std::setw(12) << "moved"
+            << std::setw(12) << "updated" << std::setw(12) << "avg ms"
+            << std::setw(12) << "p95 ms" << std::setw(14) << "Mnodes/s"
+            << std::endl;
+  for (uint32_t threadCount : threadCounts) {
+    ThreadPool pool(threadCount);
+    for (const Case &benchmarkCase : cases) {
+      RollingStats times(frames);
+      uint32_t updated = 0;
+      for (int frame = 0; frame < frames; frame++) {
+        if (benchmarkCase.nodes) {
+          const std::vector<TransformHandle> &nodes = *benchmarkCase.nodes;
+          for (size_t i = 0; i < nodes.size(); i += benchmarkCase.stride) {
+            TransformDesc desc = hierarchy.local(nodes[i]);
+            desc.rotation = glm::angleAxis(static_cast<float>(frame) * 0.01f,
+                                           glm::vec3(0.0f, 1.0f, 0.0f));
+            hierarchy.setLocal(nodes[i], desc);
+          }
+        }
+        auto start = std::chrono::high_resolution_clock::now();
+        hierarchy.update(&pool);
+        auto end = std::chrono::high_resolution_clock::now();
+        times.push(
+            std::chrono::duration<double, std::milli>(end - start).count());
+        updated = hierarchy.updatedCount();
+      }
+      std::cout << std::fixed << std::setprecision(3) << std::setw(10)
+                << threadCount << std::setw(12) << benchmarkCase.name
+                << std::setw(12) << updated << std::setw(12)
+                << times.average() << std::setw(12) << times.percentile(95.0)
+                << std::setw(14)
+                << (times.average() > 0.0
+                        ? updated / times.average() / 1000.0
+                        : 0.0)
+                << std::endl;
+    }
+  }
+}
+
+// Sways every fourth row of the --instances grid about the vertical axis,
+// the instances of the other rows stay where they are
+static void animateInstanceRows(Scene &scene, float time) {
+  for (size_t row = 0; row < scene.groupNodes.size(); row += 4) {
+    TransformDesc desc = scene.transforms.local(scene.groupNodes[row]);
+    desc.rotation =
+        glm::angleAxis(0.1f * std::sin(time + static_cast<float>(row)),
+                       glm::vec3(0.0f, 1.0f, 0.0f));
+    scene.transforms.setLocal(scene.groupNodes[row], desc);
+  }
+}
+
+// Draws --headless frames without a window. The instance rows sway at a
+// fixed 60 steps per second of animation time, whatever the frame rate.
+static void runHeadless(Scene &scene, const SceneOptions &sceneOptions,
+                        VkBackend &backend) {
+  for (uint32_t frame = 0; frame < sceneOptions.headlessFrames; frame++) {
+    if (sceneOptions.animateInstances) {
+      animateInstanceRows(scene, static_cast<float>(frame) / 60.0f);
+    }
+    if (scene.updateTransforms(&backend.getWorkerPool())) {
+      backend.setInstanceTransforms(scene.instances);
+    }
+    backend.update();
+    backend.drawFrame();
+    if (sceneOptions.gpuTimingLogInterval > 0 &&
+        (frame + 1) % sceneOptions.gpuTimingLogInterval == 0) {
+      logGpuTimes(backend, frame + 1);
+    }
+  }
+  std::cout << "headless: " << backend.getHeadlessFrameCount()
+            << " frames drawn" << std::endl;
+}
+
+// "name": {"count": n, "min": ..., "max": ...} in ms, null without samples
+static void writeStatsJson(std::ostream &out, const char *name,
+                           const RollingStats &stats) {
+  out << "  \"" << name << "\": ";
+  if (stats.count() == 0) {
+    out << "null";
+    return;
+  }
+  out << "{\"count\": " << stats.count() << ", \"min\": " << stats.min()
+      << ", \"avg\": " << stats.average()
+      << ", \"p50\": " << stats.percentile(50.0)
+      << ", \"p95\": " << stats.percentile(95.0)
+      << ", \"p99\": " << stats.percentile(99.0)
+      << ", \"max\": " << stats.max() << "}";
+}
+
+// Frame times over a fixed animation: the camera, the lights and the
+// --animate-instances rows move by frame index, 60 steps per second of
+// animation time, so that every run draws the same frames. The warmup
+// frames hold the first one. window null: headless. GPU times are read
+// back getGpuTimingLatency() frames late, those of the last measured frames
+// are of earlier ones.
+static void runFrameBenchmark(GLFWwindow *window, Scene &scene,
+                              const SceneOptions &sceneOptions,
+                              const FrameBenchmarkOptions &options,
+                              VkBackend &backend) {
+  RollingStats cpuTimes(options.measuredFrames);
+  RollingStats gpuTimes(options.measuredFrames);
+  RollingStats presentIntervals(options.measuredFrames);
+  const SwapChainTelemetry &telemetry = backend.getSwapChainTelemetry();
+  const uint32_t frames = options.warmupFrames + options.measuredFrames;
+  for (uint32_t frame = 0; frame < frames; frame++) {
+    if (window && glfwWindowShouldClose(window)) return;
+    const uint32_t step =
+        frame < options.warmupFrames ? 0 : frame - options.warmupFrames;
+    const float time = static_cast<float>(step) / 60.0f;
+    backend.setAnimationTime(time);
+    if (window) glfwPollEvents();
+    if (sceneOptions.animateInstances) animateInstanceRows(scene, time);
+    if (scene.updateTransforms(&backend.getWorkerPool())) {
+      backend.setInstanceTransforms(scene.instances);
+    }
+    backend.update();
+    backend.drawFrame();
+    if (frame < options.warmupFrames) continue;
+    if (telemetry.cpuFrame.count() > 0) {
+      cpuTimes.push(telemetry.cpuFrame.last());
+    }
+    const RollingStats &gpuTime = backend.getGpuTime(GpuScope::Frame);
+    if (gpuTime.count() > 0) gpuTimes.push(gpuTime.last());
+    if (telemetry.presentInterval.count() > 0) {
+      presentIntervals.push(telemetry.presentInterval.last());
+    }
+  }
+  backend.setAnimationTime(-1.0f);
+
+  const VkExtent2D extent = backend.getSwapChainExtent();
+  std::ofstream file(options.jsonPath);
+  if (!file.is_open()) {
+    throw std::runtime_error("failed to open " + options.jsonPath);
+  }
+  file << std::fixed << std::setprecision(4) << "{\n"
+       << "  \"warmup_frames\": " << options.warmupFrames << ",\n"
+       << "  \"measured_frames\": " << options.measuredFrames << ",\n"
+       << "  \"headless\": " << (backend.getHeadless() ? "true" : "false")
+       << ",\n"
+       << "  \"extent\": [" << extent.width << ", " << extent.height
+       << "],\n"
+       << "  \"present_mode\": \"" << presentModeName(backend.getPresentMode())
+       << "\",\n"
+       << "  \"culling\": \"" << cullingModeName(backend.getCullingMode())
+       << "\",\n"
+       << "  \"instances\": " << scene.instanceCount() << ",\n";
+  writeStatsJson(file, "cpu_frame_ms", cpuTimes);
+  file << ",\n";
+  writeStatsJson(file, "gpu_frame_ms", gpuTimes);
+  file << ",\n";
+  writeStatsJson(file, "present_interval_ms", presentIntervals);
+  file << "\n}\n";
+
+  std::cout << std::setw(20) << "ms" << std::setw(10) << "min"
+            << std::setw(10) << "avg" << std::setw(10) << "p50"
+            << std::setw(10) << "p95" << std::setw(10) << "p99"
+            << std::setw(10) << "max" << std::endl;
+  const std::pair<const char *, const RollingStats *> rows[] = {
+      {"cpu frame", &cpuTimes},
+      {"gpu frame", &gpuTimes},
+      {"present interval", &presentIntervals}};
+  for (const auto &row : rows) {
+    const RollingStats &stats = *row.second;
+    std::cout << std::setw(20) << row.first << std::fixed
+              << std::setprecision(3);
+    if (stats.count() == 0) {
+      std::cout << std::setw(10) << "n/a" << std::endl;
+      continue;
+    }
+    std::cout << std::setw(10) << stats.min() << std::setw(10)
+              << stats.average() << std::setw(10) << stats.percentile(50.0)
+              << std::setw(10) << stats.percentile(95.0) << std::setw(10)
+              << stats.percentile(99.0) << std::setw(10) << stats.max()
+              << std::endl;
+  }
+  std::cout << "written to " << options.jsonPath << std::endl;
+}
+
+int main(int argc, char **argv) {
+  Benchmark benchmark = Benchmark::None;
+  SceneOptions sceneOptions;
+  FrameBenchmarkOptions frameOptions;
+  VkBackendSettings settings =
+      parseArguments(argc, argv, benchmark, sceneOptions, frameOptions);
+  if (benchmark == Benchmark::LightCpu) {
+    runLightCpuBenchmark();
+    return 0;
+  }
+  if (benchmark == Benchmark::Transforms) {
+    runTransformBenchmark();
+    return 0;
+  }
+  if (benchmark == Benchmark::OcclusionTest) {
+    return runOcclusionTest() == 0 ? 0 : 1;
+  }
+  if (benchmark == Benchmark::OcclusionCpu) {
+    Model model;
+    model.load("models/sponza/sponza.obj");
+    runOcclusionCpuBenchmark(model);
+    return 0;
+  }
+
+  if (settings.headless && benchmark != Benchmark::None &&
+      benchmark != Benchmark::Pipelines && benchmark != Benchmark::Frames) {
+    throw std::runtime_error("this benchmark needs a window, not --headless");
+  }
+
+  GLFWwindow *window = nullptr;
+  if (!settings.headless) {
+    glfwInit();
+
+    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+    window = glfwCreateWindow(1280, 720, "Vulkan Deferred renderer", nullptr,
+                              nullptr);
+  }
+
+  Scene scene;
+  scene.model.load("models/sponza/sponza.obj");
+  if (benchmark == Benchmark::Instances && sceneOptions.instanceCount == 0) {
+    sceneOptions.instanceCount = DEFAULT_BENCHMARK_INSTANCES;
+  }
+  if (benchmark == Benchmark::PerDraw && sceneOptions.instanceCount == 0) {
+    size_t subMeshes = 0;
+    for (const auto &mesh : scene.model.meshes) {
+      subMeshes += mesh.subMeshes.size();
+    }
+    sceneOptions.instanceCount = static_cast<uint32_t>(
+        (PER_DRAW_BENCHMARK_DRAWS + subMeshes - 1) /
+        std::max<size_t>(subMeshes, 1));
+  }
+  if (sceneOptions.instanceCount > 0) {
+    scene.addGrid(sceneOptions.instanceCount);
+  } else {
+    scene.addInstance(glm::mat4());
+  }
+
+  VkBackend vulkanBackend(settings);
+  vulkanBackend.init(window, scene);
+  if (window) {
+    glfwSetWindowUserPointer(window, &vulkanBackend);
+    glfwSetWindowSizeCallback(window, onWindowResized);
+    glfwSetKeyCallback(window, onKey);
+  }
+  if (settings.headless) {
+    if (benchmark == Benchmark::Pipelines) {
+      runPipelineBenchmark(vulkanBackend);
+    } else if (benchmark == Benchmark::Frames) {
+      runFrameBenchmark(nullptr, scene, sceneOptions, frameOptions,
+                        vulkanBackend);
+    } else {
+      runHeadless(scene, sceneOptions, vulkanBackend);
+    }
+  } else if (benchmark == Benchmark::Light) {
+    runLightBenchmark(window, vulkanBackend);
+    glfwSetWindowShouldClose(window, GLFW_TRUE);
+  } else if (benchmark == Benchmark::Occlusion) {
+    runOcclusionBenchmark(window, vulkanBackend);
+    glfwSetWindowShouldClose(window, GLFW_TRUE);
+  } else if (benchmark == Benchmark::PrePass) {
+    runPrePassBenchmark(window, vulkanBackend);
+    glfwSetWindowShouldClose(window, GLFW_TRUE);
+  } else if (benchmark == Benchmark::Resolution) {
+    runResolutionBenchmark(window, vulkanBackend);
+    glfwSetWindowShouldClose(window, GLFW_TRUE);
+  } else if (benchmark == Benchmark::Pipelines) {
+    runPipelineBenchmark(vulkanBackend);
+    glfwSetWindowShouldClose(window, GLFW_TRUE);
+  } else if (benchmark == Benchmark::Instances) {
+    runInstanceBenchmark(window, vulkanBackend);
+    glfwSetWindowShouldClose(window, GLFW_TRUE);
+  } else if (benchmark == Benchmark::PerDraw) {
+    runPerDrawBenchmark(window, vulkanBackend);
+    glfwSetWindowShouldClose(window, GLFW_TRUE);
+  } else if (benchmark == Benchmark::Frames) {
+    runFrameBenchmark(window, scene, sceneOptions, frameOptions,
+                      vulkanBackend);
+    glfwSetWindowShouldClose(window, GLFW_TRUE);
+  }
+  uint32_t frame = 0;
+  while (window && !glfwWindowShouldClose(window)) {
+    updateFpsCounter(window, vulkanBackend);
+    glfwPollEvents();
+    if (sceneOptions.animateInstances) {
+      animateInstanceRows(scene, static_cast<float>(glfwGetTime()));
+    }
+    if (scene.updateTransforms(&vulkanBackend.getWorkerPool())) {
+      vulkanBackend.setInstanceTransforms(scene.instances);
+    }
+    vulkanBackend.update();
+    vulkanBackend.drawFrame();
+    frame++;
+    if (sceneOptions.gpuTimingLogInterval > 0 &&
+        frame % sceneOptions.gpuTimingLogInterval == 0) {
+      logGpuTimes(vulkanBackend, frame);
+    }
+  }
+  printTelemetry(vulkanBackend);
+
+  if (window) {
+    glfwDestroyWindow(window);
+
+    glfwTerminate();
+  }
+  vulkanBackend.cleanup();
+  return 0;
+}
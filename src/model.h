@@ -1,42 +1,60 @@
-#pragma once
-#include <iostream>
-#include <string>
-#include <vector>
-#include "renderer.h"
-
-struct Vertex {
-  glm::vec3 pos;
-  glm::vec3 normal;
-  glm::vec2 texCoord;
-  glm::vec3 tangent;
-};
-
-class Mesh {
- public:
-  Mesh();
-  Mesh(uint32_t count, int32_t offset, std::string ambient_tex,
-       std::string diffuse_tex, std::string specular_tex,
-       std::string normal_tex);
-  ~Mesh();
-  uint32_t indexCount;   // vertices count
-  int32_t vertexOffset;  // offset in vertex array
-  std::string ambient_texname;
-  std::string diffuse_texname;
-  std::string specular_texname;
-  std::string normal_texname;
-
- private:
-};
-
-class Model {
- public:
-  Model();
-  ~Model();
-
-  void load(const std::string filepath);
-  std::vector<Vertex> vertices;
-  std::vector<uint32_t> indices;
-  std::vector<Mesh> meshes;
-
- private:
+#pragma once
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+#include "renderer.h"
+
+struct Vertex {
+  glm::vec3 pos;
+  glm::vec3 normal;
+  glm::vec2 texCoord;
+  glm::vec3 tangent;
+};
+
+struct AABB {
+  glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+  glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+  void extend(const glm::vec3 &point);
+  void extend(const AABB &box);
+};
+
+// Contiguous run of a mesh's vertices coming from one OBJ shape
+struct SubMesh {
+  uint32_t indexCount;
+  uint32_t firstIndex;   // offset in index array
+  int32_t vertexOffset;  // offset in vertex array
+  AABB bounds;
+};
+
+class Mesh {
+ public:
+  Mesh();
+  Mesh(uint32_t count, int32_t offset, std::string ambient_tex,
+       std::string diffuse_tex, std::string specular_tex,
+       std::string normal_tex);
+  ~Mesh();
+  uint32_t indexCount;   // vertices count
+  int32_t vertexOffset;  // offset in vertex array
+  std::string ambient_texname;
+  std::string diffuse_texname;
+  std::string specular_texname;
+  std::string normal_texname;
+  AABB bounds;  // object space, union of the sub-meshes
+  std::vector<SubMesh> subMeshes;
+
+ private:
+};
+
+class Model {
+ public:
+  Model();
+  ~Model();
+
+  void load(const std::string filepath);
+  std::vector<Vertex> vertices;
+  std::vector<uint32_t> indices;
+  std::vector<Mesh> meshes;
+
+ private:
 };
\ No newline at end of file
@@ -0,0 +1,431 @@
+#include "occlusion_culling.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define OCCLUSION_WIDTH 8
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define OCCLUSION_WIDTH 4
+#else
+#define OCCLUSION_WIDTH 1
+#endif
+
+#define SUBTILE_WIDTH 8
+#define SUBTILE_HEIGHT 4
+#define BAND_TILE_ROWS 2  // subtile rows rasterized by one task
+
+// The same loops run at every SIMD width through these few operations
+#if OCCLUSION_WIDTH == 8
+typedef __m256 floatv;
+static inline floatv set1(float v) { return _mm256_set1_ps(v); }
+static inline floatv load(const float *p) { return _mm256_loadu_ps(p); }
+static inline void store(float *p, floatv v) { _mm256_storeu_ps(p, v); }
+static inline floatv add(floatv a, floatv b) { return _mm256_add_ps(a, b); }
+static inline floatv mul(floatv a, floatv b) { return _mm256_mul_ps(a, b); }
+static inline floatv div(floatv a, floatv b) { return _mm256_div_ps(a, b); }
+// replacement where test < 0, value elsewhere
+static inline floatv selectNegative(floatv test, floatv value,
+                                    floatv replacement) {
+  return _mm256_blendv_ps(
+      value, replacement,
+      _mm256_cmp_ps(test, _mm256_setzero_ps(), _CMP_LT_OQ));
+}
+// Bit per lane, set when any of the values has its sign bit set
+static inline int signMask(floatv a, floatv b, floatv c) {
+  __m256i bits = _mm256_or_si256(
+      _mm256_or_si256(_mm256_castps_si256(a), _mm256_castps_si256(b)),
+      _mm256_castps_si256(c));
+  return _mm256_movemask_ps(_mm256_castsi256_ps(bits));
+}
+#elif OCCLUSION_WIDTH == 4
+typedef __m128 floatv;
+static inline floatv set1(float v) { return _mm_set1_ps(v); }
+static inline floatv load(const float *p) { return _mm_loadu_ps(p); }
+static inline void store(float *p, floatv v) { _mm_storeu_ps(p, v); }
+static inline floatv add(floatv a, floatv b) { return _mm_add_ps(a, b); }
+static inline floatv mul(floatv a, floatv b) { return _mm_mul_ps(a, b); }
+static inline floatv div(floatv a, floatv b) { return _mm_div_ps(a, b); }
+static inline floatv selectNegative(floatv test, floatv value,
+                                    floatv replacement) {
+  __m128 negative = _mm_cmplt_ps(test, _mm_setzero_ps());
+  return _mm_or_ps(_mm_and_ps(negative, replacement),
+                   _mm_andnot_ps(negative, value));
+}
+static inline int signMask(floatv a, floatv b, floatv c) {
+  return _mm_movemask_ps(_mm_or_ps(_mm_or_ps(a, b), c));
+}
+#else
+typedef float floatv;
+static inline floatv set1(float v) { return v; }
+static inline floatv load(const float *p) { return *p; }
+static inline void store(float *p, floatv v) { *p = v; }
+static inline floatv add(floatv a, floatv b) { return a + b; }
+static inline floatv mul(floatv a, floatv b) { return a * b; }
+static inline floatv div(floatv a, floatv b) { return a / b; }
+static inline floatv selectNegative(floatv test, floatv value,
+                                    floatv replacement) {
+  return test < 0.0f ? replacement : value;
+}
+static inline int signMask(floatv a, floatv b, floatv c) {
+  uint32_t bits[3];
+  memcpy(&bits[0], &a, sizeof(float));
+  memcpy(&bits[1], &b, sizeof(float));
+  memcpy(&bits[2], &c, sizeof(float));
+  return static_cast<int>((bits[0] | bits[1] | bits[2]) >> 31);
+}
+#endif
+
+static const float laneOffsets[8] = {0.0f, 1.0f, 2.0f, 3.0f,
+                                     4.0f, 5.0f, 6.0f, 7.0f};
+
+OcclusionCuller::OcclusionCuller(uint32_t width, uint32_t height)
+    : _triangleCount(0), _trianglesPerChunk(0) {
+  _tilesX = std::max((width + SUBTILE_WIDTH - 1) / SUBTILE_WIDTH, 1u);
+  _tilesY = std::max((height + SUBTILE_HEIGHT - 1) / SUBTILE_HEIGHT, 1u);
+  _width = _tilesX * SUBTILE_WIDTH;
+  _height = _tilesY * SUBTILE_HEIGHT;
+  _zMax.assign(_tilesX * _tilesY, 1.0f);
+  _zWorking.assign(_tilesX * _tilesY, 0.0f);
+  _coverage.assign(_tilesX * _tilesY, 0);
+}
+
+uint32_t OcclusionCuller::width() const { return _width; }
+
+uint32_t OcclusionCuller::height() const { return _height; }
+
+void OcclusionCuller::clearOccluders() {
+  _x.clear();
+  _y.clear();
+  _z.clear();
+  _triangleCount = 0;
+}
+
+void OcclusionCuller::addOccluder(const Vertex *vertices,
+                                  uint32_t vertexCount,
+                                  const glm::mat4 &transform) {
+  // Drop the padding of the previous occluders first
+  size_t size = _triangleCount * 3;
+  _x.resize(size);
+  _y.resize(size);
+  _z.resize(size);
+  for (uint32_t i = 0; i + 2 < vertexCount; i += 3) {
+    for (uint32_t j = i; j < i + 3; j++) {
+      glm::vec4 position = transform * glm::vec4(vertices[j].pos, 1.0f);
+      _x.push_back(position.x);
+      _y.push_back(position.y);
+      _z.push_back(position.z);
+    }
+    _triangleCount++;
+  }
+  size = (_x.size() + OCCLUSION_WIDTH - 1) / OCCLUSION_WIDTH *
+         OCCLUSION_WIDTH;
+  _x.resize(size, 0.0f);
+  _y.resize(size, 0.0f);
+  _z.resize(size, 0.0f);
+}
+
+void OcclusionCuller::selectOccluders(const Model &model,
+                                      uint32_t triangleBudget) {
+  selectOccluders(model, std::vector<glm::mat4>(1, glm::mat4()),
+                  triangleBudget);
+}
+
+void OcclusionCuller::selectOccluders(const Model &model,
+                                      const std::vector<glm::mat4> &instances,
+                                      uint32_t triangleBudget) {
+  struct Candidate {
+    float size;
+    const SubMesh *subMesh;
+    uint32_t instance;
+  };
+  std::vector<Candidate> candidates;
+  for (uint32_t instance = 0; instance < instances.size(); instance++) {
+    for (const auto &mesh : model.meshes) {
+      for (const auto &subMesh : mesh.subMeshes) {
+        // Transformed diagonal, exact for the uniform scales of instances
+        glm::vec3 diagonal = glm::vec3(
+            instances[instance] *
+            glm::vec4(subMesh.bounds.max - subMesh.bounds.min, 0.0f));
+        Candidate candidate = {glm::length(diagonal), &subMesh, instance};
+        candidates.push_back(candidate);
+      }
+    }
+  }
+  std::stable_sort(candidates.begin(), candidates.end(),
+                   [](const Candidate &a, const Candidate &b) {
+                     return a.size > b.size;
+                   });
+  for (const auto &candidate : candidates) {
+    const SubMesh &subMesh = *candidate.subMesh;
+    uint32_t triangles = subMesh.indexCount / 3;
+    if (triangles > triangleBudget) continue;
+    addOccluder(&model.vertices[subMesh.vertexOffset], subMesh.indexCount,
+                instances[candidate.instance]);
+    triangleBudget -= triangles;
+  }
+}
+
+uint32_t OcclusionCuller::occluderTriangleCount() const {
+  return _triangleCount;
+}
+
+void OcclusionCuller::render(const glm::mat4 &modelViewProj,
+                             ThreadPool &pool) {
+  _modelViewProj = modelViewProj;
+  _screenX.resize(_x.size());
+  _screenY.resize(_x.size());
+  _screenZ.resize(_x.size());
+
+  // Chunks start on a multiple of 8 triangles, so their vertex ranges stay
+  // aligned to the SIMD width and never share a vector
+  uint32_t chunkCount = std::max(pool.size(), 1u);
+  _trianglesPerChunk = (_triangleCount + chunkCount - 1) / chunkCount;
+  _trianglesPerChunk = std::max((_trianglesPerChunk + 7) / 8 * 8, 8u);
+  chunkCount = (_triangleCount + _trianglesPerChunk - 1) / _trianglesPerChunk;
+  const uint32_t bandCount = (_tilesY + BAND_TILE_ROWS - 1) / BAND_TILE_ROWS;
+  _bins.resize(chunkCount * bandCount);
+  for (auto &bin : _bins) bin.clear();
+
+  pool.parallelFor(chunkCount, [this, chunkCount](uint32_t chunk) {
+    transformAndBin(chunk, chunkCount);
+  });
+  pool.parallelFor(bandCount, [this, chunkCount](uint32_t band) {
+    rasterizeBand(band, chunkCount);
+  });
+}
+
+void OcclusionCuller::transformAndBin(uint32_t chunk, uint32_t chunkCount) {
+  const uint32_t firstTriangle = chunk * _trianglesPerChunk;
+  const uint32_t lastTriangle =
+      std::min(firstTriangle + _trianglesPerChunk, _triangleCount);
+  // The last chunk also transforms the padding
+  const uint32_t begin = firstTriangle * 3;
+  const uint32_t end =
+      chunk + 1 == chunkCount ? static_cast<uint32_t>(_x.size())
+                              : lastTriangle * 3;
+
+  // glm is column-major, m[column][row]
+  const glm::mat4 &m = _modelViewProj;
+  const floatv halfWidth = set1(_width * 0.5f);
+  const floatv halfHeight = set1(_height * 0.5f);
+  for (uint32_t i = begin; i < end; i += OCCLUSION_WIDTH) {
+    floatv x = load(&_x[i]);
+    floatv y = load(&_y[i]);
+    floatv z = load(&_z[i]);
+    floatv clip[4];
+    for (int row = 0; row < 4; row++) {
+      clip[row] = add(add(mul(set1(m[0][row]), x), mul(set1(m[1][row]), y)),
+                      add(mul(set1(m[2][row]), z), set1(m[3][row])));
+    }
+    floatv invW = div(set1(1.0f), clip[3]);
+    store(&_screenX[i],
+          add(mul(mul(clip[0], invW), halfWidth), halfWidth));
+    store(&_screenY[i],
+          add(mul(mul(clip[1], invW), halfHeight), halfHeight));
+    // Clip z < 0 is in front of the near plane, or behind the camera
+    store(&_screenZ[i],
+          selectNegative(clip[2], mul(clip[2], invW), set1(-1.0f)));
+  }
+
+  const uint32_t bandCount = (_tilesY + BAND_TILE_ROWS - 1) / BAND_TILE_ROWS;
+  const uint32_t bandHeight = BAND_TILE_ROWS * SUBTILE_HEIGHT;
+  std::vector<uint32_t> *bins = &_bins[chunk * bandCount];
+  for (uint32_t triangle = firstTriangle; triangle < lastTriangle;
+       triangle++) {
+    const uint32_t v = triangle * 3;
+    const float *sx = &_screenX[v];
+    const float *sy = &_screenY[v];
+    const float *sz = &_screenZ[v];
+    // Clipping is skipped: occluders crossing the near plane or beyond the
+    // far plane are dropped, which only loses occlusion
+    if (sz[0] < 0.0f || sz[1] < 0.0f || sz[2] < 0.0f) continue;
+    if (std::min(std::min(sz[0], sz[1]), sz[2]) >= 1.0f) continue;
+    float area = (sx[1] - sx[0]) * (sy[2] - sy[0]) -
+                 (sx[2] - sx[0]) * (sy[1] - sy[0]);
+    if (!(std::fabs(area) > 1e-6f)) continue;  // also rejects NaN
+
+    // Rows whose pixel centers the bounding box spans
+    float minY = std::min(std::min(sy[0], sy[1]), sy[2]);
+    float maxY = std::max(std::max(sy[0], sy[1]), sy[2]);
+    float minX = std::min(std::min(sx[0], sx[1]), sx[2]);
+    float maxX = std::max(std::max(sx[0], sx[1]), sx[2]);
+    if (maxX < 0.5f || minX > _width - 0.5f || maxY < 0.5f ||
+        minY > _height - 0.5f) {
+      continue;
+    }
+    uint32_t pixelMinY = static_cast<uint32_t>(
+        std::max(std::ceil(minY - 0.5f), 0.0f));
+    uint32_t pixelMaxY = static_cast<uint32_t>(
+        std::min(std::floor(maxY - 0.5f), _height - 1.0f));
+    if (pixelMinY > pixelMaxY) continue;
+    for (uint32_t band = pixelMinY / bandHeight;
+         band <= pixelMaxY / bandHeight && band < bandCount; band++) {
+      bins[band].push_back(triangle);
+    }
+  }
+}
+
+void OcclusionCuller::rasterizeBand(uint32_t band, uint32_t chunkCount) {
+  const uint32_t bandCount = (_tilesY + BAND_TILE_ROWS - 1) / BAND_TILE_ROWS;
+  const uint32_t tileYBegin = band * BAND_TILE_ROWS;
+  const uint32_t tileYEnd = std::min(tileYBegin + BAND_TILE_ROWS, _tilesY);
+  const uint32_t first = tileYBegin * _tilesX;
+  const uint32_t last = tileYEnd * _tilesX;
+  std::fill(_zMax.begin() + first, _zMax.begin() + last, 1.0f);
+  std::fill(_zWorking.begin() + first, _zWorking.begin() + last, 0.0f);
+  std::fill(_coverage.begin() + first, _coverage.begin() + last, 0u);
+
+  for (uint32_t chunk = 0; chunk < chunkCount; chunk++) {
+    for (uint32_t triangle : _bins[chunk * bandCount + band]) {
+      rasterizeTriangle(triangle, tileYBegin, tileYEnd);
+    }
+  }
+}
+
+void OcclusionCuller::rasterizeTriangle(uint32_t triangle,
+                                        uint32_t tileYBegin,
+                                        uint32_t tileYEnd) {
+  const uint32_t v = triangle * 3;
+  float x[3] = {_screenX[v], _screenX[v + 1], _screenX[v + 2]};
+  float y[3] = {_screenY[v], _screenY[v + 1], _screenY[v + 2]};
+  float z[3] = {_screenZ[v], _screenZ[v + 1], _screenZ[v + 2]};
+  float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+  // Occluders are double-sided like the G-pass, make the winding positive
+  if (area < 0.0f) {
+    std::swap(x[1], x[2]);
+    std::swap(y[1], y[2]);
+    std::swap(z[1], z[2]);
+    area = -area;
+  }
+
+  // Edge functions a * x + b * y + c, positive inside
+  float a[3], b[3], c[3];
+  for (int i = 0; i < 3; i++) {
+    int j = (i + 1) % 3;
+    a[i] = y[i] - y[j];
+    b[i] = x[j] - x[i];
+    c[i] = -(a[i] * x[i] + b[i] * y[i]);
+  }
+  // Depth is linear in screen space after the perspective divide
+  float zx = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) /
+             area;
+  float zy = ((z[2] - z[0]) * (x[1] - x[0]) - (z[1] - z[0]) * (x[2] - x[0])) /
+             area;
+  float zc = z[0] - zx * x[0] - zy * y[0];
+  float zTriangle = std::max(std::max(z[0], z[1]), z[2]);
+  float zTriangleMin = std::min(std::min(z[0], z[1]), z[2]);
+
+  float minX = std::min(std::min(x[0], x[1]), x[2]);
+  float maxX = std::max(std::max(x[0], x[1]), x[2]);
+  float minY = std::min(std::min(y[0], y[1]), y[2]);
+  float maxY = std::max(std::max(y[0], y[1]), y[2]);
+  uint32_t tileXMin = static_cast<uint32_t>(
+      std::max(std::ceil(minX - 0.5f), 0.0f)) / SUBTILE_WIDTH;
+  uint32_t tileXMax = static_cast<uint32_t>(
+      std::min(std::floor(maxX - 0.5f), _width - 1.0f)) / SUBTILE_WIDTH;
+  uint32_t tileYMin = std::max(
+      static_cast<uint32_t>(std::max(std::ceil(minY - 0.5f), 0.0f)) /
+          SUBTILE_HEIGHT,
+      tileYBegin);
+  uint32_t tileYMax = std::min(
+      static_cast<uint32_t>(std::min(std::floor(maxY - 0.5f), _height - 1.0f)) /
+          SUBTILE_HEIGHT,
+      tileYEnd - 1);
+
+  floatv laneStep[3];
+  for (int i = 0; i < 3; i++) {
+    laneStep[i] = mul(set1(a[i]), load(laneOffsets));
+  }
+  for (uint32_t tileY = tileYMin; tileY <= tileYMax; tileY++) {
+    float pixelY = tileY * SUBTILE_HEIGHT + 0.5f;
+    for (uint32_t tileX = tileXMin; tileX <= tileXMax; tileX++) {
+      const uint32_t index = tileY * _tilesX + tileX;
+      // Entirely behind what the subtile already hides
+      if (zTriangleMin >= _zMax[index]) continue;
+      float pixelX = tileX * SUBTILE_WIDTH + 0.5f;
+      uint32_t coverage = 0;
+      for (uint32_t row = 0; row < SUBTILE_HEIGHT; row++) {
+        float rowY = pixelY + row;
+        for (uint32_t lane = 0; lane < SUBTILE_WIDTH;
+             lane += OCCLUSION_WIDTH) {
+          floatv edge[3];
+          for (int i = 0; i < 3; i++) {
+            edge[i] = add(set1(a[i] * (pixelX + lane) + b[i] * rowY + c[i]),
+                          laneStep[i]);
+          }
+          uint32_t outside = signMask(edge[0], edge[1], edge[2]);
+          uint32_t inside = ~outside & ((1u << OCCLUSION_WIDTH) - 1);
+          coverage |= inside << (row * SUBTILE_WIDTH + lane);
+        }
+      }
+      if (coverage == 0) continue;
+
+      // Farthest depth of the plane over the subtile's pixel centers
+      float cornerX = zx >= 0.0f ? pixelX + SUBTILE_WIDTH - 1 : pixelX;
+      float cornerY = zy >= 0.0f ? pixelY + SUBTILE_HEIGHT - 1 : pixelY;
+      float depth = std::min(zc + zx * cornerX + zy * cornerY, zTriangle);
+      updateSubtile(index, coverage, depth);
+    }
+  }
+}
+
+// Merge of a triangle into the two layers: the working layer collects the
+// coverage of triangles nearer than the subtile's depth and replaces it once
+// every pixel is covered, its farthest depth then bounds the whole subtile
+void OcclusionCuller::updateSubtile(uint32_t index, uint32_t coverage,
+                                    float depth) {
+  if (depth >= _zMax[index]) return;
+  _zWorking[index] = std::max(_zWorking[index], depth);
+  _coverage[index] |= coverage;
+  if (_coverage[index] == 0xFFFFFFFFu) {
+    _zMax[index] = _zWorking[index];
+    _zWorking[index] = 0.0f;
+    _coverage[index] = 0;
+  }
+}
+
+bool OcclusionCuller::isVisible(const AABB &box) const {
+  const glm::mat4 &m = _modelViewProj;
+  float minX = std::numeric_limits<float>::max();
+  float minY = std::numeric_limits<float>::max();
+  float maxX = -std::numeric_limits<float>::max();
+  float maxY = -std::numeric_limits<float>::max();
+  float minZ = std::numeric_limits<float>::max();
+  for (int i = 0; i < 8; i++) {
+    glm::vec4 corner((i & 1) ? box.max.x : box.min.x,
+                     (i & 2) ? box.max.y : box.min.y,
+                     (i & 4) ? box.max.z : box.min.z, 1.0f);
+    glm::vec4 clip = m * corner;
+    if (clip.z < 0.0f) return true;  // crosses the near plane
+    float x = (clip.x / clip.w * 0.5f + 0.5f) * _width;
+    float y = (clip.y / clip.w * 0.5f + 0.5f) * _height;
+    minX = std::min(minX, x);
+    maxX = std::max(maxX, x);
+    minY = std::min(minY, y);
+    maxY = std::max(maxY, y);
+    minZ = std::min(minZ, clip.z / clip.w);
+  }
+  // Outside the buffer, left to frustum culling
+  if (maxX < 0.0f || maxY < 0.0f || minX >= _width || minY >= _height) {
+    return true;
+  }
+  // Every pixel the box touches, not only the centers it covers
+  uint32_t tileXMin =
+      static_cast<uint32_t>(std::max(minX, 0.0f)) / SUBTILE_WIDTH;
+  uint32_t tileXMax =
+      static_cast<uint32_t>(std::min(maxX, _width - 1.0f)) / SUBTILE_WIDTH;
+  uint32_t tileYMin =
+      static_cast<uint32_t>(std::max(minY, 0.0f)) / SUBTILE_HEIGHT;
+  uint32_t tileYMax =
+      static_cast<uint32_t>(std::min(maxY, _height - 1.0f)) / SUBTILE_HEIGHT;
+  for (uint32_t tileY = tileYMin; tileY <= tileYMax; tileY++) {
+    const float *zMax = &_zMax[tileY * _tilesX];
+    for (uint32_t tileX = tileXMin; tileX <= tileXMax; tileX++) {
+      if (minZ <= zMax[tileX]) return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "model.h"
+#include "renderer.h"
+#include "thread_pool.h"
+
+// CPU occlusion culling in the style of masked occlusion culling. Occluder
+// triangles are rasterized into a low resolution buffer of 8x4 pixel
+// subtiles which keep a coverage mask and two depth layers instead of one
+// depth per pixel, then boxes are tested against the farthest depth of the
+// subtiles they cover. Bands of subtile rows are rasterized in parallel,
+// coverage is computed 8 (AVX2) or 4 (SSE2) pixels at a time. Depth is
+// Vulkan's, 0 near and 1 far.
+class OcclusionCuller {
+ public:
+  // Rounded up to whole subtiles
+  OcclusionCuller(uint32_t width = 320, uint32_t height = 180);
+
+  uint32_t width() const;
+  uint32_t height() const;
+
+  void clearOccluders();
+  // Triangle list, 3 vertices per triangle, placed in the occluders' space
+  // by transform
+  void addOccluder(const Vertex *vertices, uint32_t vertexCount,
+                   const glm::mat4 &transform = glm::mat4());
+  // Adds the sub-meshes with the largest boxes first, skipping the ones
+  // that no longer fit in the triangle budget
+  void selectOccluders(const Model &model, uint32_t triangleBudget);
+  // The same over the sub-meshes of every instance of the model, ranked by
+  // their size once transformed
+  void selectOccluders(const Model &model,
+                       const std::vector<glm::mat4> &instances,
+                       uint32_t triangleBudget);
+  uint32_t occluderTriangleCount() const;
+
+  // Clears the buffer and rasterizes the occluders seen through the matrix
+  void render(const glm::mat4 &modelViewProj, ThreadPool &pool);
+  // Box in the occluders' space, false when hidden in the last render
+  bool isVisible(const AABB &box) const;
+
+ private:
+  void transformAndBin(uint32_t chunk, uint32_t chunkCount);
+  void rasterizeBand(uint32_t band, uint32_t chunkCount);
+  void rasterizeTriangle(uint32_t triangle, uint32_t tileYBegin,
+                         uint32_t tileYEnd);
+  void updateSubtile(uint32_t index, uint32_t coverage, float depth);
+
+  uint32_t _width, _height;
+  uint32_t _tilesX, _tilesY;
+  // Per subtile: farthest depth of the whole subtile, and the working layer
+  // being filled by nearer triangles, merged once its coverage is full
+  std::vector<float> _zMax;
+  std::vector<float> _zWorking;
+  std::vector<uint32_t> _coverage;  // bit y * 8 + x
+
+  // Occluder vertices as SoA, padded to the SIMD width, and their screen
+  // position for the current render, z < 0 when in front of the near plane
+  std::vector<float> _x, _y, _z;
+  std::vector<float> _screenX, _screenY, _screenZ;
+  uint32_t _triangleCount;
+  uint32_t _trianglesPerChunk;
+  // Triangles overlapping each band, per transform chunk so that every
+  // band sees them in submission order
+  std::vector<std::vector<uint32_t>> _bins;
+  glm::mat4 _modelViewProj;
+};
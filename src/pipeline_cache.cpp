@@ -0,0 +1,182 @@
+#include "pipeline_cache.h"
+#include <cstdio>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+namespace {
+
+const uint32_t FILE_MAGIC = 0x43505256;  // "VRPC"
+const uint32_t FILE_VERSION = 1;
+
+// Precedes the cache data in the file
+struct FileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t vendorID;
+  uint32_t deviceID;
+  uint32_t driverVersion;
+  uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+  uint64_t dataSize;
+};
+
+// Start of the data of vkGetPipelineCacheData (header version one)
+struct CacheHeader {
+  uint32_t length;
+  uint32_t version;
+  uint32_t vendorID;
+  uint32_t deviceID;
+  uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+};
+
+bool replaceFile(const std::string &from, const std::string &to) {
+#ifdef _WIN32
+  return MoveFileExA(from.c_str(), to.c_str(),
+                     MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+  return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+}  // namespace
+
+void PipelineCache::init(VkPhysicalDevice physicalDevice, VkDevice device,
+                         const std::string &path) {
+  _device = device;
+  _path = path;
+  _loadedSize = 0;
+  vkGetPhysicalDeviceProperties(physicalDevice, &_properties);
+
+  std::vector<uint8_t> data;
+  std::ifstream file;
+  if (!_path.empty()) file.open(_path, std::ios::binary);
+  if (file.is_open()) {
+    FileHeader header = {};
+    file.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (!file || header.magic != FILE_MAGIC ||
+        header.version != FILE_VERSION) {
+      std::cout << "pipeline cache: " << _path << " unreadable, ignored"
+                << std::endl;
+    } else if (header.vendorID != _properties.vendorID ||
+               header.deviceID != _properties.deviceID ||
+               header.driverVersion != _properties.driverVersion ||
+               std::memcmp(header.pipelineCacheUUID,
+                           _properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+      std::cout << "pipeline cache: " << _path
+                << " from another device or driver, ignored" << std::endl;
+    } else {
+      // The size is checked against what the file holds past the header
+      // before allocating, a truncated file is only corrupt
+      const std::streampos dataStart = file.tellg();
+      file.seekg(0, std::ios::end);
+      const uint64_t remaining =
+          static_cast<uint64_t>(file.tellg() - dataStart);
+      file.seekg(dataStart);
+      if (file && header.dataSize <= remaining) {
+        data.resize(static_cast<size_t>(header.dataSize));
+        file.read(reinterpret_cast<char *>(data.data()), data.size());
+      } else {
+        file.setstate(std::ios::failbit);
+      }
+      if (!file || !matchesDevice(data.data(), data.size())) {
+        std::cout << "pipeline cache: " << _path << " corrupt, ignored"
+                  << std::endl;
+        data.clear();
+      }
+    }
+  }
+
+  VkPipelineCacheCreateInfo cacheInfo = {};
+  cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  cacheInfo.initialDataSize = data.size();
+  cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+  VkResult result =
+      vkCreatePipelineCache(_device, &cacheInfo, nullptr, &_cache);
+  vkCheckResult(result, "vkCreatePipelineCache");
+  _loadedSize = data.size();
+}
+
+bool PipelineCache::save() {
+  if (_path.empty() || _cache == VK_NULL_HANDLE) return false;
+  size_t size = 0;
+  VkResult result = vkGetPipelineCacheData(_device, _cache, &size, nullptr);
+  vkCheckResult(result, "vkGetPipelineCacheData");
+  std::vector<uint8_t> data(size);
+  result = vkGetPipelineCacheData(_device, _cache, &size, data.data());
+  vkCheckResult(result, "vkGetPipelineCacheData");
+  data.resize(size);
+  // What the driver returns is checked like a loaded file would be
+  if (!matchesDevice(data.data(), data.size())) {
+    std::cout << "pipeline cache: data doesn't match the device, not saved"
+              << std::endl;
+    return false;
+  }
+
+  FileHeader header = {};
+  header.magic = FILE_MAGIC;
+  header.version = FILE_VERSION;
+  header.vendorID = _properties.vendorID;
+  header.deviceID = _properties.deviceID;
+  header.driverVersion = _properties.driverVersion;
+  std::memcpy(header.pipelineCacheUUID, _properties.pipelineCacheUUID,
+              VK_UUID_SIZE);
+  header.dataSize = data.size();
+
+  const std::string temporaryPath = _path + ".tmp";
+  {
+    std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(data.data()), data.size());
+    file.flush();
+    if (!file) {
+      std::cout << "pipeline cache: cannot write " << temporaryPath
+                << std::endl;
+      std::remove(temporaryPath.c_str());
+      return false;
+    }
+  }
+  if (!replaceFile(temporaryPath, _path)) {
+    std::cout << "pipeline cache: cannot replace " << _path << std::endl;
+    std::remove(temporaryPath.c_str());
+    return false;
+  }
+  std::cout << "pipeline cache: " << data.size() / 1024 << " KiB saved to "
+            << _path << std::endl;
+  return true;
+}
+
+void PipelineCache::reset() {
+  destroy();
+  VkPipelineCacheCreateInfo cacheInfo = {};
+  cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  VkResult result =
+      vkCreatePipelineCache(_device, &cacheInfo, nullptr, &_cache);
+  vkCheckResult(result, "vkCreatePipelineCache");
+  _loadedSize = 0;  // cold from now on
+}
+
+void PipelineCache::destroy() {
+  if (_cache != VK_NULL_HANDLE) {
+    vkDestroyPipelineCache(_device, _cache, nullptr);
+    _cache = VK_NULL_HANDLE;
+  }
+}
+
+VkPipelineCache PipelineCache::handle() const { return _cache; }
+
+bool PipelineCache::warm() const { return _loadedSize > 0; }
+
+size_t PipelineCache::loadedSize() const { return _loadedSize; }
+
+bool PipelineCache::matchesDevice(const uint8_t *data, size_t size) const {
+  CacheHeader header;
+  if (size < sizeof(header)) return false;
+  std::memcpy(&header, data, sizeof(header));
+  return header.length >= sizeof(header) && header.length <= size &&
+         header.version == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+         header.vendorID == _properties.vendorID &&
+         header.deviceID == _properties.deviceID &&
+         std::memcmp(header.pipelineCacheUUID, _properties.pipelineCacheUUID,
+                     VK_UUID_SIZE) == 0;
+}
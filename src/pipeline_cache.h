@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "vk_utils.h"
+
+// VkPipelineCache kept on disk between runs. The file starts with the
+// identity of the device and driver that wrote it, then the data of
+// vkGetPipelineCacheData. A file from another device or driver version, or
+// whose cache header doesn't match the device, is ignored and the cache
+// starts empty (cold) rather than handing the driver data it may reject.
+class PipelineCache {
+ public:
+  // Loads path when it matches the device, empty path: never persisted
+  void init(VkPhysicalDevice physicalDevice, VkDevice device,
+            const std::string &path);
+  // Writes the cache to a temporary file renamed over path, so an
+  // interrupted save leaves the previous file intact. False when nothing
+  // was written.
+  bool save();
+  // Replaced by an empty cache, for cold creation timings. The file is
+  // untouched until the next save().
+  void reset();
+  void destroy();
+
+  VkPipelineCache handle() const;
+  bool warm() const;          // started from the file
+  size_t loadedSize() const;  // bytes of cache data read from the file
+
+ private:
+  bool matchesDevice(const uint8_t *data, size_t size) const;
+
+  VkDevice _device = VK_NULL_HANDLE;
+  VkPipelineCache _cache = VK_NULL_HANDLE;
+  VkPhysicalDeviceProperties _properties;
+  std::string _path;
+  size_t _loadedSize = 0;
+};
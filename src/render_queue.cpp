@@ -0,0 +1,96 @@
+#include "render_queue.h"
+#include <algorithm>
+
+namespace {
+
+const uint32_t DEPTH_SHIFT = 64 - RenderQueue::PASS_BITS -
+                             RenderQueue::PIPELINE_BITS -
+                             RenderQueue::MATERIAL_BITS -
+                             RenderQueue::DEPTH_BITS;
+const uint32_t MATERIAL_SHIFT = DEPTH_SHIFT + RenderQueue::DEPTH_BITS;
+const uint32_t PIPELINE_SHIFT = MATERIAL_SHIFT + RenderQueue::MATERIAL_BITS;
+const uint32_t PASS_SHIFT = PIPELINE_SHIFT + RenderQueue::PIPELINE_BITS;
+
+uint64_t field(uint32_t value, uint32_t bits, uint32_t shift) {
+  return (static_cast<uint64_t>(value) & ((1ull << bits) - 1)) << shift;
+}
+
+uint32_t extract(uint64_t key, uint32_t bits, uint32_t shift) {
+  return static_cast<uint32_t>((key >> shift) & ((1ull << bits) - 1));
+}
+
+}  // namespace
+
+uint64_t RenderQueue::makeKey(uint32_t pass, uint32_t pipeline,
+                              uint32_t material, uint32_t depth) {
+  return field(pass, PASS_BITS, PASS_SHIFT) |
+         field(pipeline, PIPELINE_BITS, PIPELINE_SHIFT) |
+         field(material, MATERIAL_BITS, MATERIAL_SHIFT) |
+         field(depth, DEPTH_BITS, DEPTH_SHIFT);
+}
+
+uint32_t RenderQueue::keyPass(uint64_t key) {
+  return extract(key, PASS_BITS, PASS_SHIFT);
+}
+
+uint32_t RenderQueue::keyPipeline(uint64_t key) {
+  return extract(key, PIPELINE_BITS, PIPELINE_SHIFT);
+}
+
+uint32_t RenderQueue::keyMaterial(uint64_t key) {
+  return extract(key, MATERIAL_BITS, MATERIAL_SHIFT);
+}
+
+uint32_t RenderQueue::depthBucket(float depth, float maxDepth) {
+  const uint32_t maxBucket = (1u << DEPTH_BITS) - 1;
+  if (!(depth > 0.0f) || maxDepth <= 0.0f) return 0;
+  if (depth >= maxDepth) return maxBucket;
+  return static_cast<uint32_t>(depth / maxDepth * maxBucket);
+}
+
+void RenderQueue::clear() { _commands.clear(); }
+
+void RenderQueue::push(uint64_t key, uint32_t draw) {
+  RenderCommand command;
+  command.key = key;
+  command.draw = draw;
+  _commands.push_back(command);
+}
+
+void RenderQueue::sort() {
+  const size_t count = _commands.size();
+  if (count < 2) return;
+
+  // Histograms of the eight bytes in one read
+  std::vector<uint32_t> histograms(8 * 256, 0);
+  for (const RenderCommand &command : _commands) {
+    for (uint32_t byte = 0; byte < 8; byte++) {
+      histograms[byte * 256 + ((command.key >> (byte * 8)) & 0xff)]++;
+    }
+  }
+
+  _scratch.resize(count);
+  for (uint32_t byte = 0; byte < 8; byte++) {
+    uint32_t *histogram = &histograms[byte * 256];
+    // Every key has the same byte: this pass wouldn't move anything
+    const uint64_t first = (_commands[0].key >> (byte * 8)) & 0xff;
+    if (histogram[first] == count) continue;
+
+    uint32_t offset = 0;
+    for (uint32_t digit = 0; digit < 256; digit++) {
+      uint32_t digitCount = histogram[digit];
+      histogram[digit] = offset;
+      offset += digitCount;
+    }
+    for (const RenderCommand &command : _commands) {
+      _scratch[histogram[(command.key >> (byte * 8)) & 0xff]++] = command;
+    }
+    _commands.swap(_scratch);
+  }
+}
+
+const std::vector<RenderCommand> &RenderQueue::commands() const {
+  return _commands;
+}
+
+size_t RenderQueue::size() const { return _commands.size(); }
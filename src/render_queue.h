@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// One queued draw: its sort key and the caller's index of the draw
+struct RenderCommand {
+  uint64_t key;
+  uint32_t draw;
+};
+
+// Draws of a frame ordered by a 64-bit key, from the most significant bits:
+// pass (8), pipeline (12), material (16), depth bucket (16) and 12 spare
+// bits. Recording in key order keeps the draws sharing a pipeline, then a
+// material, together so that binding only on change elides the rest.
+class RenderQueue {
+ public:
+  static const uint32_t PASS_BITS = 8;
+  static const uint32_t PIPELINE_BITS = 12;
+  static const uint32_t MATERIAL_BITS = 16;
+  static const uint32_t DEPTH_BITS = 16;
+
+  // Fields are truncated to their width
+  static uint64_t makeKey(uint32_t pass, uint32_t pipeline, uint32_t material,
+                          uint32_t depth);
+  static uint32_t keyPass(uint64_t key);
+  static uint32_t keyPipeline(uint64_t key);
+  static uint32_t keyMaterial(uint64_t key);
+  // Bucket of a view depth in [0, maxDepth], front to back
+  static uint32_t depthBucket(float depth, float maxDepth);
+
+  void clear();
+  void push(uint64_t key, uint32_t draw);
+  // LSD radix sort, a byte per pass, skipping the bytes every key shares.
+  // Stable: equal keys keep their push order.
+  void sort();
+  const std::vector<RenderCommand> &commands() const;
+  size_t size() const;
+
+ private:
+  std::vector<RenderCommand> _commands;
+  std::vector<RenderCommand> _scratch;
+};
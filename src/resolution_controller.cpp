@@ -0,0 +1,55 @@
+#include "resolution_controller.h"
+#include <algorithm>
+#include <cmath>
+
+ResolutionController::ResolutionController(size_t historyCapacity)
+    : _target(16.0),
+      _minScale(0.5f),
+      _maxScale(1.0f),
+      _scale(1.0f),
+      _historyCapacity(historyCapacity) {}
+
+void ResolutionController::setTarget(double gpuTime) { _target = gpuTime; }
+
+void ResolutionController::setLimits(float minScale, float maxScale) {
+  _minScale = minScale;
+  _maxScale = std::max(maxScale, minScale);
+  _scale = std::min(std::max(_scale, _minScale), _maxScale);
+}
+
+void ResolutionController::reset(float scale) {
+  _scale = std::min(std::max(scale, _minScale), _maxScale);
+  _history.clear();
+}
+
+float ResolutionController::update(double gpuTime) {
+  const double deadBand = 0.05;   // of the target
+  const double downGain = 0.6;    // over the target
+  const double upGain = 0.15;     // under the target
+  if (gpuTime > 0.0 && _target > 0.0) {
+    double ratio = gpuTime / _target;
+    double predicted = _scale / std::sqrt(ratio);
+    double gain = 0.0;
+    if (ratio > 1.0 + deadBand) {
+      gain = downGain;
+    } else if (ratio < 1.0 - deadBand) {
+      gain = upGain;
+    }
+    double scale = _scale + gain * (predicted - _scale);
+    _scale = static_cast<float>(
+        std::min(std::max(scale, static_cast<double>(_minScale)),
+                 static_cast<double>(_maxScale)));
+  }
+  ResolutionSample sample = {gpuTime, _scale};
+  _history.push_back(sample);
+  if (_history.size() > _historyCapacity) _history.pop_front();
+  return _scale;
+}
+
+float ResolutionController::scale() const { return _scale; }
+
+double ResolutionController::target() const { return _target; }
+
+const std::deque<ResolutionSample> &ResolutionController::history() const {
+  return _history;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <deque>
+
+// One controller step: the GPU frame time it was given and the render scale
+// it picked
+struct ResolutionSample {
+  double gpuTime;  // ms
+  float scale;
+};
+
+// Render scale that holds the GPU frame time at a target. The frame time is
+// modeled as proportional to the pixel count, i.e. to scale^2, and each step
+// moves part of the way to the scale predicted to hit the target: fast when
+// over the target so that load spikes are absorbed within a few frames,
+// slowly when under it, and not at all within a dead band around it so that
+// timing noise doesn't make the resolution shimmer.
+class ResolutionController {
+ public:
+  explicit ResolutionController(size_t historyCapacity = 512);
+
+  void setTarget(double gpuTime);  // ms
+  void setLimits(float minScale, float maxScale);
+  void reset(float scale);  // also clears the history
+
+  float update(double gpuTime);  // returns the new scale
+  float scale() const;
+  double target() const;
+  const std::deque<ResolutionSample> &history() const;  // oldest first
+
+ private:
+  double _target;
+  float _minScale;
+  float _maxScale;
+  float _scale;
+  size_t _historyCapacity;
+  std::deque<ResolutionSample> _history;
+};
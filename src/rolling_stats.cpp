@@ -0,0 +1,52 @@
+#include "rolling_stats.h"
+#include <algorithm>
+#include <cmath>
+
+RollingStats::RollingStats(size_t capacity)
+    : _samples(capacity > 0 ? capacity : 1), _next(0), _count(0) {}
+
+void RollingStats::push(double sample) {
+  _samples[_next] = sample;
+  _next = (_next + 1) % _samples.size();
+  if (_count < _samples.size()) _count++;
+}
+
+void RollingStats::clear() {
+  _next = 0;
+  _count = 0;
+}
+
+size_t RollingStats::count() const { return _count; }
+
+double RollingStats::last() const {
+  if (_count == 0) return 0.0;
+  return _samples[(_next + _samples.size() - 1) % _samples.size()];
+}
+
+double RollingStats::min() const {
+  if (_count == 0) return 0.0;
+  return *std::min_element(_samples.begin(), _samples.begin() + _count);
+}
+
+double RollingStats::max() const {
+  if (_count == 0) return 0.0;
+  return *std::max_element(_samples.begin(), _samples.begin() + _count);
+}
+
+double RollingStats::average() const {
+  if (_count == 0) return 0.0;
+  double sum = 0.0;
+  for (size_t i = 0; i < _count; i++) sum += _samples[i];
+  return sum / _count;
+}
+
+double RollingStats::percentile(double p) const {
+  if (_count == 0) return 0.0;
+  std::vector<double> sorted(_samples.begin(), _samples.begin() + _count);
+  std::sort(sorted.begin(), sorted.end());
+  // Nearest-rank percentile
+  p = std::max(0.0, std::min(100.0, p));
+  size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * _count));
+  if (rank > 0) rank--;
+  return sorted[rank];
+}
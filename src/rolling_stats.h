@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+// Fixed-size window of samples (oldest overwritten first) used for frame
+// telemetry: min/avg/max and percentiles over the last `capacity` samples.
+class RollingStats {
+ public:
+  RollingStats(size_t capacity = 256);
+
+  void push(double sample);
+  void clear();
+
+  size_t count() const;
+  double last() const;
+  double min() const;
+  double max() const;
+  double average() const;
+  double percentile(double p) const;  // p in [0, 100]
+
+ private:
+  std::vector<double> _samples;
+  size_t _next;
+  size_t _count;
+};
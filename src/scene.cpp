@@ -0,0 +1,91 @@
+#include "scene.h"
+#include <algorithm>
+#include <cmath>
+#include "shadow_maps.h"
+
+Scene::Scene() {}
+
+Scene::Scene(const Model &model) : model(model) {}
+
+uint32_t Scene::addInstance(const glm::mat4 &transform) {
+  instances.push_back(transform);
+  instanceNodes.push_back(INVALID_TRANSFORM_HANDLE);
+  return static_cast<uint32_t>(instances.size() - 1);
+}
+
+uint32_t Scene::addInstance(TransformHandle node) {
+  instances.push_back(transforms.world(node));
+  instanceNodes.push_back(node);
+  return static_cast<uint32_t>(instances.size() - 1);
+}
+
+void Scene::addGrid(uint32_t count) {
+  if (count == 0) return;
+  AABB modelBounds;
+  for (const auto &mesh : model.meshes) modelBounds.extend(mesh.bounds);
+  // An empty model still gets its instances, at the origin
+  if (modelBounds.min.x > modelBounds.max.x) {
+    modelBounds.extend(glm::vec3(0.0f));
+  }
+
+  const uint32_t side = static_cast<uint32_t>(
+      std::ceil(std::sqrt(static_cast<float>(count))));
+  const float scale = 1.0f / side;
+  const glm::vec3 center = (modelBounds.min + modelBounds.max) * 0.5f;
+  const glm::vec3 size = modelBounds.max - modelBounds.min;
+  // Cells are the scaled model's footprint, the copies rest on the model's
+  // floor: cell translation, scale, then the model's floor center moved to
+  // the origin. The rows carry the y and z part of the translation.
+  const glm::vec3 pivot = glm::vec3(center.x, modelBounds.min.y, center.z);
+  TransformHandle row = INVALID_TRANSFORM_HANDLE;
+  for (uint32_t i = 0; i < count; i++) {
+    if (i % side == 0) {
+      TransformDesc rowDesc;
+      rowDesc.translation = glm::vec3(
+          0.0f, modelBounds.min.y - pivot.y * scale,
+          modelBounds.min.z + (i / side + 0.5f) * size.z * scale -
+              pivot.z * scale);
+      row = transforms.add(INVALID_TRANSFORM_HANDLE, rowDesc);
+      groupNodes.push_back(row);
+    }
+    TransformDesc desc;
+    desc.translation = glm::vec3(
+        modelBounds.min.x + (i % side + 0.5f) * size.x * scale -
+            pivot.x * scale,
+        0.0f, 0.0f);
+    desc.scale = glm::vec3(scale);
+    instanceNodes.push_back(transforms.add(row, desc));
+    instances.push_back(glm::mat4());
+  }
+  updateTransforms();
+}
+
+bool Scene::updateTransforms(ThreadPool *pool) {
+  transforms.update(pool);
+  if (transforms.updatedCount() == 0) return false;
+  bool moved = false;
+  for (size_t i = 0; i < instanceNodes.size(); i++) {
+    const TransformHandle node = instanceNodes[i];
+    if (node == INVALID_TRANSFORM_HANDLE || !transforms.worldChanged(node)) {
+      continue;
+    }
+    instances[i] = transforms.world(node);
+    moved = true;
+  }
+  return moved;
+}
+
+uint32_t Scene::instanceCount() const {
+  return static_cast<uint32_t>(instances.size());
+}
+
+AABB Scene::bounds() const {
+  AABB modelBounds;
+  for (const auto &mesh : model.meshes) modelBounds.extend(mesh.bounds);
+  AABB result;
+  if (modelBounds.min.x > modelBounds.max.x) return result;
+  for (const glm::mat4 &transform : instances) {
+    result.extend(transformBounds(modelBounds, transform));
+  }
+  return result;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "model.h"
+#include "renderer.h"
+#include "transform_hierarchy.h"
+
+class ThreadPool;
+
+// Copies of one model, each placed by its own object to scene space
+// transform. The instances share the model's geometry and materials: the
+// backend draws the visible instances of a sub-mesh with one instanced draw.
+// An instance is either placed once by a matrix or follows a node of the
+// transform hierarchy.
+class Scene {
+ public:
+  Scene();
+  explicit Scene(const Model &model);  // no instance yet
+
+  uint32_t addInstance(const glm::mat4 &transform);
+  // Placed by the world matrix of node, as of the last updateTransforms()
+  uint32_t addInstance(TransformHandle node);
+  // count instances on a square grid of the XZ plane, scaled down so that
+  // the grid covers the footprint of the model itself. Each grid row is a
+  // node of groupNodes, parent of the nodes of its instances.
+  void addGrid(uint32_t count);
+  // Updates the hierarchy then copies the world matrices that changed into
+  // instances. Returns whether any instance moved.
+  bool updateTransforms(ThreadPool *pool = nullptr);
+  uint32_t instanceCount() const;
+  AABB bounds() const;  // scene space, of every instance
+
+  Model model;
+  std::vector<glm::mat4> instances;
+  TransformHierarchy transforms;
+  // Per instance, INVALID_TRANSFORM_HANDLE when placed by a matrix
+  std::vector<TransformHandle> instanceNodes;
+  std::vector<TransformHandle> groupNodes;
+};
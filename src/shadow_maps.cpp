@@ -0,0 +1,173 @@
+#include "shadow_maps.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static glm::vec3 boxCorner(const AABB &box, uint32_t corner) {
+  return glm::vec3((corner & 1) ? box.max.x : box.min.x,
+                   (corner & 2) ? box.max.y : box.min.y,
+                   (corner & 4) ? box.max.z : box.min.z);
+}
+
+AABB transformBounds(const AABB &box, const glm::mat4 &matrix) {
+  AABB result;
+  for (uint32_t corner = 0; corner < 8; corner++) {
+    result.extend(glm::vec3(matrix * glm::vec4(boxCorner(box, corner), 1.0f)));
+  }
+  return result;
+}
+
+// NDC depth of a view-space distance in front of the camera
+static float projectDepth(const glm::mat4 &proj, float distance) {
+  glm::vec4 clip = proj * glm::vec4(0.0f, 0.0f, -distance, 1.0f);
+  return clip.z / clip.w;
+}
+
+void computeCascades(const glm::mat4 &view, const glm::mat4 &proj,
+                     float nearPlane, float shadowDistance,
+                     const glm::vec3 &direction, const AABB &sceneBounds,
+                     uint32_t mapSize,
+                     ShadowCascade cascades[SHADOW_CASCADE_COUNT]) {
+  const float lambda = 0.75f;  // 1: logarithmic, 0: uniform
+  const glm::mat4 invViewProj = glm::inverse(proj * view);
+  const glm::vec3 lightDirection = glm::normalize(direction);
+  const glm::vec3 up = std::abs(lightDirection.y) > 0.99f
+                           ? glm::vec3(1.0f, 0.0f, 0.0f)
+                           : glm::vec3(0.0f, 1.0f, 0.0f);
+  // Rotation only, the cascades are offset in light space below
+  const glm::mat4 lightView =
+      glm::lookAt(glm::vec3(0.0f), lightDirection, up);
+
+  // Scene depth range along the light, the light looks down -z
+  float minZ = std::numeric_limits<float>::max();
+  float maxZ = -std::numeric_limits<float>::max();
+  for (uint32_t corner = 0; corner < 8; corner++) {
+    float z = (lightView * glm::vec4(boxCorner(sceneBounds, corner), 1.0f)).z;
+    minZ = std::min(minZ, z);
+    maxZ = std::max(maxZ, z);
+  }
+  const float depthMargin = 0.01f * (maxZ - minZ) + 0.01f;
+
+  float splitBegin = nearPlane;
+  for (uint32_t c = 0; c < SHADOW_CASCADE_COUNT; c++) {
+    float p = static_cast<float>(c + 1) / SHADOW_CASCADE_COUNT;
+    float logSplit = nearPlane * std::pow(shadowDistance / nearPlane, p);
+    float uniformSplit = nearPlane + (shadowDistance - nearPlane) * p;
+    float splitEnd = lambda * logSplit + (1.0f - lambda) * uniformSplit;
+
+    // Bounding sphere of the frustum slice
+    glm::vec3 corners[8];
+    glm::vec3 center(0.0f);
+    const float sliceDepth[2] = {projectDepth(proj, splitBegin),
+                                 projectDepth(proj, splitEnd)};
+    for (uint32_t corner = 0; corner < 8; corner++) {
+      glm::vec4 ndc((corner & 1) ? 1.0f : -1.0f, (corner & 2) ? 1.0f : -1.0f,
+                    sliceDepth[corner >> 2], 1.0f);
+      glm::vec4 world = invViewProj * ndc;
+      corners[corner] = glm::vec3(world) / world.w;
+      center += corners[corner];
+    }
+    center /= 8.0f;
+    float radius = 0.0f;
+    for (uint32_t corner = 0; corner < 8; corner++) {
+      radius = std::max(radius, glm::length(corners[corner] - center));
+    }
+    // Quantized so that rounding noise doesn't invalidate the cache
+    radius = std::ceil(radius * 16.0f) / 16.0f;
+
+    float texelSize = 2.0f * radius / mapSize;
+    glm::vec3 lightCenter = glm::vec3(lightView * glm::vec4(center, 1.0f));
+    lightCenter.x = std::floor(lightCenter.x / texelSize) * texelSize;
+    lightCenter.y = std::floor(lightCenter.y / texelSize) * texelSize;
+
+    ShadowCascade &cascade = cascades[c];
+    cascade.view = lightView;
+    cascade.proj = glm::ortho(lightCenter.x - radius, lightCenter.x + radius,
+                              lightCenter.y - radius, lightCenter.y + radius,
+                              -maxZ - depthMargin, -minZ + depthMargin);
+    cascade.splitDepth = splitEnd;
+    cascade.texelSize = texelSize;
+    splitBegin = splitEnd;
+  }
+}
+
+glm::mat4 pointShadowFace(const glm::vec3 &position, float range,
+                          uint32_t face) {
+  static const glm::vec3 directions[POINT_SHADOW_FACES] = {
+      glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f),
+      glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+      glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)};
+  static const glm::vec3 ups[POINT_SHADOW_FACES] = {
+      glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+      glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, 1.0f),
+      glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f)};
+  glm::mat4 view =
+      glm::lookAt(position, position + directions[face], ups[face]);
+  glm::mat4 proj = glm::perspective(glm::radians(90.0f), 1.0f,
+                                    std::max(range * 0.01f, 0.05f), range);
+  return proj * view;
+}
+
+void ShadowCache::resize(uint32_t layerCount) {
+  _layers.assign(layerCount, Layer());
+}
+
+void ShadowCache::invalidate() {
+  for (Layer &layer : _layers) {
+    layer.valid = false;
+    layer.stale = true;
+    layer.staleSince = 0;
+  }
+}
+
+void ShadowCache::request(uint32_t layer, const glm::mat4 &viewProj,
+                          const glm::mat4 &model) {
+  Layer &entry = _layers[layer];
+  entry.requestedViewProj = viewProj;
+  entry.requestedModel = model;
+  bool changed =
+      !entry.valid ||
+      std::memcmp(&viewProj, &entry.viewProj, sizeof(glm::mat4)) != 0 ||
+      std::memcmp(&model, &entry.model, sizeof(glm::mat4)) != 0;
+  if (changed && !entry.stale) {
+    entry.stale = true;
+    entry.staleSince = _frame;
+  } else if (!changed) {
+    entry.stale = false;
+  }
+}
+
+void ShadowCache::schedule(uint32_t layerCount, uint32_t budget,
+                           std::vector<uint32_t> &layers) {
+  std::vector<uint32_t> stale;
+  for (uint32_t i = 0; i < layerCount; i++) {
+    if (_layers[i].stale) stale.push_back(i);
+  }
+  // Never rendered first, then the longest stale, in layer order on ties
+  std::stable_sort(stale.begin(), stale.end(), [this](uint32_t a, uint32_t b) {
+    if (_layers[a].valid != _layers[b].valid) return !_layers[a].valid;
+    return _layers[a].staleSince < _layers[b].staleSince;
+  });
+  if (stale.size() > budget) stale.resize(budget);
+  for (uint32_t i : stale) {
+    Layer &layer = _layers[i];
+    layer.viewProj = layer.requestedViewProj;
+    layer.model = layer.requestedModel;
+    layer.valid = true;
+    layer.stale = false;
+    layers.push_back(i);
+  }
+  _frame++;
+}
+
+const glm::mat4 &ShadowCache::viewProj(uint32_t layer) const {
+  return _layers[layer].viewProj;
+}
+
+uint32_t ShadowCache::staleCount(uint32_t layerCount) const {
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < layerCount; i++) {
+    if (_layers[i].stale) count++;
+  }
+  return count;
+}
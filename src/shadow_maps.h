@@ -0,0 +1,77 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "model.h"
+#include "renderer.h"
+
+// Must match shaders/shadows.glsl
+const uint32_t SHADOW_CASCADE_COUNT = 4;
+const uint32_t MAX_POINT_SHADOWS = 4;
+const uint32_t POINT_SHADOW_FACES = 6;
+
+struct ShadowCascade {
+  glm::mat4 view;
+  glm::mat4 proj;    // orthographic, Vulkan depth
+  float splitDepth;  // view-space distance where the cascade ends
+  float texelSize;   // world units per shadow map texel
+};
+
+// Cascades of a directional light over [nearPlane, shadowDistance] of the
+// camera, split between logarithmic and uniform (practical split scheme).
+// Each cascade bounds a sphere around its slice of the view frustum, so its
+// size doesn't change when the camera turns, and is snapped to whole texels
+// so that a cached map stays valid while the camera moves within a texel.
+// The depth range covers the whole scene so that casters outside the view
+// still cast. Direction is the one the light travels, in world space.
+void computeCascades(const glm::mat4 &view, const glm::mat4 &proj,
+                     float nearPlane, float shadowDistance,
+                     const glm::vec3 &direction, const AABB &sceneBounds,
+                     uint32_t mapSize,
+                     ShadowCascade cascades[SHADOW_CASCADE_COUNT]);
+
+// Face of a point light cube map, +x, -x, +y, -y, +z, -z, as a 90 degree
+// perspective view-projection reaching the light's range. The light passes
+// pick the face from the major axis of the light to fragment vector.
+glm::mat4 pointShadowFace(const glm::vec3 &position, float range,
+                          uint32_t face);
+
+// World-space box of an object-space box
+AABB transformBounds(const AABB &box, const glm::mat4 &matrix);
+
+// Bookkeeping of shadow map layers (cascades and cube faces): a layer is
+// re-rendered only when the matrices it is requested with differ from the
+// ones it was last rendered with, i.e. when its light or the geometry
+// moved. Stale layers are rendered under a per-frame budget, the longest
+// stale first; the others keep their previous contents and matrices so that
+// the light passes stay consistent with what the map holds.
+class ShadowCache {
+ public:
+  void resize(uint32_t layerCount);
+  void invalidate();  // every layer is rendered again
+
+  // Matrices of this frame, model moves the geometry
+  void request(uint32_t layer, const glm::mat4 &viewProj,
+               const glm::mat4 &model);
+  // Appends up to budget stale layers of [0, layerCount) and marks them
+  // rendered with their requested matrices
+  void schedule(uint32_t layerCount, uint32_t budget,
+                std::vector<uint32_t> &layers);
+
+  // Matrix the layer's contents were rendered with
+  const glm::mat4 &viewProj(uint32_t layer) const;
+  uint32_t staleCount(uint32_t layerCount) const;  // of [0, layerCount)
+
+ private:
+  struct Layer {
+    glm::mat4 requestedViewProj;
+    glm::mat4 requestedModel;
+    glm::mat4 viewProj;
+    glm::mat4 model;
+    bool valid = false;
+    bool stale = true;
+    uint64_t staleSince = 0;  // frame it went stale
+  };
+
+  std::vector<Layer> _layers;
+  uint64_t _frame = 0;
+};
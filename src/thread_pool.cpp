@@ -0,0 +1,76 @@
+#include "thread_pool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(uint32_t threadCount)
+    : _task(nullptr),
+      _taskCount(0),
+      _nextTask(0),
+      _busyWorkers(0),
+      _generation(0),
+      _stop(false) {
+  if (threadCount == 0) {
+    threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  for (uint32_t i = 1; i < threadCount; i++) {
+    _workers.emplace_back(&ThreadPool::workerLoop, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+  }
+  _wake.notify_all();
+  for (auto &worker : _workers) worker.join();
+}
+
+uint32_t ThreadPool::size() const {
+  return static_cast<uint32_t>(_workers.size()) + 1;
+}
+
+void ThreadPool::parallelFor(uint32_t taskCount,
+                             const std::function<void(uint32_t)> &task) {
+  if (taskCount == 0) return;
+  if (_workers.empty() || taskCount == 1) {
+    for (uint32_t i = 0; i < taskCount; i++) task(i);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _task = &task;
+    _taskCount = taskCount;
+    _nextTask = 0;
+    _busyWorkers = static_cast<uint32_t>(_workers.size());
+    _generation++;
+  }
+  _wake.notify_all();
+  runTasks();
+
+  // Every worker checks in, so none still holds the task on return
+  std::unique_lock<std::mutex> lock(_mutex);
+  _done.wait(lock, [this] { return _busyWorkers == 0; });
+  _task = nullptr;
+}
+
+void ThreadPool::workerLoop() {
+  uint64_t generation = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _wake.wait(lock,
+                 [&] { return _stop || _generation != generation; });
+      if (_stop) return;
+      generation = _generation;
+    }
+    runTasks();
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (--_busyWorkers == 0) _done.notify_one();
+  }
+}
+
+void ThreadPool::runTasks() {
+  for (uint32_t i = _nextTask++; i < _taskCount; i = _nextTask++) {
+    (*_task)(i);
+  }
+}
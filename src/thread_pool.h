@@ -0,0 +1,39 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running indexed tasks. The calling thread
+// takes part in the work and parallelFor returns once every task ran; one
+// parallelFor at a time.
+class ThreadPool {
+ public:
+  explicit ThreadPool(uint32_t threadCount = 0);  // 0: hardware threads
+  ~ThreadPool();
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  uint32_t size() const;  // workers plus the calling thread
+  // Runs task(0) .. task(taskCount - 1), in any order and thread
+  void parallelFor(uint32_t taskCount,
+                   const std::function<void(uint32_t)> &task);
+
+ private:
+  void workerLoop();
+  void runTasks();
+
+  std::vector<std::thread> _workers;
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  std::condition_variable _done;
+  const std::function<void(uint32_t)> *_task;
+  uint32_t _taskCount;
+  std::atomic<uint32_t> _nextTask;
+  uint32_t _busyWorkers;
+  uint64_t _generation;  // bumped by each parallelFor
+  bool _stop;
+};
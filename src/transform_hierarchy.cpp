@@ -0,0 +1,273 @@
+#include "transform_hierarchy.h"
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <stdexcept>
+#include "thread_pool.h"
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define TRANSFORM_HIERARCHY_SSE
+#endif
+
+// Nodes of a level per worker task
+static const uint32_t TASK_SIZE = 4096;
+
+// out = a * b, column-major. out must not alias a or b.
+static inline void multiply4x4(const float *a, const float *b, float *out) {
+#ifdef TRANSFORM_HIERARCHY_SSE
+  // Each column of out is the columns of a weighted by a column of b
+  const __m128 a0 = _mm_loadu_ps(a);
+  const __m128 a1 = _mm_loadu_ps(a + 4);
+  const __m128 a2 = _mm_loadu_ps(a + 8);
+  const __m128 a3 = _mm_loadu_ps(a + 12);
+  for (int c = 0; c < 4; c++) {
+    const float *column = b + 4 * c;
+    __m128 result = _mm_mul_ps(a0, _mm_set1_ps(column[0]));
+    result = _mm_add_ps(result, _mm_mul_ps(a1, _mm_set1_ps(column[1])));
+    result = _mm_add_ps(result, _mm_mul_ps(a2, _mm_set1_ps(column[2])));
+    result = _mm_add_ps(result, _mm_mul_ps(a3, _mm_set1_ps(column[3])));
+    _mm_storeu_ps(out + 4 * c, result);
+  }
+#else
+  for (int c = 0; c < 4; c++) {
+    for (int r = 0; r < 4; r++) {
+      out[4 * c + r] = a[r] * b[4 * c] + a[4 + r] * b[4 * c + 1] +
+                       a[8 + r] * b[4 * c + 2] + a[12 + r] * b[4 * c + 3];
+    }
+  }
+#endif
+}
+
+template <typename T>
+static void permute(std::vector<T> &values,
+                    const std::vector<uint32_t> &order) {
+  std::vector<T> sorted(values.size());
+  for (size_t i = 0; i < order.size(); i++) sorted[i] = values[order[i]];
+  values.swap(sorted);
+}
+
+TransformHierarchy::TransformHierarchy()
+    : _dirtyDepth(std::numeric_limits<uint32_t>::max()),
+      _updatedCount(0),
+      _sorted(true) {}
+
+TransformHandle TransformHierarchy::add(TransformHandle parent,
+                                        const TransformDesc &desc) {
+  uint32_t parentIndex = INVALID_TRANSFORM_HANDLE;
+  uint32_t depth = 0;
+  if (parent != INVALID_TRANSFORM_HANDLE) {
+    parentIndex = denseIndex(parent);
+    depth = _depths[parentIndex] + 1;
+  }
+
+  const uint32_t index = count();
+  const TransformHandle handle =
+      static_cast<TransformHandle>(_handleToDense.size());
+  for (auto &stream : _streams) stream.push_back(0.0f);
+  _parents.push_back(parentIndex);
+  _depths.push_back(depth);
+  _dirty.push_back(0);
+  _changed.push_back(0);
+  _worlds.push_back(glm::mat4());
+  _denseToHandle.push_back(handle);
+  _handleToDense.push_back(index);
+  _sorted = false;
+  write(index, desc);
+  return handle;
+}
+
+void TransformHierarchy::setLocal(TransformHandle handle,
+                                  const TransformDesc &desc) {
+  write(denseIndex(handle), desc);
+}
+
+TransformDesc TransformHierarchy::local(TransformHandle handle) const {
+  const uint32_t index = denseIndex(handle);
+  TransformDesc desc;
+  desc.translation = glm::vec3(_streams[TranslationX][index],
+                               _streams[TranslationY][index],
+                               _streams[TranslationZ][index]);
+  desc.rotation = glm::quat(
+      _streams[RotationW][index], _streams[RotationX][index],
+      _streams[RotationY][index], _streams[RotationZ][index]);
+  desc.scale = glm::vec3(_streams[ScaleX][index], _streams[ScaleY][index],
+                         _streams[ScaleZ][index]);
+  return desc;
+}
+
+void TransformHierarchy::clear() {
+  for (auto &stream : _streams) stream.clear();
+  _parents.clear();
+  _depths.clear();
+  _dirty.clear();
+  _changed.clear();
+  _worlds.clear();
+  _denseToHandle.clear();
+  _handleToDense.clear();
+  _levelOffsets.clear();
+  _dirtyDepth = std::numeric_limits<uint32_t>::max();
+  _updatedCount = 0;
+  _sorted = true;
+}
+
+void TransformHierarchy::update(ThreadPool *pool) {
+  if (!_sorted) sortByDepth();
+  const uint32_t levels = levelCount();
+  std::atomic<uint32_t> updated(0);
+  for (uint32_t level = 0; level < levels; level++) {
+    const uint32_t begin = _levelOffsets[level];
+    const uint32_t end = _levelOffsets[level + 1];
+    // Above the shallowest dirty node nothing moves, only what the last
+    // update() changed is forgotten
+    if (level < _dirtyDepth) {
+      if (_updatedCount > 0) {
+        std::fill(_changed.begin() + begin, _changed.begin() + end, 0);
+      }
+      continue;
+    }
+    const uint32_t taskCount = (end - begin + TASK_SIZE - 1) / TASK_SIZE;
+    if (!pool || taskCount < 2) {
+      updated += updateRange(begin, end);
+      continue;
+    }
+    // Parents are in the levels before, complete once parallelFor returns
+    pool->parallelFor(taskCount, [&](uint32_t task) {
+      const uint32_t taskBegin = begin + task * TASK_SIZE;
+      updated += updateRange(taskBegin, std::min(taskBegin + TASK_SIZE, end));
+    });
+  }
+  _updatedCount = updated;
+  _dirtyDepth = std::numeric_limits<uint32_t>::max();
+}
+
+uint32_t TransformHierarchy::count() const {
+  return static_cast<uint32_t>(_parents.size());
+}
+
+uint32_t TransformHierarchy::levelCount() const {
+  return _levelOffsets.empty()
+             ? 0
+             : static_cast<uint32_t>(_levelOffsets.size() - 1);
+}
+
+const glm::mat4 &TransformHierarchy::world(TransformHandle handle) const {
+  return _worlds[denseIndex(handle)];
+}
+
+bool TransformHierarchy::worldChanged(TransformHandle handle) const {
+  return _changed[denseIndex(handle)] != 0;
+}
+
+uint32_t TransformHierarchy::updatedCount() const { return _updatedCount; }
+
+uint32_t TransformHierarchy::denseIndex(TransformHandle handle) const {
+  if (handle >= _handleToDense.size()) {
+    throw std::runtime_error("invalid transform handle");
+  }
+  return _handleToDense[handle];
+}
+
+void TransformHierarchy::write(uint32_t index, const TransformDesc &desc) {
+  _streams[TranslationX][index] = desc.translation.x;
+  _streams[TranslationY][index] = desc.translation.y;
+  _streams[TranslationZ][index] = desc.translation.z;
+  _streams[RotationX][index] = desc.rotation.x;
+  _streams[RotationY][index] = desc.rotation.y;
+  _streams[RotationZ][index] = desc.rotation.z;
+  _streams[RotationW][index] = desc.rotation.w;
+  _streams[ScaleX][index] = desc.scale.x;
+  _streams[ScaleY][index] = desc.scale.y;
+  _streams[ScaleZ][index] = desc.scale.z;
+  _dirty[index] = 1;
+  _dirtyDepth = std::min(_dirtyDepth, _depths[index]);
+}
+
+// Stable counting sort of the nodes by depth, which keeps each level in
+// the order its nodes were added
+void TransformHierarchy::sortByDepth() {
+  _sorted = true;
+  const uint32_t n = count();
+  uint32_t levels = 0;
+  for (uint32_t depth : _depths) levels = std::max(levels, depth + 1);
+  _levelOffsets.assign(levels + 1, 0);
+  for (uint32_t depth : _depths) _levelOffsets[depth + 1]++;
+  for (uint32_t level = 0; level < levels; level++) {
+    _levelOffsets[level + 1] += _levelOffsets[level];
+  }
+  // Nodes added level by level are already in place
+  if (std::is_sorted(_depths.begin(), _depths.end())) return;
+
+  std::vector<uint32_t> order(n);  // sorted to current dense index
+  std::vector<uint32_t> next(_levelOffsets.begin(), _levelOffsets.end() - 1);
+  for (uint32_t i = 0; i < n; i++) order[next[_depths[i]]++] = i;
+  std::vector<uint32_t> sortedIndex(n);
+  for (uint32_t i = 0; i < n; i++) sortedIndex[order[i]] = i;
+
+  for (auto &stream : _streams) permute(stream, order);
+  permute(_parents, order);
+  for (uint32_t &parent : _parents) {
+    if (parent != INVALID_TRANSFORM_HANDLE) parent = sortedIndex[parent];
+  }
+  permute(_depths, order);
+  permute(_dirty, order);
+  permute(_changed, order);
+  permute(_worlds, order);
+  permute(_denseToHandle, order);
+  for (uint32_t i = 0; i < n; i++) _handleToDense[_denseToHandle[i]] = i;
+}
+
+uint32_t TransformHierarchy::updateRange(uint32_t begin, uint32_t end) {
+  const float *translationX = _streams[TranslationX].data();
+  const float *translationY = _streams[TranslationY].data();
+  const float *translationZ = _streams[TranslationZ].data();
+  const float *rotationX = _streams[RotationX].data();
+  const float *rotationY = _streams[RotationY].data();
+  const float *rotationZ = _streams[RotationZ].data();
+  const float *rotationW = _streams[RotationW].data();
+  const float *scaleX = _streams[ScaleX].data();
+  const float *scaleY = _streams[ScaleY].data();
+  const float *scaleZ = _streams[ScaleZ].data();
+
+  uint32_t updated = 0;
+  for (uint32_t i = begin; i < end; i++) {
+    const uint32_t parent = _parents[i];
+    const bool parentChanged =
+        parent != INVALID_TRANSFORM_HANDLE && _changed[parent];
+    if (!_dirty[i] && !parentChanged) {
+      _changed[i] = 0;
+      continue;
+    }
+    _dirty[i] = 0;
+    _changed[i] = 1;
+    updated++;
+
+    // Columns of the rotation scaled by their axis, then the translation
+    const float x = rotationX[i], y = rotationY[i], z = rotationZ[i];
+    const float w = rotationW[i];
+    const float sx = scaleX[i], sy = scaleY[i], sz = scaleZ[i];
+    const float local[16] = {(1.0f - 2.0f * (y * y + z * z)) * sx,
+                             2.0f * (x * y + w * z) * sx,
+                             2.0f * (x * z - w * y) * sx,
+                             0.0f,
+                             2.0f * (x * y - w * z) * sy,
+                             (1.0f - 2.0f * (x * x + z * z)) * sy,
+                             2.0f * (y * z + w * x) * sy,
+                             0.0f,
+                             2.0f * (x * z + w * y) * sz,
+                             2.0f * (y * z - w * x) * sz,
+                             (1.0f - 2.0f * (x * x + y * y)) * sz,
+                             0.0f,
+                             translationX[i],
+                             translationY[i],
+                             translationZ[i],
+                             1.0f};
+    float *world = &_worlds[i][0][0];
+    if (parent == INVALID_TRANSFORM_HANDLE) {
+      std::copy(local, local + 16, world);
+    } else {
+      multiply4x4(&_worlds[parent][0][0], local, world);
+    }
+  }
+  return updated;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <cstdint>
+#include <glm/gtc/quaternion.hpp>
+#include <vector>
+#include "renderer.h"
+
+class ThreadPool;
+
+// Local transform of a node: scaled, then rotated, then translated
+struct TransformDesc {
+  glm::vec3 translation = glm::vec3(0.0f);
+  glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+  glm::vec3 scale = glm::vec3(1.0f);
+};
+
+typedef uint32_t TransformHandle;
+const TransformHandle INVALID_TRANSFORM_HANDLE = 0xFFFFFFFF;
+
+// Local TRS transforms of a node hierarchy and the world matrices derived
+// from them, stored as structure of arrays sorted by depth: each level is a
+// contiguous range and parents come before their children. update() walks
+// the levels in order, splitting each across the worker pool, with 4x4
+// multiplies in SSE. Only the nodes set since the last update() and their
+// descendants are recomputed, static subtrees cost a flag test per node.
+class TransformHierarchy {
+ public:
+  TransformHierarchy();
+
+  // Parent INVALID_TRANSFORM_HANDLE: a root. Added nodes are sorted into
+  // their level by the next update(), handles stay valid. No removal,
+  // clear() drops every node.
+  TransformHandle add(TransformHandle parent, const TransformDesc &desc);
+  void setLocal(TransformHandle handle, const TransformDesc &desc);
+  TransformDesc local(TransformHandle handle) const;
+  void clear();
+  // pool null: on the calling thread only
+  void update(ThreadPool *pool = nullptr);
+
+  uint32_t count() const;
+  uint32_t levelCount() const;  // as sorted by the last update()
+  // As of the last update()
+  const glm::mat4 &world(TransformHandle handle) const;
+  bool worldChanged(TransformHandle handle) const;  // by the last update()
+  uint32_t updatedCount() const;  // world matrices the last update() wrote
+
+ private:
+  enum Stream {
+    TranslationX,
+    TranslationY,
+    TranslationZ,
+    RotationX,
+    RotationY,
+    RotationZ,
+    RotationW,
+    ScaleX,
+    ScaleY,
+    ScaleZ,
+    StreamCount
+  };
+
+  // Dense index, by depth
+  std::vector<float> _streams[StreamCount];
+  std::vector<uint32_t> _parents;  // INVALID_TRANSFORM_HANDLE for roots
+  std::vector<uint32_t> _depths;
+  std::vector<uint8_t> _dirty;    // local set since the last update()
+  std::vector<uint8_t> _changed;  // world written by the last update()
+  std::vector<glm::mat4> _worlds;
+  std::vector<uint32_t> _denseToHandle;
+  std::vector<uint32_t> _handleToDense;
+  std::vector<uint32_t> _levelOffsets;  // levelCount() + 1 entries
+  uint32_t _dirtyDepth;  // of the shallowest dirty node
+  uint32_t _updatedCount;
+  bool _sorted;
+
+  uint32_t denseIndex(TransformHandle handle) const;
+  void write(uint32_t index, const TransformDesc &desc);
+  void sortByDepth();
+  // Nodes [begin, end) of one level, returns the worlds written
+  uint32_t updateRange(uint32_t begin, uint32_t end);
+};
@@ -1,1601 +1,5775 @@
-#include "vk_backend.h"
-#define STB_IMAGE_IMPLEMENTATION
-#include <stb_image.h>
-
-VkBackend::VkBackend() {}
-
-VkBackend::~VkBackend() {}
-
-void VkBackend::init(GLFWwindow *window, Model model) {
-  _window = window;
-  _model = model;
-  createInstance();
-  setupDebugCallback();
-  createSurface();
-  pickPhysicalDevice();
-  createLogicalDevice();
-  createSwapChain();
-  createImageViews();
-  createGBufferAttachments();
-  createRenderPass();
-  _gpassPipeline =
-      createGraphicsPipeline("shaders/gpass.vert.spv", "shaders/gpass.frag.spv",
-                             createGPassDescriptorSetLayout(), 0, 3);
-  _lightPipeline =
-      createGraphicsPipeline("shaders/light.vert.spv", "shaders/light.frag.spv",
-                             createLightDescriptorSetLayout(), 1, 1);
-  createCommandPool();
-  createDepthResources();
-  createFramebuffers();
-  // Load textures in GPU memory
-  for (auto &mesh : _model.meshes) {
-    // TODO: texture cache
-
-    Texture diffuse = createTextureImage(mesh.diffuse_texname);
-    createTextureImageView(diffuse);
-    createTextureSampler(diffuse);
-    _diffuseTextures.push_back(diffuse);
-
-    Texture specular = createTextureImage(mesh.specular_texname);
-    createTextureImageView(specular);
-    createTextureSampler(specular);
-    _specularTextures.push_back(specular);
-
-    Texture normal = createTextureImage(mesh.normal_texname);
-    createTextureImageView(normal);
-    createTextureSampler(normal);
-    _normalTextures.push_back(normal);
-  }
-
-  _vertexBuffer = createVertexBuffer(model.vertices);
-  _indexBuffer = createIndexBuffer(model.indices);
-
-  _gpassUniformBuffer = createUniformBuffer(sizeof(gPassUbo));
-  _lightUniformBuffer = createUniformBuffer(sizeof(lightUbo));
-
-  // Geometry pass descriptor sets
-  _gpassPipeline.descriptorPool =
-      createGPassDescriptorPool(static_cast<uint32_t>(_model.meshes.size()));
-  for (size_t i = 0; i < model.meshes.size(); i++) {
-    VkDescriptorSet descriptorSet = createGPassDescriptorSet(
-        _gpassPipeline.descriptorPool, _gpassPipeline.descriptorSetLayout,
-        _diffuseTextures[i], _specularTextures[i], _normalTextures[i]);
-    _gpassPipeline.descriptorSets.push_back(descriptorSet);
-  }
-  _lightPipeline.descriptorPool = createLightDescriptorPool(1);
-  _lightPipeline.descriptorSets.push_back(createLightDescriptorSet(
-      _lightPipeline.descriptorPool, _lightPipeline.descriptorSetLayout));
-  createCommandBuffers();
-  createSemaphores();
-}
-
-void VkBackend::recreateSwapChain() {
-  vkDeviceWaitIdle(_device);
-
-  cleanupSwapChain();
-
-  createSwapChain();
-  createImageViews();
-  createRenderPass();
-  _gpassPipeline =
-      createGraphicsPipeline("shaders/vert.spv", "shaders/frag.spv",
-                             createGPassDescriptorSetLayout(), 0, 3);
-  // createGraphicsPipeline();
-  createFramebuffers();
-  createCommandBuffers();
-}
-
-void VkBackend::drawFrame() {
-  uint32_t imageIndex;
-  vkQueueWaitIdle(_presentQueue);
-  VkResult result = vkAcquireNextImageKHR(
-      _device, _swapChain, std::numeric_limits<uint64_t>::max(),
-      _imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
-  if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-    recreateSwapChain();
-    return;
-  } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
-    throw std::runtime_error("failed to acquire swap chain image!");
-  }
-
-  VkSubmitInfo submitInfo = {};
-  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-
-  VkSemaphore waitSemaphores[] = {_imageAvailableSemaphore};
-  VkPipelineStageFlags waitStages[] = {
-      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-  submitInfo.waitSemaphoreCount = 1;
-  submitInfo.pWaitSemaphores = waitSemaphores;
-  submitInfo.pWaitDstStageMask = waitStages;
-  submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers = &_commandBuffers[imageIndex];
-  VkSemaphore signalSemaphores[] = {_renderFinishedSemaphore};
-  submitInfo.signalSemaphoreCount = 1;
-  submitInfo.pSignalSemaphores = signalSemaphores;
-  result = vkQueueSubmit(_graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-  vkCheckResult(result, "vkQueueSubmit");
-
-  VkPresentInfoKHR presentInfo = {};
-  presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-
-  presentInfo.waitSemaphoreCount = 1;
-  presentInfo.pWaitSemaphores = signalSemaphores;
-  VkSwapchainKHR swapChains[] = {_swapChain};
-  presentInfo.swapchainCount = 1;
-  presentInfo.pSwapchains = swapChains;
-  presentInfo.pImageIndices = &imageIndex;
-  presentInfo.pResults = nullptr;
-  result = vkQueuePresentKHR(_presentQueue, &presentInfo);
-  if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
-    recreateSwapChain();
-  } else if (result != VK_SUCCESS) {
-    throw std::runtime_error("failed to present swap chain image!");
-  }
-}
-
-void VkBackend::update() {
-  static auto startTime = std::chrono::high_resolution_clock::now();
-
-  auto currentTime = std::chrono::high_resolution_clock::now();
-  float time = std::chrono::duration_cast<std::chrono::milliseconds>(
-                   currentTime - startTime)
-                   .count() /
-               1000.0f;
-  gPassUbo gpassUbo = {};
-  gpassUbo.model = glm::rotate(glm::mat4(), time * glm::radians(10.0f),
-                               glm::vec3(0.0f, 1.0f, 0.0f));
-  gpassUbo.view =
-      glm::lookAt(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(1.0f, 2.0f, 0.0f),
-                  glm::vec3(0.0f, 1.0f, 0.0f));
-  gpassUbo.proj = glm::perspective(
-      glm::radians(45.0f),
-      _swapChainExtent.width / (float)_swapChainExtent.height, 0.1f, 100.0f);
-  gpassUbo.proj[1][1] *= -1;
-  void *data;
-  vkMapMemory(_device, _gpassUniformBuffer.bufferMemory, 0, sizeof(gpassUbo), 0,
-              &data);
-  memcpy(data, &gpassUbo, sizeof(gpassUbo));
-  vkUnmapMemory(_device, _gpassUniformBuffer.bufferMemory);
-
-  lightUbo light = {};
-  light.viewPosition = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
-  for (int i = 0; i < 6; i++) {
-    light.lights[i].color = glm::vec3(1.0f, 0.0f, 0.0f);
-    light.lights[i].position = glm::vec4(1.0f, 1.0f, 0.0f, 1.0f);
-    light.lights[i].radius = 25.0f;
-  }
-  // White
-  light.lights[0].position = glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
-  light.lights[0].color = glm::vec3(1.5f);
-  light.lights[0].radius = 15.0f * 0.25f;
-  // Red
-  light.lights[1].position = glm::vec4(-2.0f, 0.0f, 0.0f, 0.0f);
-  light.lights[1].color = glm::vec3(1.0f, 0.0f, 0.0f);
-  light.lights[1].radius = 15.0f;
-  // Blue
-  light.lights[2].position = glm::vec4(2.0f, 1.0f, 0.0f, 0.0f);
-  light.lights[2].color = glm::vec3(0.0f, 0.0f, 2.5f);
-  light.lights[2].radius = 5.0f;
-  // Yellow
-  light.lights[3].position = glm::vec4(0.0f, 0.9f, 0.5f, 0.0f);
-  light.lights[3].color = glm::vec3(1.0f, 1.0f, 0.0f);
-  light.lights[3].radius = 2.0f;
-  // Green
-  light.lights[4].position = glm::vec4(0.0f, 0.5f, 0.0f, 0.0f);
-  light.lights[4].color = glm::vec3(0.0f, 1.0f, 0.2f);
-  light.lights[4].radius = 5.0f;
-  // Yellow
-  light.lights[5].position = glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
-  light.lights[5].color = glm::vec3(1.0f, 0.7f, 0.3f);
-  light.lights[5].radius = 25.0f;
-
-  light.lights[0].position.x = sin(glm::radians(360.0f * time)) * 5.0f;
-  light.lights[0].position.z = cos(glm::radians(360.0f * time)) * 5.0f;
-
-  light.lights[1].position.x =
-      -4.0f + sin(glm::radians(360.0f * time) + 45.0f) * 2.0f;
-  light.lights[1].position.z =
-      0.0f + cos(glm::radians(360.0f * time) + 45.0f) * 2.0f;
-
-  light.lights[2].position.x = 4.0f + sin(glm::radians(360.0f * time)) * 2.0f;
-  light.lights[2].position.z = 0.0f + cos(glm::radians(360.0f * time)) * 2.0f;
-
-  light.lights[4].position.x =
-      0.0f + sin(glm::radians(360.0f * time + 90.0f)) * 5.0f;
-  light.lights[4].position.z =
-      0.0f - cos(glm::radians(360.0f * time + 45.0f)) * 5.0f;
-
-  light.lights[5].position.x =
-      0.0f + sin(glm::radians(-360.0f * time + 135.0f)) * 10.0f;
-  light.lights[5].position.z =
-      0.0f - cos(glm::radians(-360.0f * time - 45.0f)) * 10.0f;
-
-  vkMapMemory(_device, _lightUniformBuffer.bufferMemory, 0, sizeof(lightUbo), 0,
-              &data);
-  memcpy(data, &light, sizeof(lightUbo));
-  vkUnmapMemory(_device, _lightUniformBuffer.bufferMemory);
-}
-
-void VkBackend::createInstance() {
-  VkApplicationInfo appInfo = {};
-  appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-  appInfo.pApplicationName = "VkRenderer";
-  appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
-  appInfo.pEngineName = "";
-  appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-  appInfo.apiVersion = VK_MAKE_VERSION(1, 0, VK_HEADER_VERSION);
-
-  VkInstanceCreateInfo createInfo = {};
-  createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-  createInfo.pApplicationInfo = &appInfo;
-
-  auto extensions = getRequiredExtensions();
-  createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
-  createInfo.ppEnabledExtensionNames = extensions.data();
-  if (enableValidationLayers && !checkValidationLayerSupport()) {
-    createInfo.enabledLayerCount =
-        static_cast<uint32_t>(validationLayers.size());
-    createInfo.ppEnabledLayerNames = validationLayers.data();
-  } else {
-    createInfo.enabledLayerCount = 0;
-  }
-
-  VkResult result;
-  result = vkCreateInstance(&createInfo, nullptr, &_instance);
-  vkCheckResult(result, "vkCreateInstance");
-}
-
-void VkBackend::setupDebugCallback() {
-  if (!enableValidationLayers) return;
-  VkDebugReportCallbackCreateInfoEXT createInfo = {};
-  createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_REPORT_CALLBACK_CREATE_INFO_EXT;
-  createInfo.flags =
-      VK_DEBUG_REPORT_ERROR_BIT_EXT | VK_DEBUG_REPORT_WARNING_BIT_EXT;
-  createInfo.pfnCallback = debugCallback;
-  if (CreateDebugReportCallbackEXT(_instance, &createInfo, nullptr,
-                                   &_callback) != VK_SUCCESS) {
-    throw std::runtime_error("failed to set up debug callback!");
-  }
-}
-
-void VkBackend::createSurface() {
-  if (glfwCreateWindowSurface(_instance, _window, nullptr, &_surface) !=
-      VK_SUCCESS) {
-    throw std::runtime_error("failed to create window surface!");
-  }
-}
-
-void VkBackend::pickPhysicalDevice() {
-  uint32_t deviceCount = 0;
-  VkResult result;
-  result = vkEnumeratePhysicalDevices(_instance, &deviceCount, nullptr);
-  vkCheckResult(result, "vkEnumeratePhysicalDevices");
-  if (deviceCount == 0)
-    throw std::runtime_error("failed to find GPUs with Vulkan support!");
-  std::vector<VkPhysicalDevice> devices(deviceCount);
-  result = vkEnumeratePhysicalDevices(_instance, &deviceCount, devices.data());
-  vkCheckResult(result, "vkEnumeratePhysicalDevices");
-  std::multimap<int, VkPhysicalDevice> candidates;
-  for (const auto &device : devices) {
-    int score = rateDeviceSuitability(device, _surface);
-    candidates.insert(std::make_pair(score, device));
-  }
-  if (candidates.rbegin()->first > 0) {
-    _physicalDevice = candidates.rbegin()->second;
-  }
-  if (_physicalDevice == VK_NULL_HANDLE) {
-    throw std::runtime_error("failed to find a suitable GPU!");
-  }
-}
-
-void VkBackend::createLogicalDevice() {
-  QueueFamilyIndices indices = findQueueFamilies(_physicalDevice, _surface);
-  std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-  std::set<int> uniqueQueueFamilies = {indices.graphicsFamily,
-                                       indices.presentFamily};
-
-  float queuePriority = 1.0f;
-  for (int queueFamily : uniqueQueueFamilies) {
-    VkDeviceQueueCreateInfo queueCreateInfo = {};
-    queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    queueCreateInfo.queueFamilyIndex = queueFamily;
-    queueCreateInfo.queueCount = 1;
-    queueCreateInfo.pQueuePriorities = &queuePriority;
-    queueCreateInfos.push_back(queueCreateInfo);
-  }
-
-  VkPhysicalDeviceFeatures deviceFeatures = {};
-  deviceFeatures.samplerAnisotropy = VK_TRUE;
-
-  VkDeviceCreateInfo createInfo = {};
-  createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-
-  createInfo.queueCreateInfoCount =
-      static_cast<uint32_t>(queueCreateInfos.size());
-  createInfo.pQueueCreateInfos = queueCreateInfos.data();
-
-  createInfo.pEnabledFeatures = &deviceFeatures;
-
-  createInfo.enabledExtensionCount =
-      static_cast<uint32_t>(deviceExtensions.size());
-  createInfo.ppEnabledExtensionNames = deviceExtensions.data();
-
-  if (enableValidationLayers) {
-    createInfo.enabledLayerCount =
-        static_cast<uint32_t>(validationLayers.size());
-    createInfo.ppEnabledLayerNames = validationLayers.data();
-  } else {
-    createInfo.enabledLayerCount = 0;
-  }
-  VkResult result;
-  result = vkCreateDevice(_physicalDevice, &createInfo, nullptr, &_device);
-  vkCheckResult(result, "vkCreateDevice");
-  vkGetDeviceQueue(_device, indices.graphicsFamily, 0, &_graphicsQueue);
-  vkGetDeviceQueue(_device, indices.presentFamily, 0, &_presentQueue);
-}
-
-void VkBackend::createSwapChain() {
-  SwapChainSupportDetails swapChainSupport =
-      querySwapChainSupport(_physicalDevice, _surface);
-
-  VkSurfaceFormatKHR surfaceFormat =
-      chooseSwapSurfaceFormat(swapChainSupport.formats);
-  VkPresentModeKHR presentMode =
-      chooseSwapPresentMode(swapChainSupport.presentModes);
-  VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
-
-  uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
-  if (swapChainSupport.capabilities.maxImageCount > 0 &&
-      imageCount > swapChainSupport.capabilities.maxImageCount) {
-    imageCount = swapChainSupport.capabilities.maxImageCount;
-  }
-  VkSwapchainCreateInfoKHR createInfo = {};
-  createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-  createInfo.surface = _surface;
-  createInfo.minImageCount = imageCount;
-  createInfo.imageFormat = surfaceFormat.format;
-  createInfo.imageColorSpace = surfaceFormat.colorSpace;
-  createInfo.imageExtent = extent;
-  createInfo.imageArrayLayers = 1;
-  createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-  QueueFamilyIndices indices = findQueueFamilies(_physicalDevice, _surface);
-  if (indices.graphicsFamily != indices.presentFamily) {
-    uint32_t queueFamilyIndices[] = {(uint32_t)indices.graphicsFamily,
-                                     (uint32_t)indices.presentFamily};
-    createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
-    createInfo.queueFamilyIndexCount = 2;
-    createInfo.pQueueFamilyIndices = queueFamilyIndices;
-  } else {
-    createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    createInfo.queueFamilyIndexCount = 0;      // Optional
-    createInfo.pQueueFamilyIndices = nullptr;  // Optional
-  }
-  createInfo.preTransform = swapChainSupport.capabilities.currentTransform;
-  createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-  createInfo.presentMode = presentMode;
-  createInfo.clipped = VK_TRUE;
-  createInfo.oldSwapchain = VK_NULL_HANDLE;
-  VkResult result;
-  result = vkCreateSwapchainKHR(_device, &createInfo, nullptr, &_swapChain);
-  vkCheckResult(result, "vkCreateSwapchainKHR");
-
-  result = vkGetSwapchainImagesKHR(_device, _swapChain, &imageCount, nullptr);
-  vkCheckResult(result, "vkGetSwapchainImagesKHR");
-  _swapChainImages.resize(imageCount);
-  result = vkGetSwapchainImagesKHR(_device, _swapChain, &imageCount,
-                                   _swapChainImages.data());
-  vkCheckResult(result, "vkGetSwapchainImagesKHR");
-
-  _swapChainImageFormat = surfaceFormat.format;
-  _swapChainExtent = extent;
-}
-
-void VkBackend::createImageViews() {
-  _swapChainImageViews.resize(_swapChainImages.size());
-  for (size_t i = 0; i < _swapChainImages.size(); i++) {
-    _swapChainImageViews[i] = createImageView(
-        _swapChainImages[i], _swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT);
-  }
-}
-
-void VkBackend::createRenderPass() {
-  std::array<VkAttachmentDescription, 5> attachments{};
-  attachments[0].format = _swapChainImageFormat;
-  attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;  // must match swap chain
-                                                   // image
-  attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-  attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-  attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-  attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-  attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  attachments[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-  attachments[1].format = _gBufferAttachments[0].format;
-  attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
-  attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-  attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-  attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-  attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-  attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  attachments[1].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-  attachments[2].format = _gBufferAttachments[1].format;
-  attachments[2].samples = VK_SAMPLE_COUNT_1_BIT;
-  attachments[2].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-  attachments[2].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-  attachments[2].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-  attachments[2].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-  attachments[2].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  attachments[2].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-  attachments[3].format = _gBufferAttachments[2].format;
-  attachments[3].samples = VK_SAMPLE_COUNT_1_BIT;
-  attachments[3].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-  attachments[3].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-  attachments[3].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-  attachments[3].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-  attachments[3].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  attachments[3].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-  attachments[4].format = findDepthFormat(_physicalDevice);
-  attachments[4].samples = VK_SAMPLE_COUNT_1_BIT;
-  attachments[4].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-  attachments[4].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-  attachments[4].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-  attachments[4].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-  attachments[4].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  attachments[4].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-  std::array<VkSubpassDescription, 2> subpasses{};
-
-  std::array<VkAttachmentReference, 3> firstSubpassColors;
-  firstSubpassColors[0] = {1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
-  firstSubpassColors[1] = {2, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
-  firstSubpassColors[2] = {3, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
-
-  VkAttachmentReference firstSubpassDepth = {
-      4, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
-
-  subpasses[0].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-  subpasses[0].colorAttachmentCount =
-      static_cast<uint32_t>(firstSubpassColors.size());
-  subpasses[0].pColorAttachments = firstSubpassColors.data();
-  subpasses[0].pDepthStencilAttachment = &firstSubpassDepth;
-
-  VkAttachmentReference secondSubpassColor = {
-      0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
-  std::array<VkAttachmentReference, 3> secondSubpassInput;
-  secondSubpassInput[0] = {1, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
-  secondSubpassInput[1] = {2, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
-  secondSubpassInput[2] = {3, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
-  VkAttachmentReference secondSubpassDepth = {
-      4, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
-
-  subpasses[1].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-  subpasses[1].colorAttachmentCount = 1;
-  subpasses[1].pColorAttachments = &secondSubpassColor;
-  subpasses[1].inputAttachmentCount =
-      static_cast<uint32_t>(secondSubpassInput.size());
-  subpasses[1].pInputAttachments = secondSubpassInput.data();
-  subpasses[1].pDepthStencilAttachment = &secondSubpassDepth;
-
-  std::array<VkSubpassDependency, 3> dependencies;
-
-  dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
-  dependencies[0].dstSubpass = 0;
-  dependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-  dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  dependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-  dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
-                                  VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-  dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-
-  dependencies[1].srcSubpass = 0;
-  dependencies[1].dstSubpass = 1;
-  dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-  dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-  dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-  dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-
-  dependencies[2].srcSubpass = 0;
-  dependencies[2].dstSubpass = VK_SUBPASS_EXTERNAL;
-  dependencies[2].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  dependencies[2].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-  dependencies[2].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
-                                  VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-  dependencies[2].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-  dependencies[2].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-
-  VkRenderPassCreateInfo renderPassInfo = {};
-  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-  renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
-  renderPassInfo.pAttachments = attachments.data();
-  renderPassInfo.subpassCount = static_cast<uint32_t>(subpasses.size());
-  renderPassInfo.pSubpasses = subpasses.data();
-  renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
-  renderPassInfo.pDependencies = dependencies.data();
-
-  VkResult result =
-      vkCreateRenderPass(_device, &renderPassInfo, nullptr, &_renderPass);
-  vkCheckResult(result, "vkCreateRenderPass");
-}
-
-VkDescriptorSetLayout VkBackend::createGPassDescriptorSetLayout() {
-  VkDescriptorSetLayout descriptorSetLayout = {};
-  VkDescriptorSetLayoutBinding uboLayoutBinding = {};
-  uboLayoutBinding.binding = 0;
-  uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-  uboLayoutBinding.descriptorCount = 1;
-  uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-  uboLayoutBinding.pImmutableSamplers = nullptr;
-
-  VkDescriptorSetLayoutBinding ambientSamplerLayoutBinding = {};
-  ambientSamplerLayoutBinding.binding = 1;
-  ambientSamplerLayoutBinding.descriptorCount = 1;
-  ambientSamplerLayoutBinding.descriptorType =
-      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-  ambientSamplerLayoutBinding.pImmutableSamplers = nullptr;
-  ambientSamplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
-  VkDescriptorSetLayoutBinding diffuseSamplerLayoutBinding = {};
-  diffuseSamplerLayoutBinding.binding = 2;
-  diffuseSamplerLayoutBinding.descriptorCount = 1;
-  diffuseSamplerLayoutBinding.descriptorType =
-      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-  diffuseSamplerLayoutBinding.pImmutableSamplers = nullptr;
-  diffuseSamplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
-  VkDescriptorSetLayoutBinding specularSamplerLayoutBinding = {};
-  specularSamplerLayoutBinding.binding = 3;
-  specularSamplerLayoutBinding.descriptorCount = 1;
-  specularSamplerLayoutBinding.descriptorType =
-      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-  specularSamplerLayoutBinding.pImmutableSamplers = nullptr;
-  specularSamplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
-  std::array<VkDescriptorSetLayoutBinding, 4> bindings = {
-      uboLayoutBinding, ambientSamplerLayoutBinding,
-      diffuseSamplerLayoutBinding, specularSamplerLayoutBinding};
-  VkDescriptorSetLayoutCreateInfo layoutInfo = {};
-  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-  layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
-  layoutInfo.pBindings = bindings.data();
-
-  VkResult result = vkCreateDescriptorSetLayout(_device, &layoutInfo, nullptr,
-                                                &descriptorSetLayout);
-  vkCheckResult(result, "vkCreateDescriptorSetLayout");
-  return descriptorSetLayout;
-}
-
-VkDescriptorSetLayout VkBackend::createLightDescriptorSetLayout() {
-  VkDescriptorSetLayout descriptorSetLayout = {};
-
-  VkDescriptorSetLayoutBinding positionInputLayoutBinding = {};
-  positionInputLayoutBinding.binding = 0;
-  positionInputLayoutBinding.descriptorCount = 1;
-  positionInputLayoutBinding.descriptorType =
-      VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-  positionInputLayoutBinding.pImmutableSamplers = nullptr;
-  positionInputLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
-  VkDescriptorSetLayoutBinding normalInputLayoutBinding = {};
-  normalInputLayoutBinding.binding = 1;
-  normalInputLayoutBinding.descriptorCount = 1;
-  normalInputLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-  normalInputLayoutBinding.pImmutableSamplers = nullptr;
-  normalInputLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
-  VkDescriptorSetLayoutBinding albedoInputLayoutBinding = {};
-  albedoInputLayoutBinding.binding = 2;
-  albedoInputLayoutBinding.descriptorCount = 1;
-  albedoInputLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-  albedoInputLayoutBinding.pImmutableSamplers = nullptr;
-  albedoInputLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
-  VkDescriptorSetLayoutBinding uboLayoutBinding = {};
-  uboLayoutBinding.binding = 3;
-  uboLayoutBinding.descriptorCount = 1;
-  uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-  uboLayoutBinding.pImmutableSamplers = nullptr;
-  uboLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
-  std::array<VkDescriptorSetLayoutBinding, 4> bindings = {
-      positionInputLayoutBinding, normalInputLayoutBinding,
-      albedoInputLayoutBinding, uboLayoutBinding};
-
-  VkDescriptorSetLayoutCreateInfo layoutInfo = {};
-  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-  layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
-  layoutInfo.pBindings = bindings.data();
-
-  VkResult result = vkCreateDescriptorSetLayout(_device, &layoutInfo, nullptr,
-                                                &descriptorSetLayout);
-  vkCheckResult(result, "vkCreateDescriptorSetLayout");
-  return descriptorSetLayout;
-}
-
-Pipeline VkBackend::createGraphicsPipeline(
-    const std::string vertexShader, const std::string fragShader,
-    VkDescriptorSetLayout descriptorSetLayout, uint32_t subpass_id,
-    uint32_t colorAttachmentCount) {
-  Pipeline pipeline = {};  // TODO: give pipeline his own class
-  pipeline.descriptorSetLayout = descriptorSetLayout;
-
-  auto vertShaderCode = readShader(vertexShader);
-  auto fragShaderCode = readShader(fragShader);
-  VkShaderModule vertShaderModule = createShaderModule(_device, vertShaderCode);
-  VkShaderModule fragShaderModule = createShaderModule(_device, fragShaderCode);
-
-  VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
-  vertShaderStageInfo.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-  vertShaderStageInfo.module = vertShaderModule;
-  vertShaderStageInfo.pName = "main";
-
-  VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
-  fragShaderStageInfo.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-  fragShaderStageInfo.module = fragShaderModule;
-  fragShaderStageInfo.pName = "main";
-
-  VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo,
-                                                    fragShaderStageInfo};
-
-  auto bindingDescription = VkVertex::getBindingDescription();
-  auto attributeDescriptions = VkVertex::getAttributeDescriptions();
-
-  VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
-  vertexInputInfo.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-  vertexInputInfo.vertexBindingDescriptionCount = 1;
-  vertexInputInfo.vertexAttributeDescriptionCount =
-      static_cast<uint32_t>(attributeDescriptions.size());
-  vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-  vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
-
-  VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
-  inputAssembly.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-  inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-  inputAssembly.primitiveRestartEnable = VK_FALSE;
-
-  VkViewport viewport = {};
-  viewport.x = 0.0f;
-  viewport.y = 0.0f;
-  viewport.width = (float)_swapChainExtent.width;
-  viewport.height = (float)_swapChainExtent.height;
-  viewport.minDepth = 0.0f;
-  viewport.maxDepth = 1.0f;
-
-  VkRect2D scissor = {};
-  scissor.offset = {0, 0};
-  scissor.extent = _swapChainExtent;
-
-  VkPipelineViewportStateCreateInfo viewportState = {};
-  viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-  viewportState.viewportCount = 1;
-  viewportState.pViewports = &viewport;
-  viewportState.scissorCount = 1;
-  viewportState.pScissors = &scissor;
-
-  VkPipelineRasterizationStateCreateInfo rasterizer = {};
-  rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-  rasterizer.depthClampEnable = VK_FALSE;
-  rasterizer.rasterizerDiscardEnable = VK_FALSE;
-  rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-  rasterizer.cullMode = VK_CULL_MODE_NONE;
-  rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-  rasterizer.depthBiasEnable = VK_FALSE;
-  rasterizer.depthBiasConstantFactor = 0.0f;
-  rasterizer.depthBiasClamp = 0.0f;
-  rasterizer.depthBiasSlopeFactor = 0.0f;
-  rasterizer.lineWidth =
-      1.0f;  // Not used but produce validation error when not set
-
-  VkPipelineMultisampleStateCreateInfo multisampling = {};
-  multisampling.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-  multisampling.sampleShadingEnable = VK_FALSE;
-  multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-  multisampling.minSampleShading = 1.0f;
-  multisampling.pSampleMask = nullptr;
-  multisampling.alphaToCoverageEnable = VK_FALSE;
-  multisampling.alphaToOneEnable = VK_FALSE;
-
-  std::vector<VkPipelineColorBlendAttachmentState> colorBlendAttachmentStates;
-  for (size_t i = 0; i < colorAttachmentCount; i++) {
-    VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
-    colorBlendAttachment.colorWriteMask =
-        VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
-        VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    colorBlendAttachment.blendEnable = VK_FALSE;
-    colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-    colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
-    colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
-    colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-    colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-    colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
-    colorBlendAttachmentStates.push_back(colorBlendAttachment);
-  }
-
-  VkPipelineColorBlendStateCreateInfo colorBlending = {};
-  colorBlending.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-  colorBlending.logicOpEnable = VK_FALSE;
-  colorBlending.logicOp = VK_LOGIC_OP_COPY;
-  colorBlending.attachmentCount =
-      static_cast<uint32_t>(colorBlendAttachmentStates.size());
-  colorBlending.pAttachments = colorBlendAttachmentStates.data();
-  colorBlending.blendConstants[0] = 0.0f;
-  colorBlending.blendConstants[1] = 0.0f;
-  colorBlending.blendConstants[2] = 0.0f;
-  colorBlending.blendConstants[3] = 0.0f;
-
-  VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_VIEWPORT,
-                                    VK_DYNAMIC_STATE_LINE_WIDTH};
-
-  VkPipelineDynamicStateCreateInfo dynamicState = {};
-  dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-  dynamicState.dynamicStateCount = 2;
-  dynamicState.pDynamicStates = dynamicStates;
-
-  VkPipelineDepthStencilStateCreateInfo depthStencil = {};
-  depthStencil.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-  depthStencil.depthTestEnable = VK_TRUE;
-  depthStencil.depthWriteEnable = VK_TRUE;
-  depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
-  depthStencil.depthBoundsTestEnable = VK_FALSE;
-  depthStencil.minDepthBounds = 0.0f;
-  depthStencil.maxDepthBounds = 1.0f;
-  depthStencil.stencilTestEnable = VK_FALSE;
-  depthStencil.front = {};
-  depthStencil.back = {};
-
-  VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
-  pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-  pipelineLayoutInfo.setLayoutCount = 1;
-  pipelineLayoutInfo.pSetLayouts = &pipeline.descriptorSetLayout;
-  pipelineLayoutInfo.pushConstantRangeCount = 0;
-  pipelineLayoutInfo.pPushConstantRanges = 0;
-
-  VkResult result = vkCreatePipelineLayout(_device, &pipelineLayoutInfo,
-                                           nullptr, &pipeline.layout);
-  vkCheckResult(result, "vkCreatePipelineLayout");
-
-  VkGraphicsPipelineCreateInfo pipelineInfo = {};
-  pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-  pipelineInfo.stageCount = 2;
-  pipelineInfo.pStages = shaderStages;
-  pipelineInfo.pVertexInputState = &vertexInputInfo;
-  pipelineInfo.pInputAssemblyState = &inputAssembly;
-  pipelineInfo.pViewportState = &viewportState;
-  pipelineInfo.pRasterizationState = &rasterizer;
-  pipelineInfo.pMultisampleState = &multisampling;
-  pipelineInfo.pDepthStencilState = &depthStencil;
-  pipelineInfo.pColorBlendState = &colorBlending;
-  pipelineInfo.pDynamicState = nullptr;
-
-  pipelineInfo.layout = pipeline.layout;
-  pipelineInfo.renderPass = _renderPass;
-  pipelineInfo.subpass = subpass_id;
-  pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
-  pipelineInfo.basePipelineIndex = -1;
-
-  result = vkCreateGraphicsPipelines(_device, VK_NULL_HANDLE, 1, &pipelineInfo,
-                                     nullptr, &pipeline.pipeline);
-  vkCheckResult(result, "vkCreateGraphicsPipelines");
-
-  vkDestroyShaderModule(_device, fragShaderModule, nullptr);
-  vkDestroyShaderModule(_device, vertShaderModule, nullptr);
-  return pipeline;
-}
-
-void VkBackend::createFramebuffers() {
-  _swapChainFramebuffers.resize(_swapChainImageViews.size());
-  for (size_t i = 0; i < _swapChainImageViews.size(); i++) {
-    std::array<VkImageView, 5> attachments = {
-        _swapChainImageViews[i],
-        _gBufferAttachments[0].imageView,  // positions
-        _gBufferAttachments[1].imageView,  // normals
-        _gBufferAttachments[2].imageView,  // albedo
-        _depth.imageView};
-
-    VkFramebufferCreateInfo framebufferInfo = {};
-    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-    framebufferInfo.renderPass = _renderPass;
-    framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
-    framebufferInfo.pAttachments = attachments.data();
-    framebufferInfo.width = _swapChainExtent.width;
-    framebufferInfo.height = _swapChainExtent.height;
-    framebufferInfo.layers = 1;
-
-    VkResult result = vkCreateFramebuffer(_device, &framebufferInfo, nullptr,
-                                          &_swapChainFramebuffers[i]);
-    vkCheckResult(result, "vkCreateFramebuffer");
-  }
-}
-
-void VkBackend::createCommandPool() {
-  QueueFamilyIndices queueFamilyIndices =
-      findQueueFamilies(_physicalDevice, _surface);
-
-  VkCommandPoolCreateInfo poolInfo = {};
-  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-  poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily;
-  poolInfo.flags = 0;
-  VkResult result =
-      vkCreateCommandPool(_device, &poolInfo, nullptr, &_commandPool);
-  vkCheckResult(result, "vkCreateCommandPool");
-}
-
-void VkBackend::createDepthResources() {
-  VkFormat depthFormat = findDepthFormat(_physicalDevice);
-  createImage(
-      _swapChainExtent.width, _swapChainExtent.height, depthFormat,
-      VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _depth.image, _depth.imageMemory);
-  _depth.imageView =
-      createImageView(_depth.image, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
-  transitionImageLayout(_depth.image, depthFormat, VK_IMAGE_LAYOUT_UNDEFINED,
-                        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
-}
-
-void VkBackend::createGBufferAttachments() {
-  Attachment position = {};
-  position.format = VK_FORMAT_R16G16B16A16_SFLOAT;
-  createImage(
-      _swapChainExtent.width, _swapChainExtent.height, position.format,
-      VK_IMAGE_TILING_OPTIMAL,
-      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT,
-      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, position.image, position.memory);
-  position.imageView = createImageView(position.image, position.format,
-                                       VK_IMAGE_ASPECT_COLOR_BIT);
-
-  Attachment normal = {};
-  normal.format = VK_FORMAT_R16G16B16A16_SFLOAT;
-  createImage(
-      _swapChainExtent.width, _swapChainExtent.height, normal.format,
-      VK_IMAGE_TILING_OPTIMAL,
-      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT,
-      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, normal.image, normal.memory);
-  normal.imageView =
-      createImageView(normal.image, normal.format, VK_IMAGE_ASPECT_COLOR_BIT);
-
-  Attachment albedo = {};
-  // albedo.format = VK_FORMAT_R8G8B8A8_UNORM;
-  albedo.format = VK_FORMAT_R16G16B16A16_SFLOAT;
-  createImage(
-      _swapChainExtent.width, _swapChainExtent.height, albedo.format,
-      VK_IMAGE_TILING_OPTIMAL,
-      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT,
-      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, albedo.image, albedo.memory);
-  albedo.imageView =
-      createImageView(albedo.image, albedo.format, VK_IMAGE_ASPECT_COLOR_BIT);
-
-  _gBufferAttachments.push_back(position);
-  _gBufferAttachments.push_back(normal);
-  _gBufferAttachments.push_back(albedo);
-}
-
-Texture VkBackend::createTextureImage(const std::string filepath) {
-  Texture texture = {};
-  VkBuffer stagingBuffer;
-  VkDeviceMemory stagingBufferMemory;
-  int texWidth, texHeight, texChannels;
-  stbi_uc *pixels = stbi_load(filepath.c_str(), &texWidth, &texHeight,
-                              &texChannels, STBI_rgb_alpha);
-  if (!pixels) {
-    stbi_image_free(pixels);
-    uint8_t pixels[4];  // No texture or can't load it, using a dummy texture
-                        // instead
-    pixels[0] = 255;    // AFAIK you can't have null texture in Vulkan
-    pixels[1] = 255;
-    pixels[2] = 255;
-    pixels[3] = 255;
-
-    texWidth = 1, texHeight = 1;
-
-    VkDeviceSize imageSize = texWidth * texHeight * 4;
-    createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 stagingBuffer, stagingBufferMemory);
-    void *data;
-    vkMapMemory(_device, stagingBufferMemory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
-    vkUnmapMemory(_device, stagingBufferMemory);
-  } else {
-    VkDeviceSize imageSize = texWidth * texHeight * 4;
-    createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 stagingBuffer, stagingBufferMemory);
-    void *data;
-    vkMapMemory(_device, stagingBufferMemory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
-    vkUnmapMemory(_device, stagingBufferMemory);
-    stbi_image_free(pixels);
-  }
-
-  createImage(
-      texWidth, texHeight, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL,
-      VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, texture.image, texture.imageMemory);
-  transitionImageLayout(texture.image, VK_FORMAT_R8G8B8A8_UNORM,
-                        VK_IMAGE_LAYOUT_UNDEFINED,
-                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-  copyBufferToImage(stagingBuffer, texture.image,
-                    static_cast<uint32_t>(texWidth),
-                    static_cast<uint32_t>(texHeight));
-  transitionImageLayout(texture.image, VK_FORMAT_R8G8B8A8_UNORM,
-                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-  vkDestroyBuffer(_device, stagingBuffer, nullptr);
-  vkFreeMemory(_device, stagingBufferMemory, nullptr);
-  return texture;
-}
-
-VkImageView VkBackend::createImageView(VkImage image, VkFormat format,
-                                       VkImageAspectFlags aspectFlags) {
-  VkImageViewCreateInfo viewInfo = {};
-  viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-  viewInfo.image = image;
-  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-  viewInfo.format = format;
-  viewInfo.subresourceRange.aspectMask = aspectFlags;
-  viewInfo.subresourceRange.baseMipLevel = 0;
-  viewInfo.subresourceRange.levelCount = 1;
-  viewInfo.subresourceRange.baseArrayLayer = 0;
-  viewInfo.subresourceRange.layerCount = 1;
-
-  VkImageView imageView;
-  VkResult result = vkCreateImageView(_device, &viewInfo, nullptr, &imageView);
-  vkCheckResult(result, "vkCreateImageView");
-
-  return imageView;
-}
-
-void VkBackend::createTextureImageView(Texture &texture) {
-  if (texture.image != VK_NULL_HANDLE) {
-    texture.imageView = createImageView(texture.image, VK_FORMAT_R8G8B8A8_UNORM,
-                                        VK_IMAGE_ASPECT_COLOR_BIT);
-  }
-}
-
-void VkBackend::createTextureSampler(Texture &texture) {
-  VkSamplerCreateInfo samplerInfo = {};
-  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-  samplerInfo.magFilter = VK_FILTER_LINEAR;
-  samplerInfo.minFilter = VK_FILTER_LINEAR;
-  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-  samplerInfo.anisotropyEnable = VK_TRUE;
-  samplerInfo.maxAnisotropy = 16;
-  samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
-  samplerInfo.unnormalizedCoordinates = VK_FALSE;
-  samplerInfo.compareEnable = VK_FALSE;
-  samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
-  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-  samplerInfo.mipLodBias = 0.0f;
-  samplerInfo.minLod = 0.0f;
-  samplerInfo.maxLod = 0.0f;
-
-  VkResult result =
-      vkCreateSampler(_device, &samplerInfo, nullptr, &texture.sampler);
-  vkCheckResult(result, "vkCreateSampler");
-}
-
-void VkBackend::createImage(uint32_t width, uint32_t height, VkFormat format,
-                            VkImageTiling tiling, VkImageUsageFlags usage,
-                            VkMemoryPropertyFlags properties, VkImage &image,
-                            VkDeviceMemory &imageMemory) {
-  VkImageCreateInfo imageInfo = {};
-  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-  imageInfo.imageType = VK_IMAGE_TYPE_2D;
-  imageInfo.extent.width = width;
-  imageInfo.extent.height = height;
-  imageInfo.extent.depth = 1;
-  imageInfo.mipLevels = 1;
-  imageInfo.arrayLayers = 1;
-  imageInfo.format = format;
-  imageInfo.tiling = tiling;
-  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  imageInfo.usage = usage;
-  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-  VkResult result = vkCreateImage(_device, &imageInfo, nullptr, &image);
-  vkCheckResult(result, "vkCreateImage");
-
-  VkMemoryRequirements memRequirements;
-  vkGetImageMemoryRequirements(_device, image, &memRequirements);
-
-  VkMemoryAllocateInfo allocInfo = {};
-  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  allocInfo.allocationSize = memRequirements.size;
-  allocInfo.memoryTypeIndex = findMemoryType(
-      _physicalDevice, memRequirements.memoryTypeBits, properties);
-
-  result = vkAllocateMemory(_device, &allocInfo, nullptr, &imageMemory);
-  vkCheckResult(result, "vkAllocateMemory");
-
-  vkBindImageMemory(_device, image, imageMemory, 0);
-}
-
-Buffer VkBackend::createVertexBuffer(std::vector<Vertex> vertices) {
-  Buffer vertex;
-  VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
-  VkBuffer stagingBuffer;
-  VkDeviceMemory stagingBufferMemory;
-  createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-               stagingBuffer, stagingBufferMemory);
-
-  void *data;
-  vkMapMemory(_device, stagingBufferMemory, 0, bufferSize, 0, &data);
-  memcpy(data, vertices.data(), (size_t)bufferSize);
-  vkUnmapMemory(_device, stagingBufferMemory);
-
-  createBuffer(
-      bufferSize,
-      VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertex.buffer, vertex.bufferMemory);
-  copyBuffer(stagingBuffer, vertex.buffer, bufferSize);
-  vkDestroyBuffer(_device, stagingBuffer, nullptr);
-  vkFreeMemory(_device, stagingBufferMemory, nullptr);
-  return vertex;
-}
-
-Buffer VkBackend::createIndexBuffer(std::vector<uint32_t> indices) {
-  Buffer index;
-  VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
-
-  VkBuffer stagingBuffer;
-  VkDeviceMemory stagingBufferMemory;
-  createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-               stagingBuffer, stagingBufferMemory);
-
-  void *data;
-  vkMapMemory(_device, stagingBufferMemory, 0, bufferSize, 0, &data);
-  memcpy(data, indices.data(), (size_t)bufferSize);
-  vkUnmapMemory(_device, stagingBufferMemory);
-
-  createBuffer(
-      bufferSize,
-      VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, index.buffer, index.bufferMemory);
-
-  copyBuffer(stagingBuffer, index.buffer, bufferSize);
-
-  vkDestroyBuffer(_device, stagingBuffer, nullptr);
-  vkFreeMemory(_device, stagingBufferMemory, nullptr);
-  return index;
-}
-
-Buffer VkBackend::createUniformBuffer(size_t size) {
-  Buffer buffer;
-  VkDeviceSize bufferSize = size;
-  createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-               buffer.buffer, buffer.bufferMemory);
-  return buffer;
-}
-
-VkDescriptorPool VkBackend::createGPassDescriptorPool(uint32_t poolSize) {
-  VkDescriptorPool descriptorPool = {};
-  std::array<VkDescriptorPoolSize, 4> poolSizes = {};
-  poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-  poolSizes[0].descriptorCount = poolSize;
-
-  poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-  poolSizes[1].descriptorCount = poolSize;
-
-  poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-  poolSizes[2].descriptorCount = poolSize;
-
-  poolSizes[3].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-  poolSizes[3].descriptorCount = poolSize;
-
-  VkDescriptorPoolCreateInfo poolInfo = {};
-  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-  poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
-  poolInfo.pPoolSizes = poolSizes.data();
-  poolInfo.maxSets = poolSize;
-
-  VkResult result =
-      vkCreateDescriptorPool(_device, &poolInfo, nullptr, &descriptorPool);
-  vkCheckResult(result, "vkCreateDescriptorPool");
-  return descriptorPool;
-}
-
-VkDescriptorSet VkBackend::createGPassDescriptorSet(
-    VkDescriptorPool descriptorPool, VkDescriptorSetLayout descriptorSetLayout,
-    const Texture &diffuse, const Texture &specular, const Texture &normal) {
-  VkDescriptorSet descriptorSet;
-  VkDescriptorSetLayout layouts[] = {descriptorSetLayout};
-
-  VkDescriptorSetAllocateInfo allocInfo = {};
-  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-  allocInfo.descriptorPool = descriptorPool;
-  allocInfo.descriptorSetCount = 1;
-  allocInfo.pSetLayouts = layouts;
-
-  VkResult result =
-      vkAllocateDescriptorSets(_device, &allocInfo, &descriptorSet);
-  vkCheckResult(result, "vkAllocateDescriptorSets");
-
-  VkDescriptorBufferInfo bufferInfo = {};
-  bufferInfo.buffer = _gpassUniformBuffer.buffer;
-  bufferInfo.offset = 0;
-  bufferInfo.range = sizeof(gPassUbo);
-
-  VkDescriptorImageInfo imageInfo1 = {};
-  imageInfo1.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-  imageInfo1.imageView = diffuse.imageView;
-  imageInfo1.sampler = diffuse.sampler;
-
-  VkDescriptorImageInfo imageInfo2 = {};
-  imageInfo2.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-  imageInfo2.imageView = specular.imageView;
-  imageInfo2.sampler = specular.sampler;
-
-  VkDescriptorImageInfo imageInfo3 = {};
-  imageInfo3.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-  imageInfo3.imageView = normal.imageView;
-  imageInfo3.sampler = normal.sampler;
-
-  std::array<VkWriteDescriptorSet, 4> descriptorWrites = {};
-
-  descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-  descriptorWrites[0].dstSet = descriptorSet;
-  descriptorWrites[0].dstBinding = 0;
-  descriptorWrites[0].dstArrayElement = 0;
-  descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-  descriptorWrites[0].descriptorCount = 1;
-  descriptorWrites[0].pBufferInfo = &bufferInfo;
-
-  descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-  descriptorWrites[1].dstSet = descriptorSet;
-  descriptorWrites[1].dstBinding = 1;
-  descriptorWrites[1].dstArrayElement = 0;
-  descriptorWrites[1].descriptorType =
-      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-  descriptorWrites[1].descriptorCount = 1;
-  descriptorWrites[1].pImageInfo = &imageInfo1;
-
-  descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-  descriptorWrites[2].dstSet = descriptorSet;
-  descriptorWrites[2].dstBinding = 2;
-  descriptorWrites[2].dstArrayElement = 0;
-  descriptorWrites[2].descriptorType =
-      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-  descriptorWrites[2].descriptorCount = 1;
-  descriptorWrites[2].pImageInfo = &imageInfo2;
-
-  descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-  descriptorWrites[3].dstSet = descriptorSet;
-  descriptorWrites[3].dstBinding = 3;
-  descriptorWrites[3].dstArrayElement = 0;
-  descriptorWrites[3].descriptorType =
-      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-  descriptorWrites[3].descriptorCount = 1;
-  descriptorWrites[3].pImageInfo = &imageInfo3;
-  vkUpdateDescriptorSets(_device,
-                         static_cast<uint32_t>(descriptorWrites.size()),
-                         descriptorWrites.data(), 0, nullptr);
-  return descriptorSet;
-}
-
-VkDescriptorPool VkBackend::createLightDescriptorPool(uint32_t poolSize) {
-  VkDescriptorPool descriptorPool = {};
-  std::array<VkDescriptorPoolSize, 4> poolSizes = {};
-  poolSizes[0].type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-  poolSizes[0].descriptorCount = 1;
-
-  poolSizes[1].type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-  poolSizes[1].descriptorCount = 1;
-
-  poolSizes[2].type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-  poolSizes[2].descriptorCount = 1;
-
-  poolSizes[3].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-  poolSizes[3].descriptorCount = 1;
-
-  VkDescriptorPoolCreateInfo poolInfo = {};
-  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-  poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
-  poolInfo.pPoolSizes = poolSizes.data();
-  poolInfo.maxSets = 1;
-
-  VkResult result =
-      vkCreateDescriptorPool(_device, &poolInfo, nullptr, &descriptorPool);
-  vkCheckResult(result, "vkCreateDescriptorPool");
-  return descriptorPool;
-}
-
-VkDescriptorSet VkBackend::createLightDescriptorSet(
-    VkDescriptorPool descriptorPool,
-    VkDescriptorSetLayout descriptorSetLayout) {
-  VkDescriptorSet descriptorSet;
-  VkDescriptorSetLayout layouts[] = {descriptorSetLayout};
-
-  VkDescriptorSetAllocateInfo allocInfo = {};
-  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-  allocInfo.descriptorPool = descriptorPool;
-  allocInfo.descriptorSetCount = 1;
-  allocInfo.pSetLayouts = layouts;
-
-  VkResult result =
-      vkAllocateDescriptorSets(_device, &allocInfo, &descriptorSet);
-  vkCheckResult(result, "vkAllocateDescriptorSets");
-
-  VkDescriptorImageInfo inputInfo1 = {};
-  inputInfo1.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-  inputInfo1.imageView = _gBufferAttachments[0].imageView;
-
-  VkDescriptorImageInfo inputInfo2 = {};
-  inputInfo2.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-  inputInfo2.imageView = _gBufferAttachments[1].imageView;
-
-  VkDescriptorImageInfo inputInfo3 = {};
-  inputInfo3.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-  inputInfo3.imageView = _gBufferAttachments[2].imageView;
-
-  VkDescriptorBufferInfo uboInfo = {};
-  uboInfo.buffer = _lightUniformBuffer.buffer;
-  uboInfo.offset = 0;
-  uboInfo.range = sizeof(lightUbo);
-
-  std::array<VkWriteDescriptorSet, 4> descriptorWrites = {};
-
-  descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-  descriptorWrites[0].dstSet = descriptorSet;
-  descriptorWrites[0].dstBinding = 0;
-  descriptorWrites[0].dstArrayElement = 0;
-  descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-  descriptorWrites[0].descriptorCount = 1;
-  descriptorWrites[0].pImageInfo = &inputInfo1;
-
-  descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-  descriptorWrites[1].dstSet = descriptorSet;
-  descriptorWrites[1].dstBinding = 1;
-  descriptorWrites[1].dstArrayElement = 0;
-  descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-  descriptorWrites[1].descriptorCount = 1;
-  descriptorWrites[1].pImageInfo = &inputInfo2;
-
-  descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-  descriptorWrites[2].dstSet = descriptorSet;
-  descriptorWrites[2].dstBinding = 2;
-  descriptorWrites[2].dstArrayElement = 0;
-  descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-  descriptorWrites[2].descriptorCount = 1;
-  descriptorWrites[2].pImageInfo = &inputInfo3;
-
-  descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-  descriptorWrites[3].dstSet = descriptorSet;
-  descriptorWrites[3].dstBinding = 3;
-  descriptorWrites[3].dstArrayElement = 0;
-  descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-  descriptorWrites[3].descriptorCount = 1;
-  descriptorWrites[3].pBufferInfo = &uboInfo;
-
-  vkUpdateDescriptorSets(_device,
-                         static_cast<uint32_t>(descriptorWrites.size()),
-                         descriptorWrites.data(), 0, nullptr);
-  return descriptorSet;
-}
-
-void VkBackend::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
-                             VkMemoryPropertyFlags properties, VkBuffer &buffer,
-                             VkDeviceMemory &bufferMemory) {
-  VkBufferCreateInfo bufferInfo = {};
-  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-  bufferInfo.size = size;
-  bufferInfo.usage = usage;
-  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-  VkResult result = vkCreateBuffer(_device, &bufferInfo, nullptr, &buffer);
-  vkCheckResult(result, "vkCreateBuffer");
-
-  VkMemoryRequirements memRequirements;
-  vkGetBufferMemoryRequirements(_device, buffer, &memRequirements);
-
-  VkMemoryAllocateInfo allocInfo = {};
-  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  allocInfo.allocationSize = memRequirements.size;
-  allocInfo.memoryTypeIndex = findMemoryType(
-      _physicalDevice, memRequirements.memoryTypeBits, properties);
-
-  vkAllocateMemory(_device, &allocInfo, nullptr, &bufferMemory);
-  vkCheckResult(result, "vkAllocateMemory");
-
-  vkBindBufferMemory(_device, buffer, bufferMemory, 0);
-}
-
-void VkBackend::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer,
-                           VkDeviceSize size) {
-  VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-  VkBufferCopy copyRegion = {};
-  copyRegion.size = size;
-  vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-
-  endSingleTimeCommands(commandBuffer);
-}
-
-VkCommandBuffer VkBackend::beginSingleTimeCommands() {
-  VkCommandBufferAllocateInfo allocInfo = {};
-  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-  allocInfo.commandPool = _commandPool;
-  allocInfo.commandBufferCount = 1;
-
-  VkCommandBuffer commandBuffer;
-  vkAllocateCommandBuffers(_device, &allocInfo, &commandBuffer);
-
-  VkCommandBufferBeginInfo beginInfo = {};
-  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-  vkBeginCommandBuffer(commandBuffer, &beginInfo);
-
-  return commandBuffer;
-}
-
-void VkBackend::endSingleTimeCommands(VkCommandBuffer commandBuffer) {
-  vkEndCommandBuffer(commandBuffer);
-
-  VkSubmitInfo submitInfo = {};
-  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers = &commandBuffer;
-
-  vkQueueSubmit(_graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-  vkQueueWaitIdle(_graphicsQueue);
-
-  vkFreeCommandBuffers(_device, _commandPool, 1, &commandBuffer);
-}
-
-void VkBackend::transitionImageLayout(VkImage image, VkFormat format,
-                                      VkImageLayout oldLayout,
-                                      VkImageLayout newLayout) {
-  VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-  VkImageMemoryBarrier barrier = {};
-  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-  barrier.oldLayout = oldLayout;
-  barrier.newLayout = newLayout;
-  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-  barrier.image = image;
-  if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
-    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-    if (hasStencilComponent(format)) {
-      barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
-    }
-  } else {
-    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  }
-  barrier.subresourceRange.baseMipLevel = 0;
-  barrier.subresourceRange.levelCount = 1;
-  barrier.subresourceRange.baseArrayLayer = 0;
-  barrier.subresourceRange.layerCount = 1;
-
-  if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED &&
-      newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-    barrier.srcAccessMask = 0;
-    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-  } else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL &&
-             newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-  } else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED &&
-             newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
-    barrier.srcAccessMask = 0;
-    barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
-                            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-  } else {
-    throw std::invalid_argument("unsupported layout transition!");
-  }
-  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-                       VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, 0, nullptr, 0,
-                       nullptr, 1, &barrier);
-  endSingleTimeCommands(commandBuffer);
-}
-
-void VkBackend::copyBufferToImage(VkBuffer buffer, VkImage image,
-                                  uint32_t width, uint32_t height) {
-  VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-  VkBufferImageCopy region = {};
-  region.bufferOffset = 0;
-  region.bufferRowLength = 0;
-  region.bufferImageHeight = 0;
-
-  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  region.imageSubresource.mipLevel = 0;
-  region.imageSubresource.baseArrayLayer = 0;
-  region.imageSubresource.layerCount = 1;
-
-  region.imageOffset = {0, 0, 0};
-  region.imageExtent = {width, height, 1};
-  vkCmdCopyBufferToImage(commandBuffer, buffer, image,
-                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-  endSingleTimeCommands(commandBuffer);
-}
-
-void VkBackend::createCommandBuffers() {
-  _commandBuffers.resize(_swapChainFramebuffers.size());
-  VkCommandBufferAllocateInfo allocInfo = {};
-  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-  allocInfo.commandPool = _commandPool;
-  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-  allocInfo.commandBufferCount = (uint32_t)_commandBuffers.size();
-  VkResult result =
-      vkAllocateCommandBuffers(_device, &allocInfo, _commandBuffers.data());
-  vkCheckResult(result, "vkAllocateCommandBuffers");
-
-  std::array<VkClearValue, 5> clearValues = {};
-  clearValues[0].color = {0.0f, 0.0f, 0.0f, 0.0f};
-  clearValues[1].color = {0.0f, 0.0f, 0.0f, 0.0f};
-  clearValues[2].color = {0.0f, 0.0f, 0.0f, 0.0f};
-  clearValues[3].color = {0.0f, 0.0f, 0.0f, 0.0f};
-  clearValues[4].depthStencil = {1.0f, 0};
-
-  VkCommandBufferBeginInfo beginInfo = {};
-  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-  beginInfo.pInheritanceInfo = nullptr;
-
-  VkRenderPassBeginInfo renderPassInfo = {};
-  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-  renderPassInfo.renderPass = _renderPass;
-  renderPassInfo.renderArea.offset = {0, 0};
-  renderPassInfo.renderArea.extent = _swapChainExtent;
-
-  renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-  renderPassInfo.pClearValues = clearValues.data();
-
-  for (size_t i = 0; i < _commandBuffers.size(); i++) {
-    renderPassInfo.framebuffer = _swapChainFramebuffers[i];
-
-    vkBeginCommandBuffer(_commandBuffers[i], &beginInfo);
-
-    vkCmdBeginRenderPass(_commandBuffers[i], &renderPassInfo,
-                         VK_SUBPASS_CONTENTS_INLINE);
-    // Gpass subpass
-    vkCmdBindPipeline(_commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS,
-                      _gpassPipeline.pipeline);
-    VkDeviceSize offsets[] = {0};
-    VkBuffer buffers[] = {_vertexBuffer.buffer};
-    vkCmdBindVertexBuffers(_commandBuffers[i], 0, 1, buffers, offsets);
-    vkCmdBindIndexBuffer(_commandBuffers[i], _indexBuffer.buffer, 0,
-                         VK_INDEX_TYPE_UINT32);
-    size_t mesh_id = 0;
-    for (auto &mesh : _model.meshes) {
-      vkCmdBindDescriptorSets(
-          _commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS,
-          _gpassPipeline.layout, 0, 1, &_gpassPipeline.descriptorSets[mesh_id],
-          0, nullptr);
-      vkCmdDrawIndexed(_commandBuffers[i], mesh.indexCount, 1, 0,
-                       mesh.vertexOffset, 0);
-      mesh_id++;
-    }
-    // Light subpass
-    vkCmdNextSubpass(_commandBuffers[i], VK_SUBPASS_CONTENTS_INLINE);
-    vkCmdBindPipeline(_commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS,
-                      _lightPipeline.pipeline);
-    vkCmdBindDescriptorSets(_commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS,
-                            _lightPipeline.layout, 0, 1,
-                            &_lightPipeline.descriptorSets[0], 0, nullptr);
-    vkCmdDraw(_commandBuffers[i], 3, 1, 0, 0);
-
-    vkCmdEndRenderPass(_commandBuffers[i]);
-    result = vkEndCommandBuffer(_commandBuffers[i]);
-    vkCheckResult(result, "vkEndCommandBuffer");
-  }
-}
-
-void VkBackend::createSemaphores() {
-  VkResult result;
-  VkSemaphoreCreateInfo semaphoreInfo = {};
-  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-  result = vkCreateSemaphore(_device, &semaphoreInfo, nullptr,
-                             &_imageAvailableSemaphore);
-  vkCheckResult(result, "vkCreateSemaphore");
-  result = vkCreateSemaphore(_device, &semaphoreInfo, nullptr,
-                             &_renderFinishedSemaphore);
-  vkCheckResult(result, "vkCreateSemaphore");
-}
-
-void VkBackend::cleanupSwapChain() {
-  for (size_t i = 0; i < _swapChainFramebuffers.size(); i++) {
-    vkDestroyFramebuffer(_device, _swapChainFramebuffers[i], nullptr);
-  }
-
-  vkFreeCommandBuffers(_device, _commandPool,
-                       static_cast<uint32_t>(_commandBuffers.size()),
-                       _commandBuffers.data());
-
-  vkDestroyPipeline(_device, _gpassPipeline.pipeline, nullptr);
-  vkDestroyPipelineLayout(_device, _gpassPipeline.layout, nullptr);
-
-  vkDestroyPipeline(_device, _lightPipeline.pipeline, nullptr);
-  vkDestroyPipelineLayout(_device, _lightPipeline.layout, nullptr);
-
-  vkDestroyRenderPass(_device, _renderPass, nullptr);
-
-  for (size_t i = 0; i < _swapChainImageViews.size(); i++) {
-    vkDestroyImageView(_device, _swapChainImageViews[i], nullptr);
-  }
-
-  vkDestroySwapchainKHR(_device, _swapChain, nullptr);
-}
-
-void VkBackend::cleanup() {
-  cleanupSwapChain();
-
-  vkDestroyImageView(_device, _depth.imageView, nullptr);
-  vkDestroyImage(_device, _depth.image, nullptr);
-  vkFreeMemory(_device, _depth.imageMemory, nullptr);
-
-  for (auto &texture : _diffuseTextures) {
-    vkDestroySampler(_device, texture.sampler, nullptr);
-    vkDestroyImageView(_device, texture.imageView, nullptr);
-    vkDestroyImage(_device, texture.image, nullptr);
-    vkFreeMemory(_device, texture.imageMemory, nullptr);
-  }
-  for (auto &texture : _specularTextures) {
-    vkDestroySampler(_device, texture.sampler, nullptr);
-    vkDestroyImageView(_device, texture.imageView, nullptr);
-    vkDestroyImage(_device, texture.image, nullptr);
-    vkFreeMemory(_device, texture.imageMemory, nullptr);
-  }
-  for (auto &texture : _normalTextures) {
-    vkDestroySampler(_device, texture.sampler, nullptr);
-    vkDestroyImageView(_device, texture.imageView, nullptr);
-    vkDestroyImage(_device, texture.image, nullptr);
-    vkFreeMemory(_device, texture.imageMemory, nullptr);
-  }
-
-  vkDestroyDescriptorPool(_device, _gpassPipeline.descriptorPool, nullptr);
-  vkDestroyDescriptorSetLayout(_device, _gpassPipeline.descriptorSetLayout,
-                               nullptr);
-
-  vkDestroyDescriptorPool(_device, _lightPipeline.descriptorPool, nullptr);
-  vkDestroyDescriptorSetLayout(_device, _lightPipeline.descriptorSetLayout,
-                               nullptr);
-
-  vkDestroyBuffer(_device, _gpassUniformBuffer.buffer, nullptr);
-  vkFreeMemory(_device, _gpassUniformBuffer.bufferMemory, nullptr);
-
-  vkDestroyBuffer(_device, _lightUniformBuffer.buffer, nullptr);
-  vkFreeMemory(_device, _lightUniformBuffer.bufferMemory, nullptr);
-
-  vkDestroyBuffer(_device, _vertexBuffer.buffer, nullptr);
-  vkFreeMemory(_device, _vertexBuffer.bufferMemory, nullptr);
-  vkDestroyBuffer(_device, _indexBuffer.buffer, nullptr);
-  vkFreeMemory(_device, _indexBuffer.bufferMemory, nullptr);
-
-  vkDestroySemaphore(_device, _renderFinishedSemaphore, nullptr);
-  vkDestroySemaphore(_device, _imageAvailableSemaphore, nullptr);
-  vkDestroyCommandPool(_device, _commandPool, nullptr);
-
-  vkDestroyDevice(_device, nullptr);
-  DestroyDebugReportCallbackEXT(_instance, _callback, nullptr);
-  vkDestroySurfaceKHR(_instance, _surface, nullptr);
-  vkDestroyInstance(_instance, nullptr);
-  glfwDestroyWindow(_window);
-  glfwTerminate();
-}
-
+#include "vk_backend.h"
+#include <algorithm>
+#include <exception>
+#include <iomanip>
+#include <sstream>
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+VkBackend::VkBackend() {}
+
+VkBackend::VkBackend(const VkBackendSettings &settings) : _settings(settings) {}
+
+VkBackend::~VkBackend() {}
+
+void VkBackend::init(GLFWwindow *window, Model model) {
+  Scene scene(model);
+  scene.addInstance(glm::mat4());
+  init(window, scene);
+}
+
+void VkBackend::init(GLFWwindow *window, const Scene &scene) {
+  _window = window;
+  _model = scene.model;
+  _instances = scene.instances;
+  _instancesDirty = true;
+  _resolutionController.setTarget(_settings.targetFrameTime);
+  _resolutionController.setLimits(_settings.minRenderScale,
+                                  _settings.maxRenderScale);
+  _resolutionController.reset(_settings.maxRenderScale);
+  _settings.framesInFlight = std::max(_settings.framesInFlight, 1u);
+  createInstance();
+  setupDebugCallback();
+  if (!_settings.headless) createSurface();
+  pickPhysicalDevice();
+  createLogicalDevice();
+  _pipelineCache.init(_physicalDevice, _device, _settings.pipelineCachePath);
+  _gpuProfiler.init(
+      _physicalDevice, _device,
+      findQueueFamilies(_physicalDevice, _surface).graphicsFamily,
+      static_cast<uint32_t>(GpuScope::Count) + SHADOW_CASCADE_COUNT +
+          MAX_POINT_SHADOWS,
+      128,
+      _pipelineStatisticsSupported
+          ? VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+                VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT
+          : 0,
+      std::max(GPU_TIMING_LATENCY, _settings.framesInFlight));
+  createSwapChain();
+  createImageViews();
+  createGBufferAttachments();
+  createSceneColorResources();
+  createRenderPass();
+  createEarlyRenderPass();
+  createUpscaleRenderPass();
+  createShadowRenderPass();
+  _gpassPipeline.descriptorSetLayout = createGPassDescriptorSetLayout();
+  const uint32_t materialCount = static_cast<uint32_t>(_model.meshes.size());
+  if (_mergedDrawsSupported) {
+    _mergedGPassSetLayout = createGPassDescriptorSetLayout(materialCount);
+  }
+  _lightPipeline.descriptorSetLayout = createLightDescriptorSetLayout();
+  _clusterPipeline.descriptorSetLayout = createClusterDescriptorSetLayout();
+  _drawCullPipeline.descriptorSetLayout = createDrawCullDescriptorSetLayout();
+  _hiZPipeline.descriptorSetLayout = createHiZDescriptorSetLayout();
+  _shadowPipeline.descriptorSetLayout = createShadowDescriptorSetLayout();
+  _upscalePipeline.descriptorSetLayout = createUpscaleDescriptorSetLayout();
+  _perDrawSetLayout = createPerDrawDescriptorSetLayout();
+  createPipelines();
+  createCommandPool();
+  createDepthResources();
+  createHiZResources();
+  createFramebuffers();
+  // Load textures in GPU memory
+  for (auto &mesh : _model.meshes) {
+    // TODO: texture cache
+
+    Texture diffuse = createTextureImage(mesh.diffuse_texname);
+    createTextureImageView(diffuse);
+    createTextureSampler(diffuse);
+    _diffuseTextures.push_back(diffuse);
+
+    Texture specular = createTextureImage(mesh.specular_texname);
+    createTextureImageView(specular);
+    createTextureSampler(specular);
+    _specularTextures.push_back(specular);
+
+    Texture normal = createTextureImage(mesh.normal_texname);
+    createTextureImageView(normal);
+    createTextureSampler(normal);
+    _normalTextures.push_back(normal);
+  }
+
+  _positionBuffer = createPositionBuffer(_model.vertices);
+  _attributeBuffer = createAttributeBuffer(_model.vertices);
+  _indexBuffer = createIndexBuffer(_model);
+  createDrawItems();
+  createInstanceBuffers();
+  createPerDrawBuffer(1);
+
+  _gpassUniformBuffer = createUniformBuffer(sizeof(gPassUbo));
+  _lightUniformBuffer = createUniformBuffer(sizeof(lightUbo));
+  _upscaleUniformBuffer = createUniformBuffer(sizeof(upscaleUbo));
+  setSceneLightCount(_settings.lightCount);
+  createLightStorageBuffer();
+  _clusterBuffer = createStorageBuffer(
+      CLUSTER_COUNT * (1 + MAX_LIGHTS_PER_CLUSTER) * sizeof(uint32_t),
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  createShadowResources();
+
+  // Geometry pass descriptor sets
+  _gpassPipeline.descriptorPool =
+      createGPassDescriptorPool(static_cast<uint32_t>(_model.meshes.size()));
+  for (uint32_t i = 0; i < materialCount; i++) {
+    VkDescriptorSet descriptorSet = createGPassDescriptorSet(
+        _gpassPipeline.descriptorPool, _gpassPipeline.descriptorSetLayout, i);
+    _gpassPipeline.descriptorSets.push_back(descriptorSet);
+  }
+  if (_mergedDrawsSupported) {
+    _mergedGPassPool = createGPassDescriptorPool(1, materialCount);
+    _mergedGPassSet = createGPassDescriptorSet(
+        _mergedGPassPool, _mergedGPassSetLayout, 0, materialCount);
+  }
+  _perDrawPool = createPerDrawDescriptorPool(1);
+  _perDrawSet = createPerDrawDescriptorSet(_perDrawPool, _perDrawSetLayout);
+  _lightPipeline.descriptorPool = createLightDescriptorPool(1);
+  _lightPipeline.descriptorSets.push_back(createLightDescriptorSet(
+      _lightPipeline.descriptorPool, _lightPipeline.descriptorSetLayout));
+  _clusterPipeline.descriptorPool = createClusterDescriptorPool(1);
+  _clusterPipeline.descriptorSets.push_back(createClusterDescriptorSet(
+      _clusterPipeline.descriptorPool, _clusterPipeline.descriptorSetLayout));
+  _drawCullPipeline.descriptorPool = createDrawCullDescriptorPool(2);
+  for (uint32_t slot = 0; slot < 2; slot++) {
+    _drawCullPipeline.descriptorSets.push_back(createDrawCullDescriptorSet(
+        _drawCullPipeline.descriptorPool, _drawCullPipeline.descriptorSetLayout,
+        slot));
+  }
+  _hiZPipeline.descriptorPool = createHiZDescriptorPool(_hiZ.levelCount);
+  for (uint32_t level = 0; level < _hiZ.levelCount; level++) {
+    _hiZPipeline.descriptorSets.push_back(createHiZDescriptorSet(
+        _hiZPipeline.descriptorPool, _hiZPipeline.descriptorSetLayout, level));
+  }
+  if (_settings.dynamicResolution) {
+    _upscalePipeline.descriptorPool = createUpscaleDescriptorPool(1);
+    _upscalePipeline.descriptorSets.push_back(createUpscaleDescriptorSet(
+        _upscalePipeline.descriptorPool, _upscalePipeline.descriptorSetLayout));
+  }
+  createFrameResources();
+  createCommandBuffers();
+}
+
+void VkBackend::recreateSwapChain() {
+  vkDeviceWaitIdle(_device);
+  if (_readbackPending) writeReadback();
+
+  cleanupSwapChain();
+
+  createSwapChain();
+  createImageViews();
+  createGBufferAttachments();
+  createSceneColorResources();
+  createRenderPass();
+  createEarlyRenderPass();
+  createUpscaleRenderPass();
+  createPipelines();
+  createDepthResources();
+  createHiZResources();
+  createFramebuffers();
+  // G-buffer views changed, the input attachments must be rewritten
+  _lightPipeline.descriptorPool = createLightDescriptorPool(1);
+  _lightPipeline.descriptorSets.push_back(createLightDescriptorSet(
+      _lightPipeline.descriptorPool, _lightPipeline.descriptorSetLayout));
+  _clusterPipeline.descriptorPool = createClusterDescriptorPool(1);
+  _clusterPipeline.descriptorSets.push_back(createClusterDescriptorSet(
+      _clusterPipeline.descriptorPool, _clusterPipeline.descriptorSetLayout));
+  // Depth and pyramid views changed
+  _drawCullPipeline.descriptorPool = createDrawCullDescriptorPool(2);
+  for (uint32_t slot = 0; slot < 2; slot++) {
+    _drawCullPipeline.descriptorSets.push_back(createDrawCullDescriptorSet(
+        _drawCullPipeline.descriptorPool, _drawCullPipeline.descriptorSetLayout,
+        slot));
+  }
+  _hiZPipeline.descriptorPool = createHiZDescriptorPool(_hiZ.levelCount);
+  for (uint32_t level = 0; level < _hiZ.levelCount; level++) {
+    _hiZPipeline.descriptorSets.push_back(createHiZDescriptorSet(
+        _hiZPipeline.descriptorPool, _hiZPipeline.descriptorSetLayout, level));
+  }
+  if (_settings.dynamicResolution) {
+    _upscalePipeline.descriptorPool = createUpscaleDescriptorPool(1);
+    _upscalePipeline.descriptorSets.push_back(createUpscaleDescriptorSet(
+        _upscalePipeline.descriptorPool, _upscalePipeline.descriptorSetLayout));
+  }
+  createCommandBuffers();
+}
+
+void VkBackend::setPresentMode(VkPresentModeKHR presentMode) {
+  _settings.presentMode = presentMode;
+  recreateSwapChain();
+}
+
+void VkBackend::setSwapChainImageCount(uint32_t imageCount) {
+  _settings.swapChainImageCount = imageCount;
+  recreateSwapChain();
+}
+
+void VkBackend::setGBufferLayout(GBufferLayout layout) {
+  _settings.gBufferLayout = layout;
+  recreateSwapChain();
+}
+
+VkPresentModeKHR VkBackend::getPresentMode() const { return _presentMode; }
+
+GBufferLayout VkBackend::getGBufferLayout() const {
+  return _settings.gBufferLayout;
+}
+
+void VkBackend::setLightingMode(LightingMode mode) {
+  _settings.lightingMode = mode;
+  recreateSwapChain();
+}
+
+LightingMode VkBackend::getLightingMode() const {
+  return _settings.lightingMode;
+}
+
+void VkBackend::setLightCount(uint32_t lightCount) {
+  // The light buffer grows on the next upload if needed
+  setSceneLightCount(lightCount);
+}
+
+uint32_t VkBackend::getLightCount() const { return _settings.lightCount; }
+
+void VkBackend::setCullingMode(CullingMode mode) {
+  mode = supportedCullingMode(mode);
+  // The render pass loads the attachments of the first occlusion phase
+  bool twoPhase = mode == CullingMode::GpuOcclusion;
+  bool wasTwoPhase = _settings.cullingMode == CullingMode::GpuOcclusion;
+  _settings.cullingMode = mode;
+  if (twoPhase != wasTwoPhase) recreateSwapChain();
+}
+
+CullingMode VkBackend::getCullingMode() const {
+  return _settings.cullingMode;
+}
+
+bool VkBackend::getGpuCullingSupported() const {
+  return _drawIndirectFirstInstanceSupported;
+}
+
+// The CPU mode culling the same way when the GPU modes can't draw
+CullingMode VkBackend::supportedCullingMode(CullingMode mode) const {
+  if (_drawIndirectFirstInstanceSupported) return mode;
+  if (mode != CullingMode::Gpu && mode != CullingMode::GpuOcclusion) {
+    return mode;
+  }
+  std::cerr << "warning: drawIndirectFirstInstance not supported, "
+            << (mode == CullingMode::Gpu ? "cpu" : "cpu-occlusion")
+            << " culling instead" << std::endl;
+  return mode == CullingMode::Gpu ? CullingMode::Cpu
+                                  : CullingMode::CpuOcclusion;
+}
+
+void VkBackend::setDepthPrePass(bool enabled) {
+  _settings.depthPrePass = enabled;
+  recreateSwapChain();
+}
+
+bool VkBackend::getDepthPrePass() const { return _settings.depthPrePass; }
+
+void VkBackend::setShadows(bool enabled) {
+  // The maps kept their contents, the cache knows what they hold
+  _settings.shadows = enabled;
+}
+
+bool VkBackend::getShadows() const { return _settings.shadows; }
+
+void VkBackend::setShadowBudget(uint32_t layers) {
+  _settings.shadowBudget = layers;
+}
+
+void VkBackend::setSunDirection(const glm::vec3 &direction) {
+  // Moves the cascades, which are re-rendered as stale
+  _settings.sunDirection = direction;
+}
+
+void VkBackend::setDynamicResolution(bool enabled) {
+  // Starts over from the largest scale
+  _settings.dynamicResolution = enabled;
+  _resolutionController.reset(_settings.maxRenderScale);
+  recreateSwapChain();
+}
+
+bool VkBackend::getDynamicResolution() const {
+  return _settings.dynamicResolution;
+}
+
+void VkBackend::setTargetFrameTime(float milliseconds) {
+  _settings.targetFrameTime = milliseconds;
+  _resolutionController.setTarget(milliseconds);
+}
+
+float VkBackend::getTargetFrameTime() const {
+  return _settings.targetFrameTime;
+}
+
+void VkBackend::setNormalMapping(bool enabled) {
+  // Variants of both values stay in the permutation cache
+  _settings.normalMapping = enabled;
+  selectGraphicsPipelines();
+}
+
+void VkBackend::setSpecular(bool enabled) {
+  _settings.specular = enabled;
+  selectGraphicsPipelines();
+}
+
+bool VkBackend::getNormalMapping() const { return _settings.normalMapping; }
+
+bool VkBackend::getSpecular() const { return _settings.specular; }
+
+// Batches are recorded either way, only how they are drawn changes
+void VkBackend::setInstancing(bool enabled) { _settings.instancing = enabled; }
+
+bool VkBackend::getInstancing() const { return _settings.instancing; }
+
+// The G-pass pipelines of both descriptor set layouts stay in the
+// permutation cache
+void VkBackend::setMergedDraws(bool enabled) {
+  _settings.mergedDraws = enabled;
+  selectGraphicsPipelines();
+}
+
+bool VkBackend::getMergedDraws() const { return _settings.mergedDraws; }
+
+bool VkBackend::getMergedDrawsActive() const {
+  return _settings.mergedDraws && _mergedDrawsSupported;
+}
+
+// A specialization of the G-pass pipelines, the layout is the same
+void VkBackend::setPerDrawData(PerDrawData perDrawData) {
+  _settings.perDrawData = perDrawData;
+  selectGraphicsPipelines();
+}
+
+PerDrawData VkBackend::getPerDrawData() const { return _settings.perDrawData; }
+
+void VkBackend::setInstanceTransform(uint32_t instance,
+                                     const glm::mat4 &transform) {
+  _instances.at(instance) = transform;
+  _instancesDirty = true;
+}
+
+void VkBackend::setInstanceTransforms(
+    const std::vector<glm::mat4> &transforms) {
+  if (transforms.size() != _instances.size()) {
+    throw std::runtime_error("instance transform count mismatch");
+  }
+  _instances = transforms;
+  _instancesDirty = true;
+}
+
+uint32_t VkBackend::getInstanceCount() const {
+  return static_cast<uint32_t>(_instances.size());
+}
+
+float VkBackend::getRenderScale() const {
+  return _settings.dynamicResolution ? _resolutionController.scale() : 1.0f;
+}
+
+VkExtent2D VkBackend::getRenderExtent() const { return _renderExtent; }
+
+const std::deque<ResolutionSample> &VkBackend::getResolutionHistory() const {
+  return _resolutionController.history();
+}
+
+const ShadowStats &VkBackend::getShadowStats() const { return _shadowStats; }
+
+const BindStats &VkBackend::getBindStats() const { return _bindStats; }
+
+const IndexBufferStats &VkBackend::getIndexBufferStats() const {
+  return _indexBufferStats;
+}
+
+const RollingStats &VkBackend::getShadowGpuTime(uint32_t pass) const {
+  return _gpuProfiler.stats(static_cast<uint32_t>(GpuScope::Count) + pass);
+}
+
+const RollingStats &VkBackend::getGpuTime(GpuScope scope) const {
+  return _gpuProfiler.stats(static_cast<uint32_t>(scope));
+}
+
+bool VkBackend::getGpuTimingSupported() const {
+  return _gpuProfiler.supported();
+}
+
+uint32_t VkBackend::getGpuTimingLatency() const {
+  return _gpuProfiler.frameLatency();
+}
+
+const RollingStats &VkBackend::getGpuStatistic(
+    GpuScope scope, VkQueryPipelineStatisticFlagBits statistic) const {
+  return _gpuProfiler.statistics(static_cast<uint32_t>(scope), statistic);
+}
+
+void VkBackend::setAnimationTime(float seconds) { _animationTime = seconds; }
+
+const CullingStats &VkBackend::getCullingStats() const {
+  return _cullingStats;
+}
+
+LightManager &VkBackend::getLightManager() { return _lightManager; }
+
+const RollingStats &VkBackend::getLightUpdateStats() const {
+  return _lightUpdateStats;
+}
+
+const RollingStats &VkBackend::getPipelineCreationTime() const {
+  return _pipelineCreationTime;
+}
+
+bool VkBackend::getPipelineCacheWarm() const { return _pipelineCache.warm(); }
+
+uint32_t VkBackend::getWorkerThreadCount() const {
+  return _workerPool.size();
+}
+
+ThreadPool &VkBackend::getWorkerPool() { return _workerPool; }
+
+std::vector<PipelineVariant> VkBackend::getPipelineVariants() const {
+  std::vector<PipelineVariant> variants;
+  for (const auto &entry : _pipelineVariants) {
+    variants.push_back(entry.second.variant);
+  }
+  return variants;
+}
+
+uint32_t VkBackend::getSwapChainImageCount() const {
+  return static_cast<uint32_t>(_swapChainImages.size());
+}
+
+uint32_t VkBackend::getFramesInFlight() const {
+  return static_cast<uint32_t>(_frames.size());
+}
+
+VkExtent2D VkBackend::getSwapChainExtent() const { return _swapChainExtent; }
+
+const SwapChainTelemetry &VkBackend::getSwapChainTelemetry() const {
+  return _telemetry;
+}
+
+bool VkBackend::getHeadless() const { return _settings.headless; }
+
+uint32_t VkBackend::getHeadlessFrameCount() const { return _headlessFrame; }
+
+void VkBackend::drawFrame() {
+  uint32_t imageIndex;
+  waitForFrame();
+  FrameResources &frame = _frames[_currentFrame];
+  if (_settings.headless) {
+    drawOffscreenFrame();
+    return;
+  }
+
+  auto acquireStart = std::chrono::high_resolution_clock::now();
+  VkResult result = vkAcquireNextImageKHR(
+      _device, _swapChain, std::numeric_limits<uint64_t>::max(),
+      frame.imageAvailable, VK_NULL_HANDLE, &imageIndex);
+  auto acquireEnd = std::chrono::high_resolution_clock::now();
+  if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+    recreateSwapChain();
+    return;
+  } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+    throw std::runtime_error("failed to acquire swap chain image!");
+  }
+  recordCommandBuffer(imageIndex);
+
+  VkSubmitInfo submitInfo = {};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+
+  VkSemaphore waitSemaphores[] = {frame.imageAvailable};
+  VkPipelineStageFlags waitStages[] = {
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+  submitInfo.waitSemaphoreCount = 1;
+  submitInfo.pWaitSemaphores = waitSemaphores;
+  submitInfo.pWaitDstStageMask = waitStages;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &frame.commandBuffer;
+  VkSemaphore signalSemaphores[] = {frame.renderFinished};
+  submitInfo.signalSemaphoreCount = 1;
+  submitInfo.pSignalSemaphores = signalSemaphores;
+  vkResetFences(_device, 1, &frame.inFlight);
+  result = vkQueueSubmit(_graphicsQueue, 1, &submitInfo, frame.inFlight);
+  vkCheckResult(result, "vkQueueSubmit");
+  frame.submitted = true;
+  _currentFrame = (_currentFrame + 1) % _frames.size();
+  pushFrameTimes(std::chrono::high_resolution_clock::now(),
+                 acquireEnd - acquireStart);
+
+  VkPresentInfoKHR presentInfo = {};
+  presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+
+  presentInfo.waitSemaphoreCount = 1;
+  presentInfo.pWaitSemaphores = signalSemaphores;
+  VkSwapchainKHR swapChains[] = {_swapChain};
+  presentInfo.swapchainCount = 1;
+  presentInfo.pSwapchains = swapChains;
+  presentInfo.pImageIndices = &imageIndex;
+  presentInfo.pResults = nullptr;
+  result = vkQueuePresentKHR(_presentQueue, &presentInfo);
+  auto presentEnd = std::chrono::high_resolution_clock::now();
+  _telemetry.acquireBlock.push(
+      std::chrono::duration<double, std::milli>(acquireEnd - acquireStart)
+          .count());
+  _telemetry.acquireToPresent.push(
+      std::chrono::duration<double, std::milli>(presentEnd - acquireEnd)
+          .count());
+  pushPresentInterval(presentEnd);
+  if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+    recreateSwapChain();
+  } else if (result != VK_SUCCESS) {
+    throw std::runtime_error("failed to present swap chain image!");
+  }
+}
+
+// The ring images are used in turn, the frames in flight one after the
+// other on the queue. Nothing waits on or signals the semaphores.
+void VkBackend::drawOffscreenFrame() {
+  if (_readbackPending) {
+    vkWaitForFences(_device, 1, &_frames[_readbackFrame].inFlight, VK_TRUE,
+                    std::numeric_limits<uint64_t>::max());
+    writeReadback();
+  }
+  const uint32_t imageIndex =
+      _headlessFrame % static_cast<uint32_t>(_swapChainImages.size());
+  _readbackPending = !_settings.readbackDirectory.empty() &&
+                     _headlessFrame % std::max(_settings.readbackInterval,
+                                               1u) == 0;
+  _readbackFrame = _currentFrame;
+  recordCommandBuffer(imageIndex);
+
+  FrameResources &frame = _frames[_currentFrame];
+  VkSubmitInfo submitInfo = {};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &frame.commandBuffer;
+  vkResetFences(_device, 1, &frame.inFlight);
+  VkResult result =
+      vkQueueSubmit(_graphicsQueue, 1, &submitInfo, frame.inFlight);
+  vkCheckResult(result, "vkQueueSubmit");
+  frame.submitted = true;
+  _currentFrame = (_currentFrame + 1) % _frames.size();
+  auto submitEnd = std::chrono::high_resolution_clock::now();
+  pushFrameTimes(submitEnd, std::chrono::high_resolution_clock::duration());
+  pushPresentInterval(submitEnd);
+  _headlessFrame++;
+}
+
+// Frames drawn without an update() first have no CPU time
+void VkBackend::pushFrameTimes(
+    std::chrono::high_resolution_clock::time_point submitEnd,
+    std::chrono::high_resolution_clock::duration acquire) {
+  if (!_framePending) return;
+  _framePending = false;
+  _telemetry.cpuFrame.push(std::chrono::duration<double, std::milli>(
+                               submitEnd - _frameStart - acquire)
+                               .count());
+}
+
+void VkBackend::pushPresentInterval(
+    std::chrono::high_resolution_clock::time_point presentEnd) {
+  if (_lastPresent != std::chrono::high_resolution_clock::time_point()) {
+    _telemetry.presentInterval.push(
+        std::chrono::duration<double, std::milli>(presentEnd - _lastPresent)
+            .count());
+  }
+  _lastPresent = presentEnd;
+}
+
+// After the render passes, which leave the image in TRANSFER_SRC_OPTIMAL.
+// Their dependency to VK_SUBPASS_EXTERNAL orders the copy after the color
+// writes and the layout transition.
+void VkBackend::recordReadback(VkCommandBuffer commandBuffer,
+                               uint32_t imageIndex) {
+  VkBufferImageCopy region = {};
+  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.layerCount = 1;
+  region.imageExtent = {_swapChainExtent.width, _swapChainExtent.height, 1};
+  vkCmdCopyImageToBuffer(commandBuffer, _swapChainImages[imageIndex],
+                         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                         _readbackBuffer.buffer, 1, &region);
+
+  VkBufferMemoryBarrier hostBarrier = {};
+  hostBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  hostBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  hostBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  hostBarrier.buffer = _readbackBuffer.buffer;
+  hostBarrier.size = VK_WHOLE_SIZE;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1,
+                       &hostBarrier, 0, nullptr);
+}
+
+// Binary PPM of the frame read back by the previous drawOffscreenFrame(),
+// BGRA swizzled to RGB
+void VkBackend::writeReadback() {
+  _readbackPending = false;
+  const uint32_t frame = _headlessFrame - 1;
+  std::ostringstream path;
+  path << _settings.readbackDirectory << "/frame_" << std::setfill('0')
+       << std::setw(5) << frame << ".ppm";
+  std::ofstream file(path.str(), std::ios::binary);
+  if (!file.is_open()) {
+    std::cerr << "warning: failed to write " << path.str() << std::endl;
+    return;
+  }
+  const uint32_t width = _swapChainExtent.width;
+  const uint32_t height = _swapChainExtent.height;
+  file << "P6\n" << width << " " << height << "\n255\n";
+  std::vector<char> row(width * 3);
+  for (uint32_t y = 0; y < height; y++) {
+    const char *pixel = _mappedReadback + static_cast<size_t>(y) * width * 4;
+    for (uint32_t x = 0; x < width; x++, pixel += 4) {
+      row[3 * x] = pixel[2];
+      row[3 * x + 1] = pixel[1];
+      row[3 * x + 2] = pixel[0];
+    }
+    file.write(row.data(), row.size());
+  }
+}
+
+// Loop bound of the specialized light pipeline: the next power of two, the
+// UBO count ending the loop early. 0 (from the UBO) past the largest.
+static uint32_t lightCountBucket(uint32_t lightCount) {
+  if (lightCount > MAX_SPECIALIZED_LIGHT_COUNT) return 0;
+  uint32_t bucket = MIN_SPECIALIZED_LIGHT_COUNT;
+  while (bucket < lightCount) bucket *= 2;
+  return bucket;
+}
+
+void VkBackend::update() {
+  static auto startTime = std::chrono::high_resolution_clock::now();
+
+  auto currentTime = std::chrono::high_resolution_clock::now();
+  float time = std::chrono::duration_cast<std::chrono::milliseconds>(
+                   currentTime - startTime)
+                   .count() /
+               1000.0f;
+  if (_animationTime >= 0.0f) time = _animationTime;
+  const float nearPlane = 0.1f;
+  const float farPlane = 100.0f;
+
+  // The frame's uploads and statistics are free once its previous use
+  // completed, the frames since may still execute
+  waitForFrame();
+  _frameStart = std::chrono::high_resolution_clock::now();
+  _framePending = true;
+  updateRenderExtent();
+
+  gPassUbo gpassUbo = {};
+  gpassUbo.model = glm::rotate(glm::mat4(), time * glm::radians(10.0f),
+                               glm::vec3(0.0f, 1.0f, 0.0f));
+  gpassUbo.view =
+      glm::lookAt(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(1.0f, 2.0f, 0.0f),
+                  glm::vec3(0.0f, 1.0f, 0.0f));
+  // The aspect ratio is the swapchain's, the render extent may round off
+  gpassUbo.proj = glm::perspective(
+      glm::radians(45.0f),
+      _swapChainExtent.width / (float)_swapChainExtent.height, nearPlane,
+      farPlane);
+  gpassUbo.proj[1][1] *= -1;
+  _view = gpassUbo.view;
+  _proj = gpassUbo.proj;
+  memcpy(stageUpload(_gpassUniformBuffer.buffer, 0, sizeof(gpassUbo)),
+         &gpassUbo, sizeof(gpassUbo));
+
+  // Batches of the G-pass then of the shadow layers fill the instance
+  // indices of the frame
+  updateInstances();
+  _instanceIndices.clear();
+  cullDraws(gpassUbo.proj * gpassUbo.view * gpassUbo.model);
+
+  auto lightStart = std::chrono::high_resolution_clock::now();
+  _lightManager.animate(time);
+  uploadLights();
+  auto lightEnd = std::chrono::high_resolution_clock::now();
+  _lightUpdateStats.push(
+      std::chrono::duration<double, std::milli>(lightEnd - lightStart)
+          .count());
+  // After the lights moved, the cube faces follow them
+  updateShadows(gpassUbo.view, gpassUbo.proj, gpassUbo.model, nearPlane);
+  auto queueStart = std::chrono::high_resolution_clock::now();
+  queueGPassDraws(gpassUbo.view * gpassUbo.model, farPlane);
+  queueShadowDraws();
+  auto queueEnd = std::chrono::high_resolution_clock::now();
+  _bindStats.sortTime.push(
+      std::chrono::duration<double, std::milli>(queueEnd - queueStart)
+          .count());
+  uploadInstanceIndices();
+  uploadPerDrawData();
+
+  lightUbo light = {};
+  light.invViewProj = glm::inverse(gpassUbo.proj * gpassUbo.view);
+  light.view = gpassUbo.view;
+  light.invProj = glm::inverse(gpassUbo.proj);
+  light.viewPosition = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+  light.clusterDepth =
+      glm::vec4(nearPlane, farPlane, std::log(farPlane / nearPlane), 0.0f);
+  light.clusterTile = glm::uvec4(
+      (_renderExtent.width + CLUSTER_GRID_X - 1) / CLUSTER_GRID_X,
+      (_renderExtent.height + CLUSTER_GRID_Y - 1) / CLUSTER_GRID_Y,
+      _renderExtent.width, _renderExtent.height);
+  light.lightCount = _lightManager.count();
+  // A new bucket switches the light pipeline to its variant, created the
+  // first time
+  uint32_t specializedLightCount =
+      _settings.specializeLightCount &&
+              _settings.lightingMode == LightingMode::FullScreen
+          ? lightCountBucket(light.lightCount)
+          : 0;
+  if (specializedLightCount != _specializedLightCount) {
+    _specializedLightCount = specializedLightCount;
+    selectGraphicsPipelines();
+  }
+  light.viewProj = gpassUbo.proj * gpassUbo.view;
+
+  memcpy(stageUpload(_lightUniformBuffer.buffer, 0, sizeof(lightUbo)), &light,
+         sizeof(lightUbo));
+
+  if (_settings.dynamicResolution) {
+    upscaleUbo upscale = {};
+    upscale.uvScale = glm::vec4(
+        _renderExtent.width / (float)_renderTargetExtent.width,
+        _renderExtent.height / (float)_renderTargetExtent.height,
+        (_renderExtent.width - 0.5f) / _renderTargetExtent.width,
+        (_renderExtent.height - 0.5f) / _renderTargetExtent.height);
+    memcpy(stageUpload(_upscaleUniformBuffer.buffer, 0, sizeof(upscaleUbo)),
+           &upscale, sizeof(upscaleUbo));
+  }
+}
+
+void VkBackend::updateRenderExtent() {
+  _renderExtent = _swapChainExtent;
+  if (!_settings.dynamicResolution) return;
+  const float scale = _resolutionController.scale();
+  _renderExtent.width = std::min(
+      std::max(static_cast<uint32_t>(
+                   std::lround(_swapChainExtent.width * scale)),
+               1u),
+      _renderTargetExtent.width);
+  _renderExtent.height = std::min(
+      std::max(static_cast<uint32_t>(
+                   std::lround(_swapChainExtent.height * scale)),
+               1u),
+      _renderTargetExtent.height);
+}
+
+void VkBackend::createDrawItems() {
+  _drawItems.clear();
+  _drawBounds.clear();
+  _drawBoxes.clear();
+  _meshDrawRanges.clear();
+  // The culling pass tests every draw item of every instance, grouped by
+  // mesh for the indirect draws of each mesh
+  const uint32_t instanceCount = static_cast<uint32_t>(_instances.size());
+  uint32_t instanceTriangles = 0;
+  std::vector<DrawData> drawData;
+  for (uint32_t meshId = 0; meshId < _model.meshes.size(); meshId++) {
+    MeshDrawRange range = {};
+    range.first = static_cast<uint32_t>(drawData.size());
+    range.indexType = VK_INDEX_TYPE_UINT16;
+    for (const auto &subMesh : _model.meshes[meshId].subMeshes) {
+      const IndexRange &indices = _indexRanges[_drawItems.size()];
+      range.indexType = indices.indexType;
+      DrawItem item = {};
+      item.mesh = meshId;
+      item.indexCount = subMesh.indexCount;
+      item.firstIndex = indices.firstIndex;
+      item.vertexOffset = subMesh.vertexOffset;
+      item.indexType = indices.indexType;
+      _drawItems.push_back(item);
+      _drawBounds.add(subMesh.bounds);
+      _drawBoxes.push_back(subMesh.bounds);
+      instanceTriangles += subMesh.indexCount / 3;
+
+      DrawData data = {};
+      data.boundsMin = glm::vec4(subMesh.bounds.min, 1.0f);
+      data.boundsMax = glm::vec4(subMesh.bounds.max, 1.0f);
+      data.mesh = meshId;
+      data.indexCount = subMesh.indexCount;
+      data.vertexOffset = subMesh.vertexOffset;
+      data.meshFirstDraw = range.first;
+      data.firstIndex = indices.firstIndex;
+      for (uint32_t instance = 0; instance < instanceCount; instance++) {
+        data.instance = instance;
+        drawData.push_back(data);
+      }
+    }
+    range.count = static_cast<uint32_t>(drawData.size()) - range.first;
+    _meshDrawRanges.push_back(range);
+  }
+  _gpuDrawCount = static_cast<uint32_t>(drawData.size());
+  _cullingStats.totalDraws = _gpuDrawCount;
+  _cullingStats.totalTriangles = instanceTriangles * instanceCount;
+
+  // Inputs and outputs of the GPU culling pass, sized for at least one
+  // draw so an empty model still gets valid buffers. Commands and counts
+  // have one range per occlusion phase.
+  const VkMemoryPropertyFlags hostVisible =
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  const size_t drawCount = std::max<size_t>(_gpuDrawCount, 1);
+  const size_t meshCount = std::max<size_t>(_meshDrawRanges.size(), 1);
+  const size_t countBufferSize =
+      (DrawCullStatCount + 2 * meshCount) * sizeof(uint32_t);
+  _drawDataBuffer =
+      createStorageBuffer(drawCount * sizeof(DrawData), hostVisible);
+  if (!drawData.empty()) {
+    void *data;
+    vkMapMemory(_device, _drawDataBuffer.bufferMemory, 0,
+                drawData.size() * sizeof(DrawData), 0, &data);
+    memcpy(data, drawData.data(), drawData.size() * sizeof(DrawData));
+    vkUnmapMemory(_device, _drawDataBuffer.bufferMemory);
+  }
+  _drawCommandBuffer = createStorageBuffer(
+      2 * drawCount * sizeof(VkDrawIndexedIndirectCommand),
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+  // The statistics are copied to the frame's, read back by update()
+  _drawCountBuffer = createStorageBuffer(
+      countBufferSize, hostVisible,
+      VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+          VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+  void *counts;
+  vkMapMemory(_device, _drawCountBuffer.bufferMemory, 0, VK_WHOLE_SIZE, 0,
+              &counts);
+  memset(counts, 0, countBufferSize);
+  vkUnmapMemory(_device, _drawCountBuffer.bufferMemory);
+  _drawVisibilityBuffer = createStorageBuffer(
+      drawCount * sizeof(uint32_t), VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(_physicalDevice, &properties);
+  VkDeviceSize alignment = properties.limits.minUniformBufferOffsetAlignment;
+  _drawCullUboStride =
+      (sizeof(drawCullUbo) + alignment - 1) / alignment * alignment;
+  _drawCullUniformBuffer = createUniformBuffer(2 * _drawCullUboStride);
+}
+
+void VkBackend::destroyDrawItems() {
+  forgetUploads(_drawCullUniformBuffer.buffer);
+  for (Buffer *buffer :
+       {&_drawDataBuffer, &_drawCommandBuffer, &_drawCountBuffer,
+        &_drawVisibilityBuffer, &_drawCullUniformBuffer}) {
+    vkDestroyBuffer(_device, buffer->buffer, nullptr);
+    vkFreeMemory(_device, buffer->bufferMemory, nullptr);
+  }
+}
+
+// Transforms for every instance, indices for the draw slots plus one
+// instance per draw item to start with
+void VkBackend::createInstanceBuffers() {
+  const size_t instanceCount = std::max<size_t>(_instances.size(), 1);
+  _instanceBuffer = createStorageBuffer(
+      instanceCount * sizeof(glm::mat4), VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+  createInstanceIndexBuffer(static_cast<uint32_t>(
+      std::max<size_t>(_gpuDrawCount + _drawItems.size(), 1)));
+}
+
+void VkBackend::destroyInstanceBuffers() {
+  destroyInstanceIndexBuffer();
+  forgetUploads(_instanceBuffer.buffer);
+  vkDestroyBuffer(_device, _instanceBuffer.buffer, nullptr);
+  vkFreeMemory(_device, _instanceBuffer.bufferMemory, nullptr);
+}
+
+// The draw slots are what the indirect draws of the GPU culling modes index
+// with their draw as firstInstance, in the culling pass order: draw items,
+// then instances
+void VkBackend::createInstanceIndexBuffer(uint32_t capacity) {
+  _instanceIndexCapacity = capacity;
+  _instanceIndexBuffer = createStorageBuffer(
+      capacity * sizeof(InstanceSlot),
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+  InstanceSlot *slot;
+  vkMapMemory(_device, _instanceIndexBuffer.bufferMemory, 0, VK_WHOLE_SIZE, 0,
+              reinterpret_cast<void **>(&slot));
+  for (const DrawItem &item : _drawItems) {
+    for (uint32_t i = 0; i < _instances.size(); i++) {
+      slot->instance = i;
+      slot->material = item.mesh;
+      slot++;
+    }
+  }
+  vkUnmapMemory(_device, _instanceIndexBuffer.bufferMemory);
+}
+
+void VkBackend::destroyInstanceIndexBuffer() {
+  forgetUploads(_instanceIndexBuffer.buffer);
+  vkDestroyBuffer(_device, _instanceIndexBuffer.buffer, nullptr);
+  vkFreeMemory(_device, _instanceIndexBuffer.bufferMemory, nullptr);
+}
+
+void VkBackend::writeInstanceDescriptors(VkDescriptorSet descriptorSet) {
+  std::array<VkDescriptorBufferInfo, 2> bufferInfos = {};
+  bufferInfos[0].buffer = _instanceBuffer.buffer;
+  bufferInfos[0].range = VK_WHOLE_SIZE;
+  bufferInfos[1].buffer = _instanceIndexBuffer.buffer;
+  bufferInfos[1].range = VK_WHOLE_SIZE;
+
+  std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+  for (uint32_t i = 0; i < descriptorWrites.size(); i++) {
+    descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[i].dstSet = descriptorSet;
+    descriptorWrites[i].dstBinding = INSTANCE_BINDING + i;
+    descriptorWrites[i].dstArrayElement = 0;
+    descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorWrites[i].descriptorCount = 1;
+    descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+  }
+  vkUpdateDescriptorSets(_device,
+                         static_cast<uint32_t>(descriptorWrites.size()),
+                         descriptorWrites.data(), 0, nullptr);
+}
+
+void VkBackend::updateInstances() {
+  if (!_instancesDirty) return;
+  _instancesDirty = false;
+  if (!_instances.empty()) {
+    const size_t size = _instances.size() * sizeof(glm::mat4);
+    memcpy(stageUpload(_instanceBuffer.buffer, 0, size), _instances.data(),
+           size);
+  }
+
+  // Instance boxes from the union of the draw boxes, an empty model is a
+  // point at the origin
+  AABB modelBounds;
+  for (const AABB &box : _drawBoxes) modelBounds.extend(box);
+  if (_drawBoxes.empty()) modelBounds.extend(glm::vec3(0.0f));
+  _instanceBounds.clear();
+  _sceneBounds = AABB();
+  for (const glm::mat4 &transform : _instances) {
+    AABB box = transformBounds(modelBounds, transform);
+    _instanceBounds.add(box);
+    _sceneBounds.extend(box);
+  }
+  // Occluders hold transformed vertices, only picked again when used so
+  // that animated instances don't pay for them in the other modes
+  _occludersDirty = true;
+  // Cached shadow layers still show the instances where they were
+  _shadowCache.invalidate();
+}
+
+void VkBackend::uploadInstanceIndices() {
+  const size_t required = _gpuDrawCount + _instanceIndices.size();
+  if (required > _instanceIndexCapacity) {
+    // Rare: the sets are rewritten in place once the GPU is done with them
+    vkDeviceWaitIdle(_device);
+    destroyInstanceIndexBuffer();
+    createInstanceIndexBuffer(static_cast<uint32_t>(
+        std::max<size_t>(required, 2 * _instanceIndexCapacity)));
+    for (VkDescriptorSet descriptorSet : _gpassPipeline.descriptorSets) {
+      writeInstanceDescriptors(descriptorSet);
+    }
+    for (VkDescriptorSet descriptorSet : _shadowPipeline.descriptorSets) {
+      writeInstanceDescriptors(descriptorSet);
+    }
+    if (_mergedGPassSet != VK_NULL_HANDLE) {
+      writeInstanceDescriptors(_mergedGPassSet);
+    }
+  }
+  if (!_instanceIndices.empty()) {
+    const size_t size = _instanceIndices.size() * sizeof(InstanceSlot);
+    memcpy(stageUpload(_instanceIndexBuffer.buffer,
+                       _gpuDrawCount * sizeof(InstanceSlot), size),
+           _instanceIndices.data(), size);
+  }
+}
+
+// Host-visible records _perDrawStride apart, each a dynamic offset
+void VkBackend::createPerDrawBuffer(uint32_t capacity) {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(_physicalDevice, &properties);
+  VkDeviceSize alignment = properties.limits.minUniformBufferOffsetAlignment;
+  _perDrawStride =
+      (sizeof(gPassPerDraw) + alignment - 1) / alignment * alignment;
+  _perDrawCapacity = capacity;
+  createBuffer(capacity * _perDrawStride,
+               VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+                   VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _perDrawBuffer.buffer,
+               _perDrawBuffer.bufferMemory);
+}
+
+void VkBackend::destroyPerDrawBuffer() {
+  forgetUploads(_perDrawBuffer.buffer);
+  vkDestroyBuffer(_device, _perDrawBuffer.buffer, nullptr);
+  vkFreeMemory(_device, _perDrawBuffer.bufferMemory, nullptr);
+}
+
+// The G-pass batches are culled first: their instances are the first slots
+// after the draw slots, record i is slot i of them
+void VkBackend::uploadPerDrawData() {
+  if (_settings.perDrawData != PerDrawData::DynamicUniform) return;
+  uint32_t count = 0;
+  for (const DrawBatch &batch : _visibleBatches) count += batch.instanceCount;
+  if (count > _perDrawCapacity) {
+    // Rare: the set is rewritten in place once the GPU is done with it
+    vkDeviceWaitIdle(_device);
+    destroyPerDrawBuffer();
+    createPerDrawBuffer(std::max(count, 2 * _perDrawCapacity));
+    writePerDrawDescriptor(_perDrawSet);
+  }
+  if (count == 0) return;
+  char *records = static_cast<char *>(
+      stageUpload(_perDrawBuffer.buffer, 0, count * _perDrawStride));
+  for (uint32_t i = 0; i < count; i++) {
+    const InstanceSlot &slot = _instanceIndices[i];
+    gPassPerDraw *record =
+        reinterpret_cast<gPassPerDraw *>(records + i * _perDrawStride);
+    record->model = _instances[slot.instance];
+    record->material = slot.material;
+  }
+}
+
+// Fills _visibleBatches for the next recorded frame, modelViewProj takes
+// the scene space of the instance transforms to clip space. GPU modes only
+// upload the culling parameters, the statistics reported are those of the
+// frame's previous use, complete once its fence was waited on.
+void VkBackend::cullDraws(const glm::mat4 &modelViewProj) {
+  auto start = std::chrono::high_resolution_clock::now();
+  _visibleBatches.clear();
+  if (_settings.cullingMode == CullingMode::Gpu ||
+      _settings.cullingMode == CullingMode::GpuOcclusion) {
+    const bool occlusion = _settings.cullingMode == CullingMode::GpuOcclusion;
+    Frustum frustum = extractFrustum(modelViewProj);
+    drawCullUbo ubo = {};
+    ubo.modelViewProj = modelViewProj;
+    for (int i = 0; i < 6; i++) ubo.planes[i] = frustum.planes[i];
+    // The first occlusion phase tests against the pyramid of the previous
+    // frame's depth, drawn at that frame's render extent
+    const VkExtent2D firstExtent = occlusion ? _hiZExtent : _renderExtent;
+    ubo.viewportSize = glm::vec2(firstExtent.width, firstExtent.height);
+    ubo.hiZLevels = occlusion ? _hiZ.levelCount : 0;
+    ubo.drawCount = _gpuDrawCount;
+    // The merged draw covers every command at once, the count extension's
+    // packing is per mesh
+    ubo.compact =
+        _drawIndirectCountSupported && !getMergedDrawsActive() ? 1 : 0;
+
+    char *data = static_cast<char *>(stageUpload(
+        _drawCullUniformBuffer.buffer, 0, 2 * _drawCullUboStride));
+    // Slot 0: single pass or first phase, slot 1: second phase
+    ubo.phase = occlusion ? 1 : 0;
+    memcpy(data, &ubo, sizeof(drawCullUbo));
+    ubo.phase = 2;
+    ubo.viewportSize = glm::vec2(_renderExtent.width, _renderExtent.height);
+    ubo.commandBase = ubo.drawCount;
+    ubo.countBase = static_cast<uint32_t>(_meshDrawRanges.size());
+    memcpy(data + _drawCullUboStride, &ubo, sizeof(drawCullUbo));
+    _hiZExtent = _renderExtent;
+
+    const uint32_t *stats = _frames[_currentFrame].mappedDrawStats;
+    _cullingStats.visibleDraws = stats[DrawCullDraws];
+    _cullingStats.visibleTriangles = stats[DrawCullTriangles];
+    _cullingStats.frustumDraws = stats[DrawCullFrustumDraws];
+    _cullingStats.frustumTriangles = stats[DrawCullFrustumTriangles];
+    _cullingStats.secondPhaseDraws = stats[DrawCullSecondPhaseDraws];
+  } else {
+    // Occluders are rendered with the matrices of this frame, the draws
+    // they hide are removed before recording
+    const bool occlusion = _settings.cullingMode == CullingMode::CpuOcclusion;
+    if (occlusion && _occludersDirty) {
+      _occlusionCuller.clearOccluders();
+      _occlusionCuller.selectOccluders(_model, _instances,
+                                       _settings.occluderTriangleBudget);
+      _occludersDirty = false;
+    }
+    if (occlusion) _occlusionCuller.render(modelViewProj, _workerPool);
+    cullInstances(modelViewProj, _settings.cullingMode != CullingMode::None,
+                  occlusion, _visibleBatches, &_cullingStats);
+    _cullingStats.secondPhaseDraws = 0;
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  _cullingStats.cullTime.push(
+      std::chrono::duration<double, std::milli>(end - start).count());
+}
+
+void VkBackend::cullInstances(const glm::mat4 &viewProj, bool culling,
+                              bool occlusion, std::vector<DrawBatch> &batches,
+                              CullingStats *stats) {
+  const uint32_t drawCount = static_cast<uint32_t>(_drawItems.size());
+  const uint32_t instanceCount = static_cast<uint32_t>(_instances.size());
+  _visibleInstances.clear();
+  if (culling) {
+    _instanceBounds.cull(extractFrustum(viewProj), _visibleInstances);
+  } else {
+    for (uint32_t i = 0; i < instanceCount; i++) {
+      _visibleInstances.push_back(i);
+    }
+  }
+
+  // Draw item and instance pairs, counted per draw item
+  _batchSizes.assign(drawCount, 0);
+  _visiblePairs.clear();
+  uint32_t frustumDraws = 0;
+  uint32_t frustumTriangles = 0;
+  uint32_t triangles = 0;
+  for (uint32_t instance : _visibleInstances) {
+    const glm::mat4 &transform = _instances[instance];
+    _visibleSubMeshes.clear();
+    if (culling) {
+      _drawBounds.cull(extractFrustum(viewProj * transform),
+                       _visibleSubMeshes);
+    } else {
+      for (uint32_t d = 0; d < drawCount; d++) _visibleSubMeshes.push_back(d);
+    }
+    for (uint32_t drawId : _visibleSubMeshes) {
+      const uint32_t drawTriangles = _drawItems[drawId].indexCount / 3;
+      frustumDraws++;
+      frustumTriangles += drawTriangles;
+      if (occlusion && !_occlusionCuller.isVisible(transformBounds(
+                           _drawBoxes[drawId], transform))) {
+        continue;
+      }
+      triangles += drawTriangles;
+      _batchSizes[drawId]++;
+      _visiblePairs.push_back(drawId);
+      _visiblePairs.push_back(instance);
+    }
+  }
+
+  // Counting sort of the pairs by draw item: each run of instances is a
+  // batch, placed after the draw slots of the index buffer
+  uint32_t offset = static_cast<uint32_t>(_instanceIndices.size());
+  _instanceIndices.resize(offset + _visiblePairs.size() / 2);
+  for (uint32_t drawId = 0; drawId < drawCount; drawId++) {
+    if (_batchSizes[drawId] == 0) continue;
+    DrawBatch batch = {};
+    batch.draw = drawId;
+    batch.firstInstance = _gpuDrawCount + offset;
+    batch.instanceCount = _batchSizes[drawId];
+    batches.push_back(batch);
+    // From here the next free slot of the batch
+    _batchSizes[drawId] = offset;
+    offset += batch.instanceCount;
+  }
+  for (size_t i = 0; i < _visiblePairs.size(); i += 2) {
+    InstanceSlot &slot = _instanceIndices[_batchSizes[_visiblePairs[i]]++];
+    slot.instance = _visiblePairs[i + 1];
+    slot.material = _drawItems[_visiblePairs[i]].mesh;
+  }
+
+  if (stats) {
+    stats->frustumDraws = frustumDraws;
+    stats->frustumTriangles = frustumTriangles;
+    stats->visibleDraws = static_cast<uint32_t>(_visiblePairs.size() / 2);
+    stats->visibleTriangles = triangles;
+  }
+}
+
+// The batches of a material together, front to back by the depth of the box
+// center of their first instance. Empty in the GPU culling modes, whose
+// draws are indirect.
+void VkBackend::queueGPassDraws(const glm::mat4 &modelView, float farPlane) {
+  _gPassQueue.clear();
+  // A single pipeline per G-pass, recordGPassDraws() binds it once
+  const uint32_t pipeline = static_cast<uint32_t>(QueuedPipeline::GPass);
+  for (uint32_t b = 0; b < _visibleBatches.size(); b++) {
+    const DrawBatch &batch = _visibleBatches[b];
+    const AABB &box = _drawBoxes[batch.draw];
+    const uint32_t instance =
+        _instanceIndices[batch.firstInstance - _gpuDrawCount].instance;
+    glm::vec4 center = modelView * _instances[instance] *
+                       glm::vec4((box.min + box.max) * 0.5f, 1.0f);
+    uint32_t depth = RenderQueue::depthBucket(-center.z, farPlane);
+    _gPassQueue.push(RenderQueue::makeKey(0, pipeline,
+                                          _drawItems[batch.draw].mesh, depth),
+                     b);
+  }
+  _gPassQueue.sort();
+}
+
+// Pass is the index in _shadowLayers, so that the layers stay in the order
+// their render passes are recorded
+void VkBackend::queueShadowDraws() {
+  _shadowQueue.clear();
+  for (uint32_t i = 0; i < _shadowLayers.size(); i++) {
+    const QueuedPipeline pipeline = _shadowLayers[i] < SHADOW_CASCADE_COUNT
+                                        ? QueuedPipeline::CascadeShadow
+                                        : QueuedPipeline::PointShadow;
+    const uint64_t key =
+        RenderQueue::makeKey(i, static_cast<uint32_t>(pipeline), 0, 0);
+    for (uint32_t b = _shadowBatchOffsets[i]; b < _shadowBatchOffsets[i + 1];
+         b++) {
+      _shadowQueue.push(key, b);
+    }
+  }
+  _shadowQueue.sort();
+}
+
+// Fits the cascades to the camera, places the cube faces of the shadowed
+// point lights and picks the stale layers to render this frame, each culled
+// with the matrices it is rendered with. The light passes read the matrices
+// each layer was last rendered with.
+void VkBackend::updateShadows(const glm::mat4 &view, const glm::mat4 &proj,
+                              const glm::mat4 &model, float nearPlane) {
+  auto start = std::chrono::high_resolution_clock::now();
+  _shadowLayers.clear();
+  _shadowBatches.clear();
+  _shadowBatchOffsets.assign(1, 0);
+  _shadowStats.renderedLayers = 0;
+  _shadowStats.cachedLayers = 0;
+  _shadowStats.deferredLayers = 0;
+  _shadowStats.draws = 0;
+  _shadowStats.triangles = 0;
+  _pointShadowLightCount = 0;
+
+  shadowUbo ubo = {};
+  if (_settings.shadows) {
+    ShadowCascade cascades[SHADOW_CASCADE_COUNT];
+    computeCascades(view, proj, nearPlane, _settings.shadowDistance,
+                    _settings.sunDirection,
+                    transformBounds(_sceneBounds, model),
+                    _settings.shadowMapSize, cascades);
+    for (uint32_t c = 0; c < SHADOW_CASCADE_COUNT; c++) {
+      _shadowCache.request(c, cascades[c].proj * cascades[c].view, model);
+      ubo.cascadeSplits[c] = cascades[c].splitDepth;
+      ubo.cascadeTexelSize[c] = cascades[c].texelSize;
+    }
+
+    // The first point lights, their positions are in G-buffer space
+    for (uint32_t i = 0; i < _lightManager.count() &&
+                         _pointShadowLightCount < _settings.pointShadowCount;
+         i++) {
+      if (_lightManager.type(i) != LightType::Point) continue;
+      glm::vec3 position = _lightManager.position(i);
+      position.y = -position.y;
+      uint32_t slot = _pointShadowLightCount++;
+      _pointShadowLights[slot] = i;
+      for (uint32_t face = 0; face < POINT_SHADOW_FACES; face++) {
+        _shadowCache.request(
+            SHADOW_CASCADE_COUNT + slot * POINT_SHADOW_FACES + face,
+            pointShadowFace(position, _lightManager.range(i), face), model);
+      }
+    }
+
+    const uint32_t layerCount =
+        SHADOW_CASCADE_COUNT + _pointShadowLightCount * POINT_SHADOW_FACES;
+    const uint32_t staleLayers = _shadowCache.staleCount(layerCount);
+    _shadowCache.schedule(layerCount, _settings.shadowBudget, _shadowLayers);
+    // Grouped by pass for the per-pass GPU scopes
+    std::sort(_shadowLayers.begin(), _shadowLayers.end());
+    _shadowStats.renderedLayers = static_cast<uint32_t>(_shadowLayers.size());
+    _shadowStats.cachedLayers = layerCount - staleLayers;
+    _shadowStats.deferredLayers = staleLayers - _shadowStats.renderedLayers;
+
+    for (uint32_t layer : _shadowLayers) {
+      // Cube faces carry the whole view-projection in proj
+      gPassUbo pass = {};
+      pass.model = model;
+      if (layer < SHADOW_CASCADE_COUNT) {
+        pass.view = cascades[layer].view;
+        pass.proj = cascades[layer].proj;
+      } else {
+        pass.proj = _shadowCache.viewProj(layer);
+      }
+      memcpy(stageUpload(_shadowPassBuffer.buffer, layer * _shadowPassStride,
+                         sizeof(gPassUbo)),
+             &pass, sizeof(gPassUbo));
+      cullInstances(pass.proj * pass.view * model, true, false,
+                    _shadowBatches);
+      _shadowBatchOffsets.push_back(
+          static_cast<uint32_t>(_shadowBatches.size()));
+    }
+    for (const DrawBatch &batch : _shadowBatches) {
+      _shadowStats.draws += batch.instanceCount;
+      _shadowStats.triangles +=
+          _drawItems[batch.draw].indexCount / 3 * batch.instanceCount;
+    }
+
+    for (uint32_t c = 0; c < SHADOW_CASCADE_COUNT; c++) {
+      ubo.cascadeViewProj[c] = _shadowCache.viewProj(c);
+    }
+    for (uint32_t layer = SHADOW_CASCADE_COUNT; layer < layerCount; layer++) {
+      ubo.pointFaceViewProj[layer - SHADOW_CASCADE_COUNT] =
+          _shadowCache.viewProj(layer);
+    }
+    for (uint32_t slot = 0; slot < _pointShadowLightCount; slot++) {
+      ubo.pointShadowLights[slot] = _pointShadowLights[slot];
+    }
+    ubo.pointShadowCount = _pointShadowLightCount;
+    ubo.sunDirection = glm::vec4(glm::normalize(_settings.sunDirection), 0.0f);
+    ubo.sunColor = glm::vec4(_settings.sunColor, 1.0f);
+  }
+
+  memcpy(stageUpload(_shadowUniformBuffer.buffer, 0, sizeof(shadowUbo)), &ubo,
+         sizeof(shadowUbo));
+
+  auto end = std::chrono::high_resolution_clock::now();
+  _shadowStats.cpuTime.push(
+      std::chrono::duration<double, std::milli>(end - start).count());
+}
+
+// Deterministic value in [0, 1) for a light and a parameter channel
+static float lightHash(uint32_t index, uint32_t channel) {
+  uint32_t h = index * 0x9E3779B9u ^ (channel + 1) * 0x85EBCA6Bu;
+  h ^= h >> 16;
+  h *= 0x7FEB352Du;
+  h ^= h >> 15;
+  h *= 0x846CA68Bu;
+  h ^= h >> 16;
+  return (h >> 8) / 16777216.0f;
+}
+
+// The six original lights, then small dim lights orbiting random points of
+// the atrium, used to scale the light count
+static LightDesc sceneLight(uint32_t index) {
+  const float quarterTurn = glm::radians(90.0f);
+  LightDesc light;
+  light.orbitSpeed = 1.0f;
+  switch (index) {
+    case 0:  // White
+      light.color = glm::vec3(1.5f);
+      light.intensity = 15.0f * 0.25f;
+      light.orbitRadius = 5.0f;
+      break;
+    case 1:  // Red
+      light.position = glm::vec3(-4.0f, 0.0f, 0.0f);
+      light.color = glm::vec3(1.0f, 0.0f, 0.0f);
+      light.intensity = 15.0f;
+      light.orbitRadius = 2.0f;
+      light.orbitPhase = glm::vec2(45.0f);
+      break;
+    case 2:  // Blue
+      light.position = glm::vec3(4.0f, 1.0f, 0.0f);
+      light.color = glm::vec3(0.0f, 0.0f, 2.5f);
+      light.intensity = 5.0f;
+      light.orbitRadius = 2.0f;
+      break;
+    case 3:  // Yellow
+      light.position = glm::vec3(0.0f, 0.9f, 0.5f);
+      light.color = glm::vec3(1.0f, 1.0f, 0.0f);
+      light.intensity = 2.0f;
+      light.orbitSpeed = 0.0f;
+      break;
+    case 4:  // Green
+      light.position = glm::vec3(0.0f, 0.5f, 0.0f);
+      light.color = glm::vec3(0.0f, 1.0f, 0.2f);
+      light.intensity = 5.0f;
+      light.orbitRadius = 5.0f;
+      light.orbitPhase = glm::vec2(quarterTurn, 2.5f * quarterTurn);
+      break;
+    case 5:  // Yellow
+      light.position = glm::vec3(0.0f, 1.0f, 0.0f);
+      light.color = glm::vec3(1.0f, 0.7f, 0.3f);
+      light.intensity = 25.0f;
+      light.orbitRadius = 10.0f;
+      light.orbitPhase = glm::vec2(0.5f * quarterTurn, 2.5f * quarterTurn);
+      break;
+    default:
+      light.position = glm::vec3(-14.0f + 28.0f * lightHash(index, 0),
+                                 -4.0f + 5.0f * lightHash(index, 1),
+                                 -6.0f + 12.0f * lightHash(index, 2));
+      light.color = glm::vec3(lightHash(index, 6), lightHash(index, 7),
+                              lightHash(index, 8));
+      light.intensity = 0.01f + 0.02f * lightHash(index, 9);
+      light.orbitRadius = 0.5f + 1.5f * lightHash(index, 3);
+      light.orbitSpeed = 0.1f + 0.4f * lightHash(index, 4);
+      light.orbitPhase = glm::vec2(glm::radians(360.0f) * lightHash(index, 5));
+      break;
+  }
+  return light;
+}
+
+void VkBackend::setSceneLightCount(uint32_t lightCount) {
+  _settings.lightCount = lightCount;
+  while (_sceneLights.size() > lightCount) {
+    _lightManager.remove(_sceneLights.back());
+    _sceneLights.pop_back();
+  }
+  while (_sceneLights.size() < lightCount) {
+    _sceneLights.push_back(_lightManager.add(
+        sceneLight(static_cast<uint32_t>(_sceneLights.size()))));
+  }
+}
+
+void VkBackend::createLightStorageBuffer() {
+  _lightBufferCapacity = _lightManager.capacity();
+  VkDeviceSize size = _lightBufferCapacity * sizeof(Light);
+  _lightStorageBuffer =
+      createStorageBuffer(size, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                          VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+  _lightManager.markAllDirty();
+}
+
+void VkBackend::destroyLightStorageBuffer() {
+  forgetUploads(_lightStorageBuffer.buffer);
+  vkDestroyBuffer(_device, _lightStorageBuffer.buffer, nullptr);
+  vkFreeMemory(_device, _lightStorageBuffer.bufferMemory, nullptr);
+}
+
+void VkBackend::writeLightStorageDescriptor(VkDescriptorSet descriptorSet,
+                                            uint32_t binding) {
+  VkDescriptorBufferInfo lightsInfo = {};
+  lightsInfo.buffer = _lightStorageBuffer.buffer;
+  lightsInfo.offset = 0;
+  lightsInfo.range = VK_WHOLE_SIZE;
+
+  VkWriteDescriptorSet descriptorWrite = {};
+  descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrite.dstSet = descriptorSet;
+  descriptorWrite.dstBinding = binding;
+  descriptorWrite.dstArrayElement = 0;
+  descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  descriptorWrite.descriptorCount = 1;
+  descriptorWrite.pBufferInfo = &lightsInfo;
+  vkUpdateDescriptorSets(_device, 1, &descriptorWrite, 0, nullptr);
+}
+
+// Copies the lights changed since the last upload, the buffer is only
+// reallocated when the manager outgrew it
+void VkBackend::uploadLights() {
+  if (_lightManager.capacity() > _lightBufferCapacity) {
+    // Rare: the sets are rewritten in place once the GPU is done with them
+    vkDeviceWaitIdle(_device);
+    destroyLightStorageBuffer();
+    createLightStorageBuffer();
+    // The light volumes share the light pass set
+    for (VkDescriptorSet descriptorSet : _lightPipeline.descriptorSets) {
+      writeLightStorageDescriptor(descriptorSet, LIGHT_PASS_LIGHTS_BINDING);
+    }
+    for (VkDescriptorSet descriptorSet : _clusterPipeline.descriptorSets) {
+      writeLightStorageDescriptor(descriptorSet, CLUSTER_LIGHTS_BINDING);
+    }
+  }
+  if (!_lightManager.dirty()) return;
+
+  uint32_t begin = _lightManager.dirtyBegin();
+  uint32_t end = _lightManager.dirtyEnd();
+  if (end > begin) {
+    void *lights = stageUpload(_lightStorageBuffer.buffer,
+                               begin * sizeof(Light),
+                               (end - begin) * sizeof(Light));
+    _lightManager.pack(begin, end, static_cast<Light *>(lights));
+  }
+  _lightManager.clearDirty();
+}
+
+void VkBackend::createInstance() {
+  VkApplicationInfo appInfo = {};
+  appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+  appInfo.pApplicationName = "VkRenderer";
+  appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+  appInfo.pEngineName = "";
+  appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+  appInfo.apiVersion = VK_MAKE_VERSION(1, 0, VK_HEADER_VERSION);
+
+  VkInstanceCreateInfo createInfo = {};
+  createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+  createInfo.pApplicationInfo = &appInfo;
+
+  auto extensions = getRequiredExtensions(!_settings.headless);
+  createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+  createInfo.ppEnabledExtensionNames = extensions.data();
+  if (enableValidationLayers && !checkValidationLayerSupport()) {
+    createInfo.enabledLayerCount =
+        static_cast<uint32_t>(validationLayers.size());
+    createInfo.ppEnabledLayerNames = validationLayers.data();
+  } else {
+    createInfo.enabledLayerCount = 0;
+  }
+
+  VkResult result;
+  result = vkCreateInstance(&createInfo, nullptr, &_instance);
+  vkCheckResult(result, "vkCreateInstance");
+}
+
+void VkBackend::setupDebugCallback() {
+  if (!enableValidationLayers) return;
+  VkDebugReportCallbackCreateInfoEXT createInfo = {};
+  createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_REPORT_CALLBACK_CREATE_INFO_EXT;
+  createInfo.flags =
+      VK_DEBUG_REPORT_ERROR_BIT_EXT | VK_DEBUG_REPORT_WARNING_BIT_EXT;
+  createInfo.pfnCallback = debugCallback;
+  if (CreateDebugReportCallbackEXT(_instance, &createInfo, nullptr,
+                                   &_callback) != VK_SUCCESS) {
+    throw std::runtime_error("failed to set up debug callback!");
+  }
+}
+
+void VkBackend::createSurface() {
+  if (glfwCreateWindowSurface(_instance, _window, nullptr, &_surface) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create window surface!");
+  }
+}
+
+void VkBackend::pickPhysicalDevice() {
+  uint32_t deviceCount = 0;
+  VkResult result;
+  result = vkEnumeratePhysicalDevices(_instance, &deviceCount, nullptr);
+  vkCheckResult(result, "vkEnumeratePhysicalDevices");
+  if (deviceCount == 0)
+    throw std::runtime_error("failed to find GPUs with Vulkan support!");
+  std::vector<VkPhysicalDevice> devices(deviceCount);
+  result = vkEnumeratePhysicalDevices(_instance, &deviceCount, devices.data());
+  vkCheckResult(result, "vkEnumeratePhysicalDevices");
+  std::multimap<int, VkPhysicalDevice> candidates;
+  for (const auto &device : devices) {
+    int score = rateDeviceSuitability(device, _surface);
+    candidates.insert(std::make_pair(score, device));
+  }
+  if (candidates.rbegin()->first > 0) {
+    _physicalDevice = candidates.rbegin()->second;
+  }
+  if (_physicalDevice == VK_NULL_HANDLE) {
+    throw std::runtime_error("failed to find a suitable GPU!");
+  }
+}
+
+void VkBackend::createLogicalDevice() {
+  QueueFamilyIndices indices = findQueueFamilies(_physicalDevice, _surface);
+  std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
+  std::set<int> uniqueQueueFamilies = {indices.graphicsFamily,
+                                       indices.presentFamily};
+
+  float queuePriority = 1.0f;
+  for (int queueFamily : uniqueQueueFamilies) {
+    VkDeviceQueueCreateInfo queueCreateInfo = {};
+    queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueCreateInfo.queueFamilyIndex = queueFamily;
+    queueCreateInfo.queueCount = 1;
+    queueCreateInfo.pQueuePriorities = &queuePriority;
+    queueCreateInfos.push_back(queueCreateInfo);
+  }
+
+  VkPhysicalDeviceFeatures supportedFeatures;
+  vkGetPhysicalDeviceFeatures(_physicalDevice, &supportedFeatures);
+
+  VkPhysicalDeviceFeatures deviceFeatures = {};
+  deviceFeatures.samplerAnisotropy = VK_TRUE;
+  // Optional, light volumes fall back to the depth test alone
+  _depthBoundsSupported = supportedFeatures.depthBounds == VK_TRUE;
+  deviceFeatures.depthBounds = supportedFeatures.depthBounds;
+  if (!_depthBoundsSupported) {
+    std::cerr << "warning: depthBounds not supported, light volumes use the "
+                 "depth test only"
+              << std::endl;
+  }
+  // Optional, GPU culling falls back to one indirect draw per command
+  _multiDrawIndirectSupported = supportedFeatures.multiDrawIndirect == VK_TRUE;
+  deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+  // Optional, the GPU culled commands select their instance slots through
+  // firstInstance, which must be 0 without it: the CPU culling modes
+  // stand in for the GPU ones
+  _drawIndirectFirstInstanceSupported =
+      supportedFeatures.drawIndirectFirstInstance == VK_TRUE;
+  deviceFeatures.drawIndirectFirstInstance =
+      supportedFeatures.drawIndirectFirstInstance;
+  _settings.cullingMode = supportedCullingMode(_settings.cullingMode);
+  // Optional, the merged G-pass indexes texture arrays of every mesh, three
+  // samplers per mesh, and needs the multi-draw. Its draws find their
+  // material through firstInstance, which needs drawIndirectFirstInstance.
+  deviceFeatures.shaderSampledImageArrayDynamicIndexing =
+      supportedFeatures.shaderSampledImageArrayDynamicIndexing;
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(_physicalDevice, &properties);
+  const VkPhysicalDeviceLimits &limits = properties.limits;
+  _maxDrawIndirectCount =
+      _multiDrawIndirectSupported ? limits.maxDrawIndirectCount : 1;
+  const uint32_t mergedSamplers =
+      3 * static_cast<uint32_t>(_model.meshes.size());
+  _mergedDrawsSupported =
+      _multiDrawIndirectSupported && _drawIndirectFirstInstanceSupported &&
+      supportedFeatures.shaderSampledImageArrayDynamicIndexing == VK_TRUE &&
+      mergedSamplers > 0 &&
+      mergedSamplers <= limits.maxPerStageDescriptorSamplers &&
+      mergedSamplers <= limits.maxPerStageDescriptorSampledImages &&
+      mergedSamplers <= limits.maxDescriptorSetSamplers &&
+      mergedSamplers <= limits.maxDescriptorSetSampledImages;
+  if (_settings.mergedDraws && !_mergedDrawsSupported) {
+    std::cerr << "warning: merged G-pass draws not supported, one descriptor "
+                 "set and draw call per mesh"
+              << std::endl;
+  }
+  // Optional, fragment invocation counts are not reported without it
+  _pipelineStatisticsSupported =
+      supportedFeatures.pipelineStatisticsQuery == VK_TRUE;
+  deviceFeatures.pipelineStatisticsQuery =
+      supportedFeatures.pipelineStatisticsQuery;
+
+  // The swapchain extension only with a surface
+  std::vector<const char *> extensions;
+  if (!_settings.headless) extensions = deviceExtensions;
+#ifdef VK_KHR_draw_indirect_count
+  // Optional, without it GPU culling draws every command of a mesh and
+  // culled ones have zero instances
+  _drawIndirectCountSupported = checkDeviceExtensionSupport(
+      _physicalDevice, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+  if (_drawIndirectCountSupported) {
+    extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+  }
+#endif
+
+  VkDeviceCreateInfo createInfo = {};
+  createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+
+  createInfo.queueCreateInfoCount =
+      static_cast<uint32_t>(queueCreateInfos.size());
+  createInfo.pQueueCreateInfos = queueCreateInfos.data();
+
+  createInfo.pEnabledFeatures = &deviceFeatures;
+
+  createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+  createInfo.ppEnabledExtensionNames = extensions.data();
+
+  if (enableValidationLayers) {
+    createInfo.enabledLayerCount =
+        static_cast<uint32_t>(validationLayers.size());
+    createInfo.ppEnabledLayerNames = validationLayers.data();
+  } else {
+    createInfo.enabledLayerCount = 0;
+  }
+  VkResult result;
+  result = vkCreateDevice(_physicalDevice, &createInfo, nullptr, &_device);
+  vkCheckResult(result, "vkCreateDevice");
+  vkGetDeviceQueue(_device, indices.graphicsFamily, 0, &_graphicsQueue);
+  vkGetDeviceQueue(_device, indices.presentFamily, 0, &_presentQueue);
+#ifdef VK_KHR_draw_indirect_count
+  if (_drawIndirectCountSupported) {
+    _cmdDrawIndexedIndirectCount =
+        reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(
+            vkGetDeviceProcAddr(_device, "vkCmdDrawIndexedIndirectCountKHR"));
+    _drawIndirectCountSupported = _cmdDrawIndexedIndirectCount != nullptr;
+  }
+#endif
+}
+
+void VkBackend::createSwapChain() {
+  if (_settings.headless) {
+    createOffscreenImages();
+    return;
+  }
+  SwapChainSupportDetails swapChainSupport =
+      querySwapChainSupport(_physicalDevice, _surface);
+
+  VkSurfaceFormatKHR surfaceFormat =
+      chooseSwapSurfaceFormat(swapChainSupport.formats);
+  VkPresentModeKHR presentMode = chooseSwapPresentMode(
+      swapChainSupport.presentModes, _settings.presentMode);
+  VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
+
+  uint32_t imageCount = chooseSwapImageCount(swapChainSupport.capabilities,
+                                             _settings.swapChainImageCount);
+  VkSwapchainCreateInfoKHR createInfo = {};
+  createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+  createInfo.surface = _surface;
+  createInfo.minImageCount = imageCount;
+  createInfo.imageFormat = surfaceFormat.format;
+  createInfo.imageColorSpace = surfaceFormat.colorSpace;
+  createInfo.imageExtent = extent;
+  createInfo.imageArrayLayers = 1;
+  createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+  QueueFamilyIndices indices = findQueueFamilies(_physicalDevice, _surface);
+  if (indices.graphicsFamily != indices.presentFamily) {
+    uint32_t queueFamilyIndices[] = {(uint32_t)indices.graphicsFamily,
+                                     (uint32_t)indices.presentFamily};
+    createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+    createInfo.queueFamilyIndexCount = 2;
+    createInfo.pQueueFamilyIndices = queueFamilyIndices;
+  } else {
+    createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    createInfo.queueFamilyIndexCount = 0;      // Optional
+    createInfo.pQueueFamilyIndices = nullptr;  // Optional
+  }
+  createInfo.preTransform = swapChainSupport.capabilities.currentTransform;
+  createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+  createInfo.presentMode = presentMode;
+  createInfo.clipped = VK_TRUE;
+  createInfo.oldSwapchain = VK_NULL_HANDLE;
+  VkResult result;
+  result = vkCreateSwapchainKHR(_device, &createInfo, nullptr, &_swapChain);
+  vkCheckResult(result, "vkCreateSwapchainKHR");
+
+  result = vkGetSwapchainImagesKHR(_device, _swapChain, &imageCount, nullptr);
+  vkCheckResult(result, "vkGetSwapchainImagesKHR");
+  _swapChainImages.resize(imageCount);
+  result = vkGetSwapchainImagesKHR(_device, _swapChain, &imageCount,
+                                   _swapChainImages.data());
+  vkCheckResult(result, "vkGetSwapchainImagesKHR");
+
+  _swapChainImageFormat = surfaceFormat.format;
+  _swapChainExtent = extent;
+  _presentMode = presentMode;
+  sizeRenderTargets();
+  std::cout << "swapchain: " << presentModeName(presentMode) << ", "
+            << imageCount << " images" << std::endl;
+}
+
+// Color attachments the frames are copied from, in the format a swapchain
+// would most likely have, and the host-visible buffer readbacks land in
+void VkBackend::createOffscreenImages() {
+  const uint32_t imageCount =
+      _settings.swapChainImageCount > 0 ? _settings.swapChainImageCount : 3;
+  _swapChainImageFormat = VK_FORMAT_B8G8R8A8_UNORM;
+  _swapChainExtent = _settings.headlessExtent;
+  _swapChainImages.resize(imageCount);
+  _offscreenImageMemory.resize(imageCount);
+  for (uint32_t i = 0; i < imageCount; i++) {
+    createImage(_swapChainExtent.width, _swapChainExtent.height,
+                _swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL,
+                VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                    VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _swapChainImages[i],
+                _offscreenImageMemory[i]);
+  }
+  if (!_settings.readbackDirectory.empty()) {
+    createBuffer(static_cast<VkDeviceSize>(_swapChainExtent.width) *
+                     _swapChainExtent.height * 4,
+                 VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 _readbackBuffer.buffer, _readbackBuffer.bufferMemory);
+    vkMapMemory(_device, _readbackBuffer.bufferMemory, 0, VK_WHOLE_SIZE, 0,
+                reinterpret_cast<void **>(&_mappedReadback));
+  }
+  sizeRenderTargets();
+  std::cout << "headless: " << _swapChainExtent.width << "x"
+            << _swapChainExtent.height << ", " << imageCount << " images"
+            << std::endl;
+}
+
+// Room for the largest scale, the frames render to the top-left part
+void VkBackend::sizeRenderTargets() {
+  _renderTargetExtent = _swapChainExtent;
+  if (_settings.dynamicResolution) {
+    _renderTargetExtent.width = static_cast<uint32_t>(
+        std::ceil(_swapChainExtent.width * _settings.maxRenderScale));
+    _renderTargetExtent.height = static_cast<uint32_t>(
+        std::ceil(_swapChainExtent.height * _settings.maxRenderScale));
+  }
+  updateRenderExtent();
+}
+
+VkImageLayout VkBackend::outputImageLayout() const {
+  return _settings.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                            : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+}
+
+void VkBackend::createImageViews() {
+  _swapChainImageViews.resize(_swapChainImages.size());
+  for (size_t i = 0; i < _swapChainImages.size(); i++) {
+    _swapChainImageViews[i] = createImageView(
+        _swapChainImages[i], _swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+  }
+}
+
+void VkBackend::createRenderPass() {
+  // Attachment 0 is the swapchain image, or the scene color with dynamic
+  // resolution, then the G-buffer, then depth
+  const uint32_t depthIndex =
+      static_cast<uint32_t>(_gBufferAttachments.size()) + 1;
+  const bool compact = _settings.gBufferLayout == GBufferLayout::Compact;
+  // With occlusion culling the early render pass already drew part of the
+  // G-buffer, and the final depth feeds the next frame's Hi-Z pyramid
+  const bool twoPhase = _settings.cullingMode == CullingMode::GpuOcclusion;
+  // The optional depth pre-pass shifts the G-pass and light subpasses by one
+  const uint32_t gPassSubpass = _settings.depthPrePass ? 1 : 0;
+  const uint32_t lightSubpass = gPassSubpass + 1;
+  std::vector<VkAttachmentDescription> attachments(depthIndex + 1);
+  attachments[0].format = _swapChainImageFormat;
+  attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;  // must match swap chain
+                                                   // image
+  attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  attachments[0].finalLayout = _settings.dynamicResolution
+                                   ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+                                   : outputImageLayout();
+
+  for (uint32_t i = 1; i < depthIndex; i++) {
+    attachments[i].format = _gBufferAttachments[i - 1].format;
+    attachments[i].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[i].loadOp =
+        twoPhase ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[i].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[i].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[i].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[i].initialLayout =
+        twoPhase ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+                 : VK_IMAGE_LAYOUT_UNDEFINED;
+    attachments[i].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  }
+
+  attachments[depthIndex].format = findDepthFormat(_physicalDevice);
+  attachments[depthIndex].samples = VK_SAMPLE_COUNT_1_BIT;
+  attachments[depthIndex].loadOp =
+      twoPhase ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+  attachments[depthIndex].storeOp = twoPhase
+                                        ? VK_ATTACHMENT_STORE_OP_STORE
+                                        : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  attachments[depthIndex].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  attachments[depthIndex].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  if (twoPhase) {
+    attachments[depthIndex].initialLayout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    attachments[depthIndex].finalLayout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+  } else {
+    attachments[depthIndex].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachments[depthIndex].finalLayout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+  }
+
+  std::vector<VkSubpassDescription> subpasses(lightSubpass + 1);
+
+  VkAttachmentReference prePassDepth = {
+      depthIndex, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+  if (_settings.depthPrePass) {
+    subpasses[0].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpasses[0].pDepthStencilAttachment = &prePassDepth;
+  }
+
+  std::vector<VkAttachmentReference> firstSubpassColors;
+  for (uint32_t i = 1; i < depthIndex; i++) {
+    firstSubpassColors.push_back({i, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL});
+  }
+
+  VkAttachmentReference firstSubpassDepth = {
+      depthIndex, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+
+  subpasses[gPassSubpass].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpasses[gPassSubpass].colorAttachmentCount =
+      static_cast<uint32_t>(firstSubpassColors.size());
+  subpasses[gPassSubpass].pColorAttachments = firstSubpassColors.data();
+  subpasses[gPassSubpass].pDepthStencilAttachment = &firstSubpassDepth;
+
+  VkAttachmentReference secondSubpassColor = {
+      0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+  // input_attachment_index 0 is the position, or the depth when the position
+  // is reconstructed (compact layout)
+  std::vector<VkAttachmentReference> secondSubpassInput;
+  if (compact) {
+    secondSubpassInput.push_back(
+        {depthIndex, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL});
+  }
+  for (uint32_t i = 1; i < depthIndex; i++) {
+    secondSubpassInput.push_back({i, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL});
+  }
+  // Read-only so it can be bound as an input attachment at the same time
+  VkAttachmentReference secondSubpassDepth = {
+      depthIndex, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL};
+
+  subpasses[lightSubpass].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpasses[lightSubpass].colorAttachmentCount = 1;
+  subpasses[lightSubpass].pColorAttachments = &secondSubpassColor;
+  subpasses[lightSubpass].inputAttachmentCount =
+      static_cast<uint32_t>(secondSubpassInput.size());
+  subpasses[lightSubpass].pInputAttachments = secondSubpassInput.data();
+  subpasses[lightSubpass].pDepthStencilAttachment = &secondSubpassDepth;
+
+  std::vector<VkSubpassDependency> dependencies(3);
+
+  dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[0].dstSubpass = gPassSubpass;
+  dependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+  dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+  dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                                  VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+  dependencies[1].srcSubpass = gPassSubpass;
+  dependencies[1].dstSubpass = lightSubpass;
+  dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                                 VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+                                 VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+  dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                                  VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  dependencies[1].dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT |
+                                  VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+  dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+  dependencies[2].srcSubpass = gPassSubpass;
+  dependencies[2].dstSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[2].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependencies[2].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+  dependencies[2].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                                  VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  dependencies[2].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+  dependencies[2].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+  if (_settings.depthPrePass) {
+    // The G-pass depth test reads the pre-pass depth
+    VkSubpassDependency dependency = {};
+    dependency.srcSubpass = 0;
+    dependency.dstSubpass = gPassSubpass;
+    dependency.srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+    dependency.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+    dependencies.push_back(dependency);
+  }
+
+  if (_settings.dynamicResolution) {
+    // The previous upscale pass is done reading the scene color before the
+    // light subpass overwrites it, and this frame's upscale pass reads it
+    // after
+    VkSubpassDependency dependency = {};
+    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependency.dstSubpass = lightSubpass;
+    dependency.srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependency.srcAccessMask = 0;
+    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    dependencies.push_back(dependency);
+
+    dependency.srcSubpass = lightSubpass;
+    dependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    dependency.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    dependencies.push_back(dependency);
+  } else if (_settings.headless) {
+    // The readback copy comes after the light subpass writes and the
+    // transition to the final layout
+    dependencies.push_back(readbackDependency(lightSubpass));
+  }
+
+  VkRenderPassCreateInfo renderPassInfo = {};
+  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+  renderPassInfo.pAttachments = attachments.data();
+  renderPassInfo.subpassCount = static_cast<uint32_t>(subpasses.size());
+  renderPassInfo.pSubpasses = subpasses.data();
+  renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+  renderPassInfo.pDependencies = dependencies.data();
+
+  VkResult result =
+      vkCreateRenderPass(_device, &renderPassInfo, nullptr, &_renderPass);
+  vkCheckResult(result, "vkCreateRenderPass");
+}
+
+// Subpass 0 of the main render pass on its own, storing the G-buffer and a
+// depth readable by the Hi-Z reduction
+void VkBackend::createEarlyRenderPass() {
+  const uint32_t depthIndex =
+      static_cast<uint32_t>(_gBufferAttachments.size());
+  std::vector<VkAttachmentDescription> attachments(depthIndex + 1);
+  std::vector<VkAttachmentReference> colorReferences;
+  for (uint32_t i = 0; i < depthIndex; i++) {
+    attachments[i].format = _gBufferAttachments[i].format;
+    attachments[i].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[i].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[i].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachments[i].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[i].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[i].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachments[i].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    colorReferences.push_back({i, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL});
+  }
+
+  attachments[depthIndex].format = findDepthFormat(_physicalDevice);
+  attachments[depthIndex].samples = VK_SAMPLE_COUNT_1_BIT;
+  attachments[depthIndex].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  attachments[depthIndex].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  attachments[depthIndex].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  attachments[depthIndex].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  attachments[depthIndex].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  attachments[depthIndex].finalLayout =
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+  VkAttachmentReference depthReference = {
+      depthIndex, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+
+  VkSubpassDescription subpass = {};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.colorAttachmentCount = static_cast<uint32_t>(colorReferences.size());
+  subpass.pColorAttachments = colorReferences.data();
+  subpass.pDepthStencilAttachment = &depthReference;
+
+  // The previous frame's light subpass and Hi-Z reduction read the
+  // attachments this pass clears
+  VkSubpassDependency dependency = {};
+  dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+  dependency.dstSubpass = 0;
+  dependency.srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+                            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+  dependency.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependency.srcAccessMask = 0;
+  dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                             VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+  VkRenderPassCreateInfo renderPassInfo = {};
+  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+  renderPassInfo.pAttachments = attachments.data();
+  renderPassInfo.subpassCount = 1;
+  renderPassInfo.pSubpasses = &subpass;
+  renderPassInfo.dependencyCount = 1;
+  renderPassInfo.pDependencies = &dependency;
+
+  VkResult result = vkCreateRenderPass(_device, &renderPassInfo, nullptr,
+                                       &_earlyRenderPass);
+  vkCheckResult(result, "vkCreateRenderPass");
+}
+
+// From the subpass writing the output image to the readback copy, which
+// then needs no barrier of its own on the image
+VkSubpassDependency VkBackend::readbackDependency(uint32_t subpass) const {
+  VkSubpassDependency dependency = {};
+  dependency.srcSubpass = subpass;
+  dependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+  dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependency.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+  dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  dependency.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  return dependency;
+}
+
+// Stretches the scene color over the swapchain image, which it entirely
+// overwrites
+void VkBackend::createUpscaleRenderPass() {
+  VkAttachmentDescription attachment = {};
+  attachment.format = _swapChainImageFormat;
+  attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+  attachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  attachment.finalLayout = outputImageLayout();
+  VkAttachmentReference colorReference = {
+      0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+
+  VkSubpassDescription subpass = {};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.colorAttachmentCount = 1;
+  subpass.pColorAttachments = &colorReference;
+
+  // Waits for the acquire semaphore, signaled at this stage
+  VkSubpassDependency dependency = {};
+  dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+  dependency.dstSubpass = 0;
+  dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependency.srcAccessMask = 0;
+  dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  // Headless, the readback copy after the final layout
+  const VkSubpassDependency dependencies[] = {dependency,
+                                              readbackDependency(0)};
+
+  VkRenderPassCreateInfo renderPassInfo = {};
+  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  renderPassInfo.attachmentCount = 1;
+  renderPassInfo.pAttachments = &attachment;
+  renderPassInfo.subpassCount = 1;
+  renderPassInfo.pSubpasses = &subpass;
+  renderPassInfo.dependencyCount = _settings.headless ? 2 : 1;
+  renderPassInfo.pDependencies = dependencies;
+
+  VkResult result = vkCreateRenderPass(_device, &renderPassInfo, nullptr,
+                                       &_upscaleRenderPass);
+  vkCheckResult(result, "vkCreateRenderPass");
+}
+
+VkDescriptorSetLayout VkBackend::createGPassDescriptorSetLayout(
+    uint32_t materialCount) {
+  VkDescriptorSetLayout descriptorSetLayout = {};
+  VkDescriptorSetLayoutBinding uboLayoutBinding = {};
+  uboLayoutBinding.binding = 0;
+  uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  uboLayoutBinding.descriptorCount = 1;
+  uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  uboLayoutBinding.pImmutableSamplers = nullptr;
+
+  VkDescriptorSetLayoutBinding ambientSamplerLayoutBinding = {};
+  ambientSamplerLayoutBinding.binding = 1;
+  ambientSamplerLayoutBinding.descriptorCount = materialCount;
+  ambientSamplerLayoutBinding.descriptorType =
+      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  ambientSamplerLayoutBinding.pImmutableSamplers = nullptr;
+  ambientSamplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  VkDescriptorSetLayoutBinding diffuseSamplerLayoutBinding = {};
+  diffuseSamplerLayoutBinding.binding = 2;
+  diffuseSamplerLayoutBinding.descriptorCount = materialCount;
+  diffuseSamplerLayoutBinding.descriptorType =
+      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  diffuseSamplerLayoutBinding.pImmutableSamplers = nullptr;
+  diffuseSamplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  VkDescriptorSetLayoutBinding specularSamplerLayoutBinding = {};
+  specularSamplerLayoutBinding.binding = 3;
+  specularSamplerLayoutBinding.descriptorCount = materialCount;
+  specularSamplerLayoutBinding.descriptorType =
+      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  specularSamplerLayoutBinding.pImmutableSamplers = nullptr;
+  specularSamplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  // Instance transforms and instance indices
+  std::array<VkDescriptorSetLayoutBinding, 2> instanceLayoutBindings = {};
+  for (uint32_t i = 0; i < instanceLayoutBindings.size(); i++) {
+    instanceLayoutBindings[i].binding = INSTANCE_BINDING + i;
+    instanceLayoutBindings[i].descriptorCount = 1;
+    instanceLayoutBindings[i].descriptorType =
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    instanceLayoutBindings[i].pImmutableSamplers = nullptr;
+    instanceLayoutBindings[i].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  }
+
+  std::array<VkDescriptorSetLayoutBinding, 6> bindings = {
+      uboLayoutBinding,           ambientSamplerLayoutBinding,
+      diffuseSamplerLayoutBinding, specularSamplerLayoutBinding,
+      instanceLayoutBindings[0],  instanceLayoutBindings[1]};
+  VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+  layoutInfo.pBindings = bindings.data();
+
+  VkResult result = vkCreateDescriptorSetLayout(_device, &layoutInfo, nullptr,
+                                                &descriptorSetLayout);
+  vkCheckResult(result, "vkCreateDescriptorSetLayout");
+  return descriptorSetLayout;
+}
+
+VkDescriptorSetLayout VkBackend::createLightDescriptorSetLayout() {
+  VkDescriptorSetLayout descriptorSetLayout = {};
+
+  VkDescriptorSetLayoutBinding positionInputLayoutBinding = {};
+  positionInputLayoutBinding.binding = 0;
+  positionInputLayoutBinding.descriptorCount = 1;
+  positionInputLayoutBinding.descriptorType =
+      VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+  positionInputLayoutBinding.pImmutableSamplers = nullptr;
+  positionInputLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  VkDescriptorSetLayoutBinding normalInputLayoutBinding = {};
+  normalInputLayoutBinding.binding = 1;
+  normalInputLayoutBinding.descriptorCount = 1;
+  normalInputLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+  normalInputLayoutBinding.pImmutableSamplers = nullptr;
+  normalInputLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  VkDescriptorSetLayoutBinding albedoInputLayoutBinding = {};
+  albedoInputLayoutBinding.binding = 2;
+  albedoInputLayoutBinding.descriptorCount = 1;
+  albedoInputLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+  albedoInputLayoutBinding.pImmutableSamplers = nullptr;
+  albedoInputLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  VkDescriptorSetLayoutBinding uboLayoutBinding = {};
+  uboLayoutBinding.binding = 3;
+  uboLayoutBinding.descriptorCount = 1;
+  uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  uboLayoutBinding.pImmutableSamplers = nullptr;
+  // Light volumes read the lights and view-projection in the vertex stage
+  uboLayoutBinding.stageFlags =
+      VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  VkDescriptorSetLayoutBinding lightsLayoutBinding = {};
+  lightsLayoutBinding.binding = 4;
+  lightsLayoutBinding.descriptorCount = 1;
+  lightsLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  lightsLayoutBinding.pImmutableSamplers = nullptr;
+  lightsLayoutBinding.stageFlags =
+      VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  VkDescriptorSetLayoutBinding clustersLayoutBinding = {};
+  clustersLayoutBinding.binding = 5;
+  clustersLayoutBinding.descriptorCount = 1;
+  clustersLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  clustersLayoutBinding.pImmutableSamplers = nullptr;
+  clustersLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  VkDescriptorSetLayoutBinding shadowUboLayoutBinding = {};
+  shadowUboLayoutBinding.binding = 6;
+  shadowUboLayoutBinding.descriptorCount = 1;
+  shadowUboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  shadowUboLayoutBinding.pImmutableSamplers = nullptr;
+  shadowUboLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  // Cascades, then the point lights' cube faces
+  VkDescriptorSetLayoutBinding cascadeShadowLayoutBinding = {};
+  cascadeShadowLayoutBinding.binding = 7;
+  cascadeShadowLayoutBinding.descriptorCount = 1;
+  cascadeShadowLayoutBinding.descriptorType =
+      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  cascadeShadowLayoutBinding.pImmutableSamplers = nullptr;
+  cascadeShadowLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  VkDescriptorSetLayoutBinding pointShadowLayoutBinding =
+      cascadeShadowLayoutBinding;
+  pointShadowLayoutBinding.binding = 8;
+
+  std::array<VkDescriptorSetLayoutBinding, 9> bindings = {
+      positionInputLayoutBinding, normalInputLayoutBinding,
+      albedoInputLayoutBinding,   uboLayoutBinding,
+      lightsLayoutBinding,        clustersLayoutBinding,
+      shadowUboLayoutBinding,     cascadeShadowLayoutBinding,
+      pointShadowLayoutBinding};
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+  layoutInfo.pBindings = bindings.data();
+
+  VkResult result = vkCreateDescriptorSetLayout(_device, &layoutInfo, nullptr,
+                                                &descriptorSetLayout);
+  vkCheckResult(result, "vkCreateDescriptorSetLayout");
+  return descriptorSetLayout;
+}
+
+void VkBackend::createPipelines() {
+  // Later creations hit the in-memory cache of the first one
+  const char *cacheState = _pipelineCreationTime.count() > 0
+                               ? "in-memory"
+                               : _pipelineCache.warm() ? "warm" : "cold";
+  double elapsed = buildPipelines();
+  _pipelineCreationTime.push(elapsed);
+  std::cout << "pipelines: created in " << elapsed << " ms";
+  if (_settings.parallelPipelineCreation) {
+    std::cout << " on " << _workerPool.size() << " threads";
+  } else {
+    std::cout << " serially";
+  }
+  std::cout << ", " << cacheState << " cache";
+  if (_pipelineCreationTime.count() == 1 && _pipelineCache.warm()) {
+    std::cout << " (" << _pipelineCache.loadedSize() / 1024 << " KiB)";
+  }
+  std::cout << ", " << _pipelineVariants.size() << " graphics variants"
+            << std::endl;
+}
+
+double VkBackend::buildPipelines() {
+  auto start = std::chrono::high_resolution_clock::now();
+  std::vector<GraphicsPipelineDesc> descs;
+  std::vector<Pipeline *> targets;
+  graphicsPipelineDescs(descs, targets);
+  createPipelineBatch(
+      descs, targets,
+      {"shaders/cluster_cull.comp.spv", "shaders/draw_cull.comp.spv",
+       "shaders/hiz_reduce.comp.spv"},
+      {&_clusterPipeline, &_drawCullPipeline, &_hiZPipeline});
+  auto end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+double VkBackend::recreatePipelines(bool parallel) {
+  vkDeviceWaitIdle(_device);
+  destroyGraphicsPipelines();
+  destroyComputePipelines();
+  _pipelineCache.reset();
+  const bool wasParallel = _settings.parallelPipelineCreation;
+  _settings.parallelPipelineCreation = parallel;
+  double elapsed = buildPipelines();
+  _settings.parallelPipelineCreation = wasParallel;
+  return elapsed;
+}
+
+// Every call looks the pipelines up again, the ones of the previous
+// settings stay in the cache for the frames still using them
+void VkBackend::selectGraphicsPipelines() {
+  std::vector<GraphicsPipelineDesc> descs;
+  std::vector<Pipeline *> targets;
+  graphicsPipelineDescs(descs, targets);
+  createPipelineBatch(descs, targets, {}, {});
+}
+
+// The graphics pipelines of the current settings and what each one sets
+void VkBackend::graphicsPipelineDescs(
+    std::vector<GraphicsPipelineDesc> &descs,
+    std::vector<Pipeline *> &targets) {
+  // gpass.frag doesn't declare Specular nor the light shaders
+  // NormalMapping, cleared so that they don't split variants
+  std::vector<uint32_t> gPassConstants = shaderConstants();
+  gPassConstants[static_cast<size_t>(ShaderConstant::Specular)] = 0;
+  std::vector<uint32_t> lightConstants = shaderConstants();
+  lightConstants[static_cast<size_t>(ShaderConstant::NormalMapping)] = 0;
+  const uint32_t gPassSubpass = _settings.depthPrePass ? 1 : 0;
+  // The merged G-pass samples the texture arrays of every material
+  VkDescriptorSetLayout gPassSetLayout = _gpassPipeline.descriptorSetLayout;
+  uint32_t materialCount = 1;
+  if (getMergedDrawsActive()) {
+    gPassSetLayout = _mergedGPassSetLayout;
+    materialCount = static_cast<uint32_t>(_model.meshes.size());
+  }
+  gPassConstants[static_cast<size_t>(ShaderConstant::MaterialCount)] =
+      materialCount;
+  gPassConstants[static_cast<size_t>(ShaderConstant::PerDrawData)] =
+      static_cast<uint32_t>(_settings.perDrawData);
+
+  GraphicsPipelineDesc gpassDesc;
+  gpassDesc.name = "early G-pass";
+  gpassDesc.vertexShader = "shaders/gpass.vert.spv";
+  gpassDesc.fragShader = "shaders/gpass.frag.spv";
+  gpassDesc.specialization = gPassConstants;
+  gpassDesc.descriptorSetLayout = gPassSetLayout;
+  gpassDesc.perDrawSetLayout = _perDrawSetLayout;
+  gpassDesc.pushConstantSize = sizeof(gPassPerDraw);
+  gpassDesc.subpass = 0;
+  gpassDesc.colorAttachmentCount =
+      static_cast<uint32_t>(_gBufferAttachments.size());
+  // The main render pass covers the render extent of the frame
+  gpassDesc.dynamicViewport = true;
+
+  // The early render pass of the two-phase occlusion culling has no pre-pass
+  gpassDesc.renderPass = _earlyRenderPass;
+  descs.push_back(gpassDesc);
+  targets.push_back(&_earlyGPassPipeline);
+
+  gpassDesc.name = "G-pass";
+  gpassDesc.renderPass = VK_NULL_HANDLE;
+  if (_settings.depthPrePass) {
+    // Depth is complete after the pre-pass: shade only the visible fragment
+    gpassDesc.subpass = gPassSubpass;
+    gpassDesc.depthWrite = false;
+    gpassDesc.depthCompareOp = VK_COMPARE_OP_EQUAL;
+  }
+  descs.push_back(gpassDesc);
+  targets.push_back(&_gpassPipeline);
+
+  _depthPrePassPipeline = {};
+  if (_settings.depthPrePass) {
+    GraphicsPipelineDesc prePassDesc;
+    prePassDesc.name = "depth pre-pass";
+    prePassDesc.vertexShader = "shaders/depth.vert.spv";
+    prePassDesc.vertexInput = VertexInput::Position;
+    prePassDesc.descriptorSetLayout = _gpassPipeline.descriptorSetLayout;
+    // Same layout as the G-pass, whose sets and push constants it draws with
+    prePassDesc.perDrawSetLayout = _perDrawSetLayout;
+    prePassDesc.pushConstantSize = sizeof(gPassPerDraw);
+    prePassDesc.subpass = 0;
+    prePassDesc.colorAttachmentCount = 0;
+    prePassDesc.dynamicViewport = true;
+    descs.push_back(prePassDesc);
+    targets.push_back(&_depthPrePassPipeline);
+  }
+
+  // Shadow maps, from the position stream with the layer's matrices. No
+  // culling so that thin or open geometry casts, the bias keeps lit
+  // surfaces from shadowing themselves.
+  GraphicsPipelineDesc shadowDesc;
+  shadowDesc.name = "shadow cascade";
+  shadowDesc.vertexShader = "shaders/depth.vert.spv";
+  shadowDesc.vertexInput = VertexInput::Position;
+  shadowDesc.descriptorSetLayout = _shadowPipeline.descriptorSetLayout;
+  shadowDesc.renderPass = _shadowRenderPass;
+  shadowDesc.subpass = 0;
+  shadowDesc.colorAttachmentCount = 0;
+  shadowDesc.cullMode = VK_CULL_MODE_NONE;
+  shadowDesc.depthBiasConstant = 1.25f;
+  shadowDesc.depthBiasSlope = 1.75f;
+  shadowDesc.extent = {_settings.shadowMapSize, _settings.shadowMapSize};
+  descs.push_back(shadowDesc);
+  targets.push_back(&_shadowPipeline);
+  shadowDesc.name = "point shadow";
+  shadowDesc.extent = {_settings.pointShadowMapSize,
+                       _settings.pointShadowMapSize};
+  descs.push_back(shadowDesc);
+  targets.push_back(&_pointShadowPipeline);
+
+  // Full-screen triangle, depth is read-only in this subpass
+  GraphicsPipelineDesc lightDesc;
+  lightDesc.name = "light";
+  lightDesc.vertexShader = "shaders/light.vert.spv";
+  lightDesc.vertexInput = VertexInput::None;
+  lightDesc.fragShader = "shaders/light.frag.spv";
+  lightDesc.specialization = lightConstants;
+  lightDesc.specialization[static_cast<size_t>(
+      ShaderConstant::LightingMode)] =
+      static_cast<uint32_t>(_settings.lightingMode);
+  lightDesc.specialization[static_cast<size_t>(ShaderConstant::LightCount)] =
+      _specializedLightCount;
+  lightDesc.descriptorSetLayout = _lightPipeline.descriptorSetLayout;
+  lightDesc.subpass = gPassSubpass + 1;
+  lightDesc.colorAttachmentCount = 1;
+  lightDesc.depthTest = false;
+  lightDesc.depthWrite = false;
+  lightDesc.dynamicViewport = true;
+  descs.push_back(lightDesc);
+  targets.push_back(&_lightPipeline);
+
+  // Back faces of the light sphere that lie behind the G-buffer depth: the
+  // fragment is inside the volume unless it is also in front of the sphere,
+  // which the depth bounds reject when available
+  GraphicsPipelineDesc volumeDesc;
+  volumeDesc.name = "light volume";
+  volumeDesc.vertexShader = "shaders/light_volume.vert.spv";
+  volumeDesc.vertexInput = VertexInput::None;
+  volumeDesc.fragShader = "shaders/light_volume.frag.spv";
+  volumeDesc.specialization = lightConstants;
+  volumeDesc.descriptorSetLayout = _lightPipeline.descriptorSetLayout;
+  volumeDesc.subpass = gPassSubpass + 1;
+  volumeDesc.colorAttachmentCount = 1;
+  volumeDesc.depthTest = true;
+  volumeDesc.depthWrite = false;
+  volumeDesc.depthCompareOp = VK_COMPARE_OP_GREATER_OR_EQUAL;
+  volumeDesc.depthBoundsTest = _depthBoundsSupported;
+  volumeDesc.cullMode = VK_CULL_MODE_FRONT_BIT;
+  volumeDesc.additiveBlend = true;
+  volumeDesc.dynamicViewport = true;
+  descs.push_back(volumeDesc);
+  targets.push_back(&_lightVolumePipeline);
+
+  _upscalePipeline.layout = VK_NULL_HANDLE;
+  _upscalePipeline.pipeline = VK_NULL_HANDLE;
+  if (_settings.dynamicResolution) {
+    // Full-screen triangle over the swapchain image, filtered
+    GraphicsPipelineDesc upscaleDesc;
+    upscaleDesc.name = "upscale";
+    upscaleDesc.vertexShader = "shaders/light.vert.spv";
+    upscaleDesc.vertexInput = VertexInput::None;
+    upscaleDesc.fragShader = "shaders/upscale.frag.spv";
+    upscaleDesc.descriptorSetLayout = _upscalePipeline.descriptorSetLayout;
+    upscaleDesc.renderPass = _upscaleRenderPass;
+    upscaleDesc.extent = _swapChainExtent;
+    upscaleDesc.depthTest = false;
+    upscaleDesc.depthWrite = false;
+    descs.push_back(upscaleDesc);
+    targets.push_back(&_upscalePipeline);
+  }
+}
+
+// Shared by the G-pass and light shaders, the light pipeline adds its
+// lighting mode and light count
+std::vector<uint32_t> VkBackend::shaderConstants() const {
+  std::vector<uint32_t> constants(
+      static_cast<size_t>(ShaderConstant::Count), 0);
+  constants[static_cast<size_t>(ShaderConstant::CompactGBuffer)] =
+      _settings.gBufferLayout == GBufferLayout::Compact ? VK_TRUE : VK_FALSE;
+  constants[static_cast<size_t>(ShaderConstant::Specular)] =
+      _settings.specular ? VK_TRUE : VK_FALSE;
+  constants[static_cast<size_t>(ShaderConstant::NormalMapping)] =
+      _settings.normalMapping ? VK_TRUE : VK_FALSE;
+  return constants;
+}
+
+VkDescriptorSetLayout VkBackend::createClusterDescriptorSetLayout() {
+  VkDescriptorSetLayout descriptorSetLayout = {};
+
+  VkDescriptorSetLayoutBinding uboLayoutBinding = {};
+  uboLayoutBinding.binding = 0;
+  uboLayoutBinding.descriptorCount = 1;
+  uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  uboLayoutBinding.pImmutableSamplers = nullptr;
+  uboLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+  VkDescriptorSetLayoutBinding lightsLayoutBinding = {};
+  lightsLayoutBinding.binding = 1;
+  lightsLayoutBinding.descriptorCount = 1;
+  lightsLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  lightsLayoutBinding.pImmutableSamplers = nullptr;
+  lightsLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+  VkDescriptorSetLayoutBinding clustersLayoutBinding = {};
+  clustersLayoutBinding.binding = 2;
+  clustersLayoutBinding.descriptorCount = 1;
+  clustersLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  clustersLayoutBinding.pImmutableSamplers = nullptr;
+  clustersLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+  std::array<VkDescriptorSetLayoutBinding, 3> bindings = {
+      uboLayoutBinding, lightsLayoutBinding, clustersLayoutBinding};
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+  layoutInfo.pBindings = bindings.data();
+
+  VkResult result = vkCreateDescriptorSetLayout(_device, &layoutInfo, nullptr,
+                                                &descriptorSetLayout);
+  vkCheckResult(result, "vkCreateDescriptorSetLayout");
+  return descriptorSetLayout;
+}
+
+VkDescriptorSetLayout VkBackend::createDrawCullDescriptorSetLayout() {
+  VkDescriptorSetLayout descriptorSetLayout = {};
+
+  // Uniforms, the draw data, command, count and visibility storage buffers,
+  // the Hi-Z pyramid then the instance transforms
+  std::array<VkDescriptorSetLayoutBinding, 7> bindings = {};
+  for (uint32_t i = 0; i < bindings.size(); i++) {
+    bindings[i].binding = i;
+    bindings[i].descriptorCount = 1;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[i].pImmutableSamplers = nullptr;
+    bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+  bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  bindings[5].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+  layoutInfo.pBindings = bindings.data();
+
+  VkResult result = vkCreateDescriptorSetLayout(_device, &layoutInfo, nullptr,
+                                                &descriptorSetLayout);
+  vkCheckResult(result, "vkCreateDescriptorSetLayout");
+  return descriptorSetLayout;
+}
+
+VkDescriptorSetLayout VkBackend::createHiZDescriptorSetLayout() {
+  VkDescriptorSetLayout descriptorSetLayout = {};
+
+  VkDescriptorSetLayoutBinding sourceLayoutBinding = {};
+  sourceLayoutBinding.binding = 0;
+  sourceLayoutBinding.descriptorCount = 1;
+  sourceLayoutBinding.descriptorType =
+      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  sourceLayoutBinding.pImmutableSamplers = nullptr;
+  sourceLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+  VkDescriptorSetLayoutBinding destinationLayoutBinding = {};
+  destinationLayoutBinding.binding = 1;
+  destinationLayoutBinding.descriptorCount = 1;
+  destinationLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  destinationLayoutBinding.pImmutableSamplers = nullptr;
+  destinationLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+  std::array<VkDescriptorSetLayoutBinding, 2> bindings = {
+      sourceLayoutBinding, destinationLayoutBinding};
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+  layoutInfo.pBindings = bindings.data();
+
+  VkResult result = vkCreateDescriptorSetLayout(_device, &layoutInfo, nullptr,
+                                                &descriptorSetLayout);
+  vkCheckResult(result, "vkCreateDescriptorSetLayout");
+  return descriptorSetLayout;
+}
+
+VkDescriptorSetLayout VkBackend::createUpscaleDescriptorSetLayout() {
+  VkDescriptorSetLayout descriptorSetLayout = {};
+
+  VkDescriptorSetLayoutBinding sceneColorLayoutBinding = {};
+  sceneColorLayoutBinding.binding = 0;
+  sceneColorLayoutBinding.descriptorCount = 1;
+  sceneColorLayoutBinding.descriptorType =
+      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  sceneColorLayoutBinding.pImmutableSamplers = nullptr;
+  sceneColorLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  VkDescriptorSetLayoutBinding uboLayoutBinding = {};
+  uboLayoutBinding.binding = 1;
+  uboLayoutBinding.descriptorCount = 1;
+  uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  uboLayoutBinding.pImmutableSamplers = nullptr;
+  uboLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  std::array<VkDescriptorSetLayoutBinding, 2> bindings = {
+      sceneColorLayoutBinding, uboLayoutBinding};
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+  layoutInfo.pBindings = bindings.data();
+
+  VkResult result = vkCreateDescriptorSetLayout(_device, &layoutInfo, nullptr,
+                                                &descriptorSetLayout);
+  vkCheckResult(result, "vkCreateDescriptorSetLayout");
+  return descriptorSetLayout;
+}
+
+// One dynamic uniform buffer, gPassPerDraw at the offset bound per draw
+VkDescriptorSetLayout VkBackend::createPerDrawDescriptorSetLayout() {
+  VkDescriptorSetLayout descriptorSetLayout = {};
+
+  VkDescriptorSetLayoutBinding uboLayoutBinding = {};
+  uboLayoutBinding.binding = 0;
+  uboLayoutBinding.descriptorCount = 1;
+  uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  uboLayoutBinding.pImmutableSamplers = nullptr;
+  uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = 1;
+  layoutInfo.pBindings = &uboLayoutBinding;
+
+  VkResult result = vkCreateDescriptorSetLayout(_device, &layoutInfo, nullptr,
+                                                &descriptorSetLayout);
+  vkCheckResult(result, "vkCreateDescriptorSetLayout");
+  return descriptorSetLayout;
+}
+
+// Permutation cache key: every field of the description but its name, with
+// the extent and the render pass compatibility it resolves to
+std::string VkBackend::pipelineKey(const GraphicsPipelineDesc &desc) const {
+  const VkRenderPass renderPass =
+      desc.renderPass != VK_NULL_HANDLE ? desc.renderPass : _renderPass;
+  const VkExtent2D extent =
+      desc.extent.width == 0 ? _renderTargetExtent : desc.extent;
+  std::ostringstream key;
+  key << desc.vertexShader << '|' << desc.fragShader << '|'
+      << static_cast<int>(desc.vertexInput) << '|'
+      << desc.descriptorSetLayout << '|' << renderPassKey(renderPass) << '|'
+      << desc.subpass << '|' << extent.width << 'x' << extent.height << '|'
+      << desc.dynamicViewport << '|'
+      << desc.colorAttachmentCount << '|' << desc.depthTest
+      << desc.depthWrite << '|' << desc.depthCompareOp << '|'
+      << desc.depthBoundsTest << '|' << desc.cullMode << '|'
+      << desc.additiveBlend << '|' << desc.depthBiasConstant << '|'
+      << desc.depthBiasSlope << '|' << desc.perDrawSetLayout << '|'
+      << desc.pushConstantSize;
+  for (uint32_t value : desc.specialization) key << '|' << value;
+  return key.str();
+}
+
+// What a render pass was created from, compatible passes share it. The
+// handles change with every recreateSwapChain(), the variants are kept.
+std::string VkBackend::renderPassKey(VkRenderPass renderPass) const {
+  std::ostringstream key;
+  if (renderPass == _renderPass) {
+    key << "main " << _swapChainImageFormat << ' '
+        << static_cast<int>(_settings.gBufferLayout) << ' '
+        << _settings.depthPrePass << ' '
+        << (_settings.cullingMode == CullingMode::GpuOcclusion) << ' '
+        << _settings.dynamicResolution << ' ' << _settings.headless;
+  } else if (renderPass == _earlyRenderPass) {
+    key << "early " << static_cast<int>(_settings.gBufferLayout);
+  } else if (renderPass == _upscaleRenderPass) {
+    key << "upscale " << _swapChainImageFormat;
+  } else {
+    // The shadow pass lives as long as the device
+    key << renderPass;
+  }
+  return key.str();
+}
+
+static std::string pipelineVariantName(const GraphicsPipelineDesc &desc) {
+  std::ostringstream name;
+  name << desc.name;
+  for (size_t i = 0; i < desc.specialization.size(); i++) {
+    name << (i == 0 ? " [" : " ") << desc.specialization[i];
+  }
+  if (!desc.specialization.empty()) name << "]";
+  return name.str();
+}
+
+void VkBackend::createPipelineBatch(
+    const std::vector<GraphicsPipelineDesc> &descs,
+    const std::vector<Pipeline *> &targets,
+    const std::vector<std::string> &computeShaders,
+    const std::vector<Pipeline *> &computeTargets) {
+  // Permutation cache misses, a key requested twice is built once
+  std::vector<std::string> keys;
+  std::vector<size_t> misses;
+  std::set<std::string> missedKeys;
+  for (size_t i = 0; i < descs.size(); i++) {
+    keys.push_back(pipelineKey(descs[i]));
+    if (_pipelineVariants.count(keys[i]) == 0 &&
+        missedKeys.insert(keys[i]).second) {
+      misses.push_back(i);
+    }
+  }
+
+  // The misses then the compute pipelines, one job each. Nothing is read
+  // before the join.
+  const uint32_t jobCount =
+      static_cast<uint32_t>(misses.size() + computeShaders.size());
+  std::vector<Pipeline> built(jobCount);
+  std::vector<double> creationTimes(jobCount, 0.0);
+  std::vector<std::exception_ptr> errors(jobCount);
+  auto job = [&](uint32_t i) {
+    // Rethrown on this thread, an exception leaving a worker terminates
+    try {
+      auto start = std::chrono::high_resolution_clock::now();
+      if (i < misses.size()) {
+        built[i] = createGraphicsPipeline(descs[misses[i]]);
+      } else {
+        size_t c = i - misses.size();
+        built[i] = createComputePipeline(
+            computeShaders[c], computeTargets[c]->descriptorSetLayout);
+      }
+      auto end = std::chrono::high_resolution_clock::now();
+      creationTimes[i] =
+          std::chrono::duration<double, std::milli>(end - start).count();
+    } catch (...) {
+      errors[i] = std::current_exception();
+    }
+  };
+  if (_settings.parallelPipelineCreation) {
+    _workerPool.parallelFor(jobCount, job);
+  } else {
+    for (uint32_t i = 0; i < jobCount; i++) job(i);
+  }
+
+  // What was built is owned before any error is rethrown
+  for (size_t m = 0; m < misses.size(); m++) {
+    if (errors[m]) continue;
+    CachedPipeline &entry = _pipelineVariants[keys[misses[m]]];
+    entry.pipeline = built[m];
+    entry.variant.name = pipelineVariantName(descs[misses[m]]);
+    entry.variant.creationTime = creationTimes[m];
+  }
+  for (size_t c = 0; c < computeShaders.size(); c++) {
+    const Pipeline &pipeline = built[misses.size() + c];
+    computeTargets[c]->layout = pipeline.layout;
+    computeTargets[c]->pipeline = pipeline.pipeline;
+  }
+  for (const std::exception_ptr &error : errors) {
+    if (error) std::rethrow_exception(error);
+  }
+
+  _pipelineBatch++;
+  for (size_t i = 0; i < descs.size(); i++) {
+    CachedPipeline &entry = _pipelineVariants[keys[i]];
+    entry.variant.requests++;
+    entry.lastBatch = _pipelineBatch;
+    targets[i]->layout = entry.pipeline.layout;
+    targets[i]->pipeline = entry.pipeline.pipeline;
+  }
+  evictPipelineVariants();
+}
+
+void VkBackend::evictPipelineVariants() {
+  if (_pipelineVariants.size() <= MAX_PIPELINE_VARIANTS) return;
+  std::vector<std::pair<uint64_t, std::string>> candidates;
+  for (const auto &entry : _pipelineVariants) {
+    if (entry.second.lastBatch == _pipelineBatch) continue;
+    candidates.push_back(std::make_pair(entry.second.lastBatch, entry.first));
+  }
+  std::sort(candidates.begin(), candidates.end());
+  const size_t count = std::min(
+      candidates.size(), _pipelineVariants.size() - MAX_PIPELINE_VARIANTS);
+  if (count == 0) return;
+  // Rare: recorded frames may still bind the evicted pipelines
+  vkDeviceWaitIdle(_device);
+  for (size_t i = 0; i < count; i++) {
+    CachedPipeline &entry = _pipelineVariants[candidates[i].second];
+    vkDestroyPipeline(_device, entry.pipeline.pipeline, nullptr);
+    vkDestroyPipelineLayout(_device, entry.pipeline.layout, nullptr);
+    _pipelineVariants.erase(candidates[i].second);
+  }
+}
+
+// Bindings and attributes of the streams a pipeline reads, see VertexInput
+static void vertexInputDescriptions(
+    VertexInput input, std::vector<VkVertexInputBindingDescription> &bindings,
+    std::vector<VkVertexInputAttributeDescription> &attributes) {
+  if (input == VertexInput::None) return;
+  VkVertexInputBindingDescription binding = {};
+  binding.binding = 0;
+  binding.stride = POSITION_STREAM_STRIDE;
+  binding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+  bindings.push_back(binding);
+  VkVertexInputAttributeDescription attribute = {};
+  attribute.binding = 0;
+  attribute.location = 0;
+  attribute.format = VK_FORMAT_R32G32B32_SFLOAT;
+  attribute.offset = 0;
+  attributes.push_back(attribute);
+  if (input == VertexInput::Position) return;
+
+  binding.binding = 1;
+  binding.stride = ATTRIBUTE_STREAM_STRIDE;
+  bindings.push_back(binding);
+  attribute.binding = 1;
+  attribute.location = 1;
+  attribute.format = VK_FORMAT_R32G32B32_SFLOAT;
+  attribute.offset = offsetof(VkVertexAttributes, normal);
+  attributes.push_back(attribute);
+  attribute.location = 2;
+  attribute.format = VK_FORMAT_R32G32_SFLOAT;
+  attribute.offset = offsetof(VkVertexAttributes, texCoord);
+  attributes.push_back(attribute);
+  attribute.location = 3;
+  attribute.format = VK_FORMAT_R32G32B32_SFLOAT;
+  attribute.offset = offsetof(VkVertexAttributes, tangent);
+  attributes.push_back(attribute);
+}
+
+Pipeline VkBackend::createGraphicsPipeline(
+    const GraphicsPipelineDesc &desc) const {
+  const VkRenderPass renderPass =
+      desc.renderPass != VK_NULL_HANDLE ? desc.renderPass : _renderPass;
+  const VkExtent2D extent =
+      desc.extent.width == 0 ? _renderTargetExtent : desc.extent;
+
+  Pipeline pipeline = {};  // TODO: give pipeline his own class
+  pipeline.descriptorSetLayout = desc.descriptorSetLayout;
+
+  const bool depthOnly = desc.fragShader.empty();
+  auto vertShaderCode = readShader(desc.vertexShader);
+  VkShaderModule vertShaderModule = createShaderModule(_device, vertShaderCode);
+  VkShaderModule fragShaderModule = VK_NULL_HANDLE;
+  if (!depthOnly) {
+    auto fragShaderCode = readShader(desc.fragShader);
+    fragShaderModule = createShaderModule(_device, fragShaderCode);
+  }
+
+  VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
+  vertShaderStageInfo.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+  vertShaderStageInfo.module = vertShaderModule;
+  vertShaderStageInfo.pName = "main";
+
+  VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
+  fragShaderStageInfo.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+  fragShaderStageInfo.module = fragShaderModule;
+  fragShaderStageInfo.pName = "main";
+
+  // Constant i at offset 4 * i, VkBool32 and uint32_t alike
+  std::vector<VkSpecializationMapEntry> specializationEntries;
+  for (uint32_t i = 0; i < desc.specialization.size(); i++) {
+    VkSpecializationMapEntry entry = {};
+    entry.constantID = i;
+    entry.offset = i * sizeof(uint32_t);
+    entry.size = sizeof(uint32_t);
+    specializationEntries.push_back(entry);
+  }
+  VkSpecializationInfo specializationInfo = {};
+  specializationInfo.mapEntryCount =
+      static_cast<uint32_t>(specializationEntries.size());
+  specializationInfo.pMapEntries = specializationEntries.data();
+  specializationInfo.dataSize = desc.specialization.size() * sizeof(uint32_t);
+  specializationInfo.pData = desc.specialization.data();
+  if (!desc.specialization.empty()) {
+    vertShaderStageInfo.pSpecializationInfo = &specializationInfo;
+    fragShaderStageInfo.pSpecializationInfo = &specializationInfo;
+  }
+
+  VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo,
+                                                    fragShaderStageInfo};
+
+  std::vector<VkVertexInputBindingDescription> bindingDescriptions;
+  std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
+  vertexInputDescriptions(desc.vertexInput, bindingDescriptions,
+                          attributeDescriptions);
+
+  VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+  vertexInputInfo.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+  vertexInputInfo.vertexBindingDescriptionCount =
+      static_cast<uint32_t>(bindingDescriptions.size());
+  vertexInputInfo.vertexAttributeDescriptionCount =
+      static_cast<uint32_t>(attributeDescriptions.size());
+  vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
+  vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+  VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+  inputAssembly.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+  inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+  VkViewport viewport = {};
+  viewport.x = 0.0f;
+  viewport.y = 0.0f;
+  viewport.width = (float)extent.width;
+  viewport.height = (float)extent.height;
+  viewport.minDepth = 0.0f;
+  viewport.maxDepth = 1.0f;
+
+  VkRect2D scissor = {};
+  scissor.offset = {0, 0};
+  scissor.extent = extent;
+
+  VkPipelineViewportStateCreateInfo viewportState = {};
+  viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+  viewportState.viewportCount = 1;
+  viewportState.pViewports = &viewport;
+  viewportState.scissorCount = 1;
+  viewportState.pScissors = &scissor;
+
+  VkPipelineRasterizationStateCreateInfo rasterizer = {};
+  rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+  rasterizer.depthClampEnable = VK_FALSE;
+  rasterizer.rasterizerDiscardEnable = VK_FALSE;
+  rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+  rasterizer.cullMode = desc.cullMode;
+  rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+  rasterizer.depthBiasEnable =
+      desc.depthBiasConstant != 0.0f || desc.depthBiasSlope != 0.0f
+          ? VK_TRUE
+          : VK_FALSE;
+  rasterizer.depthBiasConstantFactor = desc.depthBiasConstant;
+  rasterizer.depthBiasClamp = 0.0f;
+  rasterizer.depthBiasSlopeFactor = desc.depthBiasSlope;
+  rasterizer.lineWidth =
+      1.0f;  // Not used but produce validation error when not set
+
+  VkPipelineMultisampleStateCreateInfo multisampling = {};
+  multisampling.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+  multisampling.sampleShadingEnable = VK_FALSE;
+  multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+  multisampling.minSampleShading = 1.0f;
+  multisampling.pSampleMask = nullptr;
+  multisampling.alphaToCoverageEnable = VK_FALSE;
+  multisampling.alphaToOneEnable = VK_FALSE;
+
+  std::vector<VkPipelineColorBlendAttachmentState> colorBlendAttachmentStates;
+  for (size_t i = 0; i < desc.colorAttachmentCount; i++) {
+    VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+    colorBlendAttachment.colorWriteMask =
+        VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+        VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    if (desc.additiveBlend) {
+      // dst + src, alpha untouched
+      colorBlendAttachment.blendEnable = VK_TRUE;
+      colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+      colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+      colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+      colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    } else {
+      colorBlendAttachment.blendEnable = VK_FALSE;
+      colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+      colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+      colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+      colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+    }
+    colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+    colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+    colorBlendAttachmentStates.push_back(colorBlendAttachment);
+  }
+
+  VkPipelineColorBlendStateCreateInfo colorBlending = {};
+  colorBlending.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+  colorBlending.logicOpEnable = VK_FALSE;
+  colorBlending.logicOp = VK_LOGIC_OP_COPY;
+  colorBlending.attachmentCount =
+      static_cast<uint32_t>(colorBlendAttachmentStates.size());
+  colorBlending.pAttachments = colorBlendAttachmentStates.data();
+  colorBlending.blendConstants[0] = 0.0f;
+  colorBlending.blendConstants[1] = 0.0f;
+  colorBlending.blendConstants[2] = 0.0f;
+  colorBlending.blendConstants[3] = 0.0f;
+
+  std::vector<VkDynamicState> dynamicStates;
+  if (desc.depthBoundsTest) {
+    dynamicStates.push_back(VK_DYNAMIC_STATE_DEPTH_BOUNDS);
+  }
+  if (desc.dynamicViewport) {
+    dynamicStates.push_back(VK_DYNAMIC_STATE_VIEWPORT);
+    dynamicStates.push_back(VK_DYNAMIC_STATE_SCISSOR);
+  }
+
+  VkPipelineDynamicStateCreateInfo dynamicState = {};
+  dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+  dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+  dynamicState.pDynamicStates = dynamicStates.data();
+
+  VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+  depthStencil.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+  depthStencil.depthTestEnable = desc.depthTest ? VK_TRUE : VK_FALSE;
+  depthStencil.depthWriteEnable = desc.depthWrite ? VK_TRUE : VK_FALSE;
+  depthStencil.depthCompareOp = desc.depthCompareOp;
+  depthStencil.depthBoundsTestEnable =
+      desc.depthBoundsTest ? VK_TRUE : VK_FALSE;
+  depthStencil.minDepthBounds = 0.0f;
+  depthStencil.maxDepthBounds = 1.0f;
+  depthStencil.stencilTestEnable = VK_FALSE;
+  depthStencil.front = {};
+  depthStencil.back = {};
+
+  std::vector<VkDescriptorSetLayout> setLayouts = {desc.descriptorSetLayout};
+  if (desc.perDrawSetLayout != VK_NULL_HANDLE) {
+    setLayouts.push_back(desc.perDrawSetLayout);
+  }
+  VkPushConstantRange pushConstantRange = {};
+  pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  pushConstantRange.offset = 0;
+  pushConstantRange.size = desc.pushConstantSize;
+
+  VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+  pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+  pipelineLayoutInfo.pSetLayouts = setLayouts.data();
+  pipelineLayoutInfo.pushConstantRangeCount =
+      desc.pushConstantSize > 0 ? 1 : 0;
+  pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+  VkResult result = vkCreatePipelineLayout(_device, &pipelineLayoutInfo,
+                                           nullptr, &pipeline.layout);
+  vkCheckResult(result, "vkCreatePipelineLayout");
+
+  VkGraphicsPipelineCreateInfo pipelineInfo = {};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipelineInfo.stageCount = depthOnly ? 1 : 2;
+  pipelineInfo.pStages = shaderStages;
+  pipelineInfo.pVertexInputState = &vertexInputInfo;
+  pipelineInfo.pInputAssemblyState = &inputAssembly;
+  pipelineInfo.pViewportState = &viewportState;
+  pipelineInfo.pRasterizationState = &rasterizer;
+  pipelineInfo.pMultisampleState = &multisampling;
+  pipelineInfo.pDepthStencilState = &depthStencil;
+  pipelineInfo.pColorBlendState = &colorBlending;
+  pipelineInfo.pDynamicState =
+      dynamicStates.empty() ? nullptr : &dynamicState;
+
+  pipelineInfo.layout = pipeline.layout;
+  pipelineInfo.renderPass = renderPass;
+  pipelineInfo.subpass = desc.subpass;
+  pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+  pipelineInfo.basePipelineIndex = -1;
+
+  result = vkCreateGraphicsPipelines(_device, _pipelineCache.handle(), 1,
+                                     &pipelineInfo, nullptr,
+                                     &pipeline.pipeline);
+  vkCheckResult(result, "vkCreateGraphicsPipelines");
+
+  vkDestroyShaderModule(_device, fragShaderModule, nullptr);
+  vkDestroyShaderModule(_device, vertShaderModule, nullptr);
+  return pipeline;
+}
+
+void VkBackend::destroyGraphicsPipelines() {
+  for (auto &entry : _pipelineVariants) {
+    vkDestroyPipeline(_device, entry.second.pipeline.pipeline, nullptr);
+    vkDestroyPipelineLayout(_device, entry.second.pipeline.layout, nullptr);
+  }
+  _pipelineVariants.clear();
+}
+
+void VkBackend::destroyComputePipelines() {
+  vkDestroyPipeline(_device, _clusterPipeline.pipeline, nullptr);
+  vkDestroyPipelineLayout(_device, _clusterPipeline.layout, nullptr);
+
+  vkDestroyPipeline(_device, _drawCullPipeline.pipeline, nullptr);
+  vkDestroyPipelineLayout(_device, _drawCullPipeline.layout, nullptr);
+
+  vkDestroyPipeline(_device, _hiZPipeline.pipeline, nullptr);
+  vkDestroyPipelineLayout(_device, _hiZPipeline.layout, nullptr);
+}
+
+Pipeline VkBackend::createComputePipeline(
+    const std::string &computeShader,
+    VkDescriptorSetLayout descriptorSetLayout) const {
+  Pipeline pipeline = {};
+  pipeline.descriptorSetLayout = descriptorSetLayout;
+
+  auto shaderCode = readShader(computeShader);
+  VkShaderModule shaderModule = createShaderModule(_device, shaderCode);
+
+  VkPipelineShaderStageCreateInfo shaderStageInfo = {};
+  shaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  shaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  shaderStageInfo.module = shaderModule;
+  shaderStageInfo.pName = "main";
+
+  VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+  pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutInfo.setLayoutCount = 1;
+  pipelineLayoutInfo.pSetLayouts = &pipeline.descriptorSetLayout;
+
+  VkResult result = vkCreatePipelineLayout(_device, &pipelineLayoutInfo,
+                                           nullptr, &pipeline.layout);
+  vkCheckResult(result, "vkCreatePipelineLayout");
+
+  VkComputePipelineCreateInfo pipelineInfo = {};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipelineInfo.stage = shaderStageInfo;
+  pipelineInfo.layout = pipeline.layout;
+  pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+  pipelineInfo.basePipelineIndex = -1;
+
+  result = vkCreateComputePipelines(_device, _pipelineCache.handle(), 1,
+                                    &pipelineInfo, nullptr,
+                                    &pipeline.pipeline);
+  vkCheckResult(result, "vkCreateComputePipelines");
+
+  vkDestroyShaderModule(_device, shaderModule, nullptr);
+  return pipeline;
+}
+
+void VkBackend::createFramebuffers() {
+  _swapChainFramebuffers.resize(_swapChainImageViews.size());
+  for (size_t i = 0; i < _swapChainImageViews.size(); i++) {
+    // The light subpass writes the scene color when it is upscaled after
+    std::vector<VkImageView> attachments = {_settings.dynamicResolution
+                                                ? _sceneColor.imageView
+                                                : _swapChainImageViews[i]};
+    for (const auto &attachment : _gBufferAttachments) {
+      attachments.push_back(attachment.imageView);
+    }
+    attachments.push_back(_depth.imageView);
+
+    VkFramebufferCreateInfo framebufferInfo = {};
+    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebufferInfo.renderPass = _renderPass;
+    framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+    framebufferInfo.pAttachments = attachments.data();
+    framebufferInfo.width = _renderTargetExtent.width;
+    framebufferInfo.height = _renderTargetExtent.height;
+    framebufferInfo.layers = 1;
+
+    VkResult result = vkCreateFramebuffer(_device, &framebufferInfo, nullptr,
+                                          &_swapChainFramebuffers[i]);
+    vkCheckResult(result, "vkCreateFramebuffer");
+  }
+
+  _upscaleFramebuffers.clear();
+  if (_settings.dynamicResolution) {
+    _upscaleFramebuffers.resize(_swapChainImageViews.size());
+    for (size_t i = 0; i < _swapChainImageViews.size(); i++) {
+      VkFramebufferCreateInfo framebufferInfo = {};
+      framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+      framebufferInfo.renderPass = _upscaleRenderPass;
+      framebufferInfo.attachmentCount = 1;
+      framebufferInfo.pAttachments = &_swapChainImageViews[i];
+      framebufferInfo.width = _swapChainExtent.width;
+      framebufferInfo.height = _swapChainExtent.height;
+      framebufferInfo.layers = 1;
+      VkResult result = vkCreateFramebuffer(_device, &framebufferInfo, nullptr,
+                                            &_upscaleFramebuffers[i]);
+      vkCheckResult(result, "vkCreateFramebuffer");
+    }
+  }
+
+  std::vector<VkImageView> earlyAttachments;
+  for (const auto &attachment : _gBufferAttachments) {
+    earlyAttachments.push_back(attachment.imageView);
+  }
+  earlyAttachments.push_back(_depth.imageView);
+
+  VkFramebufferCreateInfo framebufferInfo = {};
+  framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+  framebufferInfo.renderPass = _earlyRenderPass;
+  framebufferInfo.attachmentCount =
+      static_cast<uint32_t>(earlyAttachments.size());
+  framebufferInfo.pAttachments = earlyAttachments.data();
+  framebufferInfo.width = _renderTargetExtent.width;
+  framebufferInfo.height = _renderTargetExtent.height;
+  framebufferInfo.layers = 1;
+  VkResult result = vkCreateFramebuffer(_device, &framebufferInfo, nullptr,
+                                        &_earlyFramebuffer);
+  vkCheckResult(result, "vkCreateFramebuffer");
+}
+
+void VkBackend::createCommandPool() {
+  QueueFamilyIndices queueFamilyIndices =
+      findQueueFamilies(_physicalDevice, _surface);
+
+  VkCommandPoolCreateInfo poolInfo = {};
+  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily;
+  // Command buffers are re-recorded every frame
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  VkResult result =
+      vkCreateCommandPool(_device, &poolInfo, nullptr, &_commandPool);
+  vkCheckResult(result, "vkCreateCommandPool");
+}
+
+void VkBackend::createDepthResources() {
+  VkFormat depthFormat = findDepthFormat(_physicalDevice);
+  // Sampled by the Hi-Z reduction
+  VkImageUsageFlags usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+                            VK_IMAGE_USAGE_SAMPLED_BIT;
+  if (_settings.gBufferLayout == GBufferLayout::Compact) {
+    usage |= VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+  }
+  createImage(_renderTargetExtent.width, _renderTargetExtent.height,
+              depthFormat, VK_IMAGE_TILING_OPTIMAL, usage,
+              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _depth.image,
+              _depth.imageMemory);
+  _depth.imageView =
+      createImageView(_depth.image, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
+  transitionImageLayout(_depth.image, depthFormat, VK_IMAGE_LAYOUT_UNDEFINED,
+                        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+}
+
+// The pyramid stays in the general layout, sampled by the culling pass and
+// written level by level by the reduction. It starts at the far plane so
+// nothing is occluded before the first reduction.
+void VkBackend::createHiZResources() {
+  _hiZ.width = std::max(_renderTargetExtent.width / 2, 1u);
+  _hiZ.height = std::max(_renderTargetExtent.height / 2, 1u);
+  _hiZExtent = _renderExtent;  // cleared, any extent tests visible
+  _hiZ.levelCount = 1;
+  for (uint32_t size = std::max(_hiZ.width, _hiZ.height); size > 1;
+       size /= 2) {
+    _hiZ.levelCount++;
+  }
+
+  const VkFormat format = VK_FORMAT_R32_SFLOAT;
+  createImage(_hiZ.width, _hiZ.height, format, VK_IMAGE_TILING_OPTIMAL,
+              VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
+                  VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _hiZ.image, _hiZ.memory,
+              _hiZ.levelCount);
+  _hiZ.view = createImageView(_hiZ.image, format, VK_IMAGE_ASPECT_COLOR_BIT, 0,
+                              _hiZ.levelCount);
+  for (uint32_t level = 0; level < _hiZ.levelCount; level++) {
+    _hiZ.levelViews.push_back(
+        createImageView(_hiZ.image, format, VK_IMAGE_ASPECT_COLOR_BIT, level));
+  }
+
+  VkSamplerCreateInfo samplerInfo = {};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_NEAREST;
+  samplerInfo.minFilter = VK_FILTER_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.anisotropyEnable = VK_FALSE;
+  samplerInfo.maxAnisotropy = 1;
+  samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+  samplerInfo.unnormalizedCoordinates = VK_FALSE;
+  samplerInfo.compareEnable = VK_FALSE;
+  samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.mipLodBias = 0.0f;
+  samplerInfo.minLod = 0.0f;
+  samplerInfo.maxLod = static_cast<float>(_hiZ.levelCount);
+  VkResult result =
+      vkCreateSampler(_device, &samplerInfo, nullptr, &_hiZ.sampler);
+  vkCheckResult(result, "vkCreateSampler");
+
+  VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+  VkImageMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = _hiZ.image;
+  barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, _hiZ.levelCount,
+                              0, 1};
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
+  VkClearColorValue farPlane = {{1.0f, 1.0f, 1.0f, 1.0f}};
+  vkCmdClearColorImage(commandBuffer, _hiZ.image, VK_IMAGE_LAYOUT_GENERAL,
+                       &farPlane, 1, &barrier.subresourceRange);
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
+  endSingleTimeCommands(commandBuffer);
+}
+
+void VkBackend::destroyHiZResources() {
+  vkDestroySampler(_device, _hiZ.sampler, nullptr);
+  for (VkImageView view : _hiZ.levelViews) {
+    vkDestroyImageView(_device, view, nullptr);
+  }
+  _hiZ.levelViews.clear();
+  vkDestroyImageView(_device, _hiZ.view, nullptr);
+  vkDestroyImage(_device, _hiZ.image, nullptr);
+  vkFreeMemory(_device, _hiZ.memory, nullptr);
+  _hiZ.image = VK_NULL_HANDLE;
+}
+
+// Depth-only pass rendering one shadow map layer, left in the layout the
+// light passes sample it in
+void VkBackend::createShadowRenderPass() {
+  _shadowFormat = findSupportedFormat(
+      _physicalDevice, {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D16_UNORM},
+      VK_IMAGE_TILING_OPTIMAL,
+      VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT |
+          VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
+
+  VkAttachmentDescription attachment = {};
+  attachment.format = _shadowFormat;
+  attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+  attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  attachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+  VkAttachmentReference depthReference = {
+      0, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+
+  VkSubpassDescription subpass = {};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.colorAttachmentCount = 0;
+  subpass.pDepthStencilAttachment = &depthReference;
+
+  // The previous frame's light passes sample the layer this pass clears,
+  // this frame's sample what it wrote
+  std::array<VkSubpassDependency, 2> dependencies = {};
+  dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[0].dstSubpass = 0;
+  dependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  dependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                                 VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  dependencies[0].srcAccessMask = 0;
+  dependencies[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                                  VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  dependencies[1].srcSubpass = 0;
+  dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+  VkRenderPassCreateInfo renderPassInfo = {};
+  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  renderPassInfo.attachmentCount = 1;
+  renderPassInfo.pAttachments = &attachment;
+  renderPassInfo.subpassCount = 1;
+  renderPassInfo.pSubpasses = &subpass;
+  renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+  renderPassInfo.pDependencies = dependencies.data();
+
+  VkResult result = vkCreateRenderPass(_device, &renderPassInfo, nullptr,
+                                       &_shadowRenderPass);
+  vkCheckResult(result, "vkCreateRenderPass");
+}
+
+// Matrices of the layer being rendered, at a dynamic offset
+VkDescriptorSetLayout VkBackend::createShadowDescriptorSetLayout() {
+  VkDescriptorSetLayout descriptorSetLayout = {};
+
+  VkDescriptorSetLayoutBinding uboLayoutBinding = {};
+  uboLayoutBinding.binding = 0;
+  uboLayoutBinding.descriptorCount = 1;
+  uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  uboLayoutBinding.pImmutableSamplers = nullptr;
+  uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+  // Then the instance transforms and instance indices
+  std::array<VkDescriptorSetLayoutBinding, 3> bindings = {uboLayoutBinding};
+  for (uint32_t i = 1; i < bindings.size(); i++) {
+    bindings[i].binding = INSTANCE_BINDING + i - 1;
+    bindings[i].descriptorCount = 1;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[i].pImmutableSamplers = nullptr;
+    bindings[i].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  }
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+  layoutInfo.pBindings = bindings.data();
+
+  VkResult result = vkCreateDescriptorSetLayout(_device, &layoutInfo, nullptr,
+                                                &descriptorSetLayout);
+  vkCheckResult(result, "vkCreateDescriptorSetLayout");
+  return descriptorSetLayout;
+}
+
+// Both maps exist even with shadows off so that the light descriptor set
+// is always complete; the point map has at least one layer
+void VkBackend::createShadowResources() {
+  _settings.pointShadowCount =
+      std::min(_settings.pointShadowCount, MAX_POINT_SHADOWS);
+  const uint32_t pointLayers = _settings.pointShadowCount * POINT_SHADOW_FACES;
+  createShadowMap(_cascadeShadowMap, _settings.shadowMapSize,
+                  SHADOW_CASCADE_COUNT);
+  createShadowMap(_pointShadowMap, _settings.pointShadowMapSize,
+                  std::max(pointLayers, 1u));
+  _shadowCache.resize(SHADOW_CASCADE_COUNT + pointLayers);
+
+  // Hardware 2x2 PCF, outside of the map is lit
+  VkSamplerCreateInfo samplerInfo = {};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_LINEAR;
+  samplerInfo.minFilter = VK_FILTER_LINEAR;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+  samplerInfo.anisotropyEnable = VK_FALSE;
+  samplerInfo.maxAnisotropy = 1;
+  samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+  samplerInfo.unnormalizedCoordinates = VK_FALSE;
+  samplerInfo.compareEnable = VK_TRUE;
+  samplerInfo.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.mipLodBias = 0.0f;
+  samplerInfo.minLod = 0.0f;
+  samplerInfo.maxLod = 0.0f;
+  VkResult result =
+      vkCreateSampler(_device, &samplerInfo, nullptr, &_shadowSampler);
+  vkCheckResult(result, "vkCreateSampler");
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(_physicalDevice, &properties);
+  VkDeviceSize alignment = properties.limits.minUniformBufferOffsetAlignment;
+  _shadowPassStride =
+      (sizeof(gPassUbo) + alignment - 1) / alignment * alignment;
+  _shadowPassBuffer = createUniformBuffer(
+      _shadowPassStride * (SHADOW_CASCADE_COUNT + pointLayers));
+  _shadowUniformBuffer = createUniformBuffer(sizeof(shadowUbo));
+
+  std::array<VkDescriptorPoolSize, 2> poolSizes = {};
+  poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  poolSizes[0].descriptorCount = 1;
+  poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  poolSizes[1].descriptorCount = 2;
+  VkDescriptorPoolCreateInfo poolInfo = {};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+  poolInfo.pPoolSizes = poolSizes.data();
+  poolInfo.maxSets = 1;
+  result = vkCreateDescriptorPool(_device, &poolInfo, nullptr,
+                                  &_shadowPipeline.descriptorPool);
+  vkCheckResult(result, "vkCreateDescriptorPool");
+
+  VkDescriptorSetAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = _shadowPipeline.descriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &_shadowPipeline.descriptorSetLayout;
+  VkDescriptorSet descriptorSet;
+  result = vkAllocateDescriptorSets(_device, &allocInfo, &descriptorSet);
+  vkCheckResult(result, "vkAllocateDescriptorSets");
+  _shadowPipeline.descriptorSets.push_back(descriptorSet);
+
+  VkDescriptorBufferInfo uboInfo = {};
+  uboInfo.buffer = _shadowPassBuffer.buffer;
+  uboInfo.offset = 0;
+  uboInfo.range = sizeof(gPassUbo);
+
+  VkWriteDescriptorSet descriptorWrite = {};
+  descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrite.dstSet = descriptorSet;
+  descriptorWrite.dstBinding = 0;
+  descriptorWrite.dstArrayElement = 0;
+  descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  descriptorWrite.descriptorCount = 1;
+  descriptorWrite.pBufferInfo = &uboInfo;
+  vkUpdateDescriptorSets(_device, 1, &descriptorWrite, 0, nullptr);
+  writeInstanceDescriptors(descriptorSet);
+}
+
+void VkBackend::destroyShadowResources() {
+  vkDestroyDescriptorPool(_device, _shadowPipeline.descriptorPool, nullptr);
+  _shadowPipeline.descriptorSets.clear();
+  for (Buffer *buffer : {&_shadowPassBuffer, &_shadowUniformBuffer}) {
+    vkDestroyBuffer(_device, buffer->buffer, nullptr);
+    vkFreeMemory(_device, buffer->bufferMemory, nullptr);
+  }
+  vkDestroySampler(_device, _shadowSampler, nullptr);
+  destroyShadowMap(_cascadeShadowMap);
+  destroyShadowMap(_pointShadowMap);
+}
+
+// Layers are cleared to the far plane, so a layer not rendered yet casts no
+// shadow, and left in the read-only layout the render pass ends in
+void VkBackend::createShadowMap(ShadowMap &map, uint32_t size,
+                                uint32_t layerCount) {
+  map.size = size;
+  map.layerCount = layerCount;
+  createImage(size, size, _shadowFormat, VK_IMAGE_TILING_OPTIMAL,
+              VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+                  VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, map.image, map.memory, 1,
+              layerCount);
+  map.view = createImageView(map.image, _shadowFormat,
+                             VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1,
+                             VK_IMAGE_VIEW_TYPE_2D_ARRAY, 0, layerCount);
+  for (uint32_t layer = 0; layer < layerCount; layer++) {
+    VkImageView layerView =
+        createImageView(map.image, _shadowFormat, VK_IMAGE_ASPECT_DEPTH_BIT,
+                        0, 1, VK_IMAGE_VIEW_TYPE_2D, layer, 1);
+    map.layerViews.push_back(layerView);
+
+    VkFramebufferCreateInfo framebufferInfo = {};
+    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebufferInfo.renderPass = _shadowRenderPass;
+    framebufferInfo.attachmentCount = 1;
+    framebufferInfo.pAttachments = &layerView;
+    framebufferInfo.width = size;
+    framebufferInfo.height = size;
+    framebufferInfo.layers = 1;
+    VkFramebuffer framebuffer;
+    VkResult result = vkCreateFramebuffer(_device, &framebufferInfo, nullptr,
+                                          &framebuffer);
+    vkCheckResult(result, "vkCreateFramebuffer");
+    map.framebuffers.push_back(framebuffer);
+  }
+
+  VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+  VkImageMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = map.image;
+  barrier.subresourceRange = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, layerCount};
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
+  VkClearDepthStencilValue farPlane = {1.0f, 0};
+  vkCmdClearDepthStencilImage(commandBuffer, map.image,
+                              VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &farPlane,
+                              1, &barrier.subresourceRange);
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr,
+                       0, nullptr, 1, &barrier);
+  endSingleTimeCommands(commandBuffer);
+}
+
+void VkBackend::destroyShadowMap(ShadowMap &map) {
+  for (VkFramebuffer framebuffer : map.framebuffers) {
+    vkDestroyFramebuffer(_device, framebuffer, nullptr);
+  }
+  map.framebuffers.clear();
+  for (VkImageView view : map.layerViews) {
+    vkDestroyImageView(_device, view, nullptr);
+  }
+  map.layerViews.clear();
+  vkDestroyImageView(_device, map.view, nullptr);
+  vkDestroyImage(_device, map.image, nullptr);
+  vkFreeMemory(_device, map.memory, nullptr);
+  map.image = VK_NULL_HANDLE;
+}
+
+void VkBackend::createGBufferAttachments() {
+  if (_settings.gBufferLayout == GBufferLayout::Compact) {
+    // RG16 octahedral normals, SNORM isn't a mandatory attachment format
+    VkFormat normalFormat = findSupportedFormat(
+        _physicalDevice, {VK_FORMAT_R16G16_SNORM, VK_FORMAT_R16G16_SFLOAT},
+        VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT);
+    _gBufferAttachments.push_back(createGBufferAttachment(normalFormat));
+    // Albedo with the specular intensity in alpha
+    _gBufferAttachments.push_back(
+        createGBufferAttachment(VK_FORMAT_R8G8B8A8_SRGB));
+    std::cout << "G-buffer: compact, 8 bytes/pixel + depth" << std::endl;
+  } else {
+    _gBufferAttachments.push_back(
+        createGBufferAttachment(VK_FORMAT_R16G16B16A16_SFLOAT));  // position
+    _gBufferAttachments.push_back(
+        createGBufferAttachment(VK_FORMAT_R16G16B16A16_SFLOAT));  // normal
+    _gBufferAttachments.push_back(
+        createGBufferAttachment(VK_FORMAT_R16G16B16A16_SFLOAT));  // albedo
+    std::cout << "G-buffer: full, 24 bytes/pixel + depth" << std::endl;
+  }
+}
+
+Attachment VkBackend::createGBufferAttachment(VkFormat format) {
+  Attachment attachment = {};
+  attachment.format = format;
+  createImage(
+      _renderTargetExtent.width, _renderTargetExtent.height, attachment.format,
+      VK_IMAGE_TILING_OPTIMAL,
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, attachment.image, attachment.memory);
+  attachment.imageView = createImageView(attachment.image, attachment.format,
+                                         VK_IMAGE_ASPECT_COLOR_BIT);
+  return attachment;
+}
+
+// Light subpass output when the frame is upscaled, read with bilinear
+// filtering by the upscale pass
+void VkBackend::createSceneColorResources() {
+  _sceneColor = {};
+  if (!_settings.dynamicResolution) return;
+  _sceneColor.format = _swapChainImageFormat;
+  createImage(
+      _renderTargetExtent.width, _renderTargetExtent.height, _sceneColor.format,
+      VK_IMAGE_TILING_OPTIMAL,
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _sceneColor.image,
+      _sceneColor.memory);
+  _sceneColor.imageView = createImageView(
+      _sceneColor.image, _sceneColor.format, VK_IMAGE_ASPECT_COLOR_BIT);
+
+  VkSamplerCreateInfo samplerInfo = {};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_LINEAR;
+  samplerInfo.minFilter = VK_FILTER_LINEAR;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.anisotropyEnable = VK_FALSE;
+  samplerInfo.maxAnisotropy = 1;
+  samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
+  samplerInfo.unnormalizedCoordinates = VK_FALSE;
+  samplerInfo.compareEnable = VK_FALSE;
+  samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.mipLodBias = 0.0f;
+  samplerInfo.minLod = 0.0f;
+  samplerInfo.maxLod = 0.0f;
+  VkResult result =
+      vkCreateSampler(_device, &samplerInfo, nullptr, &_sceneColorSampler);
+  vkCheckResult(result, "vkCreateSampler");
+}
+
+void VkBackend::destroySceneColorResources() {
+  if (_sceneColor.image == VK_NULL_HANDLE) return;
+  vkDestroySampler(_device, _sceneColorSampler, nullptr);
+  vkDestroyImageView(_device, _sceneColor.imageView, nullptr);
+  vkDestroyImage(_device, _sceneColor.image, nullptr);
+  vkFreeMemory(_device, _sceneColor.memory, nullptr);
+  _sceneColor.image = VK_NULL_HANDLE;
+}
+
+Texture VkBackend::createTextureImage(const std::string filepath) {
+  Texture texture = {};
+  VkBuffer stagingBuffer;
+  VkDeviceMemory stagingBufferMemory;
+  int texWidth, texHeight, texChannels;
+  stbi_uc *pixels = stbi_load(filepath.c_str(), &texWidth, &texHeight,
+                              &texChannels, STBI_rgb_alpha);
+  if (!pixels) {
+    stbi_image_free(pixels);
+    uint8_t pixels[4];  // No texture or can't load it, using a dummy texture
+                        // instead
+    pixels[0] = 255;    // AFAIK you can't have null texture in Vulkan
+    pixels[1] = 255;
+    pixels[2] = 255;
+    pixels[3] = 255;
+
+    texWidth = 1, texHeight = 1;
+
+    VkDeviceSize imageSize = texWidth * texHeight * 4;
+    createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 stagingBuffer, stagingBufferMemory);
+    void *data;
+    vkMapMemory(_device, stagingBufferMemory, 0, imageSize, 0, &data);
+    memcpy(data, pixels, static_cast<size_t>(imageSize));
+    vkUnmapMemory(_device, stagingBufferMemory);
+  } else {
+    VkDeviceSize imageSize = texWidth * texHeight * 4;
+    createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 stagingBuffer, stagingBufferMemory);
+    void *data;
+    vkMapMemory(_device, stagingBufferMemory, 0, imageSize, 0, &data);
+    memcpy(data, pixels, static_cast<size_t>(imageSize));
+    vkUnmapMemory(_device, stagingBufferMemory);
+    stbi_image_free(pixels);
+  }
+
+  createImage(
+      texWidth, texHeight, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL,
+      VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, texture.image, texture.imageMemory);
+  transitionImageLayout(texture.image, VK_FORMAT_R8G8B8A8_UNORM,
+                        VK_IMAGE_LAYOUT_UNDEFINED,
+                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+  copyBufferToImage(stagingBuffer, texture.image,
+                    static_cast<uint32_t>(texWidth),
+                    static_cast<uint32_t>(texHeight));
+  transitionImageLayout(texture.image, VK_FORMAT_R8G8B8A8_UNORM,
+                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+  vkDestroyBuffer(_device, stagingBuffer, nullptr);
+  vkFreeMemory(_device, stagingBufferMemory, nullptr);
+  return texture;
+}
+
+VkImageView VkBackend::createImageView(VkImage image, VkFormat format,
+                                       VkImageAspectFlags aspectFlags,
+                                       uint32_t baseMipLevel,
+                                       uint32_t levelCount,
+                                       VkImageViewType viewType,
+                                       uint32_t baseArrayLayer,
+                                       uint32_t layerCount) {
+  VkImageViewCreateInfo viewInfo = {};
+  viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewInfo.image = image;
+  viewInfo.viewType = viewType;
+  viewInfo.format = format;
+  viewInfo.subresourceRange.aspectMask = aspectFlags;
+  viewInfo.subresourceRange.baseMipLevel = baseMipLevel;
+  viewInfo.subresourceRange.levelCount = levelCount;
+  viewInfo.subresourceRange.baseArrayLayer = baseArrayLayer;
+  viewInfo.subresourceRange.layerCount = layerCount;
+
+  VkImageView imageView;
+  VkResult result = vkCreateImageView(_device, &viewInfo, nullptr, &imageView);
+  vkCheckResult(result, "vkCreateImageView");
+
+  return imageView;
+}
+
+void VkBackend::createTextureImageView(Texture &texture) {
+  if (texture.image != VK_NULL_HANDLE) {
+    texture.imageView = createImageView(texture.image, VK_FORMAT_R8G8B8A8_UNORM,
+                                        VK_IMAGE_ASPECT_COLOR_BIT);
+  }
+}
+
+void VkBackend::createTextureSampler(Texture &texture) {
+  VkSamplerCreateInfo samplerInfo = {};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_LINEAR;
+  samplerInfo.minFilter = VK_FILTER_LINEAR;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerInfo.anisotropyEnable = VK_TRUE;
+  samplerInfo.maxAnisotropy = 16;
+  samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+  samplerInfo.unnormalizedCoordinates = VK_FALSE;
+  samplerInfo.compareEnable = VK_FALSE;
+  samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+  samplerInfo.mipLodBias = 0.0f;
+  samplerInfo.minLod = 0.0f;
+  samplerInfo.maxLod = 0.0f;
+
+  VkResult result =
+      vkCreateSampler(_device, &samplerInfo, nullptr, &texture.sampler);
+  vkCheckResult(result, "vkCreateSampler");
+}
+
+void VkBackend::createImage(uint32_t width, uint32_t height, VkFormat format,
+                            VkImageTiling tiling, VkImageUsageFlags usage,
+                            VkMemoryPropertyFlags properties, VkImage &image,
+                            VkDeviceMemory &imageMemory, uint32_t mipLevels,
+                            uint32_t arrayLayers) {
+  VkImageCreateInfo imageInfo = {};
+  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.extent.width = width;
+  imageInfo.extent.height = height;
+  imageInfo.extent.depth = 1;
+  imageInfo.mipLevels = mipLevels;
+  imageInfo.arrayLayers = arrayLayers;
+  imageInfo.format = format;
+  imageInfo.tiling = tiling;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  imageInfo.usage = usage;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  VkResult result = vkCreateImage(_device, &imageInfo, nullptr, &image);
+  vkCheckResult(result, "vkCreateImage");
+
+  VkMemoryRequirements memRequirements;
+  vkGetImageMemoryRequirements(_device, image, &memRequirements);
+
+  VkMemoryAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.allocationSize = memRequirements.size;
+  allocInfo.memoryTypeIndex = findMemoryType(
+      _physicalDevice, memRequirements.memoryTypeBits, properties);
+
+  result = vkAllocateMemory(_device, &allocInfo, nullptr, &imageMemory);
+  vkCheckResult(result, "vkAllocateMemory");
+
+  vkBindImageMemory(_device, image, imageMemory, 0);
+}
+
+// Both streams keep the model's vertex order
+Buffer VkBackend::createPositionBuffer(const std::vector<Vertex> &vertices) {
+  std::vector<glm::vec3> positions;
+  positions.reserve(vertices.size());
+  for (const auto &vertex : vertices) positions.push_back(vertex.pos);
+
+  Buffer position;
+  VkDeviceSize bufferSize = sizeof(positions[0]) * positions.size();
+  VkBuffer stagingBuffer;
+  VkDeviceMemory stagingBufferMemory;
+  createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+               stagingBuffer, stagingBufferMemory);
+
+  void *data;
+  vkMapMemory(_device, stagingBufferMemory, 0, bufferSize, 0, &data);
+  memcpy(data, positions.data(), (size_t)bufferSize);
+  vkUnmapMemory(_device, stagingBufferMemory);
+
+  createBuffer(
+      bufferSize,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, position.buffer,
+      position.bufferMemory);
+  copyBuffer(stagingBuffer, position.buffer, bufferSize);
+  vkDestroyBuffer(_device, stagingBuffer, nullptr);
+  vkFreeMemory(_device, stagingBufferMemory, nullptr);
+  return position;
+}
+
+Buffer VkBackend::createAttributeBuffer(const std::vector<Vertex> &vertices) {
+  std::vector<VkVertexAttributes> attributes;
+  attributes.reserve(vertices.size());
+  for (const auto &vertex : vertices) {
+    VkVertexAttributes vertexAttributes = {};
+    vertexAttributes.normal = vertex.normal;
+    vertexAttributes.texCoord = vertex.texCoord;
+    vertexAttributes.tangent = vertex.tangent;
+    attributes.push_back(vertexAttributes);
+  }
+
+  Buffer attribute;
+  VkDeviceSize bufferSize = sizeof(attributes[0]) * attributes.size();
+  VkBuffer stagingBuffer;
+  VkDeviceMemory stagingBufferMemory;
+  createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+               stagingBuffer, stagingBufferMemory);
+
+  void *data;
+  vkMapMemory(_device, stagingBufferMemory, 0, bufferSize, 0, &data);
+  memcpy(data, attributes.data(), (size_t)bufferSize);
+  vkUnmapMemory(_device, stagingBufferMemory);
+
+  createBuffer(
+      bufferSize,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, attribute.buffer,
+      attribute.bufferMemory);
+  copyBuffer(stagingBuffer, attribute.buffer, bufferSize);
+  vkDestroyBuffer(_device, stagingBuffer, nullptr);
+  vkFreeMemory(_device, stagingBufferMemory, nullptr);
+  return attribute;
+}
+
+// A mesh whose sub-meshes all index less than 64K vertices past their
+// vertexOffset gets 16-bit indices, which halves its index fetches
+Buffer VkBackend::createIndexBuffer(const Model &model) {
+  std::vector<uint16_t> narrow;
+  std::vector<uint32_t> wide;
+  _indexRanges.clear();
+  for (const auto &mesh : model.meshes) {
+    bool fits = true;
+    for (const auto &subMesh : mesh.subMeshes) {
+      for (uint32_t i = 0; i < subMesh.indexCount && fits; i++) {
+        const int64_t index =
+            static_cast<int64_t>(model.indices[subMesh.firstIndex + i]) -
+            subMesh.vertexOffset;
+        fits = index >= 0 && index <= std::numeric_limits<uint16_t>::max();
+      }
+    }
+    for (const auto &subMesh : mesh.subMeshes) {
+      IndexRange range = {};
+      range.indexType = fits ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+      range.firstIndex = static_cast<uint32_t>(fits ? narrow.size()
+                                                    : wide.size());
+      for (uint32_t i = 0; i < subMesh.indexCount; i++) {
+        const uint32_t index =
+            model.indices[subMesh.firstIndex + i] - subMesh.vertexOffset;
+        if (fits) {
+          narrow.push_back(static_cast<uint16_t>(index));
+        } else {
+          wide.push_back(index);
+        }
+      }
+      _indexRanges.push_back(range);
+    }
+  }
+
+  // Binding offsets are multiples of the index size
+  const VkDeviceSize narrowSize = narrow.size() * sizeof(uint16_t);
+  _wideIndexOffset = (narrowSize + 3) / 4 * 4;
+  const VkDeviceSize wideSize = wide.size() * sizeof(uint32_t);
+  VkDeviceSize bufferSize =
+      std::max<VkDeviceSize>(_wideIndexOffset + wideSize, 4);
+  _indexBufferStats = {};
+  _indexBufferStats.narrowIndices = static_cast<uint32_t>(narrow.size());
+  _indexBufferStats.wideIndices = static_cast<uint32_t>(wide.size());
+  _indexBufferStats.bytes = _wideIndexOffset + wideSize;
+  _indexBufferStats.bytesSaved = narrow.size() * sizeof(uint32_t) +
+                                 wideSize - _indexBufferStats.bytes;
+
+  Buffer index;
+  VkBuffer stagingBuffer;
+  VkDeviceMemory stagingBufferMemory;
+  createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+               stagingBuffer, stagingBufferMemory);
+
+  char *data;
+  vkMapMemory(_device, stagingBufferMemory, 0, bufferSize, 0,
+              reinterpret_cast<void **>(&data));
+  memcpy(data, narrow.data(), (size_t)narrowSize);
+  memcpy(data + _wideIndexOffset, wide.data(), (size_t)wideSize);
+  vkUnmapMemory(_device, stagingBufferMemory);
+
+  createBuffer(
+      bufferSize,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, index.buffer, index.bufferMemory);
+
+  copyBuffer(stagingBuffer, index.buffer, bufferSize);
+
+  vkDestroyBuffer(_device, stagingBuffer, nullptr);
+  vkFreeMemory(_device, stagingBufferMemory, nullptr);
+  return index;
+}
+
+// Written by the uploads of the frames, see stageUpload()
+Buffer VkBackend::createUniformBuffer(size_t size) {
+  Buffer buffer;
+  VkDeviceSize bufferSize = size;
+  createBuffer(bufferSize,
+               VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+                   VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer.buffer,
+               buffer.bufferMemory);
+  return buffer;
+}
+
+Buffer VkBackend::createStorageBuffer(size_t size,
+                                      VkMemoryPropertyFlags properties,
+                                      VkBufferUsageFlags extraUsage) {
+  Buffer buffer;
+  VkDeviceSize bufferSize = size;
+  createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | extraUsage,
+               properties, buffer.buffer, buffer.bufferMemory);
+  return buffer;
+}
+
+VkDescriptorPool VkBackend::createGPassDescriptorPool(uint32_t poolSize,
+                                                     uint32_t materialCount) {
+  VkDescriptorPool descriptorPool = {};
+  std::array<VkDescriptorPoolSize, 5> poolSizes = {};
+  poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  poolSizes[0].descriptorCount = poolSize;
+
+  poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  poolSizes[1].descriptorCount = poolSize * materialCount;
+
+  poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  poolSizes[2].descriptorCount = poolSize * materialCount;
+
+  poolSizes[3].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  poolSizes[3].descriptorCount = poolSize * materialCount;
+
+  poolSizes[4].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  poolSizes[4].descriptorCount = 2 * poolSize;
+
+  VkDescriptorPoolCreateInfo poolInfo = {};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+  poolInfo.pPoolSizes = poolSizes.data();
+  poolInfo.maxSets = poolSize;
+
+  VkResult result =
+      vkCreateDescriptorPool(_device, &poolInfo, nullptr, &descriptorPool);
+  vkCheckResult(result, "vkCreateDescriptorPool");
+  return descriptorPool;
+}
+
+VkDescriptorSet VkBackend::createGPassDescriptorSet(
+    VkDescriptorPool descriptorPool, VkDescriptorSetLayout descriptorSetLayout,
+    uint32_t firstMaterial, uint32_t materialCount) {
+  VkDescriptorSet descriptorSet;
+  VkDescriptorSetLayout layouts[] = {descriptorSetLayout};
+
+  VkDescriptorSetAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = layouts;
+
+  VkResult result =
+      vkAllocateDescriptorSets(_device, &allocInfo, &descriptorSet);
+  vkCheckResult(result, "vkAllocateDescriptorSets");
+
+  VkDescriptorBufferInfo bufferInfo = {};
+  bufferInfo.buffer = _gpassUniformBuffer.buffer;
+  bufferInfo.offset = 0;
+  bufferInfo.range = sizeof(gPassUbo);
+
+  // Array element i of each binding is material firstMaterial + i
+  std::vector<VkDescriptorImageInfo> imageInfos1(materialCount);
+  std::vector<VkDescriptorImageInfo> imageInfos2(materialCount);
+  std::vector<VkDescriptorImageInfo> imageInfos3(materialCount);
+  for (uint32_t i = 0; i < materialCount; i++) {
+    const Texture &diffuse = _diffuseTextures[firstMaterial + i];
+    imageInfos1[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    imageInfos1[i].imageView = diffuse.imageView;
+    imageInfos1[i].sampler = diffuse.sampler;
+
+    const Texture &specular = _specularTextures[firstMaterial + i];
+    imageInfos2[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    imageInfos2[i].imageView = specular.imageView;
+    imageInfos2[i].sampler = specular.sampler;
+
+    const Texture &normal = _normalTextures[firstMaterial + i];
+    imageInfos3[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    imageInfos3[i].imageView = normal.imageView;
+    imageInfos3[i].sampler = normal.sampler;
+  }
+
+  std::array<VkWriteDescriptorSet, 4> descriptorWrites = {};
+
+  descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrites[0].dstSet = descriptorSet;
+  descriptorWrites[0].dstBinding = 0;
+  descriptorWrites[0].dstArrayElement = 0;
+  descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  descriptorWrites[0].descriptorCount = 1;
+  descriptorWrites[0].pBufferInfo = &bufferInfo;
+
+  descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrites[1].dstSet = descriptorSet;
+  descriptorWrites[1].dstBinding = 1;
+  descriptorWrites[1].dstArrayElement = 0;
+  descriptorWrites[1].descriptorType =
+      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  descriptorWrites[1].descriptorCount = materialCount;
+  descriptorWrites[1].pImageInfo = imageInfos1.data();
+
+  descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrites[2].dstSet = descriptorSet;
+  descriptorWrites[2].dstBinding = 2;
+  descriptorWrites[2].dstArrayElement = 0;
+  descriptorWrites[2].descriptorType =
+      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  descriptorWrites[2].descriptorCount = materialCount;
+  descriptorWrites[2].pImageInfo = imageInfos2.data();
+
+  descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrites[3].dstSet = descriptorSet;
+  descriptorWrites[3].dstBinding = 3;
+  descriptorWrites[3].dstArrayElement = 0;
+  descriptorWrites[3].descriptorType =
+      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  descriptorWrites[3].descriptorCount = materialCount;
+  descriptorWrites[3].pImageInfo = imageInfos3.data();
+  vkUpdateDescriptorSets(_device,
+                         static_cast<uint32_t>(descriptorWrites.size()),
+                         descriptorWrites.data(), 0, nullptr);
+  writeInstanceDescriptors(descriptorSet);
+  return descriptorSet;
+}
+
+VkDescriptorPool VkBackend::createLightDescriptorPool(uint32_t poolSize) {
+  VkDescriptorPool descriptorPool = {};
+  std::array<VkDescriptorPoolSize, 6> poolSizes = {};
+  poolSizes[0].type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+  poolSizes[0].descriptorCount = 1;
+
+  poolSizes[1].type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+  poolSizes[1].descriptorCount = 1;
+
+  poolSizes[2].type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+  poolSizes[2].descriptorCount = 1;
+
+  poolSizes[3].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  poolSizes[3].descriptorCount = 2;
+
+  poolSizes[4].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  poolSizes[4].descriptorCount = 2;
+
+  poolSizes[5].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  poolSizes[5].descriptorCount = 2;
+
+  VkDescriptorPoolCreateInfo poolInfo = {};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+  poolInfo.pPoolSizes = poolSizes.data();
+  poolInfo.maxSets = 1;
+
+  VkResult result =
+      vkCreateDescriptorPool(_device, &poolInfo, nullptr, &descriptorPool);
+  vkCheckResult(result, "vkCreateDescriptorPool");
+  return descriptorPool;
+}
+
+VkDescriptorSet VkBackend::createLightDescriptorSet(
+    VkDescriptorPool descriptorPool,
+    VkDescriptorSetLayout descriptorSetLayout) {
+  VkDescriptorSet descriptorSet;
+  VkDescriptorSetLayout layouts[] = {descriptorSetLayout};
+
+  VkDescriptorSetAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = layouts;
+
+  VkResult result =
+      vkAllocateDescriptorSets(_device, &allocInfo, &descriptorSet);
+  vkCheckResult(result, "vkAllocateDescriptorSets");
+
+  // Same bindings for both layouts, the compact one reads depth in place of
+  // the position
+  const bool compact = _settings.gBufferLayout == GBufferLayout::Compact;
+  const size_t firstAttachment = compact ? 0 : 1;
+
+  VkDescriptorImageInfo inputInfo1 = {};
+  if (compact) {
+    inputInfo1.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    inputInfo1.imageView = _depth.imageView;
+  } else {
+    inputInfo1.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    inputInfo1.imageView = _gBufferAttachments[0].imageView;
+  }
+
+  VkDescriptorImageInfo inputInfo2 = {};
+  inputInfo2.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  inputInfo2.imageView = _gBufferAttachments[firstAttachment].imageView;
+
+  VkDescriptorImageInfo inputInfo3 = {};
+  inputInfo3.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  inputInfo3.imageView = _gBufferAttachments[firstAttachment + 1].imageView;
+
+  VkDescriptorBufferInfo uboInfo = {};
+  uboInfo.buffer = _lightUniformBuffer.buffer;
+  uboInfo.offset = 0;
+  uboInfo.range = sizeof(lightUbo);
+
+  VkDescriptorBufferInfo lightsInfo = {};
+  lightsInfo.buffer = _lightStorageBuffer.buffer;
+  lightsInfo.offset = 0;
+  lightsInfo.range = VK_WHOLE_SIZE;
+
+  VkDescriptorBufferInfo clustersInfo = {};
+  clustersInfo.buffer = _clusterBuffer.buffer;
+  clustersInfo.offset = 0;
+  clustersInfo.range = VK_WHOLE_SIZE;
+
+  VkDescriptorBufferInfo shadowUboInfo = {};
+  shadowUboInfo.buffer = _shadowUniformBuffer.buffer;
+  shadowUboInfo.offset = 0;
+  shadowUboInfo.range = sizeof(shadowUbo);
+
+  VkDescriptorImageInfo cascadeShadowInfo = {};
+  cascadeShadowInfo.imageLayout =
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+  cascadeShadowInfo.imageView = _cascadeShadowMap.view;
+  cascadeShadowInfo.sampler = _shadowSampler;
+
+  VkDescriptorImageInfo pointShadowInfo = cascadeShadowInfo;
+  pointShadowInfo.imageView = _pointShadowMap.view;
+
+  std::array<VkWriteDescriptorSet, 9> descriptorWrites = {};
+
+  descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrites[0].dstSet = descriptorSet;
+  descriptorWrites[0].dstBinding = 0;
+  descriptorWrites[0].dstArrayElement = 0;
+  descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+  descriptorWrites[0].descriptorCount = 1;
+  descriptorWrites[0].pImageInfo = &inputInfo1;
+
+  descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrites[1].dstSet = descriptorSet;
+  descriptorWrites[1].dstBinding = 1;
+  descriptorWrites[1].dstArrayElement = 0;
+  descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+  descriptorWrites[1].descriptorCount = 1;
+  descriptorWrites[1].pImageInfo = &inputInfo2;
+
+  descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrites[2].dstSet = descriptorSet;
+  descriptorWrites[2].dstBinding = 2;
+  descriptorWrites[2].dstArrayElement = 0;
+  descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+  descriptorWrites[2].descriptorCount = 1;
+  descriptorWrites[2].pImageInfo = &inputInfo3;
+
+  descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrites[3].dstSet = descriptorSet;
+  descriptorWrites[3].dstBinding = 3;
+  descriptorWrites[3].dstArrayElement = 0;
+  descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  descriptorWrites[3].descriptorCount = 1;
+  descriptorWrites[3].pBufferInfo = &uboInfo;
+
+  descriptorWrites[4].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrites[4].dstSet = descriptorSet;
+  descriptorWrites[4].dstBinding = 4;
+  descriptorWrites[4].dstArrayElement = 0;
+  descriptorWrites[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  descriptorWrites[4].descriptorCount = 1;
+  descriptorWrites[4].pBufferInfo = &lightsInfo;
+
+  descriptorWrites[5].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrites[5].dstSet = descriptorSet;
+  descriptorWrites[5].dstBinding = 5;
+  descriptorWrites[5].dstArrayElement = 0;
+  descriptorWrites[5].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  descriptorWrites[5].descriptorCount = 1;
+  descriptorWrites[5].pBufferInfo = &clustersInfo;
+
+  descriptorWrites[6].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrites[6].dstSet = descriptorSet;
+  descriptorWrites[6].dstBinding = 6;
+  descriptorWrites[6].dstArrayElement = 0;
+  descriptorWrites[6].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  descriptorWrites[6].descriptorCount = 1;
+  descriptorWrites[6].pBufferInfo = &shadowUboInfo;
+
+  descriptorWrites[7].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrites[7].dstSet = descriptorSet;
+  descriptorWrites[7].dstBinding = 7;
+  descriptorWrites[7].dstArrayElement = 0;
+  descriptorWrites[7].descriptorType =
+      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  descriptorWrites[7].descriptorCount = 1;
+  descriptorWrites[7].pImageInfo = &cascadeShadowInfo;
+
+  descriptorWrites[8].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrites[8].dstSet = descriptorSet;
+  descriptorWrites[8].dstBinding = 8;
+  descriptorWrites[8].dstArrayElement = 0;
+  descriptorWrites[8].descriptorType =
+      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  descriptorWrites[8].descriptorCount = 1;
+  descriptorWrites[8].pImageInfo = &pointShadowInfo;
+
+  vkUpdateDescriptorSets(_device,
+                         static_cast<uint32_t>(descriptorWrites.size()),
+                         descriptorWrites.data(), 0, nullptr);
+  return descriptorSet;
+}
+
+VkDescriptorPool VkBackend::createClusterDescriptorPool(uint32_t poolSize) {
+  VkDescriptorPool descriptorPool = {};
+  std::array<VkDescriptorPoolSize, 2> poolSizes = {};
+  poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  poolSizes[0].descriptorCount = poolSize;
+
+  poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  poolSizes[1].descriptorCount = 2 * poolSize;
+
+  VkDescriptorPoolCreateInfo poolInfo = {};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+  poolInfo.pPoolSizes = poolSizes.data();
+  poolInfo.maxSets = poolSize;
+
+  VkResult result =
+      vkCreateDescriptorPool(_device, &poolInfo, nullptr, &descriptorPool);
+  vkCheckResult(result, "vkCreateDescriptorPool");
+  return descriptorPool;
+}
+
+VkDescriptorSet VkBackend::createClusterDescriptorSet(
+    VkDescriptorPool descriptorPool,
+    VkDescriptorSetLayout descriptorSetLayout) {
+  VkDescriptorSet descriptorSet;
+  VkDescriptorSetLayout layouts[] = {descriptorSetLayout};
+
+  VkDescriptorSetAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = layouts;
+
+  VkResult result =
+      vkAllocateDescriptorSets(_device, &allocInfo, &descriptorSet);
+  vkCheckResult(result, "vkAllocateDescriptorSets");
+
+  VkDescriptorBufferInfo uboInfo = {};
+  uboInfo.buffer = _lightUniformBuffer.buffer;
+  uboInfo.offset = 0;
+  uboInfo.range = sizeof(lightUbo);
+
+  VkDescriptorBufferInfo lightsInfo = {};
+  lightsInfo.buffer = _lightStorageBuffer.buffer;
+  lightsInfo.offset = 0;
+  lightsInfo.range = VK_WHOLE_SIZE;
+
+  VkDescriptorBufferInfo clustersInfo = {};
+  clustersInfo.buffer = _clusterBuffer.buffer;
+  clustersInfo.offset = 0;
+  clustersInfo.range = VK_WHOLE_SIZE;
+
+  std::array<VkWriteDescriptorSet, 3> descriptorWrites = {};
+
+  descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrites[0].dstSet = descriptorSet;
+  descriptorWrites[0].dstBinding = 0;
+  descriptorWrites[0].dstArrayElement = 0;
+  descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  descriptorWrites[0].descriptorCount = 1;
+  descriptorWrites[0].pBufferInfo = &uboInfo;
+
+  descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrites[1].dstSet = descriptorSet;
+  descriptorWrites[1].dstBinding = 1;
+  descriptorWrites[1].dstArrayElement = 0;
+  descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  descriptorWrites[1].descriptorCount = 1;
+  descriptorWrites[1].pBufferInfo = &lightsInfo;
+
+  descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrites[2].dstSet = descriptorSet;
+  descriptorWrites[2].dstBinding = 2;
+  descriptorWrites[2].dstArrayElement = 0;
+  descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  descriptorWrites[2].descriptorCount = 1;
+  descriptorWrites[2].pBufferInfo = &clustersInfo;
+
+  vkUpdateDescriptorSets(_device,
+                         static_cast<uint32_t>(descriptorWrites.size()),
+                         descriptorWrites.data(), 0, nullptr);
+  return descriptorSet;
+}
+
+void VkBackend::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
+                             VkMemoryPropertyFlags properties, VkBuffer &buffer,
+                             VkDeviceMemory &bufferMemory) {
+  VkBufferCreateInfo bufferInfo = {};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = size;
+  bufferInfo.usage = usage;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  VkResult result = vkCreateBuffer(_device, &bufferInfo, nullptr, &buffer);
+  vkCheckResult(result, "vkCreateBuffer");
+
+  VkMemoryRequirements memRequirements;
+  vkGetBufferMemoryRequirements(_device, buffer, &memRequirements);
+
+  VkMemoryAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.allocationSize = memRequirements.size;
+  allocInfo.memoryTypeIndex = findMemoryType(
+      _physicalDevice, memRequirements.memoryTypeBits, properties);
+
+  vkAllocateMemory(_device, &allocInfo, nullptr, &bufferMemory);
+  vkCheckResult(result, "vkAllocateMemory");
+
+  vkBindBufferMemory(_device, buffer, bufferMemory, 0);
+}
+
+void VkBackend::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer,
+                           VkDeviceSize size) {
+  VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+
+  VkBufferCopy copyRegion = {};
+  copyRegion.size = size;
+  vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+
+  endSingleTimeCommands(commandBuffer);
+}
+
+VkCommandBuffer VkBackend::beginSingleTimeCommands() {
+  VkCommandBufferAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocInfo.commandPool = _commandPool;
+  allocInfo.commandBufferCount = 1;
+
+  VkCommandBuffer commandBuffer;
+  vkAllocateCommandBuffers(_device, &allocInfo, &commandBuffer);
+
+  VkCommandBufferBeginInfo beginInfo = {};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+  vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+  return commandBuffer;
+}
+
+void VkBackend::endSingleTimeCommands(VkCommandBuffer commandBuffer) {
+  vkEndCommandBuffer(commandBuffer);
+
+  VkSubmitInfo submitInfo = {};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &commandBuffer;
+
+  vkQueueSubmit(_graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+  vkQueueWaitIdle(_graphicsQueue);
+
+  vkFreeCommandBuffers(_device, _commandPool, 1, &commandBuffer);
+}
+
+void VkBackend::transitionImageLayout(VkImage image, VkFormat format,
+                                      VkImageLayout oldLayout,
+                                      VkImageLayout newLayout) {
+  VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+
+  VkImageMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.oldLayout = oldLayout;
+  barrier.newLayout = newLayout;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    if (hasStencilComponent(format)) {
+      barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+    }
+  } else {
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  }
+  barrier.subresourceRange.baseMipLevel = 0;
+  barrier.subresourceRange.levelCount = 1;
+  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.layerCount = 1;
+
+  if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED &&
+      newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  } else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL &&
+             newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  } else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED &&
+             newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  } else {
+    throw std::invalid_argument("unsupported layout transition!");
+  }
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                       VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
+  endSingleTimeCommands(commandBuffer);
+}
+
+void VkBackend::copyBufferToImage(VkBuffer buffer, VkImage image,
+                                  uint32_t width, uint32_t height) {
+  VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+
+  VkBufferImageCopy region = {};
+  region.bufferOffset = 0;
+  region.bufferRowLength = 0;
+  region.bufferImageHeight = 0;
+
+  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.mipLevel = 0;
+  region.imageSubresource.baseArrayLayer = 0;
+  region.imageSubresource.layerCount = 1;
+
+  region.imageOffset = {0, 0, 0};
+  region.imageExtent = {width, height, 1};
+  vkCmdCopyBufferToImage(commandBuffer, buffer, image,
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+  endSingleTimeCommands(commandBuffer);
+}
+
+VkDescriptorPool VkBackend::createDrawCullDescriptorPool(uint32_t poolSize) {
+  VkDescriptorPool descriptorPool = {};
+  std::array<VkDescriptorPoolSize, 3> poolSizes = {};
+  poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  poolSizes[0].descriptorCount = poolSize;
+
+  poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  poolSizes[1].descriptorCount = 5 * poolSize;
+
+  poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  poolSizes[2].descriptorCount = poolSize;
+
+  VkDescriptorPoolCreateInfo poolInfo = {};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+  poolInfo.pPoolSizes = poolSizes.data();
+  poolInfo.maxSets = poolSize;
+
+  VkResult result =
+      vkCreateDescriptorPool(_device, &poolInfo, nullptr, &descriptorPool);
+  vkCheckResult(result, "vkCreateDescriptorPool");
+  return descriptorPool;
+}
+
+// phaseSlot selects the uniforms of the single pass / first phase (0) or of
+// the second occlusion phase (1)
+VkDescriptorSet VkBackend::createDrawCullDescriptorSet(
+    VkDescriptorPool descriptorPool, VkDescriptorSetLayout descriptorSetLayout,
+    uint32_t phaseSlot) {
+  VkDescriptorSet descriptorSet;
+  VkDescriptorSetLayout layouts[] = {descriptorSetLayout};
+
+  VkDescriptorSetAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = layouts;
+
+  VkResult result =
+      vkAllocateDescriptorSets(_device, &allocInfo, &descriptorSet);
+  vkCheckResult(result, "vkAllocateDescriptorSets");
+
+  // Binding 5 is the Hi-Z pyramid, its buffer info is unused
+  std::array<VkDescriptorBufferInfo, 7> bufferInfos = {};
+  bufferInfos[0].buffer = _drawCullUniformBuffer.buffer;
+  bufferInfos[0].offset = phaseSlot * _drawCullUboStride;
+  bufferInfos[0].range = sizeof(drawCullUbo);
+  bufferInfos[1].buffer = _drawDataBuffer.buffer;
+  bufferInfos[1].range = VK_WHOLE_SIZE;
+  bufferInfos[2].buffer = _drawCommandBuffer.buffer;
+  bufferInfos[2].range = VK_WHOLE_SIZE;
+  bufferInfos[3].buffer = _drawCountBuffer.buffer;
+  bufferInfos[3].range = VK_WHOLE_SIZE;
+  bufferInfos[4].buffer = _drawVisibilityBuffer.buffer;
+  bufferInfos[4].range = VK_WHOLE_SIZE;
+  bufferInfos[6].buffer = _instanceBuffer.buffer;
+  bufferInfos[6].range = VK_WHOLE_SIZE;
+
+  VkDescriptorImageInfo hiZInfo = {};
+  hiZInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+  hiZInfo.imageView = _hiZ.view;
+  hiZInfo.sampler = _hiZ.sampler;
+
+  std::array<VkWriteDescriptorSet, 7> descriptorWrites = {};
+  for (uint32_t i = 0; i < descriptorWrites.size(); i++) {
+    descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[i].dstSet = descriptorSet;
+    descriptorWrites[i].dstBinding = i;
+    descriptorWrites[i].dstArrayElement = 0;
+    descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorWrites[i].descriptorCount = 1;
+    descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+  }
+  descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  descriptorWrites[5].descriptorType =
+      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  descriptorWrites[5].pBufferInfo = nullptr;
+  descriptorWrites[5].pImageInfo = &hiZInfo;
+
+  vkUpdateDescriptorSets(_device,
+                         static_cast<uint32_t>(descriptorWrites.size()),
+                         descriptorWrites.data(), 0, nullptr);
+  return descriptorSet;
+}
+
+VkDescriptorPool VkBackend::createHiZDescriptorPool(uint32_t poolSize) {
+  VkDescriptorPool descriptorPool = {};
+  std::array<VkDescriptorPoolSize, 2> poolSizes = {};
+  poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  poolSizes[0].descriptorCount = poolSize;
+
+  poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  poolSizes[1].descriptorCount = poolSize;
+
+  VkDescriptorPoolCreateInfo poolInfo = {};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+  poolInfo.pPoolSizes = poolSizes.data();
+  poolInfo.maxSets = poolSize;
+
+  VkResult result =
+      vkCreateDescriptorPool(_device, &poolInfo, nullptr, &descriptorPool);
+  vkCheckResult(result, "vkCreateDescriptorPool");
+  return descriptorPool;
+}
+
+// Reduction of one pyramid level, from the depth buffer for level 0
+VkDescriptorSet VkBackend::createHiZDescriptorSet(
+    VkDescriptorPool descriptorPool, VkDescriptorSetLayout descriptorSetLayout,
+    uint32_t level) {
+  VkDescriptorSet descriptorSet;
+  VkDescriptorSetLayout layouts[] = {descriptorSetLayout};
+
+  VkDescriptorSetAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = layouts;
+
+  VkResult result =
+      vkAllocateDescriptorSets(_device, &allocInfo, &descriptorSet);
+  vkCheckResult(result, "vkAllocateDescriptorSets");
+
+  VkDescriptorImageInfo sourceInfo = {};
+  sourceInfo.sampler = _hiZ.sampler;
+  if (level == 0) {
+    sourceInfo.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    sourceInfo.imageView = _depth.imageView;
+  } else {
+    sourceInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    sourceInfo.imageView = _hiZ.levelViews[level - 1];
+  }
+
+  VkDescriptorImageInfo destinationInfo = {};
+  destinationInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+  destinationInfo.imageView = _hiZ.levelViews[level];
+
+  std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+
+  descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrites[0].dstSet = descriptorSet;
+  descriptorWrites[0].dstBinding = 0;
+  descriptorWrites[0].dstArrayElement = 0;
+  descriptorWrites[0].descriptorType =
+      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  descriptorWrites[0].descriptorCount = 1;
+  descriptorWrites[0].pImageInfo = &sourceInfo;
+
+  descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrites[1].dstSet = descriptorSet;
+  descriptorWrites[1].dstBinding = 1;
+  descriptorWrites[1].dstArrayElement = 0;
+  descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  descriptorWrites[1].descriptorCount = 1;
+  descriptorWrites[1].pImageInfo = &destinationInfo;
+
+  vkUpdateDescriptorSets(_device,
+                         static_cast<uint32_t>(descriptorWrites.size()),
+                         descriptorWrites.data(), 0, nullptr);
+  return descriptorSet;
+}
+
+VkDescriptorPool VkBackend::createUpscaleDescriptorPool(uint32_t poolSize) {
+  VkDescriptorPool descriptorPool = {};
+  std::array<VkDescriptorPoolSize, 2> poolSizes = {};
+  poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  poolSizes[0].descriptorCount = poolSize;
+
+  poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  poolSizes[1].descriptorCount = poolSize;
+
+  VkDescriptorPoolCreateInfo poolInfo = {};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+  poolInfo.pPoolSizes = poolSizes.data();
+  poolInfo.maxSets = poolSize;
+
+  VkResult result =
+      vkCreateDescriptorPool(_device, &poolInfo, nullptr, &descriptorPool);
+  vkCheckResult(result, "vkCreateDescriptorPool");
+  return descriptorPool;
+}
+
+VkDescriptorSet VkBackend::createUpscaleDescriptorSet(
+    VkDescriptorPool descriptorPool,
+    VkDescriptorSetLayout descriptorSetLayout) {
+  VkDescriptorSet descriptorSet;
+  VkDescriptorSetLayout layouts[] = {descriptorSetLayout};
+
+  VkDescriptorSetAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = layouts;
+
+  VkResult result =
+      vkAllocateDescriptorSets(_device, &allocInfo, &descriptorSet);
+  vkCheckResult(result, "vkAllocateDescriptorSets");
+
+  VkDescriptorImageInfo sceneColorInfo = {};
+  sceneColorInfo.sampler = _sceneColorSampler;
+  sceneColorInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  sceneColorInfo.imageView = _sceneColor.imageView;
+
+  VkDescriptorBufferInfo bufferInfo = {};
+  bufferInfo.buffer = _upscaleUniformBuffer.buffer;
+  bufferInfo.offset = 0;
+  bufferInfo.range = sizeof(upscaleUbo);
+
+  std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+
+  descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrites[0].dstSet = descriptorSet;
+  descriptorWrites[0].dstBinding = 0;
+  descriptorWrites[0].dstArrayElement = 0;
+  descriptorWrites[0].descriptorType =
+      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  descriptorWrites[0].descriptorCount = 1;
+  descriptorWrites[0].pImageInfo = &sceneColorInfo;
+
+  descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrites[1].dstSet = descriptorSet;
+  descriptorWrites[1].dstBinding = 1;
+  descriptorWrites[1].dstArrayElement = 0;
+  descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  descriptorWrites[1].descriptorCount = 1;
+  descriptorWrites[1].pBufferInfo = &bufferInfo;
+
+  vkUpdateDescriptorSets(_device,
+                         static_cast<uint32_t>(descriptorWrites.size()),
+                         descriptorWrites.data(), 0, nullptr);
+  return descriptorSet;
+}
+
+VkDescriptorPool VkBackend::createPerDrawDescriptorPool(uint32_t poolSize) {
+  VkDescriptorPool descriptorPool = {};
+  VkDescriptorPoolSize dynamicPoolSize = {};
+  dynamicPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  dynamicPoolSize.descriptorCount = poolSize;
+
+  VkDescriptorPoolCreateInfo poolInfo = {};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &dynamicPoolSize;
+  poolInfo.maxSets = poolSize;
+
+  VkResult result =
+      vkCreateDescriptorPool(_device, &poolInfo, nullptr, &descriptorPool);
+  vkCheckResult(result, "vkCreateDescriptorPool");
+  return descriptorPool;
+}
+
+VkDescriptorSet VkBackend::createPerDrawDescriptorSet(
+    VkDescriptorPool descriptorPool,
+    VkDescriptorSetLayout descriptorSetLayout) {
+  VkDescriptorSet descriptorSet;
+  VkDescriptorSetLayout layouts[] = {descriptorSetLayout};
+
+  VkDescriptorSetAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = layouts;
+
+  VkResult result =
+      vkAllocateDescriptorSets(_device, &allocInfo, &descriptorSet);
+  vkCheckResult(result, "vkAllocateDescriptorSets");
+  writePerDrawDescriptor(descriptorSet);
+  return descriptorSet;
+}
+
+void VkBackend::writePerDrawDescriptor(VkDescriptorSet descriptorSet) {
+  VkDescriptorBufferInfo bufferInfo = {};
+  bufferInfo.buffer = _perDrawBuffer.buffer;
+  bufferInfo.offset = 0;
+  bufferInfo.range = sizeof(gPassPerDraw);
+
+  VkWriteDescriptorSet descriptorWrite = {};
+  descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrite.dstSet = descriptorSet;
+  descriptorWrite.dstBinding = 0;
+  descriptorWrite.dstArrayElement = 0;
+  descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  descriptorWrite.descriptorCount = 1;
+  descriptorWrite.pBufferInfo = &bufferInfo;
+  vkUpdateDescriptorSets(_device, 1, &descriptorWrite, 0, nullptr);
+}
+
+// One per frame in flight, recorded for whichever image it renders to
+void VkBackend::createCommandBuffers() {
+  std::vector<VkCommandBuffer> commandBuffers(_frames.size());
+  VkCommandBufferAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocInfo.commandPool = _commandPool;
+  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+  VkResult result =
+      vkAllocateCommandBuffers(_device, &allocInfo, commandBuffers.data());
+  vkCheckResult(result, "vkAllocateCommandBuffers");
+  for (size_t i = 0; i < _frames.size(); i++) {
+    _frames[i].commandBuffer = commandBuffers[i];
+  }
+}
+
+// Window-space depth range covered by a light's sphere, false when the
+// sphere is entirely behind the camera
+static bool lightDepthBounds(const glm::vec3 &position, float range,
+                             const glm::mat4 &view, const glm::mat4 &proj,
+                             float &minDepth, float &maxDepth) {
+  // Lights are stored in the y-flipped G-buffer space
+  glm::vec4 center =
+      view * glm::vec4(position.x, -position.y, position.z, 1.0f);
+  float nearest = -center.z - range;
+  float farthest = -center.z + range;
+  if (farthest <= 0.0f) return false;
+
+  auto depth = [&proj](float viewDepth) {
+    glm::vec4 clip = proj * glm::vec4(0.0f, 0.0f, -viewDepth, 1.0f);
+    return glm::clamp(clip.z / clip.w, 0.0f, 1.0f);
+  };
+  minDepth = nearest > 0.0f ? depth(nearest) : 0.0f;
+  maxDepth = depth(farthest);
+  return true;
+}
+
+void VkBackend::recordCommandBuffer(uint32_t imageIndex) {
+  auto recordStart = std::chrono::high_resolution_clock::now();
+  VkCommandBuffer commandBuffer = _frames[_currentFrame].commandBuffer;
+
+  // Swapchain image (or scene color) and G-buffer, then depth
+  std::vector<VkClearValue> clearValues(_gBufferAttachments.size() + 2);
+  for (size_t i = 0; i + 1 < clearValues.size(); i++) {
+    clearValues[i].color = {0.0f, 0.0f, 0.0f, 0.0f};
+  }
+  clearValues.back().depthStencil = {1.0f, 0};
+
+  VkCommandBufferBeginInfo beginInfo = {};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  beginInfo.pInheritanceInfo = nullptr;
+
+  VkRenderPassBeginInfo renderPassInfo = {};
+  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+  renderPassInfo.renderPass = _renderPass;
+  renderPassInfo.framebuffer = _swapChainFramebuffers[imageIndex];
+  renderPassInfo.renderArea.offset = {0, 0};
+  renderPassInfo.renderArea.extent = _renderExtent;
+
+  renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+  renderPassInfo.pClearValues = clearValues.data();
+
+  // Implicitly resets the command buffer, the fence wait in drawFrame
+  // guarantees it is no longer executing
+  VkResult result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+  vkCheckResult(result, "vkBeginCommandBuffer");
+  recordUploads(commandBuffer);
+  // The frame time read back, frameLatency() frames old, picks the scale
+  // of the next update()
+  if (_gpuProfiler.collect() && _settings.dynamicResolution) {
+    _resolutionController.update(
+        _gpuProfiler.stats(static_cast<uint32_t>(GpuScope::Frame)).last());
+  }
+  _gpuProfiler.beginFrame(commandBuffer);
+  _gpuProfiler.begin(commandBuffer, static_cast<uint32_t>(GpuScope::Frame));
+  _bindStats.draws = 0;
+  _bindStats.pipelineRequests = 0;
+  _bindStats.pipelineBinds = 0;
+  _bindStats.descriptorRequests = 0;
+  _bindStats.descriptorBinds = 0;
+  _bindStats.indirectDraws = 0;
+  _bindStats.indirectDescriptorBinds = 0;
+  _bindStats.perDrawUpdates = 0;
+  _bindStats.indexBinds = 0;
+  _boundIndexType = VK_INDEX_TYPE_MAX_ENUM;
+
+  if (_settings.lightingMode == LightingMode::Clustered) {
+    // Bin the lights into froxels before the light subpass reads them
+    _gpuProfiler.begin(commandBuffer,
+                       static_cast<uint32_t>(GpuScope::LightClustering));
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      _clusterPipeline.pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            _clusterPipeline.layout, 0, 1,
+                            &_clusterPipeline.descriptorSets[0], 0, nullptr);
+    vkCmdDispatch(commandBuffer,
+                  (CLUSTER_COUNT + CLUSTER_CULL_GROUP_SIZE - 1) /
+                      CLUSTER_CULL_GROUP_SIZE,
+                  1, 1);
+    _gpuProfiler.end(commandBuffer,
+                     static_cast<uint32_t>(GpuScope::LightClustering));
+
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = _clusterBuffer.buffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr,
+                         1, &barrier, 0, nullptr);
+  }
+  if (!_shadowLayers.empty()) recordShadowPasses(commandBuffer);
+
+  // Both streams for the G-pass, the position stream alone for the
+  // position-only passes
+  VkDeviceSize offsets[] = {0, 0};
+  VkBuffer buffers[] = {_positionBuffer.buffer, _attributeBuffer.buffer};
+  const bool twoPhase = _settings.cullingMode == CullingMode::GpuOcclusion;
+  if (_settings.cullingMode == CullingMode::Gpu) {
+    recordDrawCulling(commandBuffer, 0);
+  } else if (twoPhase) {
+    // First phase in its own render pass, its depth refines the pyramid
+    // the second phase tests against
+    recordDrawCulling(commandBuffer, 1);
+
+    std::vector<VkClearValue> earlyClearValues(clearValues.begin() + 1,
+                                               clearValues.end());
+    VkRenderPassBeginInfo earlyPassInfo = renderPassInfo;
+    earlyPassInfo.renderPass = _earlyRenderPass;
+    earlyPassInfo.framebuffer = _earlyFramebuffer;
+    earlyPassInfo.clearValueCount =
+        static_cast<uint32_t>(earlyClearValues.size());
+    earlyPassInfo.pClearValues = earlyClearValues.data();
+    vkCmdBeginRenderPass(commandBuffer, &earlyPassInfo,
+                         VK_SUBPASS_CONTENTS_INLINE);
+    setRenderViewport(commandBuffer);
+    _gpuProfiler.begin(commandBuffer, static_cast<uint32_t>(GpuScope::GPass));
+    _gpuProfiler.beginStatistics(commandBuffer,
+                                 static_cast<uint32_t>(GpuScope::GPass));
+    vkCmdBindVertexBuffers(commandBuffer, 0, 2, buffers, offsets);
+    recordGPassDraws(commandBuffer, 0, _earlyGPassPipeline.pipeline);
+    _gpuProfiler.endStatistics(commandBuffer,
+                               static_cast<uint32_t>(GpuScope::GPass));
+    _gpuProfiler.end(commandBuffer, static_cast<uint32_t>(GpuScope::GPass));
+    vkCmdEndRenderPass(commandBuffer);
+
+    recordHiZBuild(commandBuffer);
+    recordDrawCulling(commandBuffer, 2);
+
+    // The main render pass loads the G-buffer and the depth
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer,
+                         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                             VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                             VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                         0, 1, &barrier, 0, nullptr, 0, nullptr);
+  }
+
+  vkCmdBeginRenderPass(commandBuffer, &renderPassInfo,
+                       VK_SUBPASS_CONTENTS_INLINE);
+  setRenderViewport(commandBuffer);
+  if (_settings.depthPrePass) {
+    // Depth pre-pass subpass, positions only and the matrices of set 0
+    _gpuProfiler.begin(commandBuffer,
+                       static_cast<uint32_t>(GpuScope::DepthPrePass));
+    _gpuProfiler.beginStatistics(
+        commandBuffer, static_cast<uint32_t>(GpuScope::DepthPrePass));
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, buffers, offsets);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            _depthPrePassPipeline.layout, 0, 1,
+                            &_gpassPipeline.descriptorSets[0], 0, nullptr);
+    recordGPassDraws(commandBuffer, twoPhase ? 1 : 0,
+                     _depthPrePassPipeline.pipeline, false);
+    _gpuProfiler.endStatistics(
+        commandBuffer, static_cast<uint32_t>(GpuScope::DepthPrePass));
+    _gpuProfiler.end(commandBuffer,
+                     static_cast<uint32_t>(GpuScope::DepthPrePass));
+    vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
+  }
+  // Gpass subpass
+  _gpuProfiler.begin(commandBuffer, static_cast<uint32_t>(GpuScope::GPass));
+  _gpuProfiler.beginStatistics(commandBuffer,
+                               static_cast<uint32_t>(GpuScope::GPass));
+  vkCmdBindVertexBuffers(commandBuffer, 0, 2, buffers, offsets);
+  recordGPassDraws(commandBuffer, twoPhase ? 1 : 0, _gpassPipeline.pipeline);
+  _gpuProfiler.endStatistics(commandBuffer,
+                             static_cast<uint32_t>(GpuScope::GPass));
+  _gpuProfiler.end(commandBuffer, static_cast<uint32_t>(GpuScope::GPass));
+  // Light subpass
+  vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
+  _gpuProfiler.begin(commandBuffer, static_cast<uint32_t>(GpuScope::Lighting));
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                    _lightPipeline.pipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          _lightPipeline.layout, 0, 1,
+                          &_lightPipeline.descriptorSets[0], 0, nullptr);
+  vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+
+  if (_settings.lightingMode == LightingMode::Volumes) {
+    // Same set layout, the light descriptor set stays bound
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      _lightVolumePipeline.pipeline);
+    for (uint32_t i = 0; i < _lightManager.count(); i++) {
+      float minDepth, maxDepth;
+      if (!lightDepthBounds(_lightManager.position(i), _lightManager.range(i),
+                            _view, _proj, minDepth, maxDepth)) {
+        continue;
+      }
+      if (_depthBoundsSupported) {
+        vkCmdSetDepthBounds(commandBuffer, minDepth, maxDepth);
+      }
+      // firstInstance selects the light
+      vkCmdDraw(commandBuffer, LIGHT_VOLUME_VERTEX_COUNT, 1, 0, i);
+    }
+  }
+  _gpuProfiler.end(commandBuffer, static_cast<uint32_t>(GpuScope::Lighting));
+
+  vkCmdEndRenderPass(commandBuffer);
+  // Pyramid of the final depth for the next frame's first phase
+  if (twoPhase) recordHiZBuild(commandBuffer);
+
+  if (_settings.dynamicResolution) {
+    VkRenderPassBeginInfo upscalePassInfo = {};
+    upscalePassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    upscalePassInfo.renderPass = _upscaleRenderPass;
+    upscalePassInfo.framebuffer = _upscaleFramebuffers[imageIndex];
+    upscalePassInfo.renderArea.offset = {0, 0};
+    upscalePassInfo.renderArea.extent = _swapChainExtent;
+    vkCmdBeginRenderPass(commandBuffer, &upscalePassInfo,
+                         VK_SUBPASS_CONTENTS_INLINE);
+    _gpuProfiler.begin(commandBuffer,
+                       static_cast<uint32_t>(GpuScope::Upscale));
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      _upscalePipeline.pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            _upscalePipeline.layout, 0, 1,
+                            &_upscalePipeline.descriptorSets[0], 0, nullptr);
+    vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+    _gpuProfiler.end(commandBuffer, static_cast<uint32_t>(GpuScope::Upscale));
+    vkCmdEndRenderPass(commandBuffer);
+  }
+  _gpuProfiler.end(commandBuffer, static_cast<uint32_t>(GpuScope::Frame));
+  if (_readbackPending) recordReadback(commandBuffer, imageIndex);
+  if (_settings.cullingMode == CullingMode::Gpu || twoPhase) {
+    recordDrawStatsCopy(commandBuffer);
+  }
+  result = vkEndCommandBuffer(commandBuffer);
+  vkCheckResult(result, "vkEndCommandBuffer");
+  auto recordEnd = std::chrono::high_resolution_clock::now();
+  _bindStats.recordTime.push(
+      std::chrono::duration<double, std::milli>(recordEnd - recordStart)
+          .count());
+}
+
+// The main render pass draws to the top-left render extent of its
+// attachments
+void VkBackend::setRenderViewport(VkCommandBuffer commandBuffer) {
+  VkViewport viewport = {};
+  viewport.x = 0.0f;
+  viewport.y = 0.0f;
+  viewport.width = (float)_renderExtent.width;
+  viewport.height = (float)_renderExtent.height;
+  viewport.minDepth = 0.0f;
+  viewport.maxDepth = 1.0f;
+  vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+  VkRect2D scissor = {};
+  scissor.offset = {0, 0};
+  scissor.extent = _renderExtent;
+  vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+}
+
+// Writes one indirect command per draw item for a culling phase (0: single
+// pass), visible to the G-pass indirect draws, the statistics to the host
+// through the frame's copy. Counts and statistics are cleared before the
+// first phase.
+void VkBackend::recordDrawCulling(VkCommandBuffer commandBuffer,
+                                  uint32_t phase) {
+  _gpuProfiler.begin(commandBuffer,
+                     static_cast<uint32_t>(GpuScope::DrawCulling));
+  if (phase < 2) {
+    vkCmdFillBuffer(commandBuffer, _drawCountBuffer.buffer, 0, VK_WHOLE_SIZE,
+                    0);
+
+    VkBufferMemoryBarrier clearBarrier = {};
+    clearBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    clearBarrier.dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    clearBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    clearBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    clearBarrier.buffer = _drawCountBuffer.buffer;
+    clearBarrier.offset = 0;
+    clearBarrier.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr,
+                         1, &clearBarrier, 0, nullptr);
+  }
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    _drawCullPipeline.pipeline);
+  vkCmdBindDescriptorSets(
+      commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _drawCullPipeline.layout,
+      0, 1, &_drawCullPipeline.descriptorSets[phase == 2 ? 1 : 0], 0, nullptr);
+  vkCmdDispatch(commandBuffer,
+                (_gpuDrawCount + DRAW_CULL_GROUP_SIZE - 1) /
+                    DRAW_CULL_GROUP_SIZE,
+                1, 1);
+
+  std::array<VkBufferMemoryBarrier, 2> barriers = {};
+  for (auto &barrier : barriers) {
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT |
+                            VK_ACCESS_SHADER_READ_BIT |
+                            VK_ACCESS_SHADER_WRITE_BIT |
+                            VK_ACCESS_HOST_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+  }
+  barriers[0].buffer = _drawCommandBuffer.buffer;
+  barriers[1].buffer = _drawCountBuffer.buffer;
+  // The second phase also reads the counts and visibility of the first
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                           VK_PIPELINE_STAGE_HOST_BIT,
+                       0, 0, nullptr, static_cast<uint32_t>(barriers.size()),
+                       barriers.data(), 0, nullptr);
+  _gpuProfiler.end(commandBuffer,
+                   static_cast<uint32_t>(GpuScope::DrawCulling));
+}
+
+// Max-reduces the depth buffer into the pyramid, one dispatch per level
+void VkBackend::recordHiZBuild(VkCommandBuffer commandBuffer) {
+  _gpuProfiler.begin(commandBuffer, static_cast<uint32_t>(GpuScope::HiZ));
+  VkFormat depthFormat = findDepthFormat(_physicalDevice);
+  VkImageMemoryBarrier depthBarrier = {};
+  depthBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  depthBarrier.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  depthBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  depthBarrier.oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+  depthBarrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+  depthBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  depthBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  depthBarrier.image = _depth.image;
+  depthBarrier.subresourceRange = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1};
+  if (hasStencilComponent(depthFormat)) {
+    depthBarrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+  }
+  // Also orders the pyramid writes after the culling passes reading it
+  vkCmdPipelineBarrier(commandBuffer,
+                       VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT |
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &depthBarrier);
+
+  VkImageMemoryBarrier levelBarrier = {};
+  levelBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  levelBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+  levelBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+  levelBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  levelBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  levelBarrier.image = _hiZ.image;
+  levelBarrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    _hiZPipeline.pipeline);
+  for (uint32_t level = 0; level < _hiZ.levelCount; level++) {
+    uint32_t width = std::max(_hiZ.width >> level, 1u);
+    uint32_t height = std::max(_hiZ.height >> level, 1u);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            _hiZPipeline.layout, 0, 1,
+                            &_hiZPipeline.descriptorSets[level], 0, nullptr);
+    vkCmdDispatch(commandBuffer,
+                  (width + HIZ_REDUCE_GROUP_SIZE - 1) / HIZ_REDUCE_GROUP_SIZE,
+                  (height + HIZ_REDUCE_GROUP_SIZE - 1) / HIZ_REDUCE_GROUP_SIZE,
+                  1);
+    levelBarrier.subresourceRange.baseMipLevel = level;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr,
+                         0, nullptr, 1, &levelBarrier);
+  }
+  _gpuProfiler.end(commandBuffer, static_cast<uint32_t>(GpuScope::HiZ));
+}
+
+// Renders the layers scheduled by updateShadows(), each in its own instance
+// of the shadow render pass. Consecutive layers of a pass (a cascade or a
+// point light's cube) share its GPU scope.
+void VkBackend::recordShadowPasses(VkCommandBuffer commandBuffer) {
+  _gpuProfiler.begin(commandBuffer, static_cast<uint32_t>(GpuScope::Shadows));
+  _gpuProfiler.beginStatistics(commandBuffer,
+                               static_cast<uint32_t>(GpuScope::Shadows));
+  VkClearValue clearValue = {};
+  clearValue.depthStencil = {1.0f, 0};
+  // Buffer and pipeline bindings last across render pass instances
+  VkDeviceSize offsets[] = {0};
+  VkBuffer positionBuffers[] = {_positionBuffer.buffer};
+  vkCmdBindVertexBuffers(commandBuffer, 0, 1, positionBuffers, offsets);
+  const std::vector<RenderCommand> &commands = _shadowQueue.commands();
+  size_t next = 0;
+  const uint32_t noPass = std::numeric_limits<uint32_t>::max();
+  uint32_t openPass = noPass;
+  uint32_t boundPipeline = noPass;
+  for (uint32_t i = 0; i < _shadowLayers.size(); i++) {
+    const uint32_t layer = _shadowLayers[i];
+    const bool cascade = layer < SHADOW_CASCADE_COUNT;
+    const uint32_t pass =
+        cascade ? layer
+                : SHADOW_CASCADE_COUNT +
+                      (layer - SHADOW_CASCADE_COUNT) / POINT_SHADOW_FACES;
+    const uint32_t scope = static_cast<uint32_t>(GpuScope::Count) + pass;
+    if (pass != openPass) {
+      if (openPass != noPass) {
+        _gpuProfiler.end(commandBuffer,
+                         static_cast<uint32_t>(GpuScope::Count) + openPass);
+      }
+      _gpuProfiler.begin(commandBuffer, scope);
+      openPass = pass;
+    }
+
+    const ShadowMap &map = cascade ? _cascadeShadowMap : _pointShadowMap;
+    const uint32_t mapLayer = cascade ? layer : layer - SHADOW_CASCADE_COUNT;
+    VkRenderPassBeginInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassInfo.renderPass = _shadowRenderPass;
+    renderPassInfo.framebuffer = map.framebuffers[mapLayer];
+    renderPassInfo.renderArea.offset = {0, 0};
+    renderPassInfo.renderArea.extent = {map.size, map.size};
+    renderPassInfo.clearValueCount = 1;
+    renderPassInfo.pClearValues = &clearValue;
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo,
+                         VK_SUBPASS_CONTENTS_INLINE);
+
+    // The layer's draws, an empty layer is only cleared. The descriptor
+    // set is bound once per layer for its dynamic offset. Without the
+    // queue, each layer bound its pipeline and set.
+    const Pipeline &pipeline = cascade ? _shadowPipeline : _pointShadowPipeline;
+    bool layerBound = false;
+    _bindStats.pipelineRequests++;
+    _bindStats.descriptorRequests++;
+    for (; next < commands.size() &&
+           RenderQueue::keyPass(commands[next].key) == i;
+         next++) {
+      const uint32_t queuedPipeline =
+          RenderQueue::keyPipeline(commands[next].key);
+      if (queuedPipeline != boundPipeline) {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          pipeline.pipeline);
+        _bindStats.pipelineBinds++;
+        boundPipeline = queuedPipeline;
+      }
+      if (!layerBound) {
+        uint32_t dynamicOffset =
+            static_cast<uint32_t>(layer * _shadowPassStride);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                pipeline.layout, 0, 1,
+                                &_shadowPipeline.descriptorSets[0], 1,
+                                &dynamicOffset);
+        _bindStats.descriptorBinds++;
+        layerBound = true;
+      }
+      recordBatch(commandBuffer, _shadowBatches[commands[next].draw]);
+    }
+    vkCmdEndRenderPass(commandBuffer);
+  }
+  if (openPass != noPass) {
+    _gpuProfiler.end(commandBuffer,
+                     static_cast<uint32_t>(GpuScope::Count) + openPass);
+  }
+  _gpuProfiler.endStatistics(commandBuffer,
+                             static_cast<uint32_t>(GpuScope::Shadows));
+  _gpuProfiler.end(commandBuffer, static_cast<uint32_t>(GpuScope::Shadows));
+}
+
+void VkBackend::bindIndexBuffer(VkCommandBuffer commandBuffer,
+                                VkIndexType indexType) {
+  if (indexType == _boundIndexType) return;
+  vkCmdBindIndexBuffer(
+      commandBuffer, _indexBuffer.buffer,
+      indexType == VK_INDEX_TYPE_UINT16 ? 0 : _wideIndexOffset, indexType);
+  _boundIndexType = indexType;
+  _bindStats.indexBinds++;
+}
+
+void VkBackend::recordBatch(VkCommandBuffer commandBuffer,
+                            const DrawBatch &batch) {
+  const DrawItem &item = _drawItems[batch.draw];
+  bindIndexBuffer(commandBuffer, item.indexType);
+  if (_settings.instancing) {
+    vkCmdDrawIndexed(commandBuffer, item.indexCount, batch.instanceCount,
+                     item.firstIndex, item.vertexOffset, batch.firstInstance);
+    _bindStats.draws++;
+    return;
+  }
+  for (uint32_t i = 0; i < batch.instanceCount; i++) {
+    vkCmdDrawIndexed(commandBuffer, item.indexCount, 1, item.firstIndex,
+                     item.vertexOffset, batch.firstInstance + i);
+  }
+  _bindStats.draws += batch.instanceCount;
+}
+
+// The draws keep their slot as firstInstance, unread by these variants
+void VkBackend::recordPerDrawBatch(VkCommandBuffer commandBuffer,
+                                   const DrawBatch &batch) {
+  const DrawItem &item = _drawItems[batch.draw];
+  const uint32_t firstSlot = batch.firstInstance - _gpuDrawCount;
+  bindIndexBuffer(commandBuffer, item.indexType);
+  for (uint32_t i = 0; i < batch.instanceCount; i++) {
+    if (_settings.perDrawData == PerDrawData::PushConstants) {
+      const InstanceSlot &slot = _instanceIndices[firstSlot + i];
+      gPassPerDraw perDraw = {};
+      perDraw.model = _instances[slot.instance];
+      perDraw.material = slot.material;
+      vkCmdPushConstants(commandBuffer, _gpassPipeline.layout,
+                         VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(gPassPerDraw),
+                         &perDraw);
+    } else {
+      const uint32_t dynamicOffset =
+          static_cast<uint32_t>((firstSlot + i) * _perDrawStride);
+      vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                              _gpassPipeline.layout, 1, 1, &_perDrawSet, 1,
+                              &dynamicOffset);
+    }
+    vkCmdDrawIndexed(commandBuffer, item.indexCount, 1, item.firstIndex,
+                     item.vertexOffset, batch.firstInstance + i);
+  }
+  _bindStats.perDrawUpdates += batch.instanceCount;
+  _bindStats.draws += batch.instanceCount;
+}
+
+// Indices are relative to the sub-mesh's vertexOffset, in the index range
+// of its mesh's width. The batch instances point the vertex shaders at
+// their transforms.
+// phaseSlot picks the command and count ranges written by the single pass /
+// first occlusion phase (0) or by the second phase (1).
+void VkBackend::recordGPassDraws(VkCommandBuffer commandBuffer,
+                                 uint32_t phaseSlot, VkPipeline pipeline,
+                                 bool bindMaterials) {
+  const bool merged = getMergedDrawsActive();
+  // Set 1 is declared by the G-pass shaders whatever the per-draw data,
+  // bound after set 0 which may come from the pre-pass layout. Dynamic
+  // uniform draws bind it again at their own offset.
+  auto bindPerDrawSet = [&]() {
+    const uint32_t dynamicOffset = 0;
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            _gpassPipeline.layout, 1, 1, &_perDrawSet, 1,
+                            &dynamicOffset);
+  };
+  if (_settings.cullingMode != CullingMode::Gpu &&
+      _settings.cullingMode != CullingMode::GpuOcclusion) {
+    // In key order, binding only what changed. The merged set holds every
+    // material, it is bound once. The keys of a G-pass all have the same
+    // pipeline, the one of this call.
+    const uint32_t none = std::numeric_limits<uint32_t>::max();
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      pipeline);
+    uint32_t boundMaterial = none;
+    if (bindMaterials) {
+      // The sets the batches would bind in draw item order
+      uint32_t previous = none;
+      for (const DrawBatch &batch : _visibleBatches) {
+        const uint32_t material = merged ? 0 : _drawItems[batch.draw].mesh;
+        if (material != previous) _bindStats.descriptorRequests++;
+        previous = material;
+      }
+    }
+    for (const RenderCommand &command : _gPassQueue.commands()) {
+      const uint32_t material =
+          merged ? 0 : RenderQueue::keyMaterial(command.key);
+      if (bindMaterials) {
+        if (material != boundMaterial) {
+          const VkDescriptorSet descriptorSet =
+              merged ? _mergedGPassSet
+                     : _gpassPipeline.descriptorSets[material];
+          vkCmdBindDescriptorSets(commandBuffer,
+                                  VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                  _gpassPipeline.layout, 0, 1, &descriptorSet,
+                                  0, nullptr);
+          _bindStats.descriptorBinds++;
+          if (boundMaterial == none) bindPerDrawSet();
+          boundMaterial = material;
+        }
+      }
+      const DrawBatch &batch = _visibleBatches[command.draw];
+      if (bindMaterials &&
+          _settings.perDrawData != PerDrawData::InstanceSlots) {
+        recordPerDrawBatch(commandBuffer, batch);
+      } else {
+        recordBatch(commandBuffer, batch);
+      }
+    }
+    return;
+  }
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+  const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+  const uint32_t meshCount = static_cast<uint32_t>(_meshDrawRanges.size());
+  const uint32_t commandBase = phaseSlot * _gpuDrawCount;
+  const uint32_t countBase = DrawCullStatCount + phaseSlot * meshCount;
+  if (merged) {
+    // The materials come from the draw slots: every command of the phase
+    // in one call per run of meshes of the same index width, split only
+    // past the device's indirect draw count
+    if (bindMaterials) {
+      vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                              _gpassPipeline.layout, 0, 1, &_mergedGPassSet,
+                              0, nullptr);
+      bindPerDrawSet();
+      _bindStats.indirectDescriptorBinds++;
+    }
+    uint32_t runMesh = 0;
+    while (runMesh < meshCount) {
+      const VkIndexType indexType = _meshDrawRanges[runMesh].indexType;
+      const uint32_t runFirst = _meshDrawRanges[runMesh].first;
+      while (runMesh < meshCount &&
+             _meshDrawRanges[runMesh].indexType == indexType) {
+        runMesh++;
+      }
+      const uint32_t runEnd = _meshDrawRanges[runMesh - 1].first +
+                              _meshDrawRanges[runMesh - 1].count;
+      if (runEnd == runFirst) continue;
+      bindIndexBuffer(commandBuffer, indexType);
+      for (uint32_t first = runFirst; first < runEnd;
+           first += _maxDrawIndirectCount) {
+        vkCmdDrawIndexedIndirect(
+            commandBuffer, _drawCommandBuffer.buffer,
+            static_cast<VkDeviceSize>(commandBase + first) * stride,
+            std::min(runEnd - first, _maxDrawIndirectCount), stride);
+        _bindStats.indirectDraws++;
+      }
+    }
+    return;
+  }
+
+  // One indirect draw per mesh over its command range. With the count
+  // extension only the visible commands packed at the front are consumed,
+  // otherwise culled commands have zero instances.
+  bool perDrawBound = false;
+  for (uint32_t meshId = 0; meshId < meshCount; meshId++) {
+    const MeshDrawRange &range = _meshDrawRanges[meshId];
+    if (range.count == 0) continue;
+    if (bindMaterials) {
+      vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                              _gpassPipeline.layout, 0, 1,
+                              &_gpassPipeline.descriptorSets[meshId], 0,
+                              nullptr);
+      if (!perDrawBound) bindPerDrawSet();
+      perDrawBound = true;
+      _bindStats.indirectDescriptorBinds++;
+    }
+    bindIndexBuffer(commandBuffer, range.indexType);
+    VkDeviceSize offset =
+        static_cast<VkDeviceSize>(commandBase + range.first) * stride;
+#ifdef VK_KHR_draw_indirect_count
+    if (_drawIndirectCountSupported) {
+      _cmdDrawIndexedIndirectCount(
+          commandBuffer, _drawCommandBuffer.buffer, offset,
+          _drawCountBuffer.buffer, (countBase + meshId) * sizeof(uint32_t),
+          range.count, stride);
+      _bindStats.indirectDraws++;
+      continue;
+    }
+#endif
+    if (_multiDrawIndirectSupported) {
+      vkCmdDrawIndexedIndirect(commandBuffer, _drawCommandBuffer.buffer,
+                               offset, range.count, stride);
+      _bindStats.indirectDraws++;
+    } else {
+      for (uint32_t i = 0; i < range.count; i++) {
+        vkCmdDrawIndexedIndirect(commandBuffer, _drawCommandBuffer.buffer,
+                                 offset + i * stride, 1, stride);
+      }
+      _bindStats.indirectDraws += range.count;
+    }
+  }
+}
+
+void VkBackend::createFrameResources() {
+  _frames.resize(_settings.framesInFlight);
+  _currentFrame = 0;
+  VkSemaphoreCreateInfo semaphoreInfo = {};
+  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  // Created signaled so the first drawFrame doesn't wait forever
+  VkFenceCreateInfo fenceInfo = {};
+  fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+  for (FrameResources &frame : _frames) {
+    VkResult result = vkCreateSemaphore(_device, &semaphoreInfo, nullptr,
+                                        &frame.imageAvailable);
+    vkCheckResult(result, "vkCreateSemaphore");
+    result = vkCreateSemaphore(_device, &semaphoreInfo, nullptr,
+                               &frame.renderFinished);
+    vkCheckResult(result, "vkCreateSemaphore");
+    result = vkCreateFence(_device, &fenceInfo, nullptr, &frame.inFlight);
+    vkCheckResult(result, "vkCreateFence");
+
+    const VkDeviceSize statsSize = DrawCullStatCount * sizeof(uint32_t);
+    createBuffer(statsSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 frame.drawStats.buffer, frame.drawStats.bufferMemory);
+    vkMapMemory(_device, frame.drawStats.bufferMemory, 0, VK_WHOLE_SIZE, 0,
+                reinterpret_cast<void **>(&frame.mappedDrawStats));
+    memset(frame.mappedDrawStats, 0, statsSize);
+  }
+}
+
+void VkBackend::destroyFrameResources() {
+  for (FrameResources &frame : _frames) {
+    vkDestroySemaphore(_device, frame.renderFinished, nullptr);
+    vkDestroySemaphore(_device, frame.imageAvailable, nullptr);
+    vkDestroyFence(_device, frame.inFlight, nullptr);
+    vkUnmapMemory(_device, frame.drawStats.bufferMemory);
+    vkDestroyBuffer(_device, frame.drawStats.buffer, nullptr);
+    vkFreeMemory(_device, frame.drawStats.bufferMemory, nullptr);
+    if (frame.mappedUpload) {
+      vkUnmapMemory(_device, frame.upload.bufferMemory);
+      frame.retiredUploads.push_back(frame.upload);
+    }
+    for (const Buffer &buffer : frame.retiredUploads) {
+      vkDestroyBuffer(_device, buffer.buffer, nullptr);
+      vkFreeMemory(_device, buffer.bufferMemory, nullptr);
+    }
+  }
+  _frames.clear();
+}
+
+// A frame that was not submitted, its image out of date, keeps the uploads
+// staged so far for the next attempt
+void VkBackend::waitForFrame() {
+  FrameResources &frame = _frames[_currentFrame];
+  vkWaitForFences(_device, 1, &frame.inFlight, VK_TRUE,
+                  std::numeric_limits<uint64_t>::max());
+  if (!frame.submitted) return;
+  frame.submitted = false;
+  frame.uploadSize = 0;
+  frame.copies.clear();
+  for (const Buffer &buffer : frame.retiredUploads) {
+    vkDestroyBuffer(_device, buffer.buffer, nullptr);
+    vkFreeMemory(_device, buffer.bufferMemory, nullptr);
+  }
+  frame.retiredUploads.clear();
+}
+
+void *VkBackend::stageUpload(VkBuffer buffer, VkDeviceSize offset,
+                             VkDeviceSize size) {
+  FrameResources &frame = _frames[_currentFrame];
+  // 16 bytes keep the vec4 and mat4 members of the copies aligned
+  VkDeviceSize begin = (frame.uploadSize + 15) / 16 * 16;
+  if (begin + size > frame.uploadCapacity) {
+    if (frame.mappedUpload) {
+      vkUnmapMemory(_device, frame.upload.bufferMemory);
+      frame.retiredUploads.push_back(frame.upload);
+    }
+    frame.uploadCapacity =
+        std::max<VkDeviceSize>(2 * frame.uploadCapacity, size + 65536);
+    createBuffer(frame.uploadCapacity, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 frame.upload.buffer, frame.upload.bufferMemory);
+    vkMapMemory(_device, frame.upload.bufferMemory, 0, VK_WHOLE_SIZE, 0,
+                reinterpret_cast<void **>(&frame.mappedUpload));
+    begin = 0;
+  }
+  frame.uploadSize = begin + size;
+
+  UploadCopy copy = {};
+  copy.source = frame.upload.buffer;
+  copy.destination = buffer;
+  copy.region.srcOffset = begin;
+  copy.region.dstOffset = offset;
+  copy.region.size = size;
+  frame.copies.push_back(copy);
+  return frame.mappedUpload + begin;
+}
+
+void VkBackend::forgetUploads(VkBuffer buffer) {
+  for (FrameResources &frame : _frames) {
+    frame.copies.erase(
+        std::remove_if(frame.copies.begin(), frame.copies.end(),
+                       [buffer](const UploadCopy &copy) {
+                         return copy.destination == buffer;
+                       }),
+        frame.copies.end());
+  }
+}
+
+static bool uploadsOverlap(const UploadCopy &a, const UploadCopy &b) {
+  return a.destination == b.destination &&
+         a.region.dstOffset < b.region.dstOffset + b.region.size &&
+         b.region.dstOffset < a.region.dstOffset + a.region.size;
+}
+
+// First in the command buffer. The earlier frames may still execute: every
+// pass after the barrier waits for them, which also orders the attachments
+// and GPU-written buffers the frames share.
+void VkBackend::recordUploads(VkCommandBuffer commandBuffer) {
+  VkMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT |
+                          VK_ACCESS_MEMORY_WRITE_BIT;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0,
+                       nullptr, 0, nullptr);
+  const FrameResources &frame = _frames[_currentFrame];
+  if (frame.copies.empty()) return;
+  // A frame staged again after a failed acquire writes some ranges twice,
+  // the later copy must land last
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  std::vector<const UploadCopy *> unordered;
+  for (const UploadCopy &copy : frame.copies) {
+    for (const UploadCopy *previous : unordered) {
+      if (uploadsOverlap(*previous, copy)) {
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier,
+                             0, nullptr, 0, nullptr);
+        unordered.clear();
+        break;
+      }
+    }
+    vkCmdCopyBuffer(commandBuffer, copy.source, copy.destination, 1,
+                    &copy.region);
+    unordered.push_back(&copy);
+  }
+
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_UNIFORM_READ_BIT |
+                          VK_ACCESS_SHADER_READ_BIT |
+                          VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0,
+                       nullptr, 0, nullptr);
+}
+
+// Last in the command buffer, read by the update() that reuses the frame
+void VkBackend::recordDrawStatsCopy(VkCommandBuffer commandBuffer) {
+  VkBufferMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.buffer = _drawCountBuffer.buffer;
+  barrier.offset = 0;
+  barrier.size = VK_WHOLE_SIZE;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1,
+                       &barrier, 0, nullptr);
+
+  const FrameResources &frame = _frames[_currentFrame];
+  VkBufferCopy region = {};
+  region.size = DrawCullStatCount * sizeof(uint32_t);
+  vkCmdCopyBuffer(commandBuffer, _drawCountBuffer.buffer,
+                  frame.drawStats.buffer, 1, &region);
+
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  barrier.buffer = frame.drawStats.buffer;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1,
+                       &barrier, 0, nullptr);
+}
+
+void VkBackend::cleanupSwapChain() {
+  for (size_t i = 0; i < _swapChainFramebuffers.size(); i++) {
+    vkDestroyFramebuffer(_device, _swapChainFramebuffers[i], nullptr);
+  }
+  vkDestroyFramebuffer(_device, _earlyFramebuffer, nullptr);
+  for (VkFramebuffer framebuffer : _upscaleFramebuffers) {
+    vkDestroyFramebuffer(_device, framebuffer, nullptr);
+  }
+
+  for (const FrameResources &frame : _frames) {
+    vkFreeCommandBuffers(_device, _commandPool, 1, &frame.commandBuffer);
+  }
+
+  // The graphics variants outlive the render passes, their keys tell the
+  // compatible ones apart
+  destroyComputePipelines();
+
+  vkDestroyRenderPass(_device, _renderPass, nullptr);
+  vkDestroyRenderPass(_device, _earlyRenderPass, nullptr);
+  vkDestroyRenderPass(_device, _upscaleRenderPass, nullptr);
+
+  vkDestroyImageView(_device, _depth.imageView, nullptr);
+  vkDestroyImage(_device, _depth.image, nullptr);
+  vkFreeMemory(_device, _depth.imageMemory, nullptr);
+
+  for (auto &attachment : _gBufferAttachments) {
+    vkDestroyImageView(_device, attachment.imageView, nullptr);
+    vkDestroyImage(_device, attachment.image, nullptr);
+    vkFreeMemory(_device, attachment.memory, nullptr);
+  }
+  _gBufferAttachments.clear();
+  destroySceneColorResources();
+
+  vkDestroyDescriptorPool(_device, _lightPipeline.descriptorPool, nullptr);
+  _lightPipeline.descriptorSets.clear();
+  vkDestroyDescriptorPool(_device, _clusterPipeline.descriptorPool, nullptr);
+  _clusterPipeline.descriptorSets.clear();
+  vkDestroyDescriptorPool(_device, _drawCullPipeline.descriptorPool, nullptr);
+  _drawCullPipeline.descriptorSets.clear();
+  vkDestroyDescriptorPool(_device, _hiZPipeline.descriptorPool, nullptr);
+  _hiZPipeline.descriptorSets.clear();
+  destroyHiZResources();
+  vkDestroyDescriptorPool(_device, _upscalePipeline.descriptorPool, nullptr);
+  _upscalePipeline.descriptorPool = VK_NULL_HANDLE;
+  _upscalePipeline.descriptorSets.clear();
+
+  for (size_t i = 0; i < _swapChainImageViews.size(); i++) {
+    vkDestroyImageView(_device, _swapChainImageViews[i], nullptr);
+  }
+
+  if (!_settings.headless) {
+    vkDestroySwapchainKHR(_device, _swapChain, nullptr);
+    return;
+  }
+  for (size_t i = 0; i < _swapChainImages.size(); i++) {
+    vkDestroyImage(_device, _swapChainImages[i], nullptr);
+    vkFreeMemory(_device, _offscreenImageMemory[i], nullptr);
+  }
+  if (_mappedReadback) {
+    vkUnmapMemory(_device, _readbackBuffer.bufferMemory);
+    _mappedReadback = nullptr;
+    vkDestroyBuffer(_device, _readbackBuffer.buffer, nullptr);
+    vkFreeMemory(_device, _readbackBuffer.bufferMemory, nullptr);
+  }
+}
+
+void VkBackend::cleanup() {
+  vkDeviceWaitIdle(_device);
+  if (_readbackPending) writeReadback();
+  cleanupSwapChain();
+  destroyGraphicsPipelines();
+
+  for (auto &texture : _diffuseTextures) {
+    vkDestroySampler(_device, texture.sampler, nullptr);
+    vkDestroyImageView(_device, texture.imageView, nullptr);
+    vkDestroyImage(_device, texture.image, nullptr);
+    vkFreeMemory(_device, texture.imageMemory, nullptr);
+  }
+  for (auto &texture : _specularTextures) {
+    vkDestroySampler(_device, texture.sampler, nullptr);
+    vkDestroyImageView(_device, texture.imageView, nullptr);
+    vkDestroyImage(_device, texture.image, nullptr);
+    vkFreeMemory(_device, texture.imageMemory, nullptr);
+  }
+  for (auto &texture : _normalTextures) {
+    vkDestroySampler(_device, texture.sampler, nullptr);
+    vkDestroyImageView(_device, texture.imageView, nullptr);
+    vkDestroyImage(_device, texture.image, nullptr);
+    vkFreeMemory(_device, texture.imageMemory, nullptr);
+  }
+
+  vkDestroyDescriptorPool(_device, _perDrawPool, nullptr);
+  vkDestroyDescriptorSetLayout(_device, _perDrawSetLayout, nullptr);
+  destroyPerDrawBuffer();
+  vkDestroyDescriptorPool(_device, _mergedGPassPool, nullptr);
+  vkDestroyDescriptorSetLayout(_device, _mergedGPassSetLayout, nullptr);
+  vkDestroyDescriptorPool(_device, _gpassPipeline.descriptorPool, nullptr);
+  vkDestroyDescriptorSetLayout(_device, _gpassPipeline.descriptorSetLayout,
+                               nullptr);
+
+  vkDestroyDescriptorSetLayout(_device, _lightPipeline.descriptorSetLayout,
+                               nullptr);
+  vkDestroyDescriptorSetLayout(_device, _clusterPipeline.descriptorSetLayout,
+                               nullptr);
+  vkDestroyDescriptorSetLayout(_device, _drawCullPipeline.descriptorSetLayout,
+                               nullptr);
+  vkDestroyDescriptorSetLayout(_device, _hiZPipeline.descriptorSetLayout,
+                               nullptr);
+  vkDestroyDescriptorSetLayout(_device, _upscalePipeline.descriptorSetLayout,
+                               nullptr);
+
+  destroyShadowResources();
+  vkDestroyDescriptorSetLayout(_device, _shadowPipeline.descriptorSetLayout,
+                               nullptr);
+  vkDestroyRenderPass(_device, _shadowRenderPass, nullptr);
+
+  vkDestroyBuffer(_device, _gpassUniformBuffer.buffer, nullptr);
+  vkFreeMemory(_device, _gpassUniformBuffer.bufferMemory, nullptr);
+
+  vkDestroyBuffer(_device, _lightUniformBuffer.buffer, nullptr);
+  vkFreeMemory(_device, _lightUniformBuffer.bufferMemory, nullptr);
+
+  vkDestroyBuffer(_device, _upscaleUniformBuffer.buffer, nullptr);
+  vkFreeMemory(_device, _upscaleUniformBuffer.bufferMemory, nullptr);
+
+  destroyLightStorageBuffer();
+  vkDestroyBuffer(_device, _clusterBuffer.buffer, nullptr);
+  vkFreeMemory(_device, _clusterBuffer.bufferMemory, nullptr);
+
+  destroyDrawItems();
+  destroyInstanceBuffers();
+
+  vkDestroyBuffer(_device, _positionBuffer.buffer, nullptr);
+  vkFreeMemory(_device, _positionBuffer.bufferMemory, nullptr);
+  vkDestroyBuffer(_device, _attributeBuffer.buffer, nullptr);
+  vkFreeMemory(_device, _attributeBuffer.bufferMemory, nullptr);
+  vkDestroyBuffer(_device, _indexBuffer.buffer, nullptr);
+  vkFreeMemory(_device, _indexBuffer.bufferMemory, nullptr);
+
+  destroyFrameResources();
+  vkDestroyCommandPool(_device, _commandPool, nullptr);
+  _gpuProfiler.destroy();
+  _pipelineCache.save();
+  _pipelineCache.destroy();
+
+  vkDestroyDevice(_device, nullptr);
+  DestroyDebugReportCallbackEXT(_instance, _callback, nullptr);
+  if (_surface != VK_NULL_HANDLE) {
+    vkDestroySurfaceKHR(_instance, _surface, nullptr);
+  }
+  vkDestroyInstance(_instance, nullptr);
+  if (_window) {
+    glfwDestroyWindow(_window);
+    glfwTerminate();
+  }
+}
+
 void VkBackend::onResize() { recreateSwapChain(); }
\ No newline at end of file
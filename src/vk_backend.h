@@ -1,210 +1,1040 @@
-#pragma once
-#include <chrono>
-#include <map>
-#include <set>
-#include <vector>
-#include "vk_utils.h"
-#include "graphics_backend.h"
-#include "model.h"
-#include "renderer.h"
-
-struct VkVertex {
-  glm::vec3 pos;
-  glm::vec3 normal;
-  glm::vec2 texCoord;
-  glm::vec3 tangent;
-  static VkVertexInputBindingDescription getBindingDescription() {
-    VkVertexInputBindingDescription bindingDescription = {};
-    bindingDescription.binding = 0;
-    bindingDescription.stride = sizeof(VkVertex);
-    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-    return bindingDescription;
-  }
-
-  static std::array<VkVertexInputAttributeDescription, 4>
-  getAttributeDescriptions() {
-    std::array<VkVertexInputAttributeDescription, 4> attributeDescriptions = {};
-    attributeDescriptions[0].binding = 0;
-    attributeDescriptions[0].location = 0;
-    attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[0].offset = offsetof(VkVertex, pos);
-
-    attributeDescriptions[1].binding = 0;
-    attributeDescriptions[1].location = 1;
-    attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[1].offset = offsetof(VkVertex, normal);
-
-    attributeDescriptions[2].binding = 0;
-    attributeDescriptions[2].location = 2;
-    attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-    attributeDescriptions[2].offset = offsetof(VkVertex, texCoord);
-
-    attributeDescriptions[3].binding = 0;
-    attributeDescriptions[3].location = 3;
-    attributeDescriptions[3].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[3].offset = offsetof(VkVertex, tangent);
-
-    return attributeDescriptions;
-  }
-};
-
-struct gPassUbo {
-  glm::mat4 model;
-  glm::mat4 view;
-  glm::mat4 proj;
-};
-
-struct Light {
-  glm::vec4 position;
-  glm::vec3 color;
-  float radius;
-};
-
-struct lightUbo {
-  glm::vec4 viewPosition;
-  std::array<Light, 6> lights;
-};
-
-struct Texture {
-  VkImage image;
-  VkDeviceMemory imageMemory;
-  VkImageView imageView;
-  VkSampler sampler;
-};
-
-struct DepthStencil {
-  VkImage image;
-  VkDeviceMemory imageMemory;
-  VkImageView imageView;
-};
-
-struct Buffer {
-  VkBuffer buffer;
-  VkDeviceMemory bufferMemory;
-};
-
-struct Attachment {
-  VkImage image;
-  VkDeviceMemory memory;
-  VkImageView imageView;
-  VkFormat format;
-};
-
-struct Pipeline {
-  VkPipelineLayout layout;
-  VkPipeline pipeline;
-  VkDescriptorSetLayout descriptorSetLayout;
-  VkDescriptorPool descriptorPool;
-  std::vector<VkDescriptorSet> descriptorSets;
-};
-
-class VkBackend : public GraphicsBackend {
- public:
-  VkBackend();
-  ~VkBackend();
-
-  void init(GLFWwindow *window, Model model);
-  void drawFrame();
-  void update();
-  void cleanup();
-  void onResize();
-
- private:
-  VkInstance _instance;
-  VkDebugReportCallbackEXT _callback;
-  VkSurfaceKHR _surface;
-  VkPhysicalDevice _physicalDevice = VK_NULL_HANDLE;
-  VkDevice _device;
-  VkQueue _graphicsQueue;
-  VkQueue _presentQueue;
-  VkSwapchainKHR _swapChain;
-  std::vector<VkImage> _swapChainImages;
-  VkFormat _swapChainImageFormat;
-  VkExtent2D _swapChainExtent;
-  std::vector<VkImageView> _swapChainImageViews;
-
-  VkRenderPass _renderPass;
-
-  Pipeline _gpassPipeline;  // Geometry-pass (1st subpass)
-  Pipeline _lightPipeline;
-
-  std::vector<VkFramebuffer> _swapChainFramebuffers;
-  VkCommandPool _commandPool;
-  std::vector<VkCommandBuffer> _commandBuffers;
-  VkSemaphore _imageAvailableSemaphore;
-  VkSemaphore _renderFinishedSemaphore;
-
-  Buffer _vertexBuffer;
-  Buffer _indexBuffer;
-
-  Buffer _gpassUniformBuffer;
-  Buffer _lightUniformBuffer;
-
-  // VkDescriptorPool	_descriptorPool;
-
-  // std::vector<Texture> _ambientTextures;
-  std::vector<Texture> _diffuseTextures;
-  std::vector<Texture> _specularTextures;
-  std::vector<Texture> _normalTextures;
-  DepthStencil _depth;
-  std::vector<Attachment> _gBufferAttachments;
-
-  void createInstance();
-  void setupDebugCallback();
-  void createSurface();
-  void pickPhysicalDevice();
-  void createLogicalDevice();
-  void createSwapChain();
-  void createImageViews();
-  void createRenderPass();
-  VkDescriptorSetLayout createGPassDescriptorSetLayout();
-  VkDescriptorSetLayout createLightDescriptorSetLayout();
-  Pipeline createGraphicsPipeline(const std::string vertexShader,
-                                  const std::string fragShader,
-                                  VkDescriptorSetLayout setLayout,
-                                  uint32_t subpass_id,
-                                  uint32_t colorAttachementCount);
-  void createFramebuffers();
-  void createCommandPool();
-  void createDepthResources();
-  void createGBufferAttachments();
-  Texture createTextureImage(const std::string filepath);
-  void createTextureImageView(Texture &texture);
-  void createTextureSampler(Texture &texture);
-  VkImageView createImageView(VkImage image, VkFormat format,
-                              VkImageAspectFlags aspectFlags);
-  void createImage(uint32_t width, uint32_t height, VkFormat format,
-                   VkImageTiling tiling, VkImageUsageFlags usage,
-                   VkMemoryPropertyFlags properties, VkImage &image,
-                   VkDeviceMemory &imageMemory);
-
-  Buffer createVertexBuffer(std::vector<Vertex> vertices);
-  Buffer createIndexBuffer(std::vector<uint32_t> indices);
-  Buffer createUniformBuffer(size_t bufferSize);
-
-  VkDescriptorPool createGPassDescriptorPool(uint32_t poolSize);
-  VkDescriptorSet createGPassDescriptorSet(VkDescriptorPool pool,
-                                           VkDescriptorSetLayout layout,
-                                           const Texture &diffuse,
-                                           const Texture &specular,
-                                           const Texture &normal);
-
-  VkDescriptorPool createLightDescriptorPool(uint32_t poolSize);
-  VkDescriptorSet createLightDescriptorSet(VkDescriptorPool pool,
-                                           VkDescriptorSetLayout layout);
-
-  void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
-                    VkMemoryPropertyFlags properties, VkBuffer &buffer,
-                    VkDeviceMemory &bufferMemory);
-  void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
-  VkCommandBuffer beginSingleTimeCommands();
-  void endSingleTimeCommands(VkCommandBuffer commandBuffer);
-  void transitionImageLayout(VkImage image, VkFormat format,
-                             VkImageLayout oldLayout, VkImageLayout newLayout);
-  void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width,
-                         uint32_t height);
-  void createCommandBuffers();
-  void createSemaphores();
-  void recreateSwapChain();
-  void cleanupSwapChain();
-};
+#pragma once
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <set>
+#include <vector>
+#include "vk_utils.h"
+#include "frustum_culling.h"
+#include "gpu_profiler.h"
+#include "graphics_backend.h"
+#include "light_manager.h"
+#include "model.h"
+#include "occlusion_culling.h"
+#include "pipeline_cache.h"
+#include "render_queue.h"
+#include "renderer.h"
+#include "resolution_controller.h"
+#include "rolling_stats.h"
+#include "scene.h"
+#include "shadow_maps.h"
+#include "thread_pool.h"
+
+// Vertex streams of the model, one binding each: the packed positions
+// read by every pass at binding 0, then the shading attributes of the
+// G-pass at binding 1
+struct VkVertexAttributes {
+  glm::vec3 normal;
+  glm::vec2 texCoord;
+  glm::vec3 tangent;
+};
+
+const uint32_t POSITION_STREAM_STRIDE = sizeof(glm::vec3);
+const uint32_t ATTRIBUTE_STREAM_STRIDE = sizeof(VkVertexAttributes);
+// Of a single interleaved stream, what a position-only pass would fetch
+// without the split
+const uint32_t INTERLEAVED_VERTEX_STRIDE =
+    POSITION_STREAM_STRIDE + ATTRIBUTE_STREAM_STRIDE;
+
+// Vertex streams a pipeline declares, and its draws bind
+enum class VertexInput {
+  None,      // vertices generated from gl_VertexIndex
+  Position,  // binding 0, location 0
+  Full,      // binding 0, then locations 1 to 3 from binding 1
+};
+
+// Froxel grid of the clustered light pass, must match shaders/cluster.glsl
+const uint32_t CLUSTER_GRID_X = 16;
+const uint32_t CLUSTER_GRID_Y = 9;
+const uint32_t CLUSTER_GRID_Z = 24;
+const uint32_t CLUSTER_COUNT = CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z;
+const uint32_t MAX_LIGHTS_PER_CLUSTER = 256;
+const uint32_t CLUSTER_CULL_GROUP_SIZE = 128;
+
+// Must match the local sizes of shaders/draw_cull.comp and
+// shaders/hiz_reduce.comp
+const uint32_t DRAW_CULL_GROUP_SIZE = 64;
+const uint32_t HIZ_REDUCE_GROUP_SIZE = 8;
+
+// First of the instance transform and instance index bindings of
+// shaders/instances.glsl, in the G-pass and shadow descriptor sets
+const uint32_t INSTANCE_BINDING = 4;
+
+// Specialized light counts are powers of two up to the largest, scenes with
+// more lights use the generic light pipeline
+const uint32_t MIN_SPECIALIZED_LIGHT_COUNT = 16;
+const uint32_t MAX_SPECIALIZED_LIGHT_COUNT = 1024;
+// Graphics variants kept by the permutation cache
+const size_t MAX_PIPELINE_VARIANTS = 64;
+
+// Light storage buffer of the light pass and cluster culling sets, must
+// match shaders/light.frag, light_volume.frag and cluster_cull.comp
+const uint32_t LIGHT_PASS_LIGHTS_BINDING = 4;
+const uint32_t CLUSTER_LIGHTS_BINDING = 1;
+
+// Statistics at the start of the draw count buffer, must match
+// shaders/draw_cull.comp
+enum DrawCullStat {
+  DrawCullFrustumDraws,
+  DrawCullFrustumTriangles,
+  DrawCullDraws,
+  DrawCullTriangles,
+  DrawCullSecondPhaseDraws,
+  DrawCullStatCount = 8
+};
+
+// Light volume sphere tessellation, must match shaders/light_volume.vert
+const uint32_t LIGHT_VOLUME_SLICES = 16;
+const uint32_t LIGHT_VOLUME_STACKS = 8;
+const uint32_t LIGHT_VOLUME_VERTEX_COUNT =
+    LIGHT_VOLUME_SLICES * LIGHT_VOLUME_STACKS * 6;
+
+struct gPassUbo {
+  glm::mat4 model;  // scene root, the instance transforms are relative to it
+  glm::mat4 view;
+  glm::mat4 proj;
+};
+
+// Data of one G-pass draw pushed or read at a dynamic offset, must match
+// shaders/gpass.vert
+struct gPassPerDraw {
+  glm::mat4 model;  // instance transform, relative to gPassUbo::model
+  uint32_t material;
+  uint32_t padding[3];
+};
+
+// Shadow lookups of the light passes, must match shaders/shadows.glsl.
+// Matrices are the ones the layers were last rendered with.
+struct shadowUbo {
+  glm::mat4 cascadeViewProj[SHADOW_CASCADE_COUNT];  // world to shadow clip
+  glm::vec4 cascadeSplits;     // view-space depth where each cascade ends
+  glm::vec4 cascadeTexelSize;  // world units, scales the normal offset
+  glm::vec4 sunDirection;      // xyz: direction the light travels
+  glm::vec4 sunColor;          // black when shadows are off
+  glm::mat4 pointFaceViewProj[MAX_POINT_SHADOWS * POINT_SHADOW_FACES];
+  glm::uvec4 pointShadowLights;  // light index of each point shadow
+  uint32_t pointShadowCount;
+  uint32_t padding[3];
+};
+
+// Shared by the light subpass and the cluster culling compute pass, the
+// lights themselves live in a storage buffer
+struct lightUbo {
+  glm::mat4 invViewProj;  // compact G-buffer position reconstruction
+  glm::mat4 view;
+  glm::mat4 invProj;
+  glm::vec4 viewPosition;
+  glm::vec4 clusterDepth;  // near, far, log(far / near)
+  glm::uvec4 clusterTile;  // tile size, framebuffer size (pixels)
+  uint32_t lightCount;
+  uint32_t padding[3];
+  glm::mat4 viewProj;  // light volume proxies
+};
+
+// Maps the swapchain image to the rendered part of the scene color, must
+// match shaders/upscale.frag
+struct upscaleUbo {
+  glm::vec4 uvScale;  // xy: render / target extent, zw: last texel center
+};
+
+struct Texture {
+  VkImage image;
+  VkDeviceMemory imageMemory;
+  VkImageView imageView;
+  VkSampler sampler;
+};
+
+struct DepthStencil {
+  VkImage image;
+  VkDeviceMemory imageMemory;
+  VkImageView imageView;
+};
+
+struct Buffer {
+  VkBuffer buffer;
+  VkDeviceMemory bufferMemory;
+};
+
+// Host writes of a frame, from its upload buffer to the buffer the passes
+// read
+struct UploadCopy {
+  VkBuffer source;
+  VkBuffer destination;
+  VkBufferCopy region;
+};
+
+// What each of the frames in flight owns, reused once its fence signaled
+struct FrameResources {
+  VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+  VkSemaphore imageAvailable = VK_NULL_HANDLE;
+  VkSemaphore renderFinished = VK_NULL_HANDLE;
+  VkFence inFlight = VK_NULL_HANDLE;
+  bool submitted = false;  // since the fence was last waited on
+  // Persistently mapped, grown by replacing it: the copies already staged
+  // keep reading the retired buffers until the fence signals
+  Buffer upload = {VK_NULL_HANDLE, VK_NULL_HANDLE};
+  char *mappedUpload = nullptr;
+  VkDeviceSize uploadCapacity = 0;
+  VkDeviceSize uploadSize = 0;
+  std::vector<UploadCopy> copies;
+  std::vector<Buffer> retiredUploads;
+  // GPU culling statistics of the frame, copied at its end
+  Buffer drawStats;
+  uint32_t *mappedDrawStats = nullptr;
+};
+
+struct Attachment {
+  VkImage image;
+  VkDeviceMemory memory;
+  VkImageView imageView;
+  VkFormat format;
+};
+
+// Fixed-function state and shaders of a graphics pipeline
+struct GraphicsPipelineDesc {
+  std::string name;  // reported with the variant, not part of its key
+  std::string vertexShader;
+  std::string fragShader;  // empty: depth only
+  VertexInput vertexInput = VertexInput::Full;
+  VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+  VkRenderPass renderPass = VK_NULL_HANDLE;  // null: the main render pass
+  uint32_t subpass = 0;
+  VkExtent2D extent = {0, 0};  // viewport, 0: the render target extent
+  bool dynamicViewport = false;  // viewport and scissor set per frame
+  uint32_t colorAttachmentCount = 1;
+  bool depthTest = true;
+  bool depthWrite = true;
+  VkCompareOp depthCompareOp = VK_COMPARE_OP_LESS;
+  bool depthBoundsTest = false;  // bounds set per draw (dynamic state)
+  VkCullModeFlags cullMode = VK_CULL_MODE_NONE;
+  bool additiveBlend = false;
+  float depthBiasConstant = 0.0f;  // both 0: no depth bias
+  float depthBiasSlope = 0.0f;
+  // Set 1 of the pipeline layout, null: set 0 only
+  VkDescriptorSetLayout perDrawSetLayout = VK_NULL_HANDLE;
+  uint32_t pushConstantSize = 0;  // vertex stage, from offset 0
+  // Vertex and fragment shader specialization constants, element i is
+  // constant_id i
+  std::vector<uint32_t> specialization;
+};
+
+// constant_id of the G-pass and light shader specialization constants,
+// declared in gbuffer.glsl, lighting.glsl, gpass.vert, gpass.frag and
+// light.frag. Shaders ignore the ones they don't declare.
+enum class ShaderConstant {
+  CompactGBuffer,  // bool
+  Specular,        // bool
+  NormalMapping,   // bool
+  LightingMode,    // LightingMode
+  LightCount,      // full-screen lighting loop bound, 0: from the UBO
+  MaterialCount,   // gpass.frag texture array size, 1: one material per set
+  PerDrawData,     // PerDrawData of gpass.vert
+  Count
+};
+
+// A graphics pipeline of the permutation cache
+struct PipelineVariant {
+  std::string name;  // description name and specialization constants
+  double creationTime = 0.0;  // ms, vkCreateGraphicsPipelines included
+  uint32_t requests = 0;      // createGraphicsPipeline calls it served
+};
+
+struct Pipeline {
+  VkPipelineLayout layout;
+  VkPipeline pipeline;
+  VkDescriptorSetLayout descriptorSetLayout;
+  VkDescriptorPool descriptorPool;
+  std::vector<VkDescriptorSet> descriptorSets;
+};
+
+enum class GBufferLayout {
+  Full,     // RGBA16F position, normal, albedo: 24 bytes/pixel
+  Compact,  // position from depth, RG16 octahedral normal, RGBA8 albedo:
+            // 8 bytes/pixel
+};
+
+enum class LightingMode {
+  FullScreen,  // every pixel loops over every light
+  Clustered,   // compute pass bins lights per froxel, pixels loop over
+               // their froxel's lights only
+  Volumes,     // ambient full-screen pass, then one sphere proxy per light
+               // blended additively, depth-tested against the G-buffer
+};
+
+// One G-pass draw: a sub-mesh and the mesh whose descriptors it uses
+struct DrawItem {
+  uint32_t mesh;
+  uint32_t indexCount;
+  uint32_t firstIndex;  // in the index range of indexType
+  int32_t vertexOffset;
+  VkIndexType indexType;
+};
+
+// Where the indices of a sub-mesh live in the index buffer, rebased on its
+// vertexOffset. Each mesh picks 16-bit indices when all of its sub-meshes
+// fit, the 16-bit range comes first and the 32-bit range follows it.
+struct IndexRange {
+  uint32_t firstIndex;
+  VkIndexType indexType;
+};
+
+struct IndexBufferStats {
+  uint32_t narrowIndices = 0;  // 16-bit
+  uint32_t wideIndices = 0;    // 32-bit
+  VkDeviceSize bytes = 0;
+  VkDeviceSize bytesSaved = 0;  // against 32-bit indices only
+};
+
+// Visible instances of a draw item, drawn by one instanced draw. Their
+// scene instance indices are a range of the instance index buffer.
+struct DrawBatch {
+  uint32_t draw;
+  uint32_t firstInstance;
+  uint32_t instanceCount;
+};
+
+// Entry of the instance index buffer, must match shaders/instances.glsl
+struct InstanceSlot {
+  uint32_t instance;  // scene instance
+  uint32_t material;  // mesh, texture array index of the merged G-pass
+};
+
+// GPU layout of a draw item of one scene instance for the culling compute
+// pass, must match shaders/draw_cull.comp
+struct DrawData {
+  glm::vec4 boundsMin;  // object space
+  glm::vec4 boundsMax;
+  uint32_t mesh;
+  uint32_t indexCount;
+  int32_t vertexOffset;
+  uint32_t meshFirstDraw;
+  uint32_t instance;
+  uint32_t firstIndex;
+  uint32_t padding[2];  // std430 rounds the struct to 16 bytes
+};
+
+struct drawCullUbo {
+  glm::mat4 modelViewProj;  // scene root to clip
+  glm::vec4 planes[6];      // scene space frustum
+  glm::vec2 viewportSize;   // depth buffer size, pixels
+  uint32_t hiZLevels;       // 0: frustum culling only
+  uint32_t phase;           // 0: single pass, 1 or 2: occlusion phases
+  uint32_t drawCount;
+  uint32_t compact;  // visible commands packed per mesh, for the count draw
+  uint32_t commandBase;  // command and count ranges of the phase
+  uint32_t countBase;
+};
+
+// Range of a mesh's draw items of every instance in the culling pass
+// inputs, and of its indirect commands
+struct MeshDrawRange {
+  uint32_t first;
+  uint32_t count;
+  VkIndexType indexType;  // of every sub-mesh of the mesh
+};
+
+enum class CullingMode {
+  None,  // every sub-mesh is drawn
+  Cpu,   // SIMD frustum test in update(), visible draws recorded directly
+  CpuOcclusion,  // Cpu plus a software rasterized occlusion buffer of the
+                 // largest sub-meshes, same frame and no GPU readback
+  Gpu,   // compute pass writes the indirect draw commands
+  GpuOcclusion,  // Gpu plus two-phase Hi-Z occlusion culling: draws not
+                 // hidden in the previous frame's depth pyramid, then the
+                 // ones a pyramid of that first depth no longer hides
+};
+
+// Draws are the draw items of every scene instance. GPU modes report the
+// previous frame.
+struct CullingStats {
+  uint32_t visibleDraws = 0;
+  uint32_t totalDraws = 0;
+  uint32_t visibleTriangles = 0;
+  uint32_t totalTriangles = 0;
+  uint32_t frustumDraws = 0;  // before occlusion culling
+  uint32_t frustumTriangles = 0;
+  uint32_t secondPhaseDraws = 0;  // drawn after the occlusion re-test
+  RollingStats cullTime;          // ms
+};
+
+// Where the G-pass vertex shader reads the instance transform and material
+// of the draws recorded in the CPU culling modes. The indirect draws of the
+// GPU modes and the depth-only passes always read the instance slots.
+enum class PerDrawData {
+  InstanceSlots,   // storage buffers indexed by gl_InstanceIndex
+  PushConstants,   // gPassPerDraw pushed before each draw
+  DynamicUniform,  // gPassPerDraw records of a uniform buffer, one dynamic
+                   // offset bind per draw
+};
+
+// Pipeline field of the render queue keys
+enum class QueuedPipeline { GPass, CascadeShadow, PointShadow };
+
+// Binds recorded for the queued batches of the last frame: the G-pass (CPU
+// culling modes) and the shadow passes. Requested is what recording the
+// same batches in draw item order, without the queue, binds: a pipeline and
+// a descriptor set per shadow layer and a G-pass material set per change of
+// material. Issued is what recording in key order binds.
+struct BindStats {
+  uint32_t draws = 0;  // draw calls of the batches
+  // Shadow passes only, the G-pass binds its pipeline once either way
+  uint32_t pipelineRequests = 0;
+  uint32_t pipelineBinds = 0;
+  uint32_t descriptorRequests = 0;
+  uint32_t descriptorBinds = 0;
+  // Indirect draw calls and descriptor binds of the G-pass, its pre-pass
+  // and first occlusion phase included, in the GPU culling modes
+  uint32_t indirectDraws = 0;
+  uint32_t indirectDescriptorBinds = 0;
+  // Push constant updates or dynamic offset binds of the G-pass draws
+  uint32_t perDrawUpdates = 0;
+  uint32_t indexBinds = 0;  // a bind per change of index width
+  RollingStats sortTime;    // keys and radix sort of both queues, ms
+  RollingStats recordTime;  // recordCommandBuffer(), ms
+};
+
+// Max-depth pyramid of the depth buffer, level 0 is half its size
+struct HiZPyramid {
+  VkImage image = VK_NULL_HANDLE;
+  VkDeviceMemory memory;
+  VkImageView view;  // every level, read by the culling pass
+  std::vector<VkImageView> levelViews;
+  VkSampler sampler;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t levelCount = 0;
+};
+
+// Depth array of shadow map layers, sampled with depth comparison
+struct ShadowMap {
+  VkImage image = VK_NULL_HANDLE;
+  VkDeviceMemory memory;
+  VkImageView view;  // every layer, read by the light passes
+  std::vector<VkImageView> layerViews;
+  std::vector<VkFramebuffer> framebuffers;  // one per layer
+  uint32_t size = 0;
+  uint32_t layerCount = 0;
+};
+
+// Frames between recording the timestamps of a frame and reading them
+// back, raised to the frames in flight so that reading them never waits
+// on the GPU
+const uint32_t GPU_TIMING_LATENCY = 2;
+
+// Each shadow pass (cascade or point light) also has its own scope after
+// Count, see getShadowGpuTime()
+enum class GpuScope {
+  LightClustering,
+  DrawCulling,
+  Shadows,
+  DepthPrePass,
+  GPass,
+  Lighting,  // light subpass, vkCmdNextSubpass to the end of the render pass
+  HiZ,
+  Upscale,
+  Frame,  // whole command buffer
+  Count
+};
+
+// Shadow map layers of the last update(): one per cascade and six per
+// shadowed point light
+struct ShadowStats {
+  uint32_t renderedLayers = 0;  // re-rendered this frame
+  uint32_t cachedLayers = 0;    // light and geometry unchanged, reused
+  uint32_t deferredLayers = 0;  // stale, over the budget
+  uint32_t draws = 0;
+  uint32_t triangles = 0;
+  RollingStats cpuTime;  // cascade fitting, caching and culling, ms
+};
+
+struct VkBackendSettings {
+  VkPresentModeKHR presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+  uint32_t swapChainImageCount = 0;  // 0: minImageCount + 1
+  // Frames the CPU records while the GPU still executes earlier ones, each
+  // with its own command buffer, semaphores, fence and uploads
+  uint32_t framesInFlight = 2;
+  GBufferLayout gBufferLayout = GBufferLayout::Full;
+  LightingMode lightingMode = LightingMode::FullScreen;
+  uint32_t lightCount = 6;
+  CullingMode cullingMode = CullingMode::Cpu;
+  uint32_t occluderTriangleBudget = 65536;  // CpuOcclusion occluders
+  // Depth-only subpass before the G-pass, which then shades only the
+  // fragments matching the final depth
+  bool depthPrePass = false;
+  // Sun with cascaded shadow maps, plus cube shadows for the first
+  // pointShadowCount point lights. The sun only lights the scene with
+  // shadows on.
+  bool shadows = false;
+  uint32_t pointShadowCount = 1;  // at most MAX_POINT_SHADOWS
+  uint32_t shadowMapSize = 2048;  // per cascade
+  uint32_t pointShadowMapSize = 512;  // per cube face
+  // Layers (cascades and cube faces) re-rendered per frame at most
+  uint32_t shadowBudget = SHADOW_CASCADE_COUNT + POINT_SHADOW_FACES;
+  float shadowDistance = 40.0f;  // covered by the cascades
+  glm::vec3 sunDirection = glm::vec3(-0.3f, -1.0f, 0.2f);  // world space
+  glm::vec3 sunColor = glm::vec3(1.0f, 0.95f, 0.85f);
+  // G-pass and lighting rendered at a fraction of the swapchain size, picked
+  // from the measured GPU frame time, then upscaled to the swapchain
+  bool dynamicResolution = false;
+  float targetFrameTime = 16.0f;  // GPU ms
+  float minRenderScale = 0.5f;    // per axis
+  float maxRenderScale = 1.0f;    // sizes the render targets
+  // Pipeline cache loaded at init and saved by cleanup(), empty: not kept
+  std::string pipelineCachePath = "pipeline_cache.bin";
+  // Pipelines created on the worker pool, joined before first use
+  bool parallelPipelineCreation = true;
+  // Shader features, specialization constants of the pipelines
+  bool normalMapping = true;
+  bool specular = true;
+  // Full-screen lighting pipeline specialized on the light count, rounded
+  // up to a power of two so that few variants are built
+  bool specializeLightCount = false;
+  // Visible instances of a sub-mesh drawn by one instanced draw per pass,
+  // off: one draw per instance
+  bool instancing = true;
+  // Every material in one descriptor set of texture arrays, indexed per
+  // draw: the G-pass binds it once and the GPU culling modes draw every
+  // command with a single indirect call. Needs multiDrawIndirect and
+  // dynamic sampler array indexing, otherwise one set and call per mesh.
+  bool mergedDraws = true;
+  // Other than InstanceSlots, the G-pass of the CPU culling modes draws
+  // one instance per call
+  PerDrawData perDrawData = PerDrawData::InstanceSlots;
+  // No window, surface or present: frames render into a ring of
+  // swapChainImageCount (0: 3) offscreen color images of headlessExtent,
+  // the passes and pipelines are those of the swapchain
+  bool headless = false;
+  VkExtent2D headlessExtent = {1280, 720};
+  // Headless only: every readbackInterval-th frame is copied back and
+  // written to this directory as frame_<index>.ppm, empty: no readback
+  std::string readbackDirectory;
+  uint32_t readbackInterval = 1;
+};
+
+// Per-frame swapchain timings, in milliseconds
+struct SwapChainTelemetry {
+  RollingStats acquireBlock;      // time spent inside vkAcquireNextImageKHR
+  // Acquire returned -> vkQueuePresentKHR returned, CPU time: recording
+  // and submitting, not the GPU executing the frame
+  RollingStats acquireToPresent;
+  // update() past its fence wait to the submit of drawFrame(), acquire
+  // excluded
+  RollingStats cpuFrame;
+  // Between consecutive presents, headless: submits
+  RollingStats presentInterval;
+};
+
+class VkBackend : public GraphicsBackend {
+ public:
+  VkBackend();
+  VkBackend(const VkBackendSettings &settings);
+  ~VkBackend();
+
+  void init(GLFWwindow *window, Model model);  // a single instance
+  void init(GLFWwindow *window, const Scene &scene);
+  void drawFrame();
+  void update();
+  void cleanup();
+  void onResize();
+
+  void setPresentMode(VkPresentModeKHR presentMode);
+  void setSwapChainImageCount(uint32_t imageCount);
+  void setGBufferLayout(GBufferLayout layout);
+  void setLightingMode(LightingMode mode);
+  void setLightCount(uint32_t lightCount);
+  void setCullingMode(CullingMode mode);
+  void setDepthPrePass(bool enabled);
+  void setShadows(bool enabled);
+  void setShadowBudget(uint32_t layers);
+  void setSunDirection(const glm::vec3 &direction);
+  void setDynamicResolution(bool enabled);
+  void setTargetFrameTime(float milliseconds);
+  void setNormalMapping(bool enabled);
+  void setSpecular(bool enabled);
+  void setInstancing(bool enabled);
+  void setMergedDraws(bool enabled);
+  void setPerDrawData(PerDrawData perDrawData);
+  // Object to scene space, drawn from the next update()
+  void setInstanceTransform(uint32_t instance, const glm::mat4 &transform);
+  // Every instance at once, as many transforms as instances
+  void setInstanceTransforms(const std::vector<glm::mat4> &transforms);
+  VkPresentModeKHR getPresentMode() const;
+  GBufferLayout getGBufferLayout() const;
+  LightingMode getLightingMode() const;
+  uint32_t getLightCount() const;
+  CullingMode getCullingMode() const;
+  // False: setCullingMode() turns the GPU modes into the CPU ones
+  bool getGpuCullingSupported() const;
+  bool getDepthPrePass() const;
+  bool getShadows() const;
+  bool getDynamicResolution() const;
+  float getTargetFrameTime() const;  // GPU ms
+  bool getNormalMapping() const;
+  bool getSpecular() const;
+  bool getInstancing() const;
+  bool getMergedDraws() const;  // requested, see getMergedDrawsActive()
+  bool getMergedDrawsActive() const;  // requested and supported
+  PerDrawData getPerDrawData() const;
+  uint32_t getInstanceCount() const;
+  float getRenderScale() const;  // per axis, 1 without dynamic resolution
+  VkExtent2D getRenderExtent() const;
+  // Scale picked after each measured frame, oldest first
+  const std::deque<ResolutionSample> &getResolutionHistory() const;
+  const CullingStats &getCullingStats() const;
+  const ShadowStats &getShadowStats() const;
+  const BindStats &getBindStats() const;
+  const IndexBufferStats &getIndexBufferStats() const;
+  const RollingStats &getGpuTime(GpuScope scope) const;  // ms, may be empty
+  // False when the graphics queue has no timestamps, every time is empty
+  bool getGpuTimingSupported() const;
+  // Frames between recording a frame's timestamps and reading them back
+  uint32_t getGpuTimingLatency() const;
+  // Pass < SHADOW_CASCADE_COUNT: a cascade, then the point lights' cubes.
+  // Frames where the pass was cached push nothing.
+  const RollingStats &getShadowGpuTime(uint32_t pass) const;
+  // Per frame pipeline statistic of a scope, empty when the device has no
+  // pipelineStatisticsQuery or the statistic is not recorded there
+  const RollingStats &getGpuStatistic(
+      GpuScope scope, VkQueryPipelineStatisticFlagBits statistic) const;
+  // Scene animation time in seconds, negative: wall clock
+  void setAnimationTime(float seconds);
+  uint32_t getSwapChainImageCount() const;
+  uint32_t getFramesInFlight() const;
+  VkExtent2D getSwapChainExtent() const;
+  const SwapChainTelemetry &getSwapChainTelemetry() const;
+  bool getHeadless() const;
+  uint32_t getHeadlessFrameCount() const;  // frames drawn so far
+  // Lights added here are drawn from the next update(), on top of the
+  // animated scene lights sized by setLightCount()
+  LightManager &getLightManager();
+  const RollingStats &getLightUpdateStats() const;  // animate + upload, ms
+  // Every createPipelines(), the first one from the file cache (warm) or
+  // from scratch (cold), then one per swapchain recreation, ms
+  const RollingStats &getPipelineCreationTime() const;
+  bool getPipelineCacheWarm() const;
+  // Graphics pipelines created since the last swapchain recreation, which
+  // empties the permutation cache
+  std::vector<PipelineVariant> getPipelineVariants() const;
+  // Destroys every pipeline and creates them again from an empty pipeline
+  // cache, serially or on the worker pool, to compare cold starts. Returns
+  // the creation time in ms.
+  double recreatePipelines(bool parallel);
+  uint32_t getWorkerThreadCount() const;  // calling thread included
+  // Shared with the application's own parallel work between frames
+  ThreadPool &getWorkerPool();
+
+ private:
+  VkBackendSettings _settings;
+  SwapChainTelemetry _telemetry;
+  std::chrono::high_resolution_clock::time_point _frameStart;
+  std::chrono::high_resolution_clock::time_point _lastPresent;
+  bool _framePending = false;  // update() ran, its drawFrame() did not
+  VkPresentModeKHR _presentMode;
+
+  VkInstance _instance;
+  VkDebugReportCallbackEXT _callback;
+  VkSurfaceKHR _surface = VK_NULL_HANDLE;  // none when headless
+  VkPhysicalDevice _physicalDevice = VK_NULL_HANDLE;
+  VkDevice _device;
+  VkQueue _graphicsQueue;
+  VkQueue _presentQueue;
+  VkSwapchainKHR _swapChain;
+  std::vector<VkImage> _swapChainImages;
+  VkFormat _swapChainImageFormat;
+  VkExtent2D _swapChainExtent;
+  std::vector<VkImageView> _swapChainImageViews;
+  // Headless: the ring standing in for the swapchain images, owned here
+  std::vector<VkDeviceMemory> _offscreenImageMemory;
+  uint32_t _headlessFrame = 0;
+  // Copy of the last headless frame read back, written to disk once the
+  // next frame has waited for it
+  Buffer _readbackBuffer;
+  char *_mappedReadback = nullptr;
+  bool _readbackPending = false;
+  uint32_t _readbackFrame = 0;  // in flight slot of the pending readback
+  // Size of the G-buffer, depth and scene color attachments, and the
+  // sub-rectangle of them rendered this frame
+  VkExtent2D _renderTargetExtent;
+  VkExtent2D _renderExtent;
+
+  VkRenderPass _renderPass;
+  // G-pass alone, first phase of occlusion culling
+  VkRenderPass _earlyRenderPass;
+  VkFramebuffer _earlyFramebuffer;
+
+  Pipeline _gpassPipeline;  // Geometry-pass (1st subpass, 2nd after pre-pass)
+  Pipeline _lightPipeline;
+  Pipeline _clusterPipeline;  // light culling compute pass
+  Pipeline _lightVolumePipeline;  // shares the light pipeline descriptors
+  Pipeline _drawCullPipeline;     // G-pass culling compute pass
+  Pipeline _earlyGPassPipeline;   // shares the G-pass descriptors
+  Pipeline _hiZPipeline;          // one descriptor set per pyramid level
+  Pipeline _depthPrePassPipeline;  // shares the G-pass descriptors
+  Pipeline _upscalePipeline = {};  // scene color to the swapchain image
+  bool _depthBoundsSupported = false;
+  bool _pipelineStatisticsSupported = false;
+  bool _multiDrawIndirectSupported = false;
+  bool _drawIndirectFirstInstanceSupported = false;
+  bool _drawIndirectCountSupported = false;
+  bool _mergedDrawsSupported = false;
+  uint32_t _maxDrawIndirectCount = 1;  // commands of one indirect call
+#ifdef VK_KHR_draw_indirect_count
+  PFN_vkCmdDrawIndexedIndirectCountKHR _cmdDrawIndexedIndirectCount = nullptr;
+#endif
+
+  std::vector<VkFramebuffer> _swapChainFramebuffers;
+  VkCommandPool _commandPool;
+  std::vector<FrameResources> _frames;  // framesInFlight
+  uint32_t _currentFrame = 0;           // recorded by the next drawFrame()
+  GpuProfiler _gpuProfiler;
+  PipelineCache _pipelineCache;
+  RollingStats _pipelineCreationTime;
+  // Permutation cache, by description and specialization constants. Owns
+  // the graphics pipelines and their layouts until cleanup(), they outlive
+  // the swap chain as long as the render passes are compatible.
+  struct CachedPipeline {
+    Pipeline pipeline;
+    PipelineVariant variant;
+    uint64_t lastBatch = 0;  // _pipelineBatch of the last request
+  };
+  std::map<std::string, CachedPipeline> _pipelineVariants;
+  uint64_t _pipelineBatch = 0;  // createPipelineBatch() calls
+  uint32_t _specializedLightCount = 0;  // LightCount of the light pipeline
+  // Merged G-pass descriptors, every mesh's textures as array element
+  // mesh, null when merged draws are not supported
+  VkDescriptorSetLayout _mergedGPassSetLayout = VK_NULL_HANDLE;
+  VkDescriptorPool _mergedGPassPool = VK_NULL_HANDLE;
+  VkDescriptorSet _mergedGPassSet = VK_NULL_HANDLE;
+  // Set 1 of the G-pass pipelines whatever the per-draw data, so that they
+  // share one layout. Holds the gPassPerDraw records of the DynamicUniform
+  // mode, one per G-pass instance slot of the frame.
+  VkDescriptorSetLayout _perDrawSetLayout;
+  VkDescriptorPool _perDrawPool;
+  VkDescriptorSet _perDrawSet;
+  Buffer _perDrawBuffer;
+  VkDeviceSize _perDrawStride = 0;
+  uint32_t _perDrawCapacity = 0;  // records
+
+  Buffer _positionBuffer;   // vertex stream of binding 0
+  Buffer _attributeBuffer;  // vertex stream of binding 1
+  Buffer _indexBuffer;
+  std::vector<IndexRange> _indexRanges;  // per sub-mesh, draw item order
+  VkDeviceSize _wideIndexOffset = 0;     // of the 32-bit range, bytes
+  IndexBufferStats _indexBufferStats;
+  // Of the command buffer being recorded, VK_INDEX_TYPE_MAX_ENUM if none
+  VkIndexType _boundIndexType = VK_INDEX_TYPE_MAX_ENUM;
+
+  Buffer _gpassUniformBuffer;
+  Buffer _lightUniformBuffer;
+  Buffer _lightStorageBuffer;  // sized by capacity
+  uint32_t _lightBufferCapacity = 0;
+  Buffer _clusterBuffer;  // per-cluster light counts and index lists
+
+  LightManager _lightManager;
+  std::vector<LightHandle> _sceneLights;
+  RollingStats _lightUpdateStats;
+  glm::mat4 _view;
+  glm::mat4 _proj;
+
+  std::vector<DrawItem> _drawItems;  // grouped by mesh
+  CullingBoxes _drawBounds;          // one box per draw item, object space
+  std::vector<AABB> _drawBoxes;      // the same, for the occlusion test
+  OcclusionCuller _occlusionCuller;  // occluders of every instance
+  ThreadPool _workerPool;
+  std::vector<DrawBatch> _visibleBatches;  // in draw item order
+  CullingStats _cullingStats;
+  RenderQueue _gPassQueue;   // visible draws of the CPU culling modes
+  RenderQueue _shadowQueue;  // draws of the shadow layers rendered
+  BindStats _bindStats;
+  std::vector<MeshDrawRange> _meshDrawRanges;
+  uint32_t _gpuDrawCount = 0;  // draw items times instances
+  Buffer _drawDataBuffer;
+  // One VkDrawIndexedIndirectCommand per draw and culling phase
+  Buffer _drawCommandBuffer;
+  // Statistics then the visible draws per mesh and culling phase, the
+  // statistics copied to the frame's drawStats
+  Buffer _drawCountBuffer;
+  Buffer _drawVisibilityBuffer;   // drawn by the first occlusion phase
+  Buffer _drawCullUniformBuffer;  // one drawCullUbo per culling phase
+  VkDeviceSize _drawCullUboStride = 0;
+  HiZPyramid _hiZ;
+  VkExtent2D _hiZExtent = {0, 0};  // of the depth the pyramid was built from
+  float _animationTime = -1.0f;
+
+  // Scene instances, their transforms are read by the vertex shaders and
+  // the culling pass through gl_InstanceIndex and the instance index
+  // buffer. That buffer starts with one slot per GPU draw, the first
+  // instance of its indirect command, followed by the instances of the
+  // frame's batches. Slots carry the material of the draw.
+  std::vector<glm::mat4> _instances;
+  bool _instancesDirty = true;
+  bool _occludersDirty = true;  // selected again by the next CPU occlusion
+  CullingBoxes _instanceBounds;  // scene space, one box per instance
+  std::vector<uint32_t> _visibleInstances;  // culling scratch
+  std::vector<uint32_t> _visibleSubMeshes;
+  std::vector<uint32_t> _batchSizes;        // per draw item
+  std::vector<uint32_t> _visiblePairs;      // draw item, instance
+  std::vector<InstanceSlot> _instanceIndices;  // after the draw slots
+  Buffer _instanceBuffer;
+  Buffer _instanceIndexBuffer;  // draw slots filled at creation
+  uint32_t _instanceIndexCapacity = 0;
+
+  // Cascades of the sun, then the point lights' cube faces, rendered by
+  // depth-only passes from the position stream
+  VkRenderPass _shadowRenderPass;
+  VkFormat _shadowFormat;
+  Pipeline _shadowPipeline;       // cascades, one dynamic offset per layer
+  Pipeline _pointShadowPipeline;  // shares the shadow descriptors
+  ShadowMap _cascadeShadowMap;
+  ShadowMap _pointShadowMap;
+  VkSampler _shadowSampler;
+  Buffer _shadowPassBuffer;  // gPassUbo per layer, _shadowPassStride apart
+  VkDeviceSize _shadowPassStride = 0;
+  Buffer _shadowUniformBuffer;
+  ShadowCache _shadowCache;
+  ShadowStats _shadowStats;
+  std::vector<uint32_t> _shadowLayers;  // rendered by this frame
+  std::vector<DrawBatch> _shadowBatches;  // culled per rendered layer
+  std::vector<uint32_t> _shadowBatchOffsets;  // layer i: [i, i + 1)
+  uint32_t _pointShadowLights[MAX_POINT_SHADOWS];  // dense light indices
+  uint32_t _pointShadowLightCount = 0;
+  AABB _sceneBounds;  // scene space, every instance
+
+  // Dynamic resolution: the light subpass writes the scene color, which a
+  // second render pass stretches over the swapchain image
+  Attachment _sceneColor = {};
+  VkSampler _sceneColorSampler;
+  VkRenderPass _upscaleRenderPass;
+  std::vector<VkFramebuffer> _upscaleFramebuffers;
+  Buffer _upscaleUniformBuffer;
+  ResolutionController _resolutionController;
+
+  // VkDescriptorPool	_descriptorPool;
+
+  // std::vector<Texture> _ambientTextures;
+  std::vector<Texture> _diffuseTextures;
+  std::vector<Texture> _specularTextures;
+  std::vector<Texture> _normalTextures;
+  DepthStencil _depth;
+  std::vector<Attachment> _gBufferAttachments;
+
+  void createInstance();
+  void setupDebugCallback();
+  void createSurface();
+  void pickPhysicalDevice();
+  void createLogicalDevice();
+  void createSwapChain();
+  void createOffscreenImages();  // headless createSwapChain()
+  // _renderTargetExtent from _swapChainExtent, then the render extent
+  void sizeRenderTargets();
+  void createImageViews();
+  // Of the frame's final image: presented, or copied from when headless
+  VkImageLayout outputImageLayout() const;
+  void createRenderPass();
+  void createEarlyRenderPass();
+  void createUpscaleRenderPass();
+  // materialCount: texture array size of bindings 1 to 3
+  VkDescriptorSetLayout createGPassDescriptorSetLayout(
+      uint32_t materialCount = 1);
+  VkDescriptorSetLayout createLightDescriptorSetLayout();
+  VkDescriptorSetLayout createClusterDescriptorSetLayout();
+  VkDescriptorSetLayout createDrawCullDescriptorSetLayout();
+  VkDescriptorSetLayout createHiZDescriptorSetLayout();
+  VkDescriptorSetLayout createUpscaleDescriptorSetLayout();
+  void createPipelines();
+  double buildPipelines();  // ms
+  // Graphics pipelines of the current settings and specialized light count
+  void selectGraphicsPipelines();
+  void graphicsPipelineDescs(std::vector<GraphicsPipelineDesc> &descs,
+                             std::vector<Pipeline *> &targets);
+  std::vector<uint32_t> shaderConstants() const;
+  std::string pipelineKey(const GraphicsPipelineDesc &desc) const;
+  std::string renderPassKey(VkRenderPass renderPass) const;
+  // Destroys the least recently requested variants past
+  // MAX_PIPELINE_VARIANTS, but not those of the current batch
+  void evictPipelineVariants();
+  // Graphics pipelines from the permutation cache, the misses and the
+  // compute pipelines created as jobs on the worker pool (or serially),
+  // then joined. Sets the layout and pipeline of each target.
+  void createPipelineBatch(const std::vector<GraphicsPipelineDesc> &descs,
+                           const std::vector<Pipeline *> &targets,
+                           const std::vector<std::string> &computeShaders,
+                           const std::vector<Pipeline *> &computeTargets);
+  // Any thread, the shared pipeline cache is internally synchronized
+  Pipeline createGraphicsPipeline(const GraphicsPipelineDesc &desc) const;
+  Pipeline createComputePipeline(
+      const std::string &computeShader,
+      VkDescriptorSetLayout descriptorSetLayout) const;
+  void destroyGraphicsPipelines();
+  void destroyComputePipelines();
+  void createFramebuffers();
+  void createCommandPool();
+  void createDepthResources();
+  void createGBufferAttachments();
+  void createSceneColorResources();
+  void destroySceneColorResources();
+  Attachment createGBufferAttachment(VkFormat format);
+  Texture createTextureImage(const std::string filepath);
+  void createTextureImageView(Texture &texture);
+  void createTextureSampler(Texture &texture);
+  VkImageView createImageView(
+      VkImage image, VkFormat format, VkImageAspectFlags aspectFlags,
+      uint32_t baseMipLevel = 0, uint32_t levelCount = 1,
+      VkImageViewType viewType = VK_IMAGE_VIEW_TYPE_2D,
+      uint32_t baseArrayLayer = 0, uint32_t layerCount = 1);
+  void createImage(uint32_t width, uint32_t height, VkFormat format,
+                   VkImageTiling tiling, VkImageUsageFlags usage,
+                   VkMemoryPropertyFlags properties, VkImage &image,
+                   VkDeviceMemory &imageMemory, uint32_t mipLevels = 1,
+                   uint32_t arrayLayers = 1);
+  void createHiZResources();
+  void destroyHiZResources();
+  void createShadowRenderPass();
+  VkDescriptorSetLayout createShadowDescriptorSetLayout();
+  void createShadowResources();
+  void destroyShadowResources();
+  void createShadowMap(ShadowMap &map, uint32_t size, uint32_t layerCount);
+  void destroyShadowMap(ShadowMap &map);
+
+  Buffer createPositionBuffer(const std::vector<Vertex> &vertices);
+  Buffer createAttributeBuffer(const std::vector<Vertex> &vertices);
+  // Fills _indexRanges, _wideIndexOffset and _indexBufferStats
+  Buffer createIndexBuffer(const Model &model);
+  Buffer createUniformBuffer(size_t bufferSize);
+  Buffer createStorageBuffer(size_t bufferSize,
+                             VkMemoryPropertyFlags properties,
+                             VkBufferUsageFlags extraUsage = 0);
+
+  VkDescriptorPool createGPassDescriptorPool(uint32_t poolSize,
+                                             uint32_t materialCount = 1);
+  // Textures of meshes [firstMaterial, firstMaterial + materialCount)
+  VkDescriptorSet createGPassDescriptorSet(VkDescriptorPool pool,
+                                           VkDescriptorSetLayout layout,
+                                           uint32_t firstMaterial,
+                                           uint32_t materialCount = 1);
+
+  VkDescriptorPool createLightDescriptorPool(uint32_t poolSize);
+  VkDescriptorSet createLightDescriptorSet(VkDescriptorPool pool,
+                                           VkDescriptorSetLayout layout);
+
+  VkDescriptorPool createClusterDescriptorPool(uint32_t poolSize);
+  VkDescriptorSet createClusterDescriptorSet(VkDescriptorPool pool,
+                                             VkDescriptorSetLayout layout);
+
+  VkDescriptorPool createDrawCullDescriptorPool(uint32_t poolSize);
+  VkDescriptorSet createDrawCullDescriptorSet(VkDescriptorPool pool,
+                                              VkDescriptorSetLayout layout,
+                                              uint32_t phaseSlot);
+
+  VkDescriptorPool createHiZDescriptorPool(uint32_t poolSize);
+  VkDescriptorSet createHiZDescriptorSet(VkDescriptorPool pool,
+                                         VkDescriptorSetLayout layout,
+                                         uint32_t level);
+
+  VkDescriptorSetLayout createPerDrawDescriptorSetLayout();
+  VkDescriptorPool createPerDrawDescriptorPool(uint32_t poolSize);
+  VkDescriptorSet createPerDrawDescriptorSet(VkDescriptorPool pool,
+                                             VkDescriptorSetLayout layout);
+  void writePerDrawDescriptor(VkDescriptorSet descriptorSet);
+  void createPerDrawBuffer(uint32_t capacity);
+  void destroyPerDrawBuffer();
+  // Records of the frame's G-pass batches in DynamicUniform, growing the
+  // buffer when needed
+  void uploadPerDrawData();
+
+  VkDescriptorPool createUpscaleDescriptorPool(uint32_t poolSize);
+  VkDescriptorSet createUpscaleDescriptorSet(VkDescriptorPool pool,
+                                             VkDescriptorSetLayout layout);
+
+  void setSceneLightCount(uint32_t lightCount);
+  void createLightStorageBuffer();
+  void destroyLightStorageBuffer();
+  void uploadLights();
+  // Points a light or cluster set at the current light storage buffer
+  void writeLightStorageDescriptor(VkDescriptorSet descriptorSet,
+                                   uint32_t binding);
+  void createDrawItems();
+  void destroyDrawItems();
+  void createInstanceBuffers();
+  void destroyInstanceBuffers();
+  void createInstanceIndexBuffer(uint32_t capacity);
+  void destroyInstanceIndexBuffer();
+  // Instance transforms and index buffers of the sets using instances.glsl
+  void writeInstanceDescriptors(VkDescriptorSet descriptorSet);
+  // Uploads the transforms changed since the last update(), with the boxes
+  // and occluders derived from them
+  void updateInstances();
+  // Copies the frame's batch instances after the draw slots, growing the
+  // buffer when needed
+  void uploadInstanceIndices();
+  void cullDraws(const glm::mat4 &modelViewProj);
+  // Appends the draw items of the instances seen through viewProj (scene
+  // space) as one batch per draw item, tested against the occlusion buffer
+  // when occlusion is set. Without culling every draw item of every
+  // instance. Fills the draw and triangle counts of stats when given.
+  void cullInstances(const glm::mat4 &viewProj, bool culling, bool occlusion,
+                     std::vector<DrawBatch> &batches,
+                     CullingStats *stats = nullptr);
+  // Binds the range of that width unless it is the one bound
+  void bindIndexBuffer(VkCommandBuffer commandBuffer, VkIndexType indexType);
+  // One instanced draw, or one draw per instance without instancing
+  void recordBatch(VkCommandBuffer commandBuffer, const DrawBatch &batch);
+  // One G-pass draw per instance, its gPassPerDraw pushed or selected by a
+  // dynamic offset
+  void recordPerDrawBatch(VkCommandBuffer commandBuffer,
+                          const DrawBatch &batch);
+  void recordDrawCulling(VkCommandBuffer commandBuffer, uint32_t phase);
+  // Sort keys: material then front to back for the G-pass, layer order
+  // for the shadows
+  void queueGPassDraws(const glm::mat4 &modelView, float farPlane);
+  void queueShadowDraws();
+  // Binds pipeline. Without materials (the depth pre-pass) only set 0
+  // bound by the caller is used and the draws read the instance slots.
+  void recordGPassDraws(VkCommandBuffer commandBuffer, uint32_t phaseSlot,
+                        VkPipeline pipeline, bool bindMaterials = true);
+  void recordHiZBuild(VkCommandBuffer commandBuffer);
+  // Fits the cascades, picks the stale layers under the budget and culls
+  // their draws
+  void updateShadows(const glm::mat4 &view, const glm::mat4 &proj,
+                     const glm::mat4 &model, float nearPlane);
+  void recordShadowPasses(VkCommandBuffer commandBuffer);
+  CullingMode supportedCullingMode(CullingMode mode) const;
+  // Render extent from the controller's scale
+  void updateRenderExtent();
+  void setRenderViewport(VkCommandBuffer commandBuffer);
+
+  void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
+                    VkMemoryPropertyFlags properties, VkBuffer &buffer,
+                    VkDeviceMemory &bufferMemory);
+  void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
+  VkCommandBuffer beginSingleTimeCommands();
+  void endSingleTimeCommands(VkCommandBuffer commandBuffer);
+  void transitionImageLayout(VkImage image, VkFormat format,
+                             VkImageLayout oldLayout, VkImageLayout newLayout);
+  void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width,
+                         uint32_t height);
+  void createCommandBuffers();
+  void recordCommandBuffer(uint32_t imageIndex);
+  void drawOffscreenFrame();  // headless drawFrame()
+  void recordReadback(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+  VkSubpassDependency readbackDependency(uint32_t subpass) const;
+  void writeReadback();
+  void pushFrameTimes(std::chrono::high_resolution_clock::time_point submitEnd,
+                      std::chrono::high_resolution_clock::duration acquire);
+  void pushPresentInterval(
+      std::chrono::high_resolution_clock::time_point presentEnd);
+  // Command buffers are allocated by createCommandBuffers()
+  void createFrameResources();
+  void destroyFrameResources();
+  // Waits for the current frame's previous use, then recycles its uploads
+  void waitForFrame();
+  // Room for size bytes copied to buffer at offset before the passes of
+  // the next recorded frame
+  void *stageUpload(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size);
+  // Drops the copies to a buffer about to be destroyed, not yet recorded
+  void forgetUploads(VkBuffer buffer);
+  void recordUploads(VkCommandBuffer commandBuffer);
+  void recordDrawStatsCopy(VkCommandBuffer commandBuffer);
+  void recreateSwapChain();
+  void cleanupSwapChain();
+};
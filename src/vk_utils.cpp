@@ -1,342 +1,415 @@
-#include "vk_utils.h"
-
-const char* to_string(VkResult result) {
-  switch (result) {
-#define STR(r) \
-  case r:      \
-    return #r
-    STR(VK_SUCCESS);
-    STR(VK_NOT_READY);
-    STR(VK_TIMEOUT);
-    STR(VK_EVENT_SET);
-    STR(VK_EVENT_RESET);
-    STR(VK_INCOMPLETE);
-    STR(VK_ERROR_OUT_OF_HOST_MEMORY);
-    STR(VK_ERROR_OUT_OF_DEVICE_MEMORY);
-    STR(VK_ERROR_INITIALIZATION_FAILED);
-    STR(VK_ERROR_DEVICE_LOST);
-    STR(VK_ERROR_MEMORY_MAP_FAILED);
-    STR(VK_ERROR_LAYER_NOT_PRESENT);
-    STR(VK_ERROR_EXTENSION_NOT_PRESENT);
-    STR(VK_ERROR_FEATURE_NOT_PRESENT);
-    STR(VK_ERROR_INCOMPATIBLE_DRIVER);
-    STR(VK_ERROR_TOO_MANY_OBJECTS);
-    STR(VK_ERROR_FORMAT_NOT_SUPPORTED);
-    STR(VK_ERROR_SURFACE_LOST_KHR);
-    STR(VK_ERROR_NATIVE_WINDOW_IN_USE_KHR);
-    STR(VK_SUBOPTIMAL_KHR);
-    STR(VK_ERROR_OUT_OF_DATE_KHR);
-    STR(VK_ERROR_INCOMPATIBLE_DISPLAY_KHR);
-    STR(VK_ERROR_VALIDATION_FAILED_EXT);
-#undef STR
-    default:
-      return "UNKNOWN_RESULT";
-  }
-}
-
-void vkCheckResult(VkResult result, const char* apiCall) {
-  if (result != VK_SUCCESS) {
-    std::cerr << "vkCheckResult failed for " << apiCall << "("
-              << to_string(result) << ")";
-    assert(0);
-  }
-}
-
-VkShaderModule createShaderModule(VkDevice device,
-                                  const std::vector<char>& code) {
-  VkShaderModuleCreateInfo createInfo = {};
-  createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-  createInfo.codeSize = code.size();
-  createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
-  VkShaderModule shaderModule;
-  VkResult result =
-      vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule);
-  vkCheckResult(result, "vkCreateShaderModule");
-  return shaderModule;
-}
-
-bool checkValidationLayerSupport() {
-  uint32_t layerCount;
-  vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
-
-  std::vector<VkLayerProperties> availableLayers(layerCount);
-  vkEnumerateInstanceLayerProperties(&layerCount, availableLayers.data());
-
-  for (const char* layerName : validationLayers) {
-    bool layerFound = false;
-
-    for (const auto& layerProperties : availableLayers) {
-      if (std::string(layerName) == std::string(layerProperties.layerName)) {
-        layerFound = true;
-        break;
-      }
-    }
-
-    if (!layerFound) {
-      return false;
-    }
-  }
-
-  return true;
-}
-
-std::vector<const char*> getRequiredExtensions() {
-  std::vector<const char*> extensions;
-
-  unsigned int glfwExtensionCount = 0;
-  const char** glfwExtensions;
-  glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
-  for (unsigned int i = 0; i < glfwExtensionCount; i++) {
-    extensions.push_back(glfwExtensions[i]);
-  }
-
-  if (enableValidationLayers) {
-    extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
-  }
-
-  return extensions;
-}
-
-VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(VkDebugReportFlagsEXT flags,
-                                             VkDebugReportObjectTypeEXT objType,
-                                             uint64_t obj, size_t location,
-                                             int32_t code,
-                                             const char* layerPrefix,
-                                             const char* msg, void* userData) {
-  std::cerr << "validation layer: " << msg << std::endl;
-
-  return VK_FALSE;
-}
-
-VkResult CreateDebugReportCallbackEXT(
-    VkInstance instance, const VkDebugReportCallbackCreateInfoEXT* pCreateInfo,
-    const VkAllocationCallbacks* pAllocator,
-    VkDebugReportCallbackEXT* pCallback) {
-  auto func = (PFN_vkCreateDebugReportCallbackEXT)vkGetInstanceProcAddr(
-      instance, "vkCreateDebugReportCallbackEXT");
-  if (func != nullptr) {
-    return func(instance, pCreateInfo, pAllocator, pCallback);
-  } else {
-    return VK_ERROR_EXTENSION_NOT_PRESENT;
-  }
-}
-
-void DestroyDebugReportCallbackEXT(VkInstance instance,
-                                   VkDebugReportCallbackEXT callback,
-                                   const VkAllocationCallbacks* pAllocator) {
-  auto func = (PFN_vkDestroyDebugReportCallbackEXT)vkGetInstanceProcAddr(
-      instance, "vkDestroyDebugReportCallbackEXT");
-  if (func != nullptr) {
-    func(instance, callback, pAllocator);
-  }
-}
-
-bool isDeviceSuitable(VkPhysicalDevice device, VkSurfaceKHR surface) {
-  VkPhysicalDeviceProperties deviceProperties;
-  vkGetPhysicalDeviceProperties(device, &deviceProperties);
-  VkPhysicalDeviceFeatures deviceFeatures;
-  vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
-  QueueFamilyIndices indices = findQueueFamilies(device, surface);
-  bool extensionSupported = checkDeviceExtensionSupport(device);
-  bool swapChainAdequate = false;
-  if (extensionSupported) {
-    SwapChainSupportDetails swapChainSupport =
-        querySwapChainSupport(device, surface);
-    swapChainAdequate = !swapChainSupport.formats.empty() &&
-                        !swapChainSupport.presentModes.empty();
-  }
-  VkPhysicalDeviceFeatures supportedFeatures;
-  vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
-  return deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU &&
-         deviceFeatures.geometryShader && indices.isComplete() &&
-         extensionSupported && swapChainAdequate &&
-         supportedFeatures.samplerAnisotropy;
-}
-
-bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
-  uint32_t extensionCount;
-  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
-                                       nullptr);
-
-  std::vector<VkExtensionProperties> availableExtensions(extensionCount);
-  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
-                                       availableExtensions.data());
-
-  std::set<std::string> requiredExtensions(deviceExtensions.begin(),
-                                           deviceExtensions.end());
-
-  for (const auto& extension : availableExtensions) {
-    requiredExtensions.erase(extension.extensionName);
-  }
-
-  return requiredExtensions.empty();
-}
-
-int rateDeviceSuitability(VkPhysicalDevice device, VkSurfaceKHR surface) {
-  VkPhysicalDeviceProperties deviceProperties;
-  vkGetPhysicalDeviceProperties(device, &deviceProperties);
-  VkPhysicalDeviceFeatures deviceFeatures;
-  vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
-  int score = 0;
-  if (deviceProperties.deviceType = VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
-    score += 1000;
-  }
-  score += deviceProperties.limits.maxImageDimension2D;
-  if (!isDeviceSuitable(device, surface)) return 0;
-  if (!deviceFeatures.geometryShader) {
-    return 0;
-  }
-  return score;
-}
-
-QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device,
-                                     VkSurfaceKHR surface) {
-  QueueFamilyIndices indices;
-  uint32_t queueFamilyCount = 0;
-  vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
-
-  std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-  vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount,
-                                           queueFamilies.data());
-  int i = 0;
-  for (const auto& queueFamily : queueFamilies) {
-    if (queueFamily.queueCount > 0 &&
-        queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-      indices.graphicsFamily = i;
-    }
-    VkBool32 presentSupport = false;
-    vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
-
-    if (queueFamily.queueCount > 0 && presentSupport) {
-      indices.presentFamily = i;
-    }
-    if (indices.isComplete()) {
-      break;
-    }
-    i++;
-  }
-  return indices;
-}
-
-SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device,
-                                              VkSurfaceKHR surface) {
-  VkResult result;
-  SwapChainSupportDetails details;
-  result = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface,
-                                                     &details.capabilities);
-  vkCheckResult(result, "vkGetPhysicalDeviceSurfaceCapabilitiesKHR");
-
-  uint32_t formatCount;
-  result = vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount,
-                                                nullptr);
-  vkCheckResult(result, "vkGetPhysicalDeviceSurfaceFormatKHR");
-  if (formatCount != 0) {
-    details.formats.resize(formatCount);
-    result = vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount,
-                                                  details.formats.data());
-    vkCheckResult(result, "vkGetPhysicalDeviceSurfaceFormatKHR");
-  }
-
-  uint32_t presentModeCount;
-  vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount,
-                                            nullptr);
-
-  if (presentModeCount != 0) {
-    details.presentModes.resize(presentModeCount);
-    vkGetPhysicalDeviceSurfacePresentModesKHR(
-        device, surface, &presentModeCount, details.presentModes.data());
-  }
-  return details;
-}
-
-VkSurfaceFormatKHR chooseSwapSurfaceFormat(
-    const std::vector<VkSurfaceFormatKHR>& availableFormats) {
-  if (availableFormats.size() == 1 &&
-      availableFormats[0].format == VK_FORMAT_UNDEFINED) {
-    return {VK_FORMAT_B8G8R8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR};
-  }
-  for (const auto& availableFormat : availableFormats) {
-    if (availableFormat.format == VK_FORMAT_B8G8R8A8_UNORM &&
-        availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
-      return availableFormat;
-    }
-  }
-  return availableFormats[0];
-}
-
-VkPresentModeKHR chooseSwapPresentMode(
-    const std::vector<VkPresentModeKHR> availablePresentModes) {
-  VkPresentModeKHR bestMode = VK_PRESENT_MODE_FIFO_KHR;
-  for (const auto& availablePresentMode : availablePresentModes) {
-    if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
-      return availablePresentMode;
-    } else {
-      bestMode = availablePresentMode;
-    }
-  }
-  return bestMode;
-}
-
-VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities) {
-  if (capabilities.currentExtent.width !=
-      std::numeric_limits<uint32_t>::max()) {
-    return capabilities.currentExtent;
-  } else {
-    VkExtent2D actualExtent = {1280, 720};
-    actualExtent.width = std::max(
-        capabilities.minImageExtent.width,
-        std::min(capabilities.maxImageExtent.width, actualExtent.width));
-    actualExtent.height = std::max(
-        capabilities.minImageExtent.height,
-        std::min(capabilities.maxImageExtent.height, actualExtent.height));
-    return actualExtent;
-  }
-}
-
-uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter,
-                        VkMemoryPropertyFlags properties) {
-  VkPhysicalDeviceMemoryProperties memProperties;
-  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-  for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-    if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags &
-                                    properties) == properties) {
-      return i;
-    }
-  }
-
-  throw std::runtime_error("failed to find suitable memory type!");
-}
-
-bool hasStencilComponent(VkFormat format) {
-  return format == VK_FORMAT_D32_SFLOAT_S8_UINT ||
-         format == VK_FORMAT_D24_UNORM_S8_UINT;
-}
-
-VkFormat findSupportedFormat(VkPhysicalDevice physicalDevice,
-                             const std::vector<VkFormat>& candidates,
-                             VkImageTiling tiling,
-                             VkFormatFeatureFlags features) {
-  for (VkFormat format : candidates) {
-    VkFormatProperties props;
-    vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
-
-    if (tiling == VK_IMAGE_TILING_LINEAR &&
-        (props.linearTilingFeatures & features) == features) {
-      return format;
-    } else if (tiling == VK_IMAGE_TILING_OPTIMAL &&
-               (props.optimalTilingFeatures & features) == features) {
-      return format;
-    }
-  }
-
-  throw std::runtime_error("failed to find supported format!");
-}
-
-VkFormat findDepthFormat(VkPhysicalDevice physicalDevice) {
-  return findSupportedFormat(
-      physicalDevice,
-      {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT,
-       VK_FORMAT_D24_UNORM_S8_UINT},
-      VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
-}
+#include "vk_utils.h"
+
+const char* to_string(VkResult result) {
+  switch (result) {
+#define STR(r) \
+  case r:      \
+    return #r
+    STR(VK_SUCCESS);
+    STR(VK_NOT_READY);
+    STR(VK_TIMEOUT);
+    STR(VK_EVENT_SET);
+    STR(VK_EVENT_RESET);
+    STR(VK_INCOMPLETE);
+    STR(VK_ERROR_OUT_OF_HOST_MEMORY);
+    STR(VK_ERROR_OUT_OF_DEVICE_MEMORY);
+    STR(VK_ERROR_INITIALIZATION_FAILED);
+    STR(VK_ERROR_DEVICE_LOST);
+    STR(VK_ERROR_MEMORY_MAP_FAILED);
+    STR(VK_ERROR_LAYER_NOT_PRESENT);
+    STR(VK_ERROR_EXTENSION_NOT_PRESENT);
+    STR(VK_ERROR_FEATURE_NOT_PRESENT);
+    STR(VK_ERROR_INCOMPATIBLE_DRIVER);
+    STR(VK_ERROR_TOO_MANY_OBJECTS);
+    STR(VK_ERROR_FORMAT_NOT_SUPPORTED);
+    STR(VK_ERROR_SURFACE_LOST_KHR);
+    STR(VK_ERROR_NATIVE_WINDOW_IN_USE_KHR);
+    STR(VK_SUBOPTIMAL_KHR);
+    STR(VK_ERROR_OUT_OF_DATE_KHR);
+    STR(VK_ERROR_INCOMPATIBLE_DISPLAY_KHR);
+    STR(VK_ERROR_VALIDATION_FAILED_EXT);
+#undef STR
+    default:
+      return "UNKNOWN_RESULT";
+  }
+}
+
+void vkCheckResult(VkResult result, const char* apiCall) {
+  if (result != VK_SUCCESS) {
+    std::cerr << "vkCheckResult failed for " << apiCall << "("
+              << to_string(result) << ")";
+    assert(0);
+  }
+}
+
+VkShaderModule createShaderModule(VkDevice device,
+                                  const std::vector<char>& code) {
+  VkShaderModuleCreateInfo createInfo = {};
+  createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  createInfo.codeSize = code.size();
+  createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+  VkShaderModule shaderModule;
+  VkResult result =
+      vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule);
+  vkCheckResult(result, "vkCreateShaderModule");
+  return shaderModule;
+}
+
+bool checkValidationLayerSupport() {
+  uint32_t layerCount;
+  vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
+
+  std::vector<VkLayerProperties> availableLayers(layerCount);
+  vkEnumerateInstanceLayerProperties(&layerCount, availableLayers.data());
+
+  for (const char* layerName : validationLayers) {
+    bool layerFound = false;
+
+    for (const auto& layerProperties : availableLayers) {
+      if (std::string(layerName) == std::string(layerProperties.layerName)) {
+        layerFound = true;
+        break;
+      }
+    }
+
+    if (!layerFound) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+std::vector<const char*> getRequiredExtensions(bool surface) {
+  std::vector<const char*> extensions;
+
+  if (surface) {
+    unsigned int glfwExtensionCount = 0;
+    const char** glfwExtensions;
+    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+
+    for (unsigned int i = 0; i < glfwExtensionCount; i++) {
+      extensions.push_back(glfwExtensions[i]);
+    }
+  }
+
+  if (enableValidationLayers) {
+    extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
+  }
+
+  return extensions;
+}
+
+VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(VkDebugReportFlagsEXT flags,
+                                             VkDebugReportObjectTypeEXT objType,
+                                             uint64_t obj, size_t location,
+                                             int32_t code,
+                                             const char* layerPrefix,
+                                             const char* msg, void* userData) {
+  std::cerr << "validation layer: " << msg << std::endl;
+
+  return VK_FALSE;
+}
+
+VkResult CreateDebugReportCallbackEXT(
+    VkInstance instance, const VkDebugReportCallbackCreateInfoEXT* pCreateInfo,
+    const VkAllocationCallbacks* pAllocator,
+    VkDebugReportCallbackEXT* pCallback) {
+  auto func = (PFN_vkCreateDebugReportCallbackEXT)vkGetInstanceProcAddr(
+      instance, "vkCreateDebugReportCallbackEXT");
+  if (func != nullptr) {
+    return func(instance, pCreateInfo, pAllocator, pCallback);
+  } else {
+    return VK_ERROR_EXTENSION_NOT_PRESENT;
+  }
+}
+
+void DestroyDebugReportCallbackEXT(VkInstance instance,
+                                   VkDebugReportCallbackEXT callback,
+                                   const VkAllocationCallbacks* pAllocator) {
+  auto func = (PFN_vkDestroyDebugReportCallbackEXT)vkGetInstanceProcAddr(
+      instance, "vkDestroyDebugReportCallbackEXT");
+  if (func != nullptr) {
+    func(instance, callback, pAllocator);
+  }
+}
+
+bool isDeviceSuitable(VkPhysicalDevice device, VkSurfaceKHR surface) {
+  VkPhysicalDeviceProperties deviceProperties;
+  vkGetPhysicalDeviceProperties(device, &deviceProperties);
+  VkPhysicalDeviceFeatures deviceFeatures;
+  vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
+  QueueFamilyIndices indices = findQueueFamilies(device, surface);
+  const bool headless = surface == VK_NULL_HANDLE;
+  bool extensionSupported = headless || checkDeviceExtensionSupport(device);
+  bool swapChainAdequate = headless;
+  if (extensionSupported && !headless) {
+    SwapChainSupportDetails swapChainSupport =
+        querySwapChainSupport(device, surface);
+    swapChainAdequate = !swapChainSupport.formats.empty() &&
+                        !swapChainSupport.presentModes.empty();
+  }
+  VkPhysicalDeviceFeatures supportedFeatures;
+  vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
+  // Headless also takes software and integrated devices, lavapipe on CI
+  return (headless ||
+          deviceProperties.deviceType ==
+              VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) &&
+         deviceFeatures.geometryShader && indices.isComplete() &&
+         extensionSupported && swapChainAdequate &&
+         supportedFeatures.samplerAnisotropy;
+}
+
+bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
+  uint32_t extensionCount;
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
+                                       nullptr);
+
+  std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
+                                       availableExtensions.data());
+
+  std::set<std::string> requiredExtensions(deviceExtensions.begin(),
+                                           deviceExtensions.end());
+
+  for (const auto& extension : availableExtensions) {
+    requiredExtensions.erase(extension.extensionName);
+  }
+
+  return requiredExtensions.empty();
+}
+
+bool checkDeviceExtensionSupport(VkPhysicalDevice device,
+                                 const char* extensionName) {
+  uint32_t extensionCount;
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
+                                       nullptr);
+
+  std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
+                                       availableExtensions.data());
+
+  for (const auto& extension : availableExtensions) {
+    if (strcmp(extension.extensionName, extensionName) == 0) return true;
+  }
+  return false;
+}
+
+int rateDeviceSuitability(VkPhysicalDevice device, VkSurfaceKHR surface) {
+  VkPhysicalDeviceProperties deviceProperties;
+  vkGetPhysicalDeviceProperties(device, &deviceProperties);
+  VkPhysicalDeviceFeatures deviceFeatures;
+  vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
+  int score = 0;
+  if (deviceProperties.deviceType = VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
+    score += 1000;
+  }
+  score += deviceProperties.limits.maxImageDimension2D;
+  if (!isDeviceSuitable(device, surface)) return 0;
+  if (!deviceFeatures.geometryShader) {
+    return 0;
+  }
+  return score;
+}
+
+QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device,
+                                     VkSurfaceKHR surface) {
+  QueueFamilyIndices indices;
+  uint32_t queueFamilyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+
+  std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount,
+                                           queueFamilies.data());
+  int i = 0;
+  for (const auto& queueFamily : queueFamilies) {
+    if (queueFamily.queueCount > 0 &&
+        queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+      indices.graphicsFamily = i;
+    }
+    // Headless frames are never presented, the graphics queue stands in
+    VkBool32 presentSupport = false;
+    if (surface != VK_NULL_HANDLE) {
+      vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
+                                           &presentSupport);
+    } else {
+      presentSupport = indices.graphicsFamily == i;
+    }
+
+    if (queueFamily.queueCount > 0 && presentSupport) {
+      indices.presentFamily = i;
+    }
+    if (indices.isComplete()) {
+      break;
+    }
+    i++;
+  }
+  return indices;
+}
+
+SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device,
+                                              VkSurfaceKHR surface) {
+  VkResult result;
+  SwapChainSupportDetails details;
+  result = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface,
+                                                     &details.capabilities);
+  vkCheckResult(result, "vkGetPhysicalDeviceSurfaceCapabilitiesKHR");
+
+  uint32_t formatCount;
+  result = vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount,
+                                                nullptr);
+  vkCheckResult(result, "vkGetPhysicalDeviceSurfaceFormatKHR");
+  if (formatCount != 0) {
+    details.formats.resize(formatCount);
+    result = vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount,
+                                                  details.formats.data());
+    vkCheckResult(result, "vkGetPhysicalDeviceSurfaceFormatKHR");
+  }
+
+  uint32_t presentModeCount;
+  vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount,
+                                            nullptr);
+
+  if (presentModeCount != 0) {
+    details.presentModes.resize(presentModeCount);
+    vkGetPhysicalDeviceSurfacePresentModesKHR(
+        device, surface, &presentModeCount, details.presentModes.data());
+  }
+  return details;
+}
+
+VkSurfaceFormatKHR chooseSwapSurfaceFormat(
+    const std::vector<VkSurfaceFormatKHR>& availableFormats) {
+  if (availableFormats.size() == 1 &&
+      availableFormats[0].format == VK_FORMAT_UNDEFINED) {
+    return {VK_FORMAT_B8G8R8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR};
+  }
+  for (const auto& availableFormat : availableFormats) {
+    if (availableFormat.format == VK_FORMAT_B8G8R8A8_UNORM &&
+        availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
+      return availableFormat;
+    }
+  }
+  return availableFormats[0];
+}
+
+VkPresentModeKHR chooseSwapPresentMode(
+    const std::vector<VkPresentModeKHR> availablePresentModes,
+    VkPresentModeKHR preferredMode) {
+  for (const auto& availablePresentMode : availablePresentModes) {
+    if (availablePresentMode == preferredMode) {
+      return availablePresentMode;
+    }
+  }
+  // FIFO is the only mode the spec guarantees
+  std::cerr << "present mode " << presentModeName(preferredMode)
+            << " unavailable, falling back to "
+            << presentModeName(VK_PRESENT_MODE_FIFO_KHR) << std::endl;
+  return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+uint32_t chooseSwapImageCount(const VkSurfaceCapabilitiesKHR& capabilities,
+                              uint32_t requestedCount) {
+  uint32_t imageCount = requestedCount;
+  if (imageCount == 0) {
+    imageCount = capabilities.minImageCount + 1;
+  }
+  imageCount = std::max(imageCount, capabilities.minImageCount);
+  // maxImageCount == 0 means there is no upper limit
+  if (capabilities.maxImageCount > 0 &&
+      imageCount > capabilities.maxImageCount) {
+    imageCount = capabilities.maxImageCount;
+  }
+  return imageCount;
+}
+
+VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities) {
+  if (capabilities.currentExtent.width !=
+      std::numeric_limits<uint32_t>::max()) {
+    return capabilities.currentExtent;
+  } else {
+    VkExtent2D actualExtent = {1280, 720};
+    actualExtent.width = std::max(
+        capabilities.minImageExtent.width,
+        std::min(capabilities.maxImageExtent.width, actualExtent.width));
+    actualExtent.height = std::max(
+        capabilities.minImageExtent.height,
+        std::min(capabilities.maxImageExtent.height, actualExtent.height));
+    return actualExtent;
+  }
+}
+
+const char* presentModeName(VkPresentModeKHR presentMode) {
+  switch (presentMode) {
+    case VK_PRESENT_MODE_IMMEDIATE_KHR:
+      return "immediate";
+    case VK_PRESENT_MODE_MAILBOX_KHR:
+      return "mailbox";
+    case VK_PRESENT_MODE_FIFO_KHR:
+      return "fifo";
+    case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+      return "fifo_relaxed";
+    default:
+      return "unknown";
+  }
+}
+
+bool parsePresentMode(const std::string& name, VkPresentModeKHR& presentMode) {
+  const VkPresentModeKHR modes[] = {
+      VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR,
+      VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR};
+  for (VkPresentModeKHR mode : modes) {
+    if (name == presentModeName(mode)) {
+      presentMode = mode;
+      return true;
+    }
+  }
+  return false;
+}
+
+uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter,
+                        VkMemoryPropertyFlags properties) {
+  VkPhysicalDeviceMemoryProperties memProperties;
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+  for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+    if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags &
+                                    properties) == properties) {
+      return i;
+    }
+  }
+
+  throw std::runtime_error("failed to find suitable memory type!");
+}
+
+bool hasStencilComponent(VkFormat format) {
+  return format == VK_FORMAT_D32_SFLOAT_S8_UINT ||
+         format == VK_FORMAT_D24_UNORM_S8_UINT;
+}
+
+VkFormat findSupportedFormat(VkPhysicalDevice physicalDevice,
+                             const std::vector<VkFormat>& candidates,
+                             VkImageTiling tiling,
+                             VkFormatFeatureFlags features) {
+  for (VkFormat format : candidates) {
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
+
+    if (tiling == VK_IMAGE_TILING_LINEAR &&
+        (props.linearTilingFeatures & features) == features) {
+      return format;
+    } else if (tiling == VK_IMAGE_TILING_OPTIMAL &&
+               (props.optimalTilingFeatures & features) == features) {
+      return format;
+    }
+  }
+
+  throw std::runtime_error("failed to find supported format!");
+}
+
+VkFormat findDepthFormat(VkPhysicalDevice physicalDevice) {
+  return findSupportedFormat(
+      physicalDevice,
+      {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT,
+       VK_FORMAT_D24_UNORM_S8_UINT},
+      VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+}
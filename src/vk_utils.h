@@ -1,78 +1,93 @@
-#pragma once
-#define GLFW_INCLUDE_VULKAN
-#include <GLFW/glfw3.h>
-#include <algorithm>
-#include <array>
-#include <cassert>
-#include <fstream>
-#include <glm/glm.hpp>
-#include <iostream>
-#include <set>
-#include <vector>
-#include <string>
-
-#ifdef NDEBUG
-const bool enableValidationLayers = false;
-#else
-const bool enableValidationLayers = true;
-#endif
-
-const std::vector<const char*> validationLayers = {
-    "VK_LAYER_LUNARG_standard_validation"};
-
-const std::vector<const char*> deviceExtensions = {
-    VK_KHR_SWAPCHAIN_EXTENSION_NAME};
-
-struct QueueFamilyIndices {
-  int graphicsFamily = -1;
-  int presentFamily = -1;
-
-  bool isComplete() { return graphicsFamily >= 0 && presentFamily >= 0; }
-};
-
-struct SwapChainSupportDetails {
-  VkSurfaceCapabilitiesKHR capabilities;
-  std::vector<VkSurfaceFormatKHR> formats;
-  std::vector<VkPresentModeKHR> presentModes;
-};
-
-void vkCheckResult(VkResult result, const char* apiCall);
-VkShaderModule createShaderModule(VkDevice device,
-                                  const std::vector<char>& code);
-bool checkValidationLayerSupport();
-std::vector<const char*> getRequiredExtensions();
-
-VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(VkDebugReportFlagsEXT flags,
-                                             VkDebugReportObjectTypeEXT objType,
-                                             uint64_t obj, size_t location,
-                                             int32_t code,
-                                             const char* layerPrefix,
-                                             const char* msg, void* userData);
-
-VkResult CreateDebugReportCallbackEXT(
-    VkInstance instance, const VkDebugReportCallbackCreateInfoEXT* pCreateInfo,
-    const VkAllocationCallbacks* pAllocator,
-    VkDebugReportCallbackEXT* pCallback);
-void DestroyDebugReportCallbackEXT(VkInstance instance,
-                                   VkDebugReportCallbackEXT callback,
-                                   const VkAllocationCallbacks* pAllocator);
-
-bool isDeviceSuitable(VkPhysicalDevice device, VkSurfaceKHR surface);
-bool checkDeviceExtensionSupport(VkPhysicalDevice device);
-int rateDeviceSuitability(VkPhysicalDevice device, VkSurfaceKHR surface);
-QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device,
-                                     VkSurfaceKHR surface);
-SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device,
-                                              VkSurfaceKHR surface);
-
-VkSurfaceFormatKHR chooseSwapSurfaceFormat(
-    const std::vector<VkSurfaceFormatKHR>& availableFormats);
-VkPresentModeKHR chooseSwapPresentMode(
-    const std::vector<VkPresentModeKHR> availablePresentModes);
-VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities);
-
-uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter,
-                        VkMemoryPropertyFlags properties);
-
-VkFormat findDepthFormat(VkPhysicalDevice physicalDevice);
-bool hasStencilComponent(VkFormat format);
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <glm/glm.hpp>
+#include <iostream>
+#include <set>
+#include <vector>
+#include <string>
+
+#ifdef NDEBUG
+const bool enableValidationLayers = false;
+#else
+const bool enableValidationLayers = true;
+#endif
+
+const std::vector<const char*> validationLayers = {
+    "VK_LAYER_LUNARG_standard_validation"};
+
+const std::vector<const char*> deviceExtensions = {
+    VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+
+struct QueueFamilyIndices {
+  int graphicsFamily = -1;
+  int presentFamily = -1;
+
+  bool isComplete() { return graphicsFamily >= 0 && presentFamily >= 0; }
+};
+
+struct SwapChainSupportDetails {
+  VkSurfaceCapabilitiesKHR capabilities;
+  std::vector<VkSurfaceFormatKHR> formats;
+  std::vector<VkPresentModeKHR> presentModes;
+};
+
+void vkCheckResult(VkResult result, const char* apiCall);
+VkShaderModule createShaderModule(VkDevice device,
+                                  const std::vector<char>& code);
+bool checkValidationLayerSupport();
+// surface false: headless, no window system extension
+std::vector<const char*> getRequiredExtensions(bool surface = true);
+
+VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(VkDebugReportFlagsEXT flags,
+                                             VkDebugReportObjectTypeEXT objType,
+                                             uint64_t obj, size_t location,
+                                             int32_t code,
+                                             const char* layerPrefix,
+                                             const char* msg, void* userData);
+
+VkResult CreateDebugReportCallbackEXT(
+    VkInstance instance, const VkDebugReportCallbackCreateInfoEXT* pCreateInfo,
+    const VkAllocationCallbacks* pAllocator,
+    VkDebugReportCallbackEXT* pCallback);
+void DestroyDebugReportCallbackEXT(VkInstance instance,
+                                   VkDebugReportCallbackEXT callback,
+                                   const VkAllocationCallbacks* pAllocator);
+
+// surface VK_NULL_HANDLE: headless, no present support or swapchain needed
+bool isDeviceSuitable(VkPhysicalDevice device, VkSurfaceKHR surface);
+bool checkDeviceExtensionSupport(VkPhysicalDevice device);
+bool checkDeviceExtensionSupport(VkPhysicalDevice device,
+                                 const char* extensionName);
+int rateDeviceSuitability(VkPhysicalDevice device, VkSurfaceKHR surface);
+QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device,
+                                     VkSurfaceKHR surface);
+SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device,
+                                              VkSurfaceKHR surface);
+
+VkSurfaceFormatKHR chooseSwapSurfaceFormat(
+    const std::vector<VkSurfaceFormatKHR>& availableFormats);
+VkPresentModeKHR chooseSwapPresentMode(
+    const std::vector<VkPresentModeKHR> availablePresentModes,
+    VkPresentModeKHR preferredMode);
+uint32_t chooseSwapImageCount(const VkSurfaceCapabilitiesKHR& capabilities,
+                              uint32_t requestedCount);
+VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities);
+
+const char* presentModeName(VkPresentModeKHR presentMode);
+bool parsePresentMode(const std::string& name, VkPresentModeKHR& presentMode);
+
+uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter,
+                        VkMemoryPropertyFlags properties);
+
+VkFormat findSupportedFormat(VkPhysicalDevice physicalDevice,
+                             const std::vector<VkFormat>& candidates,
+                             VkImageTiling tiling,
+                             VkFormatFeatureFlags features);
+VkFormat findDepthFormat(VkPhysicalDevice physicalDevice);
+bool hasStencilComponent(VkFormat format);